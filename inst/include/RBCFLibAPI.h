@@ -0,0 +1,252 @@
+#ifndef RBCFLIB_API_H
+#define RBCFLIB_API_H
+
+/*
+ * C API of RBCFLib for the compiled code of other packages.
+ *
+ * Add "LinkingTo: RBCFLib" (and "Imports: RBCFLib") to the DESCRIPTION of
+ * the package, then include this header. The functions go through a table
+ * of entry points that RBCF_api_init() looks up with R_GetCCallable(),
+ * which may raise an R error and so must run on the R thread. The table is
+ * cached per source file: call RBCF_api_init() in each file using the API,
+ * from R_init_<pkg>() or the .Call entry point, before any of its functions
+ * runs on a worker thread. Otherwise the first call of a function looks
+ * the table up, which is only safe on the R thread.
+ *
+ * Coordinates follow the underlying structures: VBI markers are 1-based
+ * positions, queried with 1-based closed intervals; cgranges intervals are
+ * 0-based half-open. Buffers returned by RBCFLib must be released with
+ * RBCF_free(), records with RBCF_record_destroy().
+ *
+ * Thread safety: the query functions only read the index or the intervals,
+ * once built, and may run concurrently, each thread with its own result
+ * buffer. Reading records from a VBI context moves its file handle: use a
+ * context from one thread at a time. Functions taking a SEXP raise an R
+ * error on invalid objects and must be called from the R thread.
+ */
+
+#include <stdint.h>
+#include <Rinternals.h>
+#include <R_ext/Rdynload.h>
+
+#define RBCF_API_VERSION 1
+
+/* A VBI index (VBIIndex(), VBIIndexLoad()) */
+typedef struct rbcf_vbi_t rbcf_vbi_t;
+/* A set of intervals (cgranges) */
+typedef struct rbcf_cr_t rbcf_cr_t;
+/* htslib records and headers, see htslib/vcf.h (htslib 1.22) */
+struct bcf1_t;
+struct bcf_hdr_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The entry points, in a table owned by RBCFLib. Members are only ever
+ * appended, with a new RBCF_API_VERSION.
+ */
+typedef struct rbcf_api_t {
+    int version;
+    void (*free)(void *p);
+    rbcf_vbi_t *(*vbi_load)(const char *filename);
+    void (*vbi_free)(rbcf_vbi_t *idx);
+    rbcf_vbi_t *(*vbi_from_sexp)(SEXP idx_ptr);
+    int64_t (*vbi_nmarker)(const rbcf_vbi_t *idx);
+    int (*vbi_marker)(const rbcf_vbi_t *idx, int64_t marker, const char **chrom, int64_t *pos);
+    int *(*vbi_query)(rbcf_vbi_t *idx, const char *region, int *n);
+    int64_t (*vbi_overlap)(const rbcf_vbi_t *idx, const char *chrom, int64_t beg, int64_t end,
+                           int64_t **markers, int64_t *m_markers);
+    rbcf_cr_t *(*cr_init)(void);
+    void (*cr_destroy)(rbcf_cr_t *cr);
+    rbcf_cr_t *(*cr_from_sexp)(SEXP cr_ptr);
+    int (*cr_add)(rbcf_cr_t *cr, const char *ctg, int32_t st, int32_t en, int32_t label);
+    void (*cr_index)(rbcf_cr_t *cr);
+    int64_t (*cr_overlap)(const rbcf_cr_t *cr, const char *ctg, int32_t st, int32_t en,
+                          int64_t **b, int64_t *m_b);
+    int64_t (*cr_contain)(const rbcf_cr_t *cr, const char *ctg, int32_t st, int32_t en,
+                          int64_t **b, int64_t *m_b);
+    int (*cr_interval)(const rbcf_cr_t *cr, int64_t i, const char **ctg,
+                       int32_t *st, int32_t *en, int32_t *label);
+    const struct bcf_hdr_t *(*vbi_context_header)(SEXP vbi_vcf_ctx);
+    rbcf_vbi_t *(*vbi_context_index)(SEXP vbi_vcf_ctx);
+    struct bcf1_t *(*record_init)(void);
+    void (*record_destroy)(struct bcf1_t *rec);
+    int (*vbi_context_fetch)(SEXP vbi_vcf_ctx, const int *markers, int n, struct bcf1_t **recs);
+} rbcf_api_t;
+
+#ifndef RBCFLIB_API_TABLE_ONLY
+
+/* The table, looked up by RBCF_api_init() in each file including this header */
+static const rbcf_api_t *rbcf_api_ = NULL;
+
+/*
+ * Looks the table up, on the R thread, and checks that the installed
+ * RBCFLib provides the RBCF_API_VERSION this package was built with (an R
+ * error otherwise). Returns the installed version.
+ */
+static inline int RBCF_api_init(void) {
+    if (!rbcf_api_) {
+        const rbcf_api_t *(*table)(void) =
+            (const rbcf_api_t *(*)(void)) R_GetCCallable("RBCFLib", "RBCF_api_table");
+        const rbcf_api_t *api = table();
+        if (api->version < RBCF_API_VERSION)
+            Rf_error("RBCFLib provides version %d of its C API, this package needs version %d: update RBCFLib",
+                     api->version, RBCF_API_VERSION);
+        rbcf_api_ = api;
+    }
+    return rbcf_api_->version;
+}
+
+static inline const rbcf_api_t *RBCF_api(void) {
+    if (!rbcf_api_) RBCF_api_init();
+    return rbcf_api_;
+}
+
+/* Version of the API (RBCF_API_VERSION of the installed RBCFLib) */
+static inline int RBCF_api_version(void) {
+    return RBCF_api()->version;
+}
+
+/* Releases a buffer allocated by RBCFLib */
+static inline void RBCF_free(void *p) {
+    RBCF_api()->free(p);
+}
+
+/*
+ * VBI index
+ */
+
+/* Loads a .vbi file, NULL on failure; free with RBCF_vbi_free() */
+static inline rbcf_vbi_t *RBCF_vbi_load(const char *filename) {
+    return RBCF_api()->vbi_load(filename);
+}
+
+static inline void RBCF_vbi_free(rbcf_vbi_t *idx) {
+    RBCF_api()->vbi_free(idx);
+}
+
+/* The index of an R object from VBIIndexLoad(), owned by that object */
+static inline rbcf_vbi_t *RBCF_vbi_from_sexp(SEXP idx_ptr) {
+    return RBCF_api()->vbi_from_sexp(idx_ptr);
+}
+
+/* Number of markers (records) */
+static inline int64_t RBCF_vbi_nmarker(const rbcf_vbi_t *idx) {
+    return RBCF_api()->vbi_nmarker(idx);
+}
+
+/* Contig and position of a 0-based marker; returns 0, or -1 if out of range */
+static inline int RBCF_vbi_marker(const rbcf_vbi_t *idx, int64_t marker, const char **chrom, int64_t *pos) {
+    return RBCF_api()->vbi_marker(idx, marker, chrom, pos);
+}
+
+/*
+ * 0-based markers of comma-separated regions ("chr", "chr:pos",
+ * "chr:beg-end"), to RBCF_free(); *n is their number
+ */
+static inline int *RBCF_vbi_query(rbcf_vbi_t *idx, const char *region, int *n) {
+    return RBCF_api()->vbi_query(idx, region, n);
+}
+
+/*
+ * 0-based markers at positions beg to end (1-based, inclusive) of chrom, by
+ * position, without parsing a region. They are stored in *markers, grown
+ * as needed (*m_markers is its size): start from NULL and 0, reuse the
+ * buffer across calls and release it with RBCF_free(). Returns their number.
+ */
+static inline int64_t RBCF_vbi_overlap(const rbcf_vbi_t *idx, const char *chrom, int64_t beg, int64_t end,
+                                       int64_t **markers, int64_t *m_markers) {
+    return RBCF_api()->vbi_overlap(idx, chrom, beg, end, markers, m_markers);
+}
+
+/*
+ * Intervals (cgranges): add intervals, index them once, then query
+ */
+
+/* An empty set; free with RBCF_cr_destroy() */
+static inline rbcf_cr_t *RBCF_cr_init(void) {
+    return RBCF_api()->cr_init();
+}
+
+static inline void RBCF_cr_destroy(rbcf_cr_t *cr) {
+    RBCF_api()->cr_destroy(cr);
+}
+
+/* The intervals of an R object from the cgranges functions, owned by that object */
+static inline rbcf_cr_t *RBCF_cr_from_sexp(SEXP cr_ptr) {
+    return RBCF_api()->cr_from_sexp(cr_ptr);
+}
+
+/* Adds [st,en) of ctg with a label; returns 0, or -1 on failure */
+static inline int RBCF_cr_add(rbcf_cr_t *cr, const char *ctg, int32_t st, int32_t en, int32_t label) {
+    return RBCF_api()->cr_add(cr, ctg, st, en, label);
+}
+
+/* Sorts and indexes the intervals, before any query */
+static inline void RBCF_cr_index(rbcf_cr_t *cr) {
+    RBCF_api()->cr_index(cr);
+}
+
+/*
+ * Intervals overlapping [st,en) of ctg, stored in *b as in RBCF_vbi_overlap()
+ * and given to RBCF_cr_interval(); returns their number
+ */
+static inline int64_t RBCF_cr_overlap(const rbcf_cr_t *cr, const char *ctg, int32_t st, int32_t en,
+                                      int64_t **b, int64_t *m_b) {
+    return RBCF_api()->cr_overlap(cr, ctg, st, en, b, m_b);
+}
+
+/* Intervals contained in [st,en) of ctg, as RBCF_cr_overlap() */
+static inline int64_t RBCF_cr_contain(const rbcf_cr_t *cr, const char *ctg, int32_t st, int32_t en,
+                                      int64_t **b, int64_t *m_b) {
+    return RBCF_api()->cr_contain(cr, ctg, st, en, b, m_b);
+}
+
+/* Contig, start, end and label of the i-th indexed interval; NULL outputs are skipped */
+static inline int RBCF_cr_interval(const rbcf_cr_t *cr, int64_t i, const char **ctg,
+                                   int32_t *st, int32_t *en, int32_t *label) {
+    return RBCF_api()->cr_interval(cr, i, ctg, st, en, label);
+}
+
+/*
+ * Records of a VCF context (VCFLoad()), decoded by the htslib of RBCFLib
+ */
+
+/* Header of the context, owned by it */
+static inline const struct bcf_hdr_t *RBCF_vbi_context_header(SEXP vbi_vcf_ctx) {
+    return RBCF_api()->vbi_context_header(vbi_vcf_ctx);
+}
+
+/* VBI index of the context, owned by it */
+static inline rbcf_vbi_t *RBCF_vbi_context_index(SEXP vbi_vcf_ctx) {
+    return RBCF_api()->vbi_context_index(vbi_vcf_ctx);
+}
+
+/* An empty record; free with RBCF_record_destroy() */
+static inline struct bcf1_t *RBCF_record_init(void) {
+    return RBCF_api()->record_init();
+}
+
+/* Frees a record, which may point into a memory-mapped BCF file */
+static inline void RBCF_record_destroy(struct bcf1_t *rec) {
+    RBCF_api()->record_destroy(rec);
+}
+
+/*
+ * Reads the n 0-based markers into recs[0..n-1], allocating the NULL ones.
+ * The records are reused across calls. Returns the number read: n, or the
+ * position of the first marker that could not be read.
+ */
+static inline int RBCF_vbi_context_fetch(SEXP vbi_vcf_ctx, const int *markers, int n, struct bcf1_t **recs) {
+    return RBCF_api()->vbi_context_fetch(vbi_vcf_ctx, markers, n, recs);
+}
+
+#endif /* RBCFLIB_API_TABLE_ONLY */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RBCFLIB_API_H */
@@ -24,6 +24,50 @@ extern SEXP RC_BCFToolsScoreVersion(void);
 extern SEXP RC_FaidxIndexFasta(SEXP fasta_path);
 extern SEXP RC_FaidxFetchRegion(SEXP fasta_path, SEXP seqname, SEXP start, SEXP end);
 
+/*
+     * decompression
+*/
+extern SEXP RC_DecompressFile(SEXP input, SEXP output, SEXP threads, SEXP bgzip, SEXP index);
+extern SEXP RC_VcfToBcf(SEXP input, SEXP output, SEXP threads, SEXP index);
+
+/*
+     * tabix-indexed TSV reader
+*/
+extern SEXP RC_tabix_open(SEXP path);
+extern SEXP RC_tabix_query(SEXP extPtr, SEXP regions, SEXP types, SEXP names, SEXP region_index);
+extern SEXP RC_tabix_close(SEXP extPtr);
+
+/*
+     * chunk planner
+*/
+extern SEXP RC_PlanChunks(SEXP path, SEXP n_chunks, SEXP vbi_path);
+
+/*
+     * genotype column store
+*/
+extern SEXP RC_GTStoreBuild(SEXP input, SEXP output, SEXP threads, SEXP compress);
+extern SEXP RC_GTStoreOpen(SEXP path, SEXP source);
+extern SEXP RC_GTStoreClose(SEXP extPtr);
+extern SEXP RC_GTStoreDosages(SEXP extPtr, SEXP start, SEXP end, SEXP allele);
+extern SEXP RC_GTSampleBuild(SEXP input, SEXP output, SEXP threads, SEXP compress);
+extern SEXP RC_GTSampleOpen(SEXP path, SEXP source);
+extern SEXP RC_GTSampleClose(SEXP extPtr);
+extern SEXP RC_GTSampleGenotypes(SEXP extPtr, SEXP samples, SEXP region, SEXP start, SEXP end, SEXP dosage);
+/*
+ * list(ptr, samples, variants) returned by the Open bindings of both
+ * genotype stores; vars holds n_variants entries of var_size bytes starting
+ * as a gtstore_loc_t, with uint32 flags at flags_offset (not stored if
+ * `skipped` is set)
+ */
+extern SEXP gtstore_open_list(SEXP extPtr, char **sample_names, int64_t n_samples, char **chrom_names, int n_chroms,
+                              const void *vars, int64_t n_variants, size_t var_size, size_t flags_offset,
+                              uint32_t skipped);
+extern SEXP RC_LDMatrix(SEXP src, SEXP region, SEXP samples, SEXP maf_min, SEXP r2, SEXP band, SEXP threads);
+extern SEXP RC_GRMCompute(SEXP filename, SEXP output, SEXP region, SEXP samples, SEXP maf_min, SEXP block, SEXP threads);
+extern SEXP RC_PCAPass(SEXP src, SEXP store, SEXP region, SEXP samples, SEXP maf_min, SEXP basis, SEXP width, SEXP keep, SEXP block, SEXP threads);
+extern SEXP RC_AssocRun(SEXP filename, SEXP output, SEXP region, SEXP samples, SEXP trait, SEXP family, SEXP field, SEXP basis, SEXP resid, SEXP weights, SEXP X, SEXP y, SEXP firth_p, SEXP batch, SEXP threads);
+extern SEXP RC_GWASClump(SEXP filename, SEXP panel, SEXP trait, SEXP lp1, SEXP lp2, SEXP r2, SEXP window, SEXP samples, SEXP output, SEXP threads);
+
 /*
 
   * BCFTools Wrapper Functions
@@ -47,21 +91,31 @@ const char* BCFToolsPluginsPath(void);
 /* Unified bcftools pipeline function */
 
 extern SEXP RC_bcftools_pipeline(SEXP commands, SEXP args, SEXP n_commands,
-                    SEXP capture_stdout, SEXP capture_stderr, SEXP stdout_file, SEXP stderr_file);
+                    SEXP capture_stdout, SEXP capture_stderr, SEXP stdout_file, SEXP stderr_file, SEXP input);
 
 /* 
 
  * VBI index and query functions
 
 */
-extern SEXP RC_VBI_index(SEXP vcf_path, SEXP vbi_path, SEXP threads);
-extern SEXP RC_VBI_query_range(SEXP vbi_vcf_ctx, SEXP region_str, SEXP include_info, SEXP include_format, SEXP include_genotypes);
+extern SEXP RC_VBI_index(SEXP vcf_path, SEXP vbi_path, SEXP threads, SEXP keys, SEXP payload);
+extern SEXP RC_VBI_lookup_ids(SEXP vbi_vcf_ctx, SEXP ids, SEXP all);
+extern SEXP RC_VBI_lookup_alleles(SEXP vbi_vcf_ctx, SEXP chrom, SEXP pos, SEXP ref, SEXP alt, SEXP swap, SEXP all);
+extern SEXP RC_VBI_payload(SEXP vbi_vcf_ctx, SEXP region_str, SEXP filter);
+extern SEXP RC_VBI_cursor_open(SEXP vbi_vcf_ctx, SEXP region_str, SEXP start_idx, SEXP end_idx, SEXP filter);
+extern SEXP RC_VBI_cursor_next(SEXP cursor, SEXP n, SEXP include_info, SEXP include_format, SEXP include_genotypes);
+extern SEXP RC_VBI_cursor_info(SEXP cursor);
+extern SEXP RC_VBI_cursor_close(SEXP cursor);
+extern SEXP RC_VBI_query_range(SEXP vbi_vcf_ctx, SEXP chrom, SEXP start, SEXP end, SEXP include_info, SEXP include_format, SEXP include_genotypes);
+extern SEXP RC_VBID_start(SEXP socket, SEXP idle, SEXP detach);
+extern SEXP RC_VBID_request(SEXP socket, SEXP op, SEXP vbi_path, SEXP queries);
+extern SEXP RC_VBID_query_local(SEXP vbi_ptr, SEXP op, SEXP queries);
 extern SEXP RC_VBI_query_by_indices(SEXP vbi_vcf_ctx, SEXP start_idx, SEXP end_idx, SEXP include_info, SEXP include_format, SEXP include_genotypes);
 extern SEXP RC_VBI_query_by_indices_ctx(SEXP vbi_vcf_ctx, SEXP start_idx, SEXP end_idx, SEXP include_info, SEXP include_format, SEXP include_genotypes);
 extern SEXP RC_VBI_print_index(SEXP vbi_ptr, SEXP n);
 extern SEXP RC_VBI_load_index(SEXP vbi_path);
-extern SEXP RC_VBI_vcf_load(SEXP vcf_path, SEXP vbi_path);
-extern SEXP RC_VBI_query_region(SEXP vbi_vcf_ctx, SEXP region_str, SEXP include_info, SEXP include_format, SEXP include_genotypes);
+extern SEXP RC_VBI_vcf_load(SEXP vcf_path, SEXP vbi_path, SEXP use_map);
+extern SEXP RC_VBI_query_region(SEXP vbi_vcf_ctx, SEXP region_str, SEXP include_info, SEXP include_format, SEXP include_genotypes, SEXP filter);
 extern SEXP RC_VBI_query_region_cgranges_ctx(SEXP vbi_vcf_ctx, SEXP cgranges_ptr, SEXP include_info, SEXP include_format, SEXP include_genotypes);
 extern SEXP RC_VCF_header_info(SEXP vcf_path);
 extern SEXP RC_VBI_print_header_metadata(SEXP vbi_vcf_ctx_ext);
@@ -98,6 +152,7 @@ extern SEXP RBcfFileClose(SEXP sexpFile);
 extern SEXP RBcfFileOpen(SEXP Rfilename,SEXP sexpRequireIdx);
 extern SEXP RBcfNewWriter(SEXP sexpIn,SEXP Rfilename);
 extern SEXP RBcfFileWriteCtx(SEXP sexpOut,SEXP sexpCtx);
+extern SEXP RBcfExtractRegions(SEXP sexpIn,SEXP sexpRegions,SEXP Rfilename,SEXP sexpIndex);
 extern SEXP RBcfSeqNames(SEXP sexpFile);
 extern SEXP RBcfNSamples(SEXP sexpFile);
 extern SEXP RBcfSamples(SEXP sexpFile);
@@ -109,6 +164,7 @@ extern SEXP RBcfHeaderDict(SEXP sexpFile);
 extern SEXP BcfConvertSampleToIndex0(SEXP sexpFile,SEXP sexpSample);
 extern SEXP RBcfQueryRegion(SEXP sexpFile,SEXP sexpInterval);
 extern SEXP RBcfNextLine(SEXP sexpFile);
+extern SEXP RBcfReadBatch(SEXP sexpFile,SEXP sexpN,SEXP sexpInfo,SEXP sexpFormat);
 extern SEXP RBcfCtxRid(SEXP sexpCtx);
 extern SEXP RBcfCtxSeqName(SEXP sexpCtx);
 extern SEXP RBcfCtxPos(SEXP sexpCtx);
@@ -150,4 +206,8 @@ extern SEXP GenotypeFloatAttribute(SEXP sexpGt,SEXP sexpatt);
 extern SEXP VariantGenotypesFlagAttribute(SEXP sexpCtx,SEXP sexpatt);
 extern SEXP VariantGenotypesInt32Attribute(SEXP sexpCtx,SEXP sexpatt);
 extern SEXP VariantGenotypesFloatAttribute(SEXP sexpCtx,SEXP sexpatt); 
+
+/* C API for other packages (R_RegisterCCallable), see inst/include/RBCFLibAPI.h */
+extern void RC_register_ccallables(void);
+extern SEXP RC_CAPI_test(SEXP vbi_path, SEXP vbi_vcf_ctx, SEXP chrom, SEXP beg, SEXP end);
 #endif /* RBCFLIB_H */
\ No newline at end of file
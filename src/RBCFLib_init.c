@@ -20,15 +20,48 @@ static const R_CallMethodDef CallEntries[] = {
     {"RC_BCFToolsScoreVersion", (DL_FUNC) &RC_BCFToolsScoreVersion, 0},
     /* BCFTools Wrapper */
     #ifndef _WIN32
-    {"RC_bcftools_pipeline", (DL_FUNC) &RC_bcftools_pipeline, 7},
+    {"RC_bcftools_pipeline", (DL_FUNC) &RC_bcftools_pipeline, 8},
     #endif
     /* FASTA */ 
     {"RC_FaidxIndexFasta", (DL_FUNC) &RC_FaidxIndexFasta, 1},
     {"RC_FaidxFetchRegion", (DL_FUNC) &RC_FaidxFetchRegion, 4},
+    {"RC_DecompressFile", (DL_FUNC) &RC_DecompressFile, 5},
+    {"RC_VcfToBcf", (DL_FUNC) &RC_VcfToBcf, 4},
+    /* tabix TSV */
+    {"RC_tabix_open", (DL_FUNC) &RC_tabix_open, 1},
+    {"RC_tabix_query", (DL_FUNC) &RC_tabix_query, 5},
+    {"RC_tabix_close", (DL_FUNC) &RC_tabix_close, 1},
+    /* chunk planner */
+    {"RC_PlanChunks", (DL_FUNC) &RC_PlanChunks, 3},
+    /* genotype column store */
+    {"RC_GTStoreBuild", (DL_FUNC) &RC_GTStoreBuild, 4},
+    {"RC_GTStoreOpen", (DL_FUNC) &RC_GTStoreOpen, 2},
+    {"RC_GTStoreClose", (DL_FUNC) &RC_GTStoreClose, 1},
+    {"RC_GTStoreDosages", (DL_FUNC) &RC_GTStoreDosages, 4},
+    {"RC_GTSampleBuild", (DL_FUNC) &RC_GTSampleBuild, 4},
+    {"RC_GTSampleOpen", (DL_FUNC) &RC_GTSampleOpen, 2},
+    {"RC_GTSampleClose", (DL_FUNC) &RC_GTSampleClose, 1},
+    {"RC_GTSampleGenotypes", (DL_FUNC) &RC_GTSampleGenotypes, 6},
+    {"RC_LDMatrix", (DL_FUNC) &RC_LDMatrix, 7},
+    {"RC_GRMCompute", (DL_FUNC) &RC_GRMCompute, 7},
+    {"RC_PCAPass", (DL_FUNC) &RC_PCAPass, 10},
+    {"RC_AssocRun", (DL_FUNC) &RC_AssocRun, 15},
+    {"RC_GWASClump", (DL_FUNC) &RC_GWASClump, 10},
     /* vbi*/
-    {"RC_VBI_index", (DL_FUNC) &RC_VBI_index, 3},
-    {"RC_VBI_query_range", (DL_FUNC) &RC_VBI_query_range, 5},
+    {"RC_VBI_index", (DL_FUNC) &RC_VBI_index, 5},
+    {"RC_VBI_lookup_ids", (DL_FUNC) &RC_VBI_lookup_ids, 3},
+    {"RC_VBI_lookup_alleles", (DL_FUNC) &RC_VBI_lookup_alleles, 7},
+    {"RC_VBI_payload", (DL_FUNC) &RC_VBI_payload, 3},
+    {"RC_VBI_cursor_open", (DL_FUNC) &RC_VBI_cursor_open, 5},
+    {"RC_VBI_cursor_next", (DL_FUNC) &RC_VBI_cursor_next, 5},
+    {"RC_VBI_cursor_info", (DL_FUNC) &RC_VBI_cursor_info, 1},
+    {"RC_VBI_cursor_close", (DL_FUNC) &RC_VBI_cursor_close, 1},
+    {"RC_VBI_query_range", (DL_FUNC) &RC_VBI_query_range, 7},
     {"RC_VBI_query_by_indices", (DL_FUNC) &RC_VBI_query_by_indices_ctx, 6},
+    {"RC_VBID_start", (DL_FUNC) &RC_VBID_start, 3},
+    {"RC_VBID_request", (DL_FUNC) &RC_VBID_request, 4},
+    {"RC_VBID_query_local", (DL_FUNC) &RC_VBID_query_local, 3},
+    {"RC_CAPI_test", (DL_FUNC) &RC_CAPI_test, 5},
     {"RC_VBI_print_index", (DL_FUNC) &RC_VBI_print_index, 2},
     {"RC_VBI_query_region_cgranges", (DL_FUNC) &RC_VBI_query_region_cgranges_ctx, 5},
     {"RC_VCF_header_info", (DL_FUNC) &RC_VCF_header_info, 1},
@@ -37,8 +70,8 @@ static const R_CallMethodDef CallEntries[] = {
     {"RC_VBI_index_memory_usage", (DL_FUNC) &RC_VBI_index_memory_usage, 1},
     {"RC_VBI_extract_ranges", (DL_FUNC) &RC_VBI_extract_ranges, 2},
     {"RC_VBI_load_index", (DL_FUNC) &RC_VBI_load_index, 1},
-    {"RC_VBI_vcf_load", (DL_FUNC) &RC_VBI_vcf_load, 2},
-    {"RC_VBI_query_region", (DL_FUNC) &RC_VBI_query_region, 5},
+    {"RC_VBI_vcf_load", (DL_FUNC) &RC_VBI_vcf_load, 3},
+    {"RC_VBI_query_region", (DL_FUNC) &RC_VBI_query_region, 6},
     {"RC_VBI_samples", (DL_FUNC) &RC_VBI_samples, 1},
     {"RC_VBI_nsamples", (DL_FUNC) &RC_VBI_nsamples, 1},
     {"RC_VBI_sample_at", (DL_FUNC) &RC_VBI_sample_at, 2},
@@ -52,6 +85,7 @@ static const R_CallMethodDef CallEntries[] = {
     {"RC_RBcfFileOpen", (DL_FUNC) &RBcfFileOpen, 2},
     {"RC_RBcfNewWriter", (DL_FUNC) &RBcfNewWriter, 2},
     {"RC_RBcfFileWriteCtx", (DL_FUNC) &RBcfFileWriteCtx, 2},
+    {"RC_RBcfExtractRegions", (DL_FUNC) &RBcfExtractRegions, 4},
     {"RC_RBcfSeqNames", (DL_FUNC) &RBcfSeqNames, 1},
     {"RC_RBcfNSamples", (DL_FUNC) &RBcfNSamples, 1},
     {"RC_RBcfSamples", (DL_FUNC) &RBcfSamples, 1},
@@ -63,6 +97,7 @@ static const R_CallMethodDef CallEntries[] = {
     {"RC_BcfConvertSampleToIndex0", (DL_FUNC) &BcfConvertSampleToIndex0, 2},
     {"RC_RBcfQueryRegion", (DL_FUNC) &RBcfQueryRegion, 2},
     {"RC_RBcfNextLine", (DL_FUNC) &RBcfNextLine, 1},
+    {"RC_RBcfReadBatch", (DL_FUNC) &RBcfReadBatch, 4},
     {"RC_RBcfCtxRid", (DL_FUNC) &RBcfCtxRid, 1},
     {"RC_RBcfCtxSeqName", (DL_FUNC) &RBcfCtxSeqName, 1},
     {"RC_RBcfCtxPos", (DL_FUNC) &RBcfCtxPos, 1},
@@ -112,4 +147,5 @@ void R_init_RBCFLib(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
     R_forceSymbols(dll, TRUE);
+    RC_register_ccallables();
 }
\ No newline at end of file
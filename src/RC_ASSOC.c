@@ -0,0 +1,594 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <Rmath.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "RBCFLib.h"
+#include "rbcf_dosage.h"
+#include "rbcf_linalg.h"
+#include "rbcf_parallel.h"
+
+/*
+ * Per-variant association tests written as GWAS-VCF
+ * (http://github.com/MRCIEU/gwas-vcf-specification), with the FORMAT
+ * fields of the munge and metal plugins.
+ *
+ * The null model is fitted once in R (R/Assoc.R), which passes an
+ * orthonormal basis B of the covariates (weighted by sqrt(mu(1-mu)) for
+ * logistic models) and the null residuals r. Every ALT allele is a row of
+ * mean-imputed, centered dosages g; a batch of rows is multiplied with
+ * [B r] in one go, giving for each row B'g and U = g'r, from which
+ *   - linear: g'g - |B'g|^2 is the residual variance of g given the
+ *     covariates, the OLS estimate is U over it, and a t test follows;
+ *   - logistic: V = g'Wg - |B'g|^2 is the variance of the score U, giving
+ *     the score test; rows with a p-value below firth_p are refitted with
+ *     Firth's penalized likelihood and a likelihood ratio test, on threads.
+ */
+
+#define ASSOC_LINEAR 0
+#define ASSOC_LOGISTIC 1
+
+#define FIRTH_MAX_ITER 25
+#define FIRTH_MAX_STEP 5.0
+
+/* GWAS-VCF fields, as in plugins/metal.c */
+enum { F_NS, F_NC, F_ES, F_SE, F_LP, F_AF, N_FIELDS };
+static const char *field_id[N_FIELDS] = {"NS", "NC", "ES", "SE", "LP", "AF"};
+static const char *field_desc[N_FIELDS] = {
+    "Variant-specific number of samples/individuals with called genotypes used to test association with specified "
+    "trait",
+    "Variant-specific number of cases used to estimate genetic effect (binary traits only)",
+    "Effect size estimate relative to the alternative allele",
+    "Standard error of effect size estimate",
+    "-log10 p-value for effect estimate",
+    "Alternative allele frequency in trait subset"};
+
+typedef struct {
+    int family;
+    int n, p;               /* samples, covariate columns (with the intercept) */
+    const int *smp;         /* sample columns in the header */
+    float *Br;              /* [B r], n x (p + 1) column-major */
+    const double *w;        /* logistic: mu (1 - mu) of the null model */
+    const double *X, *y;    /* logistic: design and phenotype, for Firth */
+    double rr;              /* linear: r'r */
+    double firth_p;
+    double null_pll;        /* logistic: penalized log-likelihood of the null model */
+    const double *null_beta;
+} assoc_model_t;
+
+typedef struct {
+    int ns, nc;             /* called samples, and cases among them */
+    double af, gg;          /* g'g (g'Wg for logistic) */
+    double es, se, lp;
+    int firth;              /* refit with Firth */
+} assoc_row_t;
+
+/*
+ * Firth-penalized logistic regression of y on [X g] (g NULL: X alone),
+ * Heinze & Schemper (2002) as in the logistf package.
+ */
+typedef struct {
+    const assoc_model_t *m;
+    const float *g;
+    int q;
+    double *beta, *mu, *w, *L, *u;
+} firth_t;
+
+/* lower Cholesky factor of the q x q matrix A in place, -1 if not positive definite */
+static int chol(double *A, int q) {
+    for (int j = 0; j < q; j++) {
+        double d = A[j * q + j];
+        for (int k = 0; k < j; k++) d -= A[j * q + k] * A[j * q + k];
+        if (!(d > 0)) return -1;
+        A[j * q + j] = d = sqrt(d);
+        for (int i = j + 1; i < q; i++) {
+            double s = A[i * q + j];
+            for (int k = 0; k < j; k++) s -= A[i * q + k] * A[j * q + k];
+            A[i * q + j] = s / d;
+        }
+    }
+    return 0;
+}
+
+/* x <- L^-1 x, then if both L^-T x */
+static void chol_solve(const double *L, int q, double *x, int both) {
+    for (int i = 0; i < q; i++) {
+        for (int k = 0; k < i; k++) x[i] -= L[i * q + k] * x[k];
+        x[i] /= L[i * q + i];
+    }
+    if (!both) return;
+    for (int i = q - 1; i >= 0; i--) {
+        for (int k = i + 1; k < q; k++) x[i] -= L[k * q + i] * x[k];
+        x[i] /= L[i * q + i];
+    }
+}
+
+static double firth_x(const firth_t *f, int i, int j) {
+    return j < f->m->p ? f->m->X[i + (size_t)f->m->n * j] : f->g[i];
+}
+
+/* fitted values, Fisher information factor and penalized log-likelihood at beta */
+static int firth_eval(firth_t *f, const double *beta, double *pll) {
+    int n = f->m->n, q = f->q;
+    double ll = 0;
+    memset(f->L, 0, (size_t)q * q * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        double eta = 0;
+        for (int j = 0; j < q; j++) eta += firth_x(f, i, j) * beta[j];
+        double mu = 1 / (1 + exp(-eta));
+        if (mu < 1e-15) mu = 1e-15;
+        if (mu > 1 - 1e-15) mu = 1 - 1e-15;
+        f->mu[i] = mu;
+        f->w[i] = mu * (1 - mu);
+        ll += f->m->y[i] > 0 ? log(mu) : log(1 - mu);
+        for (int j = 0; j < q; j++) {
+            double xw = firth_x(f, i, j) * f->w[i];
+            for (int k = 0; k <= j; k++) f->L[j * q + k] += xw * firth_x(f, i, k);
+        }
+    }
+    if (chol(f->L, q) < 0) return -1;
+    // log-likelihood + log|I|/2
+    for (int j = 0; j < q; j++) ll += log(f->L[j * q + j]);
+    *pll = ll;
+    return 0;
+}
+
+/* fits from the starting point in f->beta; 0 if converged */
+static int firth_fit(firth_t *f, double *pll) {
+    int n = f->m->n, q = f->q;
+    double *delta = f->u + q, *z = delta + q, *cand = z + q;
+    if (firth_eval(f, f->beta, pll) < 0) return -1;
+    for (int it = 0; it < FIRTH_MAX_ITER; it++) {
+        // modified score: X'(y - mu + h (1/2 - mu)), h the diagonal of the hat matrix
+        memset(f->u, 0, q * sizeof(double));
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < q; j++) z[j] = firth_x(f, i, j);
+            chol_solve(f->L, q, z, 0);
+            double h = 0;
+            for (int j = 0; j < q; j++) h += z[j] * z[j];
+            h *= f->w[i];
+            double res = f->m->y[i] - f->mu[i] + h * (0.5 - f->mu[i]);
+            for (int j = 0; j < q; j++) f->u[j] += firth_x(f, i, j) * res;
+        }
+        double gmax = 0, dmax = 0;
+        memcpy(delta, f->u, q * sizeof(double));
+        chol_solve(f->L, q, delta, 1);
+        for (int j = 0; j < q; j++) {
+            if (fabs(f->u[j]) > gmax) gmax = fabs(f->u[j]);
+            if (fabs(delta[j]) > dmax) dmax = fabs(delta[j]);
+        }
+        if (dmax > FIRTH_MAX_STEP) {
+            for (int j = 0; j < q; j++) delta[j] *= FIRTH_MAX_STEP / dmax;
+        }
+        // step halving until the penalized likelihood does not decrease
+        double new_pll = *pll;
+        int accepted = 0;
+        for (int half = 0; half < 10 && !accepted; half++) {
+            for (int j = 0; j < q; j++) cand[j] = f->beta[j] + delta[j];
+            accepted = firth_eval(f, cand, &new_pll) == 0 && new_pll >= *pll - 1e-10;
+            for (int j = 0; j < q; j++) delta[j] /= 2;
+        }
+        if (!accepted) {
+            // no better point along the step: stay at beta, converged only if already there
+            if (firth_eval(f, f->beta, pll) < 0) return -1;
+            return dmax <= 1e-5 && gmax <= 1e-5 ? 0 : -1;
+        }
+        memcpy(f->beta, cand, q * sizeof(double));
+        *pll = new_pll;
+        if (dmax <= 1e-5 && gmax <= 1e-5) return 0;
+    }
+    return -1;
+}
+
+typedef struct {
+    const assoc_model_t *m;
+    const float *G;
+    assoc_row_t *rows;
+    int *todo;
+    rbcf_tasks_t tasks;
+} firth_job_t;
+
+static void firth_worker(void *arg, int t) {
+    (void)t;
+    firth_job_t *job = (firth_job_t *)arg;
+    const assoc_model_t *m = job->m;
+    int q = m->p + 1;
+    double *buf = malloc(((size_t)2 * m->n + (size_t)q * q + 5 * q) * sizeof(double));
+    int64_t task;
+    while ((task = rbcf_parallel_next(&job->tasks)) >= 0) {
+        assoc_row_t *row = &job->rows[job->todo[task]];
+        if (!buf) continue;
+        firth_t f = {m, job->G + (size_t)job->todo[task] * m->n, q, buf, buf + q, buf + q + m->n, NULL, NULL};
+        f.L = f.w + m->n;
+        f.u = f.L + (size_t)q * q;
+        memcpy(f.beta, m->null_beta, m->p * sizeof(double));
+        f.beta[m->p] = 0;
+        double pll;
+        if (firth_fit(&f, &pll) < 0) continue;
+        row->es = f.beta[m->p];
+        row->se = 1 / f.L[(q - 1) * q + q - 1];
+        // likelihood ratio statistic, turned into LP by the calling thread
+        row->lp = 2 * (pll - m->null_pll);
+        row->firth = 2;
+    }
+    free(buf);
+}
+
+/* output records of a batch, their ALT alleles being rows first_row .. */
+typedef struct {
+    bcf1_t **rec;
+    int *first_row;
+    int n, m;
+} assoc_slots_t;
+
+/* dosages of ALT allele a of rec for the samples of the model, -1 for missing; 0 if unavailable */
+static int assoc_dosages(const assoc_model_t *m, const bcf_hdr_t *hdr, bcf1_t *rec, int use_ds, int a,
+                         float *ds, int nds, int32_t *gt, int ngt, float *out, int *ploidy_sum) {
+    int nsmpl = bcf_hdr_nsamples(hdr);
+    *ploidy_sum = 0;
+    if (use_ds && nds > 0) {
+        int nv = nds / nsmpl;
+        if (nv != rec->n_allele - 1) return 0;
+        for (int k = 0; k < m->n; k++) {
+            float v = ds[(size_t)m->smp[k] * nv + a - 1];
+            out[k] = bcf_float_is_missing(v) || bcf_float_is_vector_end(v) ? -1 : v;
+            if (out[k] >= 0) *ploidy_sum += 2;
+        }
+        return 1;
+    }
+    if (ngt <= 0) return 0;
+    int ploidy = ngt / nsmpl;
+    for (int k = 0; k < m->n; k++) {
+        const int32_t *g = gt + (size_t)m->smp[k] * ploidy;
+        int d = 0, n_al = 0, missing = 0;
+        for (int j = 0; j < ploidy && g[j] != bcf_int32_vector_end; j++) {
+            if (bcf_gt_is_missing(g[j])) {
+                missing = 1;
+                break;
+            }
+            d += bcf_gt_allele(g[j]) == a;
+            n_al++;
+        }
+        out[k] = missing || !n_al ? -1 : d;
+        if (out[k] >= 0) *ploidy_sum += n_al;
+    }
+    return 1;
+}
+
+/* centers row in place (missing at the mean) and fills its counts */
+static void assoc_center(const assoc_model_t *m, float *g, int ploidy_sum, assoc_row_t *row) {
+    double sum = 0;
+    for (int k = 0; k < m->n; k++) {
+        if (g[k] < 0) continue;
+        sum += g[k];
+        row->ns++;
+        if (m->y && m->y[k] > 0) row->nc++;
+    }
+    if (!row->ns) return;
+    double mean = sum / row->ns;
+    row->af = ploidy_sum ? sum / ploidy_sum : NAN;
+    for (int k = 0; k < m->n; k++) {
+        g[k] = g[k] < 0 ? 0 : (float)(g[k] - mean);
+        row->gg += m->w ? m->w[k] * g[k] * g[k] : (double)g[k] * g[k];
+    }
+}
+
+/* statistics of the rows of a batch from Wb = G [B r] */
+static void assoc_stats(const assoc_model_t *m, assoc_row_t *rows, int n_rows, const double *Wb) {
+    int df = m->n - m->p - 1;
+    for (int r = 0; r < n_rows; r++) {
+        assoc_row_t *row = &rows[r];
+        double proj = 0;
+        for (int c = 0; c < m->p; c++) proj += Wb[r + (size_t)n_rows * c] * Wb[r + (size_t)n_rows * c];
+        double v = row->gg - proj, u = Wb[r + (size_t)n_rows * m->p];
+        row->es = row->se = row->lp = NAN;
+        row->firth = 0;
+        if (!row->ns || !(v > 1e-8 * row->gg)) continue;
+        if (m->family == ASSOC_LINEAR) {
+            if (df < 1) continue;
+            double beta = u / v, rss = m->rr - beta * u;
+            double se = sqrt((rss > 0 ? rss : 0) / df / v);
+            row->es = beta;
+            row->se = se;
+            row->lp = se > 0 ? -(M_LN2 + pt(-fabs(beta / se), df, 1, 1)) / M_LN10 : INFINITY;
+        } else {
+            row->es = u / v;
+            row->se = 1 / sqrt(v);
+            row->lp = -pchisq(u * u / v, 1, 0, 1) / M_LN10;
+            if (m->firth_p > 0 && row->lp > -log10(m->firth_p)) row->firth = 1;
+        }
+    }
+}
+
+/* sets the GWAS-VCF fields of the batch records and writes them; the number of alleles tested, -1 on error */
+static int assoc_write(const assoc_model_t *m, htsFile *out, bcf_hdr_t *oh, assoc_slots_t *slots,
+                       const assoc_row_t *rows, float *vals) {
+    int n_tested = 0;
+    for (int s = 0; s < slots->n; s++) {
+        bcf1_t *rec = slots->rec[s];
+        int r0 = slots->first_row[s], n_alt = rec->n_allele - 1, tested = 0;
+        for (int a = 0; a < n_alt; a++) {
+            const assoc_row_t *row = &rows[r0 + a];
+            double v[N_FIELDS] = {row->ns, row->nc, row->es, row->se, row->lp, row->af};
+            for (int f = 0; f < N_FIELDS; f++) {
+                float *x = &vals[f * n_alt + a];
+                if (isnan(v[f]) || (f != F_NS && f != F_NC && f != F_AF && isnan(row->es))) bcf_float_set_missing(*x);
+                else *x = (float)v[f];
+            }
+            tested += !isnan(row->es);
+        }
+        if (!tested) continue;
+        n_tested += tested;
+        for (int f = 0; f < N_FIELDS; f++) {
+            if (f == F_NC && m->family != ASSOC_LOGISTIC) continue;
+            if (bcf_update_format_float(oh, rec, field_id[f], &vals[f * n_alt], n_alt) < 0) return -1;
+        }
+        if (bcf_write(out, oh, rec) < 0) return -1;
+    }
+    return n_tested;
+}
+
+typedef struct {
+    rbcf_stream_t st;
+    htsFile *out;
+    bcf_hdr_t *oh;
+    assoc_slots_t slots;
+    float *G, *ds, *vals;
+    int32_t *gt;
+    int m_ds, m_gt, m_vals, cap;
+    double *Wb;
+    assoc_row_t *rows;
+    int *todo;
+    double *null_beta;
+    double n_tested;
+} assoc_state_t;
+
+static void assoc_free(assoc_state_t *s) {
+    rbcf_stream_close(&s->st);
+    if (s->out) hts_close(s->out);
+    if (s->oh) bcf_hdr_destroy(s->oh);
+    for (int i = 0; i < s->slots.m; i++) bcf_destroy(s->slots.rec[i]);
+    free(s->slots.rec);
+    free(s->slots.first_row);
+    free(s->G);
+    free(s->ds);
+    free(s->vals);
+    free(s->gt);
+    free(s->Wb);
+    free(s->rows);
+    free(s->todo);
+    free(s->null_beta);
+    memset(s, 0, sizeof(assoc_state_t));
+}
+
+/* multiplies, tests and writes the rows of the batch; -1 on error */
+static int assoc_flush(assoc_state_t *s, const assoc_model_t *m, int n_rows, int n_threads) {
+    if (n_rows) {
+        rbcf_gemm_aq(n_rows, m->n, s->G, m->n, m->Br, m->p + 1, s->Wb, n_threads);
+        assoc_stats(m, s->rows, n_rows, s->Wb);
+    }
+    if (m->family == ASSOC_LOGISTIC) {
+        firth_job_t job = {.m = m, .G = s->G, .rows = s->rows, .todo = s->todo};
+        int n_todo = 0;
+        for (int r = 0; r < n_rows; r++) {
+            if (s->rows[r].firth) s->todo[n_todo++] = r;
+        }
+        if (n_todo) {
+            rbcf_tasks_init(&job.tasks, n_todo);
+            rbcf_parallel_run(n_threads < n_todo ? n_threads : n_todo, firth_worker, &job);
+            rbcf_tasks_destroy(&job.tasks);
+            for (int t = 0; t < n_todo; t++) {
+                assoc_row_t *row = &s->rows[s->todo[t]];
+                if (row->firth == 2) row->lp = -pchisq(row->lp > 0 ? row->lp : 0, 1, 0, 1) / M_LN10;
+            }
+        }
+    }
+    int ret = assoc_write(m, s->out, s->oh, &s->slots, s->rows, s->vals);
+    s->slots.n = 0;
+    if (ret < 0) return -1;
+    s->n_tested += ret;
+    return 0;
+}
+
+/*
+ * RC_AssocRun(filename, output, region, samples, trait, family, field, basis, resid,
+ *             weights, X, y, firth_p, batch, threads)
+ * samples are the n samples of the model, in the order of its vectors.
+ * basis is the n x p orthonormal basis B, resid the null residuals r;
+ * for family 1 (logistic) weights are mu (1 - mu), X the n x p design and
+ * y the 0/1 phenotype. field is "DS" (falling back to GT for records
+ * without DS) or "GT". Writes the GWAS-VCF and returns the number of
+ * alleles tested.
+ */
+SEXP RC_AssocRun(SEXP filename, SEXP output, SEXP region, SEXP samples, SEXP trait, SEXP family,
+                 SEXP field, SEXP basis, SEXP resid, SEXP weights, SEXP X, SEXP y, SEXP firth_p,
+                 SEXP batch, SEXP threads) {
+    const char *fn = CHAR(STRING_ELT(filename, 0));
+    const char *out_fn = CHAR(STRING_ELT(output, 0));
+    const char *reg = isNull(region) ? NULL : CHAR(STRING_ELT(region, 0));
+    int n_threads = asInteger(threads), b = asInteger(batch);
+    int use_ds = !strcmp(CHAR(STRING_ELT(field, 0)), "DS");
+    if (n_threads == NA_INTEGER || n_threads < 1) n_threads = 1;
+    if (b == NA_INTEGER || b < 1) Rf_error("[Assoc] Invalid batch size");
+
+    assoc_model_t m;
+    memset(&m, 0, sizeof(assoc_model_t));
+    m.family = asInteger(family);
+    m.n = LENGTH(samples);
+    m.p = ncols(basis);
+    m.firth_p = asReal(firth_p);
+    if (nrows(basis) != m.n || LENGTH(resid) != m.n) Rf_error("[Assoc] The model does not match the samples");
+    if (m.family == ASSOC_LOGISTIC) {
+        if (LENGTH(weights) != m.n || LENGTH(y) != m.n || nrows(X) != m.n || ncols(X) != m.p) {
+            Rf_error("[Assoc] The model does not match the samples");
+        }
+        m.w = REAL(weights);
+        m.X = REAL(X);
+        m.y = REAL(y);
+    }
+    m.Br = (float *)R_alloc((size_t)m.n * (m.p + 1), sizeof(float));
+    for (size_t i = 0; i < (size_t)m.n * m.p; i++) m.Br[i] = (float)REAL(basis)[i];
+    for (int k = 0; k < m.n; k++) {
+        m.Br[(size_t)m.n * m.p + k] = (float)REAL(resid)[k];
+        m.rr += REAL(resid)[k] * REAL(resid)[k];
+    }
+
+    assoc_state_t s;
+    memset(&s, 0, sizeof(assoc_state_t));
+    const char *err = rbcf_stream_open(&s.st, fn, reg, n_threads);
+    if (err) Rf_error("[Assoc] %s: %s", err, fn);
+    bcf_hdr_t *hdr = s.st.hdr;
+    int *smp = (int *)R_alloc(m.n + 1, sizeof(int));
+    for (int k = 0; k < m.n; k++) {
+        const char *name = CHAR(STRING_ELT(samples, k));
+        smp[k] = bcf_hdr_id2int(hdr, BCF_DT_SAMPLE, name);
+        if (smp[k] < 0) {
+            assoc_free(&s);
+            Rf_error("[Assoc] Unknown sample %s", name);
+        }
+    }
+    m.smp = smp;
+
+    // null model of the Firth refits
+    if (m.family == ASSOC_LOGISTIC && m.firth_p > 0) {
+        int q = m.p;
+        double *buf = malloc(((size_t)2 * m.n + (size_t)q * q + 5 * q) * sizeof(double));
+        s.null_beta = calloc(q, sizeof(double));
+        firth_t f = {&m, NULL, q, buf, buf ? buf + q : NULL, buf ? buf + q + m.n : NULL, NULL, NULL};
+        int ret = buf && s.null_beta ? 0 : -1;
+        if (ret == 0) {
+            f.L = f.w + m.n;
+            f.u = f.L + (size_t)q * q;
+            ret = firth_fit(&f, &m.null_pll);
+            memcpy(s.null_beta, f.beta, q * sizeof(double));
+        }
+        free(buf);
+        if (ret < 0) {
+            assoc_free(&s);
+            Rf_error("[Assoc] The Firth null model does not converge");
+        }
+        m.null_beta = s.null_beta;
+    }
+
+    // GWAS-VCF header: the contigs and filters of the input, one sample
+    s.oh = bcf_hdr_subset(hdr, 0, NULL, NULL);
+    char mode[8] = "w";
+    if (vcf_open_mode(mode + 1, out_fn, NULL) < 0) strcpy(mode + 1, "b");
+    s.out = hts_open(out_fn, mode);
+    if (!s.oh || !s.out) {
+        assoc_free(&s);
+        Rf_error("[Assoc] Cannot open output file %s", out_fn);
+    }
+    bcf_hdr_remove(s.oh, BCF_HL_INFO, NULL);
+    bcf_hdr_remove(s.oh, BCF_HL_FMT, NULL);
+    int ret = 0;
+    for (int f = 0; f < N_FIELDS && !ret; f++) {
+        if (f == F_NC && m.family != ASSOC_LOGISTIC) continue;
+        ret = bcf_hdr_printf(s.oh, "##FORMAT=<ID=%s,Number=A,Type=Float,Description=\"%s\">", field_id[f],
+                             field_desc[f]);
+    }
+    if (!ret) ret = bcf_hdr_add_sample(s.oh, CHAR(STRING_ELT(trait, 0)));
+    if (!ret) ret = bcf_hdr_sync(s.oh);
+    if (!ret) ret = bcf_hdr_write(s.out, s.oh);
+    if (ret) {
+        assoc_free(&s);
+        Rf_error("[Assoc] Cannot write the header of %s", out_fn);
+    }
+
+    s.cap = b;
+    s.G = malloc((size_t)s.cap * m.n * sizeof(float));
+    s.Wb = malloc((size_t)s.cap * (m.p + 1) * sizeof(double));
+    s.rows = malloc(s.cap * sizeof(assoc_row_t));
+    s.todo = malloc(s.cap * sizeof(int));
+    ret = s.G && s.Wb && s.rows && s.todo ? 0 : -1;
+    int n_rows = 0;
+    bcf1_t *rec;
+    while (!ret && (rec = rbcf_stream_next(&s.st))) {
+        int n_alt = rec->n_allele - 1;
+        if (n_alt < 1) continue;
+        int nds = use_ds ? bcf_get_format_float(hdr, rec, "DS", &s.ds, &s.m_ds) : 0;
+        int ngt = use_ds && nds > 0 ? 0 : bcf_get_genotypes(hdr, rec, &s.gt, &s.m_gt);
+        if (nds <= 0 && ngt <= 0) continue;
+        if (n_rows + n_alt > s.cap) {
+            if ((ret = assoc_flush(&s, &m, n_rows, n_threads)) < 0) break;
+            n_rows = 0;
+            if (n_alt > s.cap) {
+                // a record with more ALT alleles than the batch
+                float *G = realloc(s.G, (size_t)n_alt * m.n * sizeof(float));
+                if (G) s.G = G;
+                double *Wb = G ? realloc(s.Wb, (size_t)n_alt * (m.p + 1) * sizeof(double)) : NULL;
+                if (Wb) s.Wb = Wb;
+                assoc_row_t *rows = Wb ? realloc(s.rows, n_alt * sizeof(assoc_row_t)) : NULL;
+                if (rows) s.rows = rows;
+                int *todo = rows ? realloc(s.todo, n_alt * sizeof(int)) : NULL;
+                if (!todo) {
+                    ret = -1;
+                    break;
+                }
+                s.todo = todo;
+                s.cap = n_alt;
+            }
+        }
+        if (s.slots.n == s.slots.m) {
+            int sm = s.slots.m ? s.slots.m * 2 : 64;
+            bcf1_t **recs = realloc(s.slots.rec, sm * sizeof(bcf1_t *));
+            if (recs) s.slots.rec = recs;
+            int *first = recs ? realloc(s.slots.first_row, sm * sizeof(int)) : NULL;
+            if (!first) {
+                ret = -1;
+                break;
+            }
+            s.slots.first_row = first;
+            for (int i = s.slots.m; i < sm; i++) s.slots.rec[i] = NULL;
+            s.slots.m = sm;
+        }
+        // site of the output record
+        bcf1_t *orec = s.slots.rec[s.slots.n];
+        if (!orec && !(orec = s.slots.rec[s.slots.n] = bcf_init())) {
+            ret = -1;
+            break;
+        }
+        bcf_clear(orec);
+        bcf_unpack(rec, BCF_UN_STR);
+        orec->rid = bcf_hdr_name2id(s.oh, bcf_hdr_id2name(hdr, rec->rid));
+        orec->pos = rec->pos;
+        bcf_float_set_missing(orec->qual);
+        if (bcf_update_id(s.oh, orec, rec->d.id) < 0 ||
+            bcf_update_alleles(s.oh, orec, (const char **)rec->d.allele, rec->n_allele) < 0) {
+            ret = -1;
+            break;
+        }
+        if (N_FIELDS * n_alt > s.m_vals) {
+            float *vals = realloc(s.vals, N_FIELDS * n_alt * sizeof(float));
+            if (!vals) {
+                ret = -1;
+                break;
+            }
+            s.vals = vals;
+            s.m_vals = N_FIELDS * n_alt;
+        }
+        s.slots.first_row[s.slots.n++] = n_rows;
+        for (int a = 1; a <= n_alt; a++, n_rows++) {
+            assoc_row_t *row = &s.rows[n_rows];
+            memset(row, 0, sizeof(assoc_row_t));
+            float *g = s.G + (size_t)n_rows * m.n;
+            int ploidy_sum;
+            if (assoc_dosages(&m, hdr, rec, use_ds, a, s.ds, nds, s.gt, ngt, g, &ploidy_sum)) {
+                assoc_center(&m, g, ploidy_sum, row);
+            } else {
+                memset(g, 0, m.n * sizeof(float));
+            }
+        }
+    }
+    if (!ret && s.st.sr->errnum) ret = -2;
+    if (!ret) ret = assoc_flush(&s, &m, n_rows, n_threads);
+    if (!ret && hts_close(s.out) < 0) ret = -1;
+    else if (!ret) s.out = NULL;
+    double n_tested = s.n_tested;
+    assoc_free(&s);
+    if (ret) Rf_error(ret == -2 ? "[Assoc] Error reading %s" : "[Assoc] Error writing %s", ret == -2 ? fn : out_fn);
+    return ScalarReal(n_tested);
+}
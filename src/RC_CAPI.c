@@ -0,0 +1,268 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <R_ext/Rdynload.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "htslib/vcf.h"
+#include "RBCFLib.h"
+#include "cgranges.h"
+#include "vbi_context.h"
+#include "vbi_index_capi.h"
+#include "vbi_map.h"
+// the table type only, the wrappers of the header would clash with the functions here
+#define RBCFLIB_API_TABLE_ONLY
+#include "../inst/include/RBCFLibAPI.h"
+
+/*
+ * C API for the compiled code of other packages, declared in
+ * inst/include/RBCFLibAPI.h, where each function is documented. These are
+ * thin wrappers over the internal VBI index, cgranges and VBI context
+ * functions, so that a package linking to RBCFLib can query them from its
+ * own loops with no R object per call.
+ *
+ * Packages reach them through rbcf_api_table, a table of entry points
+ * looked up once with RBCF_api_init(): RBCF_api_table is the only symbol
+ * registered with R_RegisterCCallable(). Bump RBCF_API_VERSION (in the
+ * header) when functions are added; the table is only ever appended to.
+ */
+
+static void RBCF_free(void *p) {
+    free(p);
+}
+
+/* VBI index */
+
+static vbi_index_t *RBCF_vbi_load(const char *filename) {
+    return vbi_index_load(filename);
+}
+
+static void RBCF_vbi_free(vbi_index_t *idx) {
+    vbi_index_free(idx);
+}
+
+static vbi_index_t *RBCF_vbi_from_sexp(SEXP idx_ptr) {
+    if (TYPEOF(idx_ptr) != EXTPTRSXP) Rf_error("[VBI] Not a VBI index pointer");
+    vbi_index_t *idx = (vbi_index_t *) R_ExternalPtrAddr(idx_ptr);
+    if (!idx) Rf_error("[VBI] Index pointer is NULL");
+    return idx;
+}
+
+static int64_t RBCF_vbi_nmarker(const vbi_index_t *idx) {
+    return idx->num_marker;
+}
+
+static int RBCF_vbi_marker(const vbi_index_t *idx, int64_t marker, const char **chrom, int64_t *pos) {
+    if (marker < 0 || marker >= idx->num_marker) return -1;
+    if (chrom) *chrom = idx->chrom_names[idx->chrom_ids[marker]];
+    if (pos) *pos = idx->positions[marker];
+    return 0;
+}
+
+static int *RBCF_vbi_query(vbi_index_t *idx, const char *region, int *n) {
+    *n = 0;
+    return vbi_index_query_region_cgranges(idx, region, n);
+}
+
+// The markers are points [pos,pos) in the cgranges, labelled with their ordinal
+static int64_t RBCF_vbi_overlap(const vbi_index_t *idx, const char *chrom, int64_t beg, int64_t end,
+                                int64_t **markers, int64_t *m_markers) {
+    if (!idx->cr || beg > end) return 0;
+    if (beg < 1) beg = 1;
+    if (end >= INT32_MAX) end = INT32_MAX - 1;
+    cgranges_t *cr = (cgranges_t *) idx->cr;
+    int64_t n = cr_overlap(cr, chrom, (int32_t)(beg - 1), (int32_t)(end + 1), markers, m_markers);
+    for (int64_t i = 0; i < n; i++) (*markers)[i] = cr_label(cr, (*markers)[i]);
+    return n;
+}
+
+/* cgranges */
+
+static cgranges_t *RBCF_cr_init(void) {
+    return cr_init();
+}
+
+static void RBCF_cr_destroy(cgranges_t *cr) {
+    cr_destroy(cr);
+}
+
+static cgranges_t *RBCF_cr_from_sexp(SEXP cr_ptr) {
+    return cgranges_context(cr_ptr);
+}
+
+static int RBCF_cr_add(cgranges_t *cr, const char *ctg, int32_t st, int32_t en, int32_t label) {
+    return cr_add(cr, ctg, st, en, label) ? 0 : -1;
+}
+
+static void RBCF_cr_index(cgranges_t *cr) {
+    cr_index(cr);
+}
+
+static int64_t RBCF_cr_overlap(const cgranges_t *cr, const char *ctg, int32_t st, int32_t en,
+                               int64_t **b, int64_t *m_b) {
+    return cr_overlap(cr, ctg, st, en, b, m_b);
+}
+
+static int64_t RBCF_cr_contain(const cgranges_t *cr, const char *ctg, int32_t st, int32_t en,
+                               int64_t **b, int64_t *m_b) {
+    return cr_contain(cr, ctg, st, en, b, m_b);
+}
+
+static int RBCF_cr_interval(const cgranges_t *cr, int64_t i, const char **ctg,
+                            int32_t *st, int32_t *en, int32_t *label) {
+    if (i < 0 || i >= cr->n_r) return -1;
+    if (ctg) {
+        // indexed intervals are sorted by contig, each contig spanning [off, off+n)
+        int32_t lo = 0, hi = cr->n_ctg - 1;
+        while (lo < hi) {
+            int32_t mid = lo + (hi - lo + 1) / 2;
+            if (cr->ctg[mid].off <= i) lo = mid;
+            else hi = mid - 1;
+        }
+        *ctg = cr->ctg[lo].name;
+    }
+    if (st) *st = cr_start(cr, i);
+    if (en) *en = cr_end(cr, i);
+    if (label) *label = cr_label(cr, i);
+    return 0;
+}
+
+/* Records of a VBI context (VCFLoad()) */
+
+static const bcf_hdr_t *RBCF_vbi_context_header(SEXP vbi_vcf_ctx) {
+    return vbi_context_header(vbi_vcf_ctx);
+}
+
+static vbi_index_t *RBCF_vbi_context_index(SEXP vbi_vcf_ctx) {
+    return vbi_context_index(vbi_vcf_ctx);
+}
+
+static bcf1_t *RBCF_record_init(void) {
+    return bcf_init();
+}
+
+static void RBCF_record_destroy(bcf1_t *rec) {
+    if (!rec) return;
+    vbi_map_release(rec);
+    bcf_destroy(rec);
+}
+
+static int RBCF_vbi_context_fetch(SEXP vbi_vcf_ctx, const int *markers, int n, bcf1_t **recs) {
+    for (int i = 0; i < n; i++) {
+        if (!recs[i] && !(recs[i] = bcf_init())) return i;
+        if (vbi_context_read(vbi_vcf_ctx, markers[i], recs[i]) < 0) return i;
+    }
+    return n;
+}
+
+static const rbcf_api_t rbcf_api_table = {
+    RBCF_API_VERSION,
+    RBCF_free,
+    (rbcf_vbi_t *(*)(const char *)) RBCF_vbi_load,
+    (void (*)(rbcf_vbi_t *)) RBCF_vbi_free,
+    (rbcf_vbi_t *(*)(SEXP)) RBCF_vbi_from_sexp,
+    (int64_t (*)(const rbcf_vbi_t *)) RBCF_vbi_nmarker,
+    (int (*)(const rbcf_vbi_t *, int64_t, const char **, int64_t *)) RBCF_vbi_marker,
+    (int *(*)(rbcf_vbi_t *, const char *, int *)) RBCF_vbi_query,
+    (int64_t (*)(const rbcf_vbi_t *, const char *, int64_t, int64_t, int64_t **, int64_t *)) RBCF_vbi_overlap,
+    (rbcf_cr_t *(*)(void)) RBCF_cr_init,
+    (void (*)(rbcf_cr_t *)) RBCF_cr_destroy,
+    (rbcf_cr_t *(*)(SEXP)) RBCF_cr_from_sexp,
+    (int (*)(rbcf_cr_t *, const char *, int32_t, int32_t, int32_t)) RBCF_cr_add,
+    (void (*)(rbcf_cr_t *)) RBCF_cr_index,
+    (int64_t (*)(const rbcf_cr_t *, const char *, int32_t, int32_t, int64_t **, int64_t *)) RBCF_cr_overlap,
+    (int64_t (*)(const rbcf_cr_t *, const char *, int32_t, int32_t, int64_t **, int64_t *)) RBCF_cr_contain,
+    (int (*)(const rbcf_cr_t *, int64_t, const char **, int32_t *, int32_t *, int32_t *)) RBCF_cr_interval,
+    (const struct bcf_hdr_t *(*)(SEXP)) RBCF_vbi_context_header,
+    (rbcf_vbi_t *(*)(SEXP)) RBCF_vbi_context_index,
+    (struct bcf1_t *(*)(void)) RBCF_record_init,
+    (void (*)(struct bcf1_t *)) RBCF_record_destroy,
+    (int (*)(SEXP, const int *, int, struct bcf1_t **)) RBCF_vbi_context_fetch,
+};
+
+static const rbcf_api_t *RBCF_api_table(void) {
+    return &rbcf_api_table;
+}
+
+void RC_register_ccallables(void) {
+    R_RegisterCCallable("RBCFLib", "RBCF_api_table", (DL_FUNC) &RBCF_api_table);
+}
+
+/*
+ * RC_CAPI_test(vbi_path, vbi_vcf_ctx, chrom, beg, end)
+ * Test hook: goes through the registered entry points as another package
+ * would, and returns list(version, markers, query, fetched, cr_hits): the 1-based markers at positions beg to end of chrom from
+ * RBCF_vbi_overlap(), the same from RBCF_vbi_query(), the positions of
+ * those records read with RBCF_vbi_context_fetch(), and the hits of
+ * [beg-1,end) among intervals built with the cgranges functions from the
+ * markers of chrom.
+ */
+SEXP RC_CAPI_test(SEXP vbi_path, SEXP vbi_vcf_ctx, SEXP chrom, SEXP beg, SEXP end) {
+    const rbcf_api_t *api = ((const rbcf_api_t *(*)(void)) R_GetCCallable("RBCFLib", "RBCF_api_table"))();
+
+    const char *ctg = CHAR(STRING_ELT(chrom, 0));
+    int64_t b = (int64_t) asReal(beg), e = (int64_t) asReal(end);
+    rbcf_vbi_t *idx = api->vbi_load(CHAR(STRING_ELT(vbi_path, 0)));
+    if (!idx) Rf_error("[CAPI] Cannot load %s", CHAR(STRING_ELT(vbi_path, 0)));
+
+    int64_t *hits = NULL, m_hits = 0;
+    int64_t n = api->vbi_overlap(idx, ctg, b, e, &hits, &m_hits);
+    char region[1024];
+    snprintf(region, sizeof(region), "%s:%" PRId64 "-%" PRId64, ctg, b, e);
+    int n_query = 0;
+    int *query = api->vbi_query(idx, region, &n_query);
+
+    SEXP out = PROTECT(allocVector(VECSXP, 5));
+    SET_VECTOR_ELT(out, 0, ScalarInteger(api->version));
+    SEXP markers = allocVector(INTSXP, n);
+    SET_VECTOR_ELT(out, 1, markers);
+    for (int64_t i = 0; i < n; i++) INTEGER(markers)[i] = (int) hits[i] + 1;
+    SEXP q = allocVector(INTSXP, n_query);
+    SET_VECTOR_ELT(out, 2, q);
+    for (int i = 0; i < n_query; i++) INTEGER(q)[i] = query[i] + 1;
+    api->free(query);
+
+    // records of the overlap, through the context
+    int *mk = (int *) R_alloc(n ? n : 1, sizeof(int));
+    struct bcf1_t **recs = (struct bcf1_t **) R_alloc(n ? n : 1, sizeof(struct bcf1_t *));
+    for (int64_t i = 0; i < n; i++) {
+        mk[i] = (int) hits[i];
+        recs[i] = NULL;
+    }
+    int n_read = api->vbi_context_fetch(vbi_vcf_ctx, mk, (int) n, recs);
+    SEXP fetched = allocVector(REALSXP, n_read);
+    SET_VECTOR_ELT(out, 3, fetched);
+    for (int i = 0; i < n_read; i++) REAL(fetched)[i] = (double) ((bcf1_t *) recs[i])->pos + 1;
+    for (int64_t i = 0; i < n; i++) api->record_destroy(recs[i]);
+
+    // cgranges of the markers of chrom, as points [pos-1,pos)
+    rbcf_cr_t *cr = api->cr_init();
+    int64_t nm = api->vbi_nmarker(idx);
+    for (int64_t i = 0; i < nm; i++) {
+        const char *c;
+        int64_t pos;
+        if (api->vbi_marker(idx, i, &c, &pos) == 0 && !strcmp(c, ctg))
+            api->cr_add(cr, c, (int32_t) (pos - 1), (int32_t) pos, (int32_t) i);
+    }
+    api->cr_index(cr);
+    int64_t nc = api->cr_overlap(cr, ctg, (int32_t) (b - 1), (int32_t) e, &hits, &m_hits);
+    SEXP cr_hits = allocVector(INTSXP, nc);
+    SET_VECTOR_ELT(out, 4, cr_hits);
+    for (int64_t i = 0; i < nc; i++) {
+        int32_t label;
+        api->cr_interval(cr, hits[i], NULL, NULL, NULL, &label);
+        INTEGER(cr_hits)[i] = label + 1;
+    }
+    api->cr_destroy(cr);
+    api->free(hits);
+    api->vbi_free(idx);
+
+    const char *nms[] = {"version", "markers", "query", "fetched", "cr_hits"};
+    SEXP names_out = PROTECT(allocVector(STRSXP, 5));
+    for (int i = 0; i < 5; i++) SET_STRING_ELT(names_out, i, mkChar(nms[i]));
+    setAttrib(out, R_NamesSymbol, names_out);
+    UNPROTECT(2);
+    return out;
+}
@@ -0,0 +1,497 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "htslib/hts.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "htslib/vcf.h"
+#include "htslib/tbx.h"
+#include "htslib/kstring.h"
+#include "RBCFLib.h"
+#include "vbi_index_capi.h"
+
+/*
+ * Chunk planner: split an indexed VCF/BCF into regions of similar
+ * compressed size without reading the records.
+ *
+ * Every contig is described by "marks": a position and the virtual offset
+ * of the first record at or after it. With a VBI index the marks are the
+ * record starts themselves (one per distinct POS), so boundaries and
+ * record counts are exact. With a CSI/TBI index they come from iterator
+ * queries, which resolve to the linear index window (16kb) and the BGZF
+ * block; marks are added by bisection only where the offsets still differ
+ * by more than a fraction of a chunk, so a sparse contig costs a handful
+ * of queries. Record counts are then prorated from the index statistics.
+ *
+ * Virtual offsets are turned into byte estimates by interpolating inside
+ * their BGZF block, whose compressed and uncompressed sizes are read from
+ * the file (two small reads per distinct block).
+ *
+ * A chunk never spans two contigs: each contig gets round(bytes / target)
+ * chunks, at least one. Chunks tile their contig (the first one starts at
+ * 1) and records are meant to be assigned by POS, so adjacent chunks never
+ * share a record.
+ */
+
+#define CHUNK_MIN_STEP     16384        /* linear index window */
+#define CHUNK_DEFAULT_SPAN (1LL << 29)  /* contig length if the header has none */
+#define CHUNK_RESOLUTION   16           /* marks per chunk when bisecting */
+
+typedef struct {
+    char *name;
+    int64_t len;            /* from the header, 0 if unknown */
+    int n, m;
+    int64_t *pos;           /* 1-based start of each mark */
+    uint64_t *voff;         /* first record at or after pos */
+    int64_t *nrec;          /* records before the mark, VBI only */
+    uint64_t end_voff;      /* just past the last record */
+    int64_t n_records;      /* -1 if unknown */
+} plan_contig_t;
+
+typedef struct {
+    uint64_t coff;          /* compressed offset of the block */
+    uint32_t csize, isize;  /* compressed and uncompressed sizes, 0 if unknown */
+} plan_block_t;
+
+typedef struct {
+    plan_contig_t *ctg;
+    int n, m;
+    int exact;              /* marks are record starts */
+    const char *index;      /* "vbi", "csi" or "tbi" */
+    plan_block_t *blocks;   /* sorted, every block a mark points into */
+    int n_blocks;
+} chunk_plan_t;
+
+static void plan_destroy(chunk_plan_t *plan) {
+    for (int i = 0; i < plan->n; i++) {
+        plan_contig_t *c = &plan->ctg[i];
+        free(c->name);
+        free(c->pos);
+        free(c->voff);
+        free(c->nrec);
+    }
+    free(plan->ctg);
+    free(plan->blocks);
+    memset(plan, 0, sizeof(chunk_plan_t));
+}
+
+static plan_contig_t *plan_add_contig(chunk_plan_t *plan, const char *name, int64_t len) {
+    if (plan->n == plan->m) {
+        int m = plan->m ? plan->m * 2 : 32;
+        plan_contig_t *ctg = realloc(plan->ctg, m * sizeof(plan_contig_t));
+        if (!ctg) return NULL;
+        plan->ctg = ctg;
+        plan->m = m;
+    }
+    plan_contig_t *c = &plan->ctg[plan->n];
+    memset(c, 0, sizeof(plan_contig_t));
+    c->name = strdup(name);
+    if (!c->name) return NULL;
+    c->len = len;
+    c->n_records = -1;
+    plan->n++;
+    return c;
+}
+
+static int contig_add_mark(plan_contig_t *c, int64_t pos, uint64_t voff, int64_t nrec, int with_nrec) {
+    if (c->n == c->m) {
+        int m = c->m ? c->m * 2 : 64;
+        int64_t *p = realloc(c->pos, m * sizeof(int64_t));
+        if (!p) return -1;
+        c->pos = p;
+        uint64_t *v = realloc(c->voff, m * sizeof(uint64_t));
+        if (!v) return -1;
+        c->voff = v;
+        if (with_nrec) {
+            int64_t *r = realloc(c->nrec, m * sizeof(int64_t));
+            if (!r) return -1;
+            c->nrec = r;
+        }
+        c->m = m;
+    }
+    c->pos[c->n] = pos;
+    c->voff[c->n] = voff;
+    if (with_nrec) c->nrec[c->n] = nrec;
+    c->n++;
+    return 0;
+}
+
+static int64_t header_contig_length(const bcf_hdr_t *hdr, const char *name) {
+    int rid = bcf_hdr_name2id(hdr, name);
+    if (rid < 0 || !hdr->id[BCF_DT_CTG][rid].val) return 0;
+    return (int64_t)hdr->id[BCF_DT_CTG][rid].val->info[0];
+}
+
+static int cmp_block(const void *a, const void *b) {
+    uint64_t x = ((const plan_block_t *)a)->coff, y = ((const plan_block_t *)b)->coff;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Size of every block a mark points into, from its BGZF header (BSIZE)
+ * and footer (ISIZE), so offsets inside a block can be interpolated.
+ * Blocks that cannot be read (plain files, remote hiccups) count their
+ * uncompressed offset as bytes.
+ */
+static int plan_collect_blocks(chunk_plan_t *plan, const char *fn) {
+    size_t n = 0;
+    for (int i = 0; i < plan->n; i++) n += plan->ctg[i].n + 1;
+    plan->blocks = malloc((n ? n : 1) * sizeof(plan_block_t));
+    if (!plan->blocks) return -1;
+    n = 0;
+    for (int i = 0; i < plan->n; i++) {
+        plan_contig_t *c = &plan->ctg[i];
+        for (int j = 0; j < c->n; j++) plan->blocks[n++].coff = c->voff[j] >> 16;
+        plan->blocks[n++].coff = c->end_voff >> 16;
+    }
+    qsort(plan->blocks, n, sizeof(plan_block_t), cmp_block);
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (k == 0 || plan->blocks[i].coff != plan->blocks[k - 1].coff) plan->blocks[k++] = plan->blocks[i];
+    }
+    plan->n_blocks = (int)k;
+
+    hFILE *fp = hopen(fn, "r");
+    for (size_t i = 0; i < k; i++) {
+        plan_block_t *b = &plan->blocks[i];
+        uint8_t hdr[18], isize[4];
+        b->csize = b->isize = 0;
+        if (!fp || hseek(fp, (off_t)b->coff, SEEK_SET) < 0 || hread(fp, hdr, 18) != 18) continue;
+        if (hdr[0] != 31 || hdr[1] != 139 || hdr[12] != 'B' || hdr[13] != 'C') continue;
+        uint32_t bsize = (uint32_t)(hdr[16] | hdr[17] << 8) + 1;
+        if (hseek(fp, (off_t)(b->coff + bsize - 4), SEEK_SET) < 0 || hread(fp, isize, 4) != 4) continue;
+        b->csize = bsize;
+        b->isize = (uint32_t)isize[0] | (uint32_t)isize[1] << 8 | (uint32_t)isize[2] << 16 | (uint32_t)isize[3] << 24;
+    }
+    if (fp) hclose_abruptly(fp);
+    return 0;
+}
+
+/* approximate compressed byte offset of a virtual offset */
+static double plan_bytes(const chunk_plan_t *plan, uint64_t voff) {
+    uint64_t coff = voff >> 16;
+    int within = (int)(voff & 0xffff);
+    if (within == 0) return (double)coff;
+    int lo = 0, hi = plan->n_blocks;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (plan->blocks[mid].coff < coff) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == plan->n_blocks || plan->blocks[lo].coff != coff || !plan->blocks[lo].isize) {
+        return (double)coff + within;
+    }
+    const plan_block_t *b = &plan->blocks[lo];
+    double frac = (double)within / b->isize;
+    return (double)coff + b->csize * (frac < 1.0 ? frac : 1.0);
+}
+
+/* start of the data overlapping [pos, end of contig), or `hi` if there is none */
+static uint64_t index_start_offset(const hts_idx_t *idx, int tid, int64_t pos, uint64_t lo, uint64_t hi) {
+    hts_itr_t *itr = hts_itr_query(idx, tid, pos, HTS_POS_MAX, NULL);
+    uint64_t off = hi;
+    if (itr) {
+        for (int i = 0; i < itr->n_off; i++) {
+            if (itr->off[i].u < off) off = itr->off[i].u;
+        }
+        hts_itr_destroy(itr);
+    }
+    if (off < lo) off = lo;
+    if (off > hi) off = hi;
+    return off;
+}
+
+/* add marks strictly inside (p0, p1), in position order */
+static int index_refine(plan_contig_t *c, const hts_idx_t *idx, int tid, double resolution,
+                        int64_t p0, uint64_t o0, int64_t p1, uint64_t o1) {
+    if (p1 - p0 <= CHUNK_MIN_STEP || o0 == o1) return 0;
+    if ((double)((o1 >> 16) - (o0 >> 16)) <= resolution) return 0;
+    int64_t mid = p0 + (p1 - p0) / 2;
+    uint64_t om = index_start_offset(idx, tid, mid, o0, o1);
+    if (index_refine(c, idx, tid, resolution, p0, o0, mid, om) < 0) return -1;
+    if (om > c->voff[c->n - 1] && om < c->end_voff && contig_add_mark(c, mid + 1, om, 0, 0) < 0) return -1;
+    return index_refine(c, idx, tid, resolution, mid, om, p1, o1);
+}
+
+static const char *plan_from_index(chunk_plan_t *plan, const char *fn, int n_chunks) {
+    const char *err = NULL;
+    htsFile *fp = hts_open(fn, "r");
+    if (!fp) return "Cannot open file";
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    tbx_t *tbx = NULL;
+    hts_idx_t *idx = NULL;
+    const char **names = NULL;
+    int nseq = 0;
+    if (!hdr) {
+        err = "Cannot read header";
+        goto done;
+    }
+    if (hts_get_format(fp)->format == bcf) {
+        idx = bcf_index_load3(fn, NULL, HTS_IDX_SILENT_FAIL);
+        if (idx) nseq = hts_idx_nseq(idx);
+    } else {
+        tbx = tbx_index_load3(fn, NULL, HTS_IDX_SILENT_FAIL);
+        if (tbx) {
+            idx = tbx->idx;
+            names = tbx_seqnames(tbx, &nseq);
+        }
+    }
+    if (!idx) {
+        err = "Cannot load a CSI/TBI index";
+        goto done;
+    }
+    plan->index = hts_idx_fmt(idx) == HTS_FMT_TBI ? "tbi" : "csi";
+
+    // one mark at the start of every contig with data, and its extent
+    double total = 0;
+    int *tids = malloc((nseq ? nseq : 1) * sizeof(int));
+    if (!tids) {
+        err = "Out of memory";
+        goto done;
+    }
+    for (int tid = 0; tid < nseq; tid++) {
+        hts_itr_t *itr = hts_itr_query(idx, tid, 0, HTS_POS_MAX, NULL);
+        if (!itr) continue;
+        uint64_t beg = UINT64_MAX, end = 0;
+        for (int i = 0; i < itr->n_off; i++) {
+            if (itr->off[i].u < beg) beg = itr->off[i].u;
+            if (itr->off[i].v > end) end = itr->off[i].v;
+        }
+        hts_itr_destroy(itr);
+        if (beg >= end) continue;
+        const char *name = names ? names[tid] : bcf_hdr_id2name(hdr, tid);
+        plan_contig_t *c = plan_add_contig(plan, name, header_contig_length(hdr, name));
+        if (!c || contig_add_mark(c, 1, beg, 0, 0) < 0) {
+            free(tids);
+            err = "Out of memory";
+            goto done;
+        }
+        c->end_voff = end;
+        uint64_t mapped, unmapped;
+        if (hts_idx_get_stat(idx, tid, &mapped, &unmapped) == 0) c->n_records = (int64_t)(mapped + unmapped);
+        tids[plan->n - 1] = tid;
+        total += (double)((end >> 16) - (beg >> 16));
+    }
+
+    double resolution = total / ((double)n_chunks * CHUNK_RESOLUTION);
+    for (int i = 0; i < plan->n; i++) {
+        plan_contig_t *c = &plan->ctg[i];
+        int64_t span = c->len > 0 ? c->len : CHUNK_DEFAULT_SPAN;
+        if (index_refine(c, idx, tids[i], resolution, 0, c->voff[0], span, c->end_voff) < 0) {
+            err = "Out of memory";
+            break;
+        }
+    }
+    free(tids);
+
+done:
+    free(names);
+    if (tbx) tbx_destroy(tbx);
+    else if (idx) hts_idx_destroy(idx);
+    if (hdr) bcf_hdr_destroy(hdr);
+    hts_close(fp);
+    return err;
+}
+
+/* virtual offset just past the record starting at voff */
+static int record_end_offset(const char *fn, uint64_t voff, uint64_t *end) {
+    int ret = -1;
+    htsFile *fp = hts_open(fn, "r");
+    if (!fp) return -1;
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    bcf1_t *rec = bcf_init();
+    if (hdr && rec && fp->format.compression == bgzf &&
+        bgzf_seek(fp->fp.bgzf, (int64_t)voff, SEEK_SET) == 0 &&
+        bcf_read(fp, hdr, rec) == 0) {
+        *end = (uint64_t)bgzf_tell(fp->fp.bgzf);
+        ret = 0;
+    }
+    if (rec) bcf_destroy(rec);
+    if (hdr) bcf_hdr_destroy(hdr);
+    hts_close(fp);
+    return ret;
+}
+
+static const char *plan_from_vbi(chunk_plan_t *plan, const char *fn, const char *vbi_path) {
+    vbi_index_t *idx = vbi_index_load(vbi_path);
+    if (!idx) return "Cannot load VBI index";
+    const char *err = NULL;
+    bcf_hdr_t *hdr = NULL;
+    htsFile *fp = hts_open(fn, "r");
+    if (fp) {
+        hdr = bcf_hdr_read(fp);
+        hts_close(fp);
+    }
+    char *seen = calloc(idx->n_chroms ? idx->n_chroms : 1, 1);
+    if (!seen) {
+        err = "Out of memory";
+        goto done;
+    }
+    plan->exact = 1;
+    plan->index = "vbi";
+    plan_contig_t *c = NULL;
+    int64_t first = 0;
+    for (int64_t i = 0; i < idx->num_marker; i++) {
+        int cid = idx->chrom_ids[i];
+        if (!c || cid != idx->chrom_ids[i - 1]) {
+            if (seen[cid]) {
+                err = "Records of a contig are not contiguous; is the file sorted?";
+                goto done;
+            }
+            seen[cid] = 1;
+            if (c) {
+                c->end_voff = (uint64_t)idx->offsets[i];
+                c->n_records = i - first;
+            }
+            const char *name = idx->chrom_names[cid];
+            c = plan_add_contig(plan, name, hdr ? header_contig_length(hdr, name) : 0);
+            if (!c) {
+                err = "Out of memory";
+                goto done;
+            }
+            first = i;
+        } else if (idx->positions[i] == idx->positions[i - 1]) {
+            continue;
+        }
+        if (contig_add_mark(c, idx->positions[i], (uint64_t)idx->offsets[i], i - first, 1) < 0) {
+            err = "Out of memory";
+            goto done;
+        }
+    }
+    if (c) {
+        int64_t last = idx->num_marker - 1;
+        c->n_records = idx->num_marker - first;
+        if (record_end_offset(fn, (uint64_t)idx->offsets[last], &c->end_voff) < 0) {
+            err = "Cannot read the last record of the file";
+        }
+    }
+
+done:
+    free(seen);
+    if (hdr) bcf_hdr_destroy(hdr);
+    vbi_index_free(idx);
+    return err;
+}
+
+typedef struct {
+    int contig;
+    int a, b;               /* marks [a, b) */
+} plan_chunk_t;
+
+// Plan balanced chunks over the CSI/TBI index of a VCF/BCF, or over a VBI
+// index when vbi_path is given. Returns a column list (chrom, start, end,
+// region, offset, bytes, records) with an "index" attribute.
+SEXP RC_PlanChunks(SEXP path, SEXP n_chunks, SEXP vbi_path) {
+    if (!isString(path) || LENGTH(path) != 1) Rf_error("[CHUNKS] path must be a single string");
+    const char *fn = CHAR(STRING_ELT(path, 0));
+    int k = asInteger(n_chunks);
+    if (k == NA_INTEGER || k < 1) Rf_error("[CHUNKS] n_chunks must be a positive integer");
+    const char *vbi = isNull(vbi_path) ? NULL : CHAR(STRING_ELT(vbi_path, 0));
+
+    chunk_plan_t plan;
+    memset(&plan, 0, sizeof(chunk_plan_t));
+    const char *err = vbi ? plan_from_vbi(&plan, fn, vbi) : plan_from_index(&plan, fn, k);
+    if (!err && plan_collect_blocks(&plan, fn) < 0) err = "Out of memory";
+    if (err) {
+        plan_destroy(&plan);
+        Rf_error("[CHUNKS] %s: %s", err, vbi ? vbi : fn);
+    }
+
+    // chunks per contig in proportion to its share of the bytes
+    double total = 0;
+    int n_out = 0;
+    for (int i = 0; i < plan.n; i++) {
+        plan_contig_t *c = &plan.ctg[i];
+        total += plan_bytes(&plan, c->end_voff) - plan_bytes(&plan, c->voff[0]);
+        n_out += c->n;
+    }
+    plan_chunk_t *chunks = malloc((n_out ? n_out : 1) * sizeof(plan_chunk_t));
+    if (!chunks) {
+        plan_destroy(&plan);
+        Rf_error("[CHUNKS] Out of memory");
+    }
+    double target = total / k;
+    n_out = 0;
+    for (int i = 0; i < plan.n; i++) {
+        plan_contig_t *c = &plan.ctg[i];
+        double b0 = plan_bytes(&plan, c->voff[0]);
+        double bytes = plan_bytes(&plan, c->end_voff) - b0;
+        int nc = target > 0 ? (int)(bytes / target + 0.5) : 1;
+        if (nc < 1) nc = 1;
+        if (nc > c->n) nc = c->n;
+        int a = 0, m = 1;
+        for (int j = 1; j < nc; j++) {
+            double want = b0 + bytes * j / nc;
+            while (m < c->n && plan_bytes(&plan, c->voff[m]) < want) m++;
+            if (m >= c->n) break;
+            chunks[n_out++] = (plan_chunk_t){i, a, m};
+            a = m++;
+        }
+        chunks[n_out++] = (plan_chunk_t){i, a, c->n};
+    }
+
+    SEXP chrom = PROTECT(allocVector(STRSXP, n_out));
+    SEXP start = PROTECT(allocVector(REALSXP, n_out));
+    SEXP end = PROTECT(allocVector(REALSXP, n_out));
+    SEXP region = PROTECT(allocVector(STRSXP, n_out));
+    SEXP offset = PROTECT(allocVector(REALSXP, n_out));
+    SEXP bytes = PROTECT(allocVector(REALSXP, n_out));
+    SEXP records = PROTECT(allocVector(REALSXP, n_out));
+    kstring_t ks = {0, 0, NULL};
+    for (int r = 0; r < n_out; r++) {
+        plan_chunk_t *ch = &chunks[r];
+        plan_contig_t *c = &plan.ctg[ch->contig];
+        int last = ch->b == c->n;
+        int64_t beg = ch->a == 0 ? 1 : c->pos[ch->a];
+        int64_t stop = 0;
+        if (!last) stop = c->pos[ch->b] - 1;
+        else if (c->len > 0) stop = c->len;
+        else if (plan.exact) stop = c->pos[c->n - 1];
+        if (plan.exact && last && stop < c->pos[c->n - 1]) stop = c->pos[c->n - 1];
+
+        double b_beg = plan_bytes(&plan, c->voff[ch->a]);
+        double b_end = plan_bytes(&plan, last ? c->end_voff : c->voff[ch->b]);
+        double b_ctg = plan_bytes(&plan, c->end_voff) - plan_bytes(&plan, c->voff[0]);
+
+        SET_STRING_ELT(chrom, r, mkChar(c->name));
+        REAL(start)[r] = (double)beg;
+        REAL(end)[r] = stop > 0 ? (double)stop : NA_REAL;
+        REAL(offset)[r] = (double)c->voff[ch->a];
+        REAL(bytes)[r] = b_end - b_beg;
+        if (plan.exact) {
+            REAL(records)[r] = (double)((last ? c->n_records : c->nrec[ch->b]) - c->nrec[ch->a]);
+        } else if (c->n_records < 0) {
+            REAL(records)[r] = NA_REAL;
+        } else if (b_ctg > 0) {
+            REAL(records)[r] = (double)c->n_records * (b_end - b_beg) / b_ctg;
+        } else {
+            REAL(records)[r] = (double)c->n_records;
+        }
+
+        ks.l = 0;
+        if (ch->a == 0 && last) kputs(c->name, &ks);
+        else if (stop > 0) ksprintf(&ks, "%s:%" PRId64 "-%" PRId64, c->name, beg, stop);
+        else ksprintf(&ks, "%s:%" PRId64 "-", c->name, beg);
+        SET_STRING_ELT(region, r, mkChar(ks.s));
+    }
+    free(ks.s);
+    free(chunks);
+    const char *index = plan.index;
+    plan_destroy(&plan);
+
+    const char *col_names[] = {"chrom", "start", "end", "region", "offset", "bytes", "records"};
+    SEXP cols[] = {chrom, start, end, region, offset, bytes, records};
+    SEXP res = PROTECT(allocVector(VECSXP, 7));
+    SEXP names = PROTECT(allocVector(STRSXP, 7));
+    for (int i = 0; i < 7; i++) {
+        SET_VECTOR_ELT(res, i, cols[i]);
+        SET_STRING_ELT(names, i, mkChar(col_names[i]));
+    }
+    setAttrib(res, R_NamesSymbol, names);
+    setAttrib(res, install("index"), mkString(index));
+    UNPROTECT(9);
+    return res;
+}
@@ -0,0 +1,508 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <math.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "htslib/hts.h"
+#include "htslib/kstring.h"
+#include "htslib/vcf.h"
+#include "RBCFLib.h"
+#include "rbcf_dosage.h"
+#include "rbcf_parallel.h"
+#include "vbi_context.h"
+#include "vbi_map.h"
+
+/*
+ * LD clumping of GWAS-VCF summary statistics against a reference panel,
+ * as PLINK --clump: alleles with a p-value under p1 become index variants
+ * in increasing p-value order, each taking the not yet clumped alleles
+ * under p2 within the window whose r^2 with it reaches the threshold.
+ *
+ * Only the alleles under p2 are looked up in the panel. Their genotypes
+ * are kept as bit planes (allele count >= 1, == 2, called) over the panel
+ * samples, so r^2 over the samples called for both is a few popcounts per
+ * 64 samples. Contigs are clumped on separate threads.
+ */
+
+typedef struct {
+    int rid;                /* contig in the GWAS-VCF header */
+    int rec, allele;        /* record number in the GWAS-VCF, ALT allele */
+    int64_t pos;
+    double lp, es;
+    int64_t str;            /* id, ref and alt in strs */
+    int64_t plane;          /* genotype planes, -1 if not in the panel */
+    int clump;              /* index variant of its clump, -1 if none */
+} clump_var_t;
+
+typedef struct {
+    clump_var_t *v;
+    int n, m;
+    kstring_t strs;
+    uint64_t *planes;       /* 3 * nw words per variant found in the panel */
+    int64_t n_planes, m_planes;
+    int nw;
+} clump_vars_t;
+
+static void clump_vars_free(clump_vars_t *cv) {
+    free(cv->v);
+    free(cv->strs.s);
+    free(cv->planes);
+}
+
+static int clump_cmp_pos(const void *a, const void *b) {
+    const clump_var_t *x = (const clump_var_t *)a, *y = (const clump_var_t *)b;
+    if (x->rid != y->rid) return x->rid < y->rid ? -1 : 1;
+    if (x->pos != y->pos) return x->pos < y->pos ? -1 : 1;
+    if (x->rec != y->rec) return x->rec < y->rec ? -1 : 1;
+    return x->allele - y->allele;
+}
+
+/* candidates of the GWAS-VCF: alleles with lp >= lp2 in sample trait; -1 out of memory */
+static int clump_read_gwas(clump_vars_t *cv, rbcf_stream_t *st, int trait, double lp2) {
+    bcf_hdr_t *hdr = st->hdr;
+    int nsmpl = bcf_hdr_nsamples(hdr), m_lp = 0, m_es = 0, ret = 0;
+    float *lp = NULL, *es = NULL;
+    bcf1_t *rec;
+    for (int r = 0; !ret && (rec = rbcf_stream_next(st)); r++) {
+        int n_alt = rec->n_allele - 1;
+        if (n_alt < 1 || bcf_get_format_float(hdr, rec, "LP", &lp, &m_lp) != n_alt * nsmpl) continue;
+        int has_es = bcf_get_format_float(hdr, rec, "ES", &es, &m_es) == n_alt * nsmpl;
+        bcf_unpack(rec, BCF_UN_STR);
+        for (int a = 1; a <= n_alt && !ret; a++) {
+            float v = lp[trait * n_alt + a - 1];
+            if (bcf_float_is_missing(v) || bcf_float_is_vector_end(v) || isnan(v) || v < lp2) continue;
+            if (cv->n == cv->m) {
+                int m = cv->m ? cv->m * 2 : 1024;
+                clump_var_t *nv = realloc(cv->v, m * sizeof(clump_var_t));
+                if (!nv) {
+                    ret = -1;
+                    break;
+                }
+                cv->v = nv;
+                cv->m = m;
+            }
+            clump_var_t *x = &cv->v[cv->n++];
+            x->rid = rec->rid;
+            x->rec = r;
+            x->allele = a;
+            x->pos = rec->pos + 1;
+            x->lp = v;
+            x->es = NA_REAL;
+            if (has_es) {
+                float e = es[trait * n_alt + a - 1];
+                if (!bcf_float_is_missing(e) && !bcf_float_is_vector_end(e)) x->es = e;
+            }
+            x->plane = -1;
+            x->clump = -1;
+            x->str = cv->strs.l;
+            kputs(rec->d.id, &cv->strs);
+            kputc('\0', &cv->strs);
+            kputs(rec->d.allele[0], &cv->strs);
+            kputc('\0', &cv->strs);
+            kputs(rec->d.allele[a], &cv->strs);
+            if (kputc('\0', &cv->strs) < 0) ret = -1;
+        }
+    }
+    free(lp);
+    free(es);
+    if (!ret && st->sr->errnum) ret = -2;
+    if (!ret) qsort(cv->v, cv->n, sizeof(clump_var_t), clump_cmp_pos);
+    return ret;
+}
+
+static const char *clump_str(const clump_vars_t *cv, const clump_var_t *x, int which) {
+    const char *s = cv->strs.s + x->str;
+    while (which--) s += strlen(s) + 1;
+    return s;
+}
+
+/* panel samples and the genotypes of the current record */
+typedef struct {
+    const int *smp;         /* panel sample columns, NULL for all */
+    int n;
+    int32_t *gt;
+    int m_gt, ngt;
+} clump_panel_t;
+
+/* bit planes of the counts of allele j of rec for candidate x; 0 if rec has no GT, -1 out of memory */
+static int clump_add_planes(clump_vars_t *cv, clump_panel_t *p, const bcf_hdr_t *hdr, bcf1_t *rec, int j,
+                            clump_var_t *x) {
+    if (p->ngt == 0) p->ngt = bcf_get_genotypes(hdr, rec, &p->gt, &p->m_gt);
+    if (p->ngt <= 0) return 0;
+    if (cv->n_planes == cv->m_planes) {
+        int64_t m = cv->m_planes ? cv->m_planes * 2 : 256;
+        uint64_t *planes = realloc(cv->planes, (size_t)m * 3 * cv->nw * sizeof(uint64_t));
+        if (!planes) return -1;
+        cv->planes = planes;
+        cv->m_planes = m;
+    }
+    uint64_t *a = cv->planes + (size_t)cv->n_planes * 3 * cv->nw, *b = a + cv->nw, *c = b + cv->nw;
+    memset(a, 0, 3 * cv->nw * sizeof(uint64_t));
+    int ploidy = p->ngt / bcf_hdr_nsamples(hdr);
+    for (int k = 0; k < p->n; k++) {
+        const int32_t *g = p->gt + (size_t)(p->smp ? p->smp[k] : k) * ploidy;
+        int d = 0, n_al = 0, missing = 0;
+        for (int i = 0; i < ploidy && g[i] != bcf_int32_vector_end; i++) {
+            if (bcf_gt_is_missing(g[i])) {
+                missing = 1;
+                break;
+            }
+            d += bcf_gt_allele(g[i]) == j;
+            n_al++;
+        }
+        if (missing || !n_al) continue;
+        uint64_t bit = (uint64_t)1 << (k & 63);
+        c[k >> 6] |= bit;
+        if (d >= 1) a[k >> 6] |= bit;
+        if (d >= 2) b[k >> 6] |= bit;
+    }
+    x->plane = cv->n_planes++;
+    return 1;
+}
+
+/* fills the planes of the candidates at the site of rec; -1 out of memory */
+static int clump_match(clump_vars_t *cv, clump_panel_t *p, const bcf_hdr_t *hdr, bcf1_t *rec, int rid) {
+    int64_t pos = rec->pos + 1;
+    int lo = 0, hi = cv->n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        clump_var_t *x = &cv->v[mid];
+        if (x->rid < rid || (x->rid == rid && x->pos < pos)) lo = mid + 1;
+        else hi = mid;
+    }
+    p->ngt = 0;
+    int unpacked = 0;
+    for (int i = lo; i < cv->n && cv->v[i].rid == rid && cv->v[i].pos == pos; i++) {
+        clump_var_t *x = &cv->v[i];
+        if (x->plane >= 0) continue;
+        if (!unpacked) {
+            bcf_unpack(rec, BCF_UN_STR);
+            unpacked = 1;
+        }
+        const char *ref = clump_str(cv, x, 1), *alt = clump_str(cv, x, 2);
+        // either orientation: r^2 does not depend on it
+        for (int j = 1; j < rec->n_allele; j++) {
+            const char *pr = rec->d.allele[0], *pa = rec->d.allele[j];
+            if ((!strcasecmp(pr, ref) && !strcasecmp(pa, alt)) || (!strcasecmp(pr, alt) && !strcasecmp(pa, ref))) {
+                if (clump_add_planes(cv, p, hdr, rec, j, x) < 0) return -1;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/* r^2 of the allele counts of two variants over the samples called for both */
+static double clump_r2(const clump_vars_t *cv, const clump_var_t *x, const clump_var_t *y) {
+    int nw = cv->nw;
+    const uint64_t *xa = cv->planes + (size_t)x->plane * 3 * nw, *xb = xa + nw, *xc = xb + nw;
+    const uint64_t *ya = cv->planes + (size_t)y->plane * 3 * nw, *yb = ya + nw, *yc = yb + nw;
+    int64_t n = 0, sx = 0, sxx = 0, sy = 0, syy = 0, sxy = 0;
+    for (int w = 0; w < nw; w++) {
+        uint64_t c = xc[w] & yc[w];
+        int xa1 = __builtin_popcountll(xa[w] & c), xb1 = __builtin_popcountll(xb[w] & c);
+        int ya1 = __builtin_popcountll(ya[w] & c), yb1 = __builtin_popcountll(yb[w] & c);
+        n += __builtin_popcountll(c);
+        sx += xa1 + xb1;
+        sxx += xa1 + 3 * xb1;
+        sy += ya1 + yb1;
+        syy += ya1 + 3 * yb1;
+        // (a + b)(a' + b') with the planes of missing calls empty
+        sxy += __builtin_popcountll(xa[w] & ya[w]) + __builtin_popcountll(xa[w] & yb[w]) +
+               __builtin_popcountll(xb[w] & ya[w]) + __builtin_popcountll(xb[w] & yb[w]);
+    }
+    double vx = (double)n * sxx - (double)sx * sx, vy = (double)n * syy - (double)sy * sy;
+    if (vx <= 0 || vy <= 0) return 0;
+    double cxy = (double)n * sxy - (double)sx * sy;
+    return cxy * cxy / (vx * vy);
+}
+
+typedef struct {
+    clump_vars_t *cv;
+    int *contig;            /* first variant of each contig, n_contigs + 1 */
+    double lp1, r2, window;
+    rbcf_tasks_t tasks;
+    int oom;                /* a contig was left unclumped, under tasks.lock */
+} clump_job_t;
+
+typedef struct {
+    double lp;
+    int i;
+} clump_order_t;
+
+static int clump_cmp_lp(const void *a, const void *b) {
+    const clump_order_t *x = (const clump_order_t *)a, *y = (const clump_order_t *)b;
+    if (x->lp != y->lp) return x->lp > y->lp ? -1 : 1;
+    return x->i - y->i;
+}
+
+static void clump_worker(void *arg, int t) {
+    (void)t;
+    clump_job_t *job = (clump_job_t *)arg;
+    clump_vars_t *cv = job->cv;
+    int64_t c;
+    while ((c = rbcf_parallel_next(&job->tasks)) >= 0) {
+        int lo = job->contig[c], hi = job->contig[c + 1], n = 0;
+        clump_order_t *order = malloc((size_t)(hi - lo) * sizeof(clump_order_t));
+        if (!order) {
+            pthread_mutex_lock(&job->tasks.lock);
+            job->oom = 1;
+            pthread_mutex_unlock(&job->tasks.lock);
+            continue;
+        }
+        for (int i = lo; i < hi; i++) {
+            if (cv->v[i].plane >= 0 && cv->v[i].lp >= job->lp1) order[n++] = (clump_order_t){cv->v[i].lp, i};
+        }
+        qsort(order, n, sizeof(clump_order_t), clump_cmp_lp);
+        for (int o = 0; o < n; o++) {
+            clump_var_t *x = &cv->v[order[o].i];
+            if (x->clump >= 0) continue;
+            x->clump = order[o].i;
+            int i = order[o].i;
+            while (i > lo && x->pos - cv->v[i - 1].pos <= job->window) i--;
+            for (; i < hi && cv->v[i].pos - x->pos <= job->window; i++) {
+                clump_var_t *y = &cv->v[i];
+                if (y->clump >= 0 || y->plane < 0) continue;
+                if (clump_r2(cv, x, y) >= job->r2) y->clump = order[o].i;
+            }
+        }
+        free(order);
+    }
+}
+
+/* copies the records of the GWAS-VCF holding an index allele; -1 on error */
+static int clump_write(const char *fn, const char *out_fn, const uint8_t *is_index, int n_rec) {
+    rbcf_stream_t st;
+    if (rbcf_stream_open(&st, fn, NULL, 1)) return -1;
+    char mode[8] = "w";
+    if (vcf_open_mode(mode + 1, out_fn, NULL) < 0) strcpy(mode + 1, "b");
+    htsFile *out = hts_open(out_fn, mode);
+    int ret = out && bcf_hdr_write(out, st.hdr) == 0 ? 0 : -1;
+    bcf1_t *rec;
+    for (int r = 0; !ret && r < n_rec && (rec = rbcf_stream_next(&st)); r++) {
+        if (is_index[r] && bcf_write(out, st.hdr, rec) < 0) ret = -1;
+    }
+    if (!ret && st.sr->errnum) ret = -1;
+    if (out && hts_close(out) < 0) ret = -1;
+    rbcf_stream_close(&st);
+    return ret;
+}
+
+/*
+ * RC_GWASClump(filename, panel, trait, lp1, lp2, r2, window, samples, output, threads)
+ * panel is a VBI context (VCFLoad()) or the path of an indexed VCF/BCF;
+ * samples are the panel samples to use, NULL for all. trait is the
+ * GWAS-VCF sample, NULL for the first. Writes the GWAS-VCF records with an
+ * index allele to output if not NULL. Returns list(variants = list(chrom,
+ * pos, id, ref, alt, lp, es), in_panel, clump), clump being the 1-based
+ * variant of the index of the clump of each allele, NA if unclumped.
+ */
+SEXP RC_GWASClump(SEXP filename, SEXP panel, SEXP trait, SEXP lp1, SEXP lp2, SEXP r2, SEXP window,
+                  SEXP samples, SEXP output, SEXP threads) {
+    const char *fn = CHAR(STRING_ELT(filename, 0));
+    int use_vbi = TYPEOF(panel) == EXTPTRSXP, n_threads = asInteger(threads);
+    if (n_threads == NA_INTEGER || n_threads < 1) n_threads = 1;
+    // an invalid context raises an R error: check it before opening anything
+    bcf_hdr_t *ph = use_vbi ? vbi_context_header(panel) : NULL;
+
+    clump_vars_t cv;
+    memset(&cv, 0, sizeof(clump_vars_t));
+    rbcf_stream_t gw;
+    const char *err = rbcf_stream_open(&gw, fn, NULL, 1);
+    if (err) Rf_error("[Clump] %s: %s", err, fn);
+    int t = 0;
+    if (!isNull(trait)) t = bcf_hdr_id2int(gw.hdr, BCF_DT_SAMPLE, CHAR(STRING_ELT(trait, 0)));
+    if (t < 0 || t >= bcf_hdr_nsamples(gw.hdr)) {
+        rbcf_stream_close(&gw);
+        Rf_error("[Clump] No trait %s in %s", isNull(trait) ? "" : CHAR(STRING_ELT(trait, 0)), fn);
+    }
+    int ret = clump_read_gwas(&cv, &gw, t, asReal(lp2));
+    int n_rec = 0;
+    for (int i = 0; i < cv.n; i++) {
+        if (cv.v[i].rec >= n_rec) n_rec = cv.v[i].rec + 1;
+    }
+    if (ret < 0) {
+        rbcf_stream_close(&gw);
+        clump_vars_free(&cv);
+        Rf_error(ret == -1 ? "[Clump] Out of memory" : "[Clump] Error reading %s", fn);
+    }
+    bcf_hdr_t *gh = gw.hdr;
+
+    // contigs with candidates
+    int n_ctg = 0;
+    int *contig = (int *)R_alloc(cv.n + 1, sizeof(int));
+    for (int i = 0; i < cv.n; i++) {
+        if (!i || cv.v[i].rid != cv.v[i - 1].rid) contig[n_ctg++] = i;
+    }
+    contig[n_ctg] = cv.n;
+
+    // panel genotypes of the candidates
+    rbcf_stream_t st;
+    memset(&st, 0, sizeof(rbcf_stream_t));
+    if (!use_vbi && n_ctg) {
+        kstring_t regs = {0, 0, NULL};
+        for (int c = 0; c < n_ctg; c++) {
+            if (c) kputc(',', &regs);
+            kputs(bcf_hdr_id2name(gh, cv.v[contig[c]].rid), &regs);
+        }
+        err = rbcf_stream_open(&st, CHAR(STRING_ELT(panel, 0)), regs.s, 1);
+        free(regs.s);
+        if (err) {
+            rbcf_stream_close(&gw);
+            clump_vars_free(&cv);
+            Rf_error("[Clump] %s: %s", err, CHAR(STRING_ELT(panel, 0)));
+        }
+        ph = st.hdr;
+    } else if (!use_vbi) {
+        // nothing to look up, but the samples are checked
+        err = rbcf_stream_open(&st, CHAR(STRING_ELT(panel, 0)), NULL, 1);
+        if (err) {
+            rbcf_stream_close(&gw);
+            clump_vars_free(&cv);
+            Rf_error("[Clump] %s: %s", err, CHAR(STRING_ELT(panel, 0)));
+        }
+        ph = st.hdr;
+    }
+    clump_panel_t p;
+    memset(&p, 0, sizeof(clump_panel_t));
+    p.n = bcf_hdr_nsamples(ph);
+    if (!isNull(samples)) {
+        int *smp = (int *)R_alloc(LENGTH(samples) + 1, sizeof(int));
+        for (int k = 0; k < LENGTH(samples); k++) {
+            const char *name = CHAR(STRING_ELT(samples, k));
+            smp[k] = bcf_hdr_id2int(ph, BCF_DT_SAMPLE, name);
+            if (smp[k] < 0) {
+                rbcf_stream_close(&st);
+                rbcf_stream_close(&gw);
+                clump_vars_free(&cv);
+                Rf_error("[Clump] Unknown sample %s", name);
+            }
+        }
+        p.smp = smp;
+        p.n = LENGTH(samples);
+    }
+    if (!p.n) {
+        rbcf_stream_close(&st);
+        rbcf_stream_close(&gw);
+        clump_vars_free(&cv);
+        Rf_error("[Clump] The panel has no samples");
+    }
+    cv.nw = (p.n + 63) / 64;
+    if (use_vbi) {
+        kstring_t reg = {0, 0, NULL};
+        bcf1_t *rec = bcf_init();
+        if (!rec) ret = -1;
+        for (int i = 0; i < cv.n && !ret; i++) {
+            // one query per site
+            if (i && cv.v[i].rid == cv.v[i - 1].rid && cv.v[i].pos == cv.v[i - 1].pos) continue;
+            reg.l = 0;
+            ksprintf(&reg, "%s:%" PRId64 "-%" PRId64, bcf_hdr_id2name(gh, cv.v[i].rid), cv.v[i].pos, cv.v[i].pos);
+            int nhits = 0;
+            int *hits = vbi_context_region(panel, reg.s, &nhits);
+            for (int h = 0; h < nhits && !ret; h++) {
+                if (vbi_context_read(panel, hits[h], rec) < 0) ret = -2;
+                else if (rec->pos + 1 == cv.v[i].pos && clump_match(&cv, &p, ph, rec, cv.v[i].rid) < 0) ret = -1;
+            }
+            free(hits);
+        }
+        if (rec) {
+            vbi_map_release(rec);
+            bcf_destroy(rec);
+        }
+        free(reg.s);
+    } else if (n_ctg) {
+        int n_prid = ph->n[BCF_DT_CTG];
+        int *rid_map = (int *)R_alloc(n_prid + 1, sizeof(int));
+        for (int c = 0; c < n_prid; c++) rid_map[c] = bcf_hdr_name2id(gh, bcf_hdr_id2name(ph, c));
+        bcf1_t *rec;
+        while (!ret && (rec = rbcf_stream_next(&st))) {
+            if (rid_map[rec->rid] >= 0 && clump_match(&cv, &p, ph, rec, rid_map[rec->rid]) < 0) ret = -1;
+        }
+        if (!ret && st.sr->errnum) ret = -2;
+    }
+    free(p.gt);
+    if (ret < 0) {
+        rbcf_stream_close(&st);
+        rbcf_stream_close(&gw);
+        clump_vars_free(&cv);
+        Rf_error(ret == -1 ? "[Clump] Out of memory" : "[Clump] Error reading the panel");
+    }
+
+    clump_job_t job;
+    memset(&job, 0, sizeof(clump_job_t));
+    job.cv = &cv;
+    job.contig = contig;
+    job.lp1 = asReal(lp1);
+    job.r2 = asReal(r2);
+    job.window = asReal(window);
+    if (n_ctg) {
+        rbcf_tasks_init(&job.tasks, n_ctg);
+        rbcf_parallel_run(n_threads < n_ctg ? n_threads : n_ctg, clump_worker, &job);
+        rbcf_tasks_destroy(&job.tasks);
+    }
+    if (job.oom) {
+        rbcf_stream_close(&st);
+        rbcf_stream_close(&gw);
+        clump_vars_free(&cv);
+        Rf_error("[Clump] Out of memory");
+    }
+
+    int n = cv.n;
+    SEXP res = PROTECT(allocVector(VECSXP, 3));
+    SEXP vars = PROTECT(allocVector(VECSXP, 7));
+    SEXP chrom = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 0, chrom);
+    SEXP pos = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(vars, 1, pos);
+    SEXP id = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 2, id);
+    SEXP ref = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 3, ref);
+    SEXP alt = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 4, alt);
+    SEXP lp = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(vars, 5, lp);
+    SEXP es = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(vars, 6, es);
+    SEXP in_panel = allocVector(LGLSXP, n);
+    SET_VECTOR_ELT(res, 1, in_panel);
+    SEXP clump = allocVector(INTSXP, n);
+    SET_VECTOR_ELT(res, 2, clump);
+    uint8_t *is_index = (uint8_t *)R_alloc(n_rec + 1, 1);
+    memset(is_index, 0, n_rec + 1);
+    for (int i = 0; i < n; i++) {
+        const clump_var_t *x = &cv.v[i];
+        SET_STRING_ELT(chrom, i, mkChar(bcf_hdr_id2name(gh, x->rid)));
+        REAL(pos)[i] = (double)x->pos;
+        const char *vid = clump_str(&cv, x, 0);
+        SET_STRING_ELT(id, i, strcmp(vid, ".") ? mkChar(vid) : NA_STRING);
+        SET_STRING_ELT(ref, i, mkChar(clump_str(&cv, x, 1)));
+        SET_STRING_ELT(alt, i, mkChar(clump_str(&cv, x, 2)));
+        REAL(lp)[i] = x->lp;
+        REAL(es)[i] = x->es;
+        LOGICAL(in_panel)[i] = x->plane >= 0;
+        INTEGER(clump)[i] = x->clump >= 0 ? x->clump + 1 : NA_INTEGER;
+        if (x->clump == i) is_index[x->rec] = 1;
+    }
+    const char *vnames[] = {"chrom", "pos", "id", "ref", "alt", "lp", "es"};
+    SEXP nms = PROTECT(allocVector(STRSXP, 7));
+    for (int c = 0; c < 7; c++) SET_STRING_ELT(nms, c, mkChar(vnames[c]));
+    setAttrib(vars, R_NamesSymbol, nms);
+    SET_VECTOR_ELT(res, 0, vars);
+    const char *rnames[] = {"variants", "in_panel", "clump"};
+    SEXP rn = PROTECT(allocVector(STRSXP, 3));
+    for (int c = 0; c < 3; c++) SET_STRING_ELT(rn, c, mkChar(rnames[c]));
+    setAttrib(res, R_NamesSymbol, rn);
+    rbcf_stream_close(&st);
+    rbcf_stream_close(&gw);
+    clump_vars_free(&cv);
+
+    if (!isNull(output) && clump_write(fn, CHAR(STRING_ELT(output, 0)), is_index, n_rec) < 0) {
+        Rf_error("[Clump] Error writing %s", CHAR(STRING_ELT(output, 0)));
+    }
+    UNPROTECT(4);
+    return res;
+}
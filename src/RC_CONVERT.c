@@ -0,0 +1,326 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "htslib/kstring.h"
+#include "htslib/kseq.h"
+#include "htslib/thread_pool.h"
+#include "RBCFLib.h"
+#include "vbi_index_capi.h"
+
+/*
+ * Parallel VCF -> BCF conversion.
+ *
+ * The text is split at line boundaries into batches (the input BGZF is
+ * inflated by the shared thread pool). Batches are parsed and encoded by
+ * vcf_parse on pool workers, collected back in input order and written by
+ * the calling thread; BGZF deflate and the CSI index (bcf_idx_init) run
+ * on the same pool while records are written, so no second pass is needed.
+ *
+ * vcf_parse adds undeclared contigs/tags to the header it is given, so
+ * every batch in flight gets its own copy of the header. A batch whose
+ * copy grew is parsed again serially against the main header, which
+ * reproduces the warnings and behaviour of a single-threaded conversion.
+ */
+
+#define CONV_BATCH_LINES 1024
+#define CONV_BATCH_BYTES (4 * 1024 * 1024)
+
+typedef struct conv_batch_t {
+    kstring_t text;      /* concatenated lines */
+    kstring_t tmp;       /* vcf_parse tokenizes in place, so it gets a copy */
+    size_t *offs;        /* start of each line in text */
+    size_t *lens;
+    bcf1_t **recs;
+    int n, m;
+    int64_t first_line;  /* 1-based line number of the first record */
+    bcf_hdr_t *hdr;      /* private header copy used by the worker */
+    int failed;          /* index of the first line vcf_parse rejected, or -1 */
+    int hdr_grew;
+    struct conv_batch_t *next;
+} conv_batch_t;
+
+static int hdr_size(const bcf_hdr_t *h) {
+    return h->n[BCF_DT_ID] + h->n[BCF_DT_CTG] + h->n[BCF_DT_SAMPLE];
+}
+
+static int batch_add_line(conv_batch_t *b, const kstring_t *line) {
+    if (b->n == b->m) {
+        int m = b->m ? b->m * 2 : CONV_BATCH_LINES;
+        size_t *offs = realloc(b->offs, m * sizeof(size_t));
+        if (!offs) return -1;
+        b->offs = offs;
+        size_t *lens = realloc(b->lens, m * sizeof(size_t));
+        if (!lens) return -1;
+        b->lens = lens;
+        bcf1_t **recs = realloc(b->recs, m * sizeof(bcf1_t *));
+        if (!recs) return -1;
+        b->recs = recs;
+        for (int i = b->m; i < m; i++) b->recs[i] = NULL;
+        b->m = m;
+    }
+    if (!b->recs[b->n] && !(b->recs[b->n] = bcf_init1())) return -1;
+    b->offs[b->n] = b->text.l;
+    b->lens[b->n] = line->l;
+    if (kputsn(line->s, line->l, &b->text) < 0) return -1;
+    b->n++;
+    return 0;
+}
+
+static int batch_parse(conv_batch_t *b, bcf_hdr_t *hdr) {
+    for (int i = 0; i < b->n; i++) {
+        b->tmp.l = 0;
+        if (kputsn(b->text.s + b->offs[i], b->lens[i], &b->tmp) < 0) return i;
+        if (vcf_parse(&b->tmp, hdr, b->recs[i]) < 0) return i;
+    }
+    return -1;
+}
+
+static void *conv_parse_job(void *arg) {
+    conv_batch_t *b = (conv_batch_t *)arg;
+    int before = hdr_size(b->hdr);
+    b->failed = batch_parse(b, b->hdr);
+    b->hdr_grew = hdr_size(b->hdr) != before;
+    return b;
+}
+
+static void batch_free(conv_batch_t *b) {
+    for (int i = 0; i < b->m; i++)
+        if (b->recs[i]) bcf_destroy1(b->recs[i]);
+    if (b->hdr) bcf_hdr_destroy(b->hdr);
+    free(b->recs);
+    free(b->offs);
+    free(b->lens);
+    free(b->text.s);
+    free(b->tmp.s);
+    free(b);
+}
+
+typedef struct {
+    htsFile *in, *out;
+    bcf_hdr_t *hdr;
+    conv_batch_t *free_list;
+    kstring_t line;
+    int threaded;
+    int64_t n_lines, n_records;
+    const char *err;
+    int64_t err_line;
+} conv_ctx_t;
+
+static conv_batch_t *conv_get_batch(conv_ctx_t *ctx) {
+    conv_batch_t *b = ctx->free_list;
+    if (b) {
+        ctx->free_list = b->next;
+    } else {
+        b = calloc(1, sizeof(conv_batch_t));
+        if (!b) return NULL;
+    }
+    if (ctx->threaded && !b->hdr && !(b->hdr = bcf_hdr_dup(ctx->hdr))) {
+        batch_free(b);
+        return NULL;
+    }
+    b->n = 0;
+    b->text.l = 0;
+    b->failed = -1;
+    b->hdr_grew = 0;
+    b->next = NULL;
+    return b;
+}
+
+static void conv_put_batch(conv_ctx_t *ctx, conv_batch_t *b) {
+    b->next = ctx->free_list;
+    ctx->free_list = b;
+}
+
+/* fill a batch from the input; returns number of lines, -1 on error */
+static int conv_read_batch(conv_ctx_t *ctx, conv_batch_t *b) {
+    b->first_line = ctx->n_lines + 1;
+    int ret = 0;
+    while (b->n < CONV_BATCH_LINES && b->text.l < CONV_BATCH_BYTES &&
+           (ret = hts_getline(ctx->in, KS_SEP_LINE, &ctx->line)) >= 0) {
+        ctx->n_lines++;
+        if (ctx->line.l == 0) continue;
+        if (batch_add_line(b, &ctx->line) < 0) return -1;
+    }
+    if (b->n < CONV_BATCH_LINES && b->text.l < CONV_BATCH_BYTES && ret < -1) return -1;
+    return b->n;
+}
+
+/* write a parsed batch in order; returns 0 on success */
+static int conv_write_batch(conv_ctx_t *ctx, conv_batch_t *b) {
+    if (b->hdr_grew) {
+        // the copy is stale now: redo the batch against the shared header
+        bcf_hdr_destroy(b->hdr);
+        b->hdr = NULL;
+        b->failed = batch_parse(b, ctx->hdr);
+    }
+    int n = b->failed >= 0 ? b->failed : b->n;
+    for (int i = 0; i < n; i++) {
+        if (bcf_write1(ctx->out, ctx->hdr, b->recs[i]) != 0) {
+            ctx->err = "failed to write record";
+            ctx->err_line = b->first_line + i;
+            return -1;
+        }
+        ctx->n_records++;
+    }
+    if (b->failed >= 0) {
+        ctx->err = "could not parse VCF line";
+        ctx->err_line = b->first_line + b->failed;
+        return -1;
+    }
+    return 0;
+}
+
+/* collect the batches still in flight after an error */
+static void conv_discard(conv_ctx_t *ctx, hts_tpool_process *q) {
+    hts_tpool_result *r;
+    hts_tpool_process_flush(q);
+    while ((r = hts_tpool_next_result(q)) != NULL) {
+        conv_put_batch(ctx, (conv_batch_t *)hts_tpool_result_data(r));
+        hts_tpool_delete_result(r, 0);
+    }
+}
+
+static int conv_drain(conv_ctx_t *ctx, hts_tpool_process *q, int wait) {
+    hts_tpool_result *r;
+    while ((r = wait ? hts_tpool_next_result_wait(q) : hts_tpool_next_result(q)) != NULL) {
+        conv_batch_t *b = (conv_batch_t *)hts_tpool_result_data(r);
+        hts_tpool_delete_result(r, 0);
+        int ret = conv_write_batch(ctx, b);
+        conv_put_batch(ctx, b);
+        if (ret < 0) return -1;
+        if (wait) break;
+    }
+    return 0;
+}
+
+/*
+ * RC_VcfToBcf(input, output, threads, index)
+ * Returns the number of records written.
+ */
+SEXP RC_VcfToBcf(SEXP input, SEXP output, SEXP threads, SEXP index) {
+    const char *in_path = CHAR(STRING_ELT(input, 0));
+    const char *out_path = CHAR(STRING_ELT(output, 0));
+    int n_threads = asInteger(threads);
+    int do_index = asLogical(index);
+    if (n_threads < 1 || n_threads == NA_INTEGER) n_threads = 1;
+
+    conv_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.in = hts_open(in_path, "r");
+    if (!ctx.in) error("Failed to open input file: %s", in_path);
+    if (ctx.in->format.format != vcf) {
+        hts_close(ctx.in);
+        error("%s is not a VCF file", in_path);
+    }
+    ctx.hdr = bcf_hdr_read(ctx.in);
+    if (!ctx.hdr) {
+        hts_close(ctx.in);
+        error("Failed to read the header of %s", in_path);
+    }
+    ctx.out = hts_open(out_path, "wb");
+    if (!ctx.out) {
+        bcf_hdr_destroy(ctx.hdr);
+        hts_close(ctx.in);
+        error("Failed to open output file: %s", out_path);
+    }
+
+    char *fnidx = NULL;
+    if (do_index) {
+        size_t plen = strlen(out_path);
+        fnidx = R_alloc(plen + 5, sizeof(char));
+        memcpy(fnidx, out_path, plen);
+        memcpy(fnidx + plen, ".csi", 5);
+    }
+
+    htsThreadPool tpool = {NULL, 0};
+    hts_tpool_process *q = NULL;
+    if (n_threads > 1) {
+        tpool.pool = hts_tpool_init(n_threads);
+        if (tpool.pool) q = hts_tpool_process_init(tpool.pool, n_threads * 2, 0);
+        if (q) {
+            ctx.threaded = 1;
+            hts_set_opt(ctx.in, HTS_OPT_THREAD_POOL, &tpool);
+            hts_set_opt(ctx.out, HTS_OPT_THREAD_POOL, &tpool);
+        }
+    }
+
+    int ret = 0;
+    if (bcf_hdr_write(ctx.out, ctx.hdr) != 0) {
+        ctx.err = "failed to write header";
+        ret = -1;
+    } else if (do_index && bcf_idx_init(ctx.out, ctx.hdr, 14, fnidx) < 0) {
+        ctx.err = "failed to initialise the index";
+        ret = -1;
+    }
+
+    int64_t n_batches = 0;
+    while (ret == 0) {
+        conv_batch_t *b = conv_get_batch(&ctx);
+        if (!b) { ctx.err = "out of memory"; ret = -1; break; }
+        int n = conv_read_batch(&ctx, b);
+        if (n <= 0) {
+            conv_put_batch(&ctx, b);
+            if (n < 0) { ctx.err = "failed to read input"; ret = -1; }
+            break;
+        }
+        if (q) {
+            // keep the writer going while the input queue is full
+            while (hts_tpool_dispatch2(tpool.pool, q, conv_parse_job, b, 1) < 0) {
+                if (errno != EAGAIN || conv_drain(&ctx, q, 1) < 0) { ret = -1; break; }
+            }
+            if (ret == 0 && conv_drain(&ctx, q, 0) < 0) ret = -1;
+        } else {
+            b->failed = batch_parse(b, ctx.hdr);
+            if (conv_write_batch(&ctx, b) < 0) ret = -1;
+            conv_put_batch(&ctx, b);
+        }
+        if (ret == 0 && (++n_batches & 15) == 0 && check_interrupt()) {
+            ctx.err = "interrupted";
+            ret = -1;
+        }
+    }
+    if (q) {
+        if (ret == 0) {
+            hts_tpool_process_flush(q);
+            if (conv_drain(&ctx, q, 0) < 0) ret = -1;
+        }
+        if (ret != 0) conv_discard(&ctx, q);
+        hts_tpool_process_destroy(q);
+    }
+
+    if (ret == 0 && do_index && bcf_idx_save(ctx.out) < 0) {
+        ctx.err = "failed to save the index";
+        ret = -1;
+    }
+    if (hts_close(ctx.out) != 0 && ret == 0) {
+        ctx.err = "failed to close output";
+        ret = -1;
+    }
+    hts_close(ctx.in);
+    if (tpool.pool) hts_tpool_destroy(tpool.pool);
+    while (ctx.free_list) {
+        conv_batch_t *b = ctx.free_list;
+        ctx.free_list = b->next;
+        batch_free(b);
+    }
+    bcf_hdr_destroy(ctx.hdr);
+    free(ctx.line.s);
+
+    if (ret != 0) {
+        remove(out_path);
+        if (fnidx) remove(fnidx);
+        if (ctx.err_line > 0)
+            error("VCF to BCF conversion of %s failed at data line %" PRId64 ": %s",
+                  in_path, ctx.err_line, ctx.err);
+        error("VCF to BCF conversion of %s failed: %s", in_path,
+              ctx.err ? ctx.err : "unknown error");
+    }
+
+    return ScalarReal((double)ctx.n_records);
+}
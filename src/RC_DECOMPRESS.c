@@ -0,0 +1,327 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include "htslib/bgzf.h"
+#include "htslib/kstring.h"
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include "RBCFLib.h"
+#include "vbi_index_capi.h"
+
+/*
+ * Native decompression / recompression of reference files.
+ *
+ * Input may be plain, gzip or BGZF. BGZF input is inflated with an htslib
+ * thread pool; plain gzip files of up to DECOMP_LIBDEFLATE_MAX go through
+ * libdeflate when htslib was built with it, and larger ones (or all of them
+ * without it) stream through zlib via BGZF. Output is either
+ * plain or BGZF (multi-threaded deflate, .gzi built on the fly), and the
+ * .fai can be produced while the bytes stream past instead of a second pass.
+ */
+
+#define DECOMP_BUFSIZE (4 * 1024 * 1024)
+/* larger gzip inputs stream through BGZF rather than libdeflate */
+#define DECOMP_LIBDEFLATE_MAX ((size_t)256 * 1024 * 1024)
+
+/* streaming .fai builder, offsets are in uncompressed coordinates */
+typedef struct {
+    kstring_t fai;       /* accumulated .fai text */
+    kstring_t name;      /* name of the current sequence */
+    uint64_t offset;     /* uncompressed bytes seen so far */
+    uint64_t seq_len;
+    uint64_t seq_offset;
+    int64_t line_blen, line_len;
+    int64_t cur_len;     /* bytes of the current line, including '\r' */
+    int last_cr;
+    int in_header, name_done, at_line_start, in_seq;
+    int short_line;      /* a line shorter than line_blen has been seen */
+    int bad;             /* layout faidx would reject; fall back to fai_build */
+} fai_stream_t;
+
+static void fai_stream_flush_seq(fai_stream_t *fs) {
+    if (!fs->in_seq || fs->bad) return;
+    ksprintf(&fs->fai, "%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRId64 "\t%" PRId64 "\n",
+             fs->name.s, fs->seq_len, fs->seq_offset,
+             fs->line_blen, fs->line_len);
+    fs->in_seq = 0;
+}
+
+static void fai_stream_end_line(fai_stream_t *fs) {
+    int64_t len = fs->cur_len + 1;
+    int64_t blen = fs->cur_len - (fs->last_cr ? 1 : 0);
+    if (blen == 0) {
+        // blank lines are only tolerated at the end of a sequence
+        fs->short_line = 1;
+    } else if (fs->line_len == 0) {
+        fs->line_blen = blen;
+        fs->line_len = len;
+    } else if (fs->short_line || blen > fs->line_blen || (blen == fs->line_blen && len != fs->line_len)) {
+        fs->bad = 1;
+    } else if (blen < fs->line_blen) {
+        fs->short_line = 1;
+    }
+    fs->seq_len += blen;
+    fs->cur_len = 0;
+    fs->last_cr = 0;
+}
+
+static void fai_stream_push(fai_stream_t *fs, const char *buf, size_t n) {
+    size_t i = 0;
+    while (i < n && !fs->bad) {
+        if (fs->at_line_start) {
+            fs->at_line_start = 0;
+            if (buf[i] == '>') {
+                // empty records are left to fai_build
+                if (fs->in_seq && fs->line_len == 0) { fs->bad = 1; break; }
+                fai_stream_flush_seq(fs);
+                fs->in_header = 1;
+                fs->name_done = 0;
+                fs->name.l = 0;
+                i++;
+                continue;
+            }
+            if (!fs->in_seq) {
+                // sequence data before any header
+                fs->bad = 1;
+                break;
+            }
+        }
+        const char *nl = memchr(buf + i, '\n', n - i);
+        size_t end = nl ? (size_t)(nl - buf) : n;
+        if (fs->in_header) {
+            if (!fs->name_done) {
+                size_t j = i;
+                while (j < end && buf[j] != ' ' && buf[j] != '\t' && buf[j] != '\r') j++;
+                kputsn(buf + i, j - i, &fs->name);
+                if (j < end) fs->name_done = 1;
+            }
+            if (nl) {
+                if (fs->name.l == 0) fs->bad = 1;
+                fs->in_header = 0;
+                fs->at_line_start = 1;
+                fs->in_seq = 1;
+                fs->seq_offset = fs->offset + end + 1;
+                fs->seq_len = 0;
+                fs->line_blen = fs->line_len = 0;
+                fs->short_line = 0;
+            }
+        } else if (end > i) {
+            fs->cur_len += (int64_t)(end - i);
+            fs->last_cr = buf[end - 1] == '\r';
+        }
+        if (nl && !fs->in_header && !fs->at_line_start) {
+            fai_stream_end_line(fs);
+            fs->at_line_start = 1;
+        }
+        i = nl ? end + 1 : n;
+    }
+    fs->offset += n;
+}
+
+static int fai_stream_finish(fai_stream_t *fs, const char *fai_path) {
+    if (!fs->at_line_start && fs->cur_len > 0) fai_stream_end_line(fs);
+    if (fs->in_header || (fs->in_seq && fs->line_len == 0)) fs->bad = 1;
+    if (fs->bad) return -1;
+    fai_stream_flush_seq(fs);
+    FILE *fp = fopen(fai_path, "wb");
+    if (!fp) return -1;
+    size_t w = fs->fai.l ? fwrite(fs->fai.s, 1, fs->fai.l, fp) : 0;
+    if (fclose(fp) != 0 || w != fs->fai.l) return -1;
+    return 0;
+}
+
+/* output sink: either a plain FILE* or a BGZF writer */
+typedef struct {
+    FILE *plain;
+    BGZF *bgzf;
+    fai_stream_t *fs;
+} decomp_sink_t;
+
+static int sink_write(decomp_sink_t *sink, const void *buf, size_t n) {
+    if (n == 0) return 0;
+    if (sink->fs) fai_stream_push(sink->fs, buf, n);
+    if (sink->bgzf) return bgzf_write(sink->bgzf, buf, n) == (ssize_t)n ? 0 : -1;
+    return fwrite(buf, 1, n, sink->plain) == n ? 0 : -1;
+}
+
+static int decompress_with_bgzf(BGZF *in, decomp_sink_t *sink) {
+    char *buf = malloc(DECOMP_BUFSIZE);
+    if (!buf) return -1;
+    ssize_t n;
+    int ret = 0, blk = 0;
+    while ((n = bgzf_read(in, buf, DECOMP_BUFSIZE)) > 0) {
+        if (sink_write(sink, buf, n) < 0) { ret = -1; break; }
+        if ((++blk & 63) == 0 && check_interrupt()) { ret = -2; break; }
+    }
+    if (n < 0) ret = -1;
+    free(buf);
+    return ret;
+}
+
+#ifdef HAVE_LIBDEFLATE
+/*
+ * libdeflate has no streaming interface, so each gzip member is inflated
+ * in one go. The ISIZE trailer gives the size of the last member modulo
+ * 2^32, which is exact for the usual single-member reference downloads.
+ * Whole file and output are held in memory, so this is only used below
+ * DECOMP_LIBDEFLATE_MAX; returns -3 without having written anything when
+ * the input is larger or the buffers cannot be allocated, for the caller
+ * to stream instead.
+ */
+static int decompress_with_libdeflate(const char *path, decomp_sink_t *sink) {
+    struct stat st;
+    if (stat(path, &st) != 0 || st.st_size < 18) return -1;
+    if ((uint64_t)st.st_size > DECOMP_LIBDEFLATE_MAX) return -3;
+    size_t in_len = (size_t)st.st_size;
+    uint8_t *in = malloc(in_len);
+    if (!in) return -3;
+    FILE *fp = fopen(path, "rb");
+    if (!fp || fread(in, 1, in_len, fp) != in_len) {
+        if (fp) fclose(fp);
+        free(in);
+        return -1;
+    }
+    fclose(fp);
+
+    uint64_t isize = (uint64_t)in[in_len - 4] | ((uint64_t)in[in_len - 3] << 8) |
+                     ((uint64_t)in[in_len - 2] << 16) | ((uint64_t)in[in_len - 1] << 24);
+    size_t out_cap = isize > 0 ? isize : in_len * 4;
+    while (out_cap < in_len) out_cap += (size_t)1 << 32;
+
+    struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+    uint8_t *out = malloc(out_cap);
+    if (!d || !out) {
+        if (d) libdeflate_free_decompressor(d);
+        free(out);
+        free(in);
+        return -3;
+    }
+
+    int ret = 0;
+    size_t consumed = 0;
+    while (consumed < in_len) {
+        // trailing padding after the last member
+        if (in[consumed] != 0x1f) break;
+        size_t in_used = 0, out_used = 0;
+        enum libdeflate_result r = libdeflate_gzip_decompress_ex(
+            d, in + consumed, in_len - consumed, out, out_cap, &in_used, &out_used);
+        if (r == LIBDEFLATE_INSUFFICIENT_SPACE) {
+            uint8_t *tmp = realloc(out, out_cap * 2);
+            // nothing written yet: let the caller stream the file
+            if (!tmp) { ret = consumed == 0 ? -3 : -1; break; }
+            out = tmp;
+            out_cap *= 2;
+            continue;
+        }
+        if (r != LIBDEFLATE_SUCCESS) { ret = -1; break; }
+        if (sink_write(sink, out, out_used) < 0) { ret = -1; break; }
+        consumed += in_used;
+        if (check_interrupt()) { ret = -2; break; }
+    }
+
+    libdeflate_free_decompressor(d);
+    free(out);
+    free(in);
+    return ret;
+}
+#endif
+
+/*
+ * RC_DecompressFile(input, output, threads, bgzip, index)
+ * Returns the output path; writes output.gzi (bgzip) and output.fai (index).
+ */
+SEXP RC_DecompressFile(SEXP input, SEXP output, SEXP threads, SEXP bgzip, SEXP index) {
+    const char *in_path = CHAR(STRING_ELT(input, 0));
+    const char *out_path = CHAR(STRING_ELT(output, 0));
+    int n_threads = asInteger(threads);
+    int do_bgzip = asLogical(bgzip);
+    int do_index = asLogical(index);
+    if (n_threads < 1 || n_threads == NA_INTEGER) n_threads = 1;
+
+    BGZF *in = bgzf_open(in_path, "r");
+    if (!in) error("Failed to open input file: %s", in_path);
+    int compression = bgzf_compression(in);
+    if (compression == bgzf && n_threads > 1) bgzf_mt(in, n_threads, 256);
+
+    decomp_sink_t sink = {NULL, NULL, NULL};
+    fai_stream_t fs;
+    memset(&fs, 0, sizeof(fs));
+    fs.at_line_start = 1;
+    if (do_index) sink.fs = &fs;
+
+    if (do_bgzip) {
+        sink.bgzf = bgzf_open(out_path, "w");
+        if (!sink.bgzf) {
+            bgzf_close(in);
+            error("Failed to open output file: %s", out_path);
+        }
+        if (n_threads > 1) bgzf_mt(sink.bgzf, n_threads, 256);
+        if (bgzf_index_build_init(sink.bgzf) < 0) {
+            bgzf_close(sink.bgzf);
+            bgzf_close(in);
+            error("Failed to initialise .gzi index for %s", out_path);
+        }
+    } else {
+        sink.plain = fopen(out_path, "wb");
+        if (!sink.plain) {
+            bgzf_close(in);
+            error("Failed to open output file: %s", out_path);
+        }
+        setvbuf(sink.plain, NULL, _IOFBF, DECOMP_BUFSIZE);
+    }
+
+    int ret;
+#ifdef HAVE_LIBDEFLATE
+    if (compression == gzip) {
+        bgzf_close(in);
+        in = NULL;
+        ret = decompress_with_libdeflate(in_path, &sink);
+        if (ret == -3) {
+            in = bgzf_open(in_path, "r");
+            ret = in ? decompress_with_bgzf(in, &sink) : -1;
+        }
+    } else
+#endif
+    ret = decompress_with_bgzf(in, &sink);
+    if (in) bgzf_close(in);
+
+    int close_ret = 0;
+    if (sink.bgzf) {
+        if (ret == 0 && bgzf_flush(sink.bgzf) == 0)
+            close_ret = bgzf_index_dump(sink.bgzf, out_path, ".gzi");
+        close_ret |= bgzf_close(sink.bgzf);
+    } else {
+        close_ret = fclose(sink.plain);
+    }
+
+    if (ret != 0 || close_ret != 0) {
+        free(fs.fai.s);
+        free(fs.name.s);
+        remove(out_path);
+        if (ret == -2) error("Decompression of %s interrupted", in_path);
+        error("Failed to decompress %s into %s", in_path, out_path);
+    }
+
+    if (do_index) {
+        size_t plen = strlen(out_path);
+        char *fai_path = R_alloc(plen + 5, sizeof(char));
+        memcpy(fai_path, out_path, plen);
+        memcpy(fai_path + plen, ".fai", 5);
+        // unusual layouts are left to faidx so it reports the real problem
+        if (fai_stream_finish(&fs, fai_path) != 0 && fai_build(out_path) != 0) {
+            free(fs.fai.s);
+            free(fs.name.s);
+            error("Failed to index FASTA file: %s", out_path);
+        }
+    }
+    free(fs.fai.s);
+    free(fs.name.s);
+
+    return mkString(out_path);
+}
@@ -0,0 +1,176 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/vcf.h"
+#include "htslib/kstring.h"
+#include "RBCFLib.h"
+#include "rbcf_dosage.h"
+#include "rbcf_linalg.h"
+
+/*
+ * Genomic relationship matrix G = Z Z^T / m over the m variants passing the
+ * filters, Z being the genotype dosages standardized by 2p and
+ * sqrt(2p(1-p)) (missing genotypes count 0). Variants are packed, one column
+ * per variant, into sample-major float blocks of a few thousand columns
+ * whose Z Z^T is added to the packed lower triangle by the SYRK kernel.
+ */
+
+typedef struct {
+    double *G;              /* lower triangle by rows, (i, j) at i(i+1)/2 + j */
+} grm_acc_t;
+
+/* tiles do not overlap and the kernel runs one block at a time: no lock */
+static void grm_emit(int i0, int i1, int j0, int j1, const double *tile, int ld, void *arg) {
+    grm_acc_t *acc = (grm_acc_t *)arg;
+    for (int i = i0; i < i1; i++) {
+        double *row = acc->G + (size_t)i * (i + 1) / 2;
+        for (int j = j0; j < j1 && j <= i; j++) row[j] += tile[(size_t)(i - i0) * ld + (j - j0)];
+    }
+}
+
+/*
+ * writes prefix.grm.bin, prefix.grm.N.bin and prefix.grm.id, 0 on success.
+ * Missing genotypes are mean-imputed, not skipped, so every pair has the m
+ * variants in .grm.N.bin.
+ */
+static int grm_write(const char *prefix, const double *G, int ns, int64_t m, const bcf_hdr_t *hdr,
+                     const int *smp) {
+    kstring_t fn = {0, 0, NULL};
+    int ret = 0;
+    float *buf = malloc((size_t)ns * sizeof(float) + 1);
+    ksprintf(&fn, "%s.grm.bin", prefix);
+    FILE *fg = fopen(fn.s, "wb");
+    fn.l = 0;
+    ksprintf(&fn, "%s.grm.N.bin", prefix);
+    FILE *fnb = fopen(fn.s, "wb");
+    fn.l = 0;
+    ksprintf(&fn, "%s.grm.id", prefix);
+    FILE *fid = fopen(fn.s, "w");
+    if (!buf || !fg || !fnb || !fid) {
+        ret = -1;
+        goto done;
+    }
+    for (int i = 0; i < ns && !ret; i++) {
+        const double *row = G + (size_t)i * (i + 1) / 2;
+        for (int j = 0; j <= i; j++) buf[j] = (float)(row[j] / m);
+        if (fwrite(buf, sizeof(float), i + 1, fg) != (size_t)i + 1) ret = -1;
+    }
+    for (int j = 0; j < ns; j++) buf[j] = (float)m;
+    for (int i = 0; i < ns && !ret; i++) {
+        if (fwrite(buf, sizeof(float), i + 1, fnb) != (size_t)i + 1) ret = -1;
+    }
+    for (int k = 0; k < ns && !ret; k++) {
+        const char *name = hdr->samples[smp ? smp[k] : k];
+        if (fprintf(fid, "%s\t%s\n", name, name) < 0) ret = -1;
+    }
+done:
+    if (fg && fclose(fg)) ret = -1;
+    if (fnb && fclose(fnb)) ret = -1;
+    if (fid && fclose(fid)) ret = -1;
+    free(buf);
+    free(fn.s);
+    return ret;
+}
+
+/*
+ * RC_GRMCompute(filename, output, region, samples, maf_min, block, threads)
+ * Streams the VCF/BCF (indexed when region is not NULL) and writes the GRM
+ * of the samples (NULL for all) in GCTA's binary layout under the output
+ * prefix. Returns list(samples, n_variants).
+ */
+SEXP RC_GRMCompute(SEXP filename, SEXP output, SEXP region, SEXP samples, SEXP maf_min,
+                   SEXP block, SEXP threads) {
+    const char *fn = CHAR(STRING_ELT(filename, 0));
+    const char *prefix = CHAR(STRING_ELT(output, 0));
+    const char *reg = isNull(region) ? NULL : CHAR(STRING_ELT(region, 0));
+    int n_threads = asInteger(threads), nb = asInteger(block);
+    if (n_threads == NA_INTEGER || n_threads < 1) n_threads = 1;
+    if (nb == NA_INTEGER || nb < 1) Rf_error("[GRM] Invalid block size");
+
+    rbcf_stream_t st;
+    const char *err = rbcf_stream_open(&st, fn, reg, n_threads);
+    if (err) Rf_error("[GRM] %s: %s", err, fn);
+    bcf_hdr_t *hdr = st.hdr;
+
+    rbcf_std_t std;
+    memset(&std, 0, sizeof(rbcf_std_t));
+    std.min_maf = asReal(maf_min);
+    std.scale = RBCF_STD_BINOM;
+    int ns = bcf_hdr_nsamples(hdr);
+    if (!isNull(samples)) {
+        int *smp = (int *)R_alloc(LENGTH(samples) + 1, sizeof(int));
+        for (int k = 0; k < LENGTH(samples); k++) {
+            const char *name = CHAR(STRING_ELT(samples, k));
+            smp[k] = bcf_hdr_id2int(hdr, BCF_DT_SAMPLE, name);
+            if (smp[k] < 0) {
+                rbcf_stream_close(&st);
+                Rf_error("[GRM] Unknown sample %s", name);
+            }
+        }
+        std.smp = smp;
+        std.n = ns = LENGTH(samples);
+    }
+    if (!ns) {
+        rbcf_stream_close(&st);
+        Rf_error("[GRM] No samples");
+    }
+
+    grm_acc_t acc;
+    acc.G = calloc((size_t)ns * (ns + 1) / 2, sizeof(double));
+    float *Z = malloc((size_t)ns * nb * sizeof(float));
+    float *z = malloc((size_t)ns * sizeof(float));
+    if (!acc.G || !Z || !z) {
+        free(acc.G);
+        free(Z);
+        free(z);
+        rbcf_stream_close(&st);
+        Rf_error("[GRM] Cannot allocate the matrices for %d samples", ns);
+    }
+
+    int64_t m = 0;
+    int filled = 0;
+    bcf1_t *rec;
+    while ((rec = rbcf_stream_next(&st))) {
+        double af;
+        if (!rbcf_std_dosages(&std, hdr, rec, z, &af)) continue;
+        for (int k = 0; k < ns; k++) Z[(size_t)k * nb + filled] = z[k];
+        if (++filled == nb) {
+            rbcf_syrk(ns, filled, Z, nb, NULL, n_threads, NULL, grm_emit, &acc);
+            m += filled;
+            filled = 0;
+        }
+    }
+    if (filled) {
+        rbcf_syrk(ns, filled, Z, nb, NULL, n_threads, NULL, grm_emit, &acc);
+        m += filled;
+    }
+    int read_error = st.sr->errnum;
+    rbcf_std_destroy(&std);
+    free(Z);
+    free(z);
+
+    err = read_error ? "Error reading the variants" : !m ? "No variant passed the filters" : NULL;
+    if (!err && grm_write(prefix, acc.G, ns, m, hdr, std.smp) < 0) err = "Cannot write the matrix";
+    free(acc.G);
+    if (err) {
+        rbcf_stream_close(&st);
+        Rf_error("[GRM] %s: %s", err, read_error ? fn : prefix);
+    }
+
+    SEXP res = PROTECT(allocVector(VECSXP, 2));
+    SEXP smp_names = allocVector(STRSXP, ns);
+    SET_VECTOR_ELT(res, 0, smp_names);
+    for (int k = 0; k < ns; k++) {
+        SET_STRING_ELT(smp_names, k, isNull(samples) ? mkChar(hdr->samples[k]) : STRING_ELT(samples, k));
+    }
+    rbcf_stream_close(&st);
+    SET_VECTOR_ELT(res, 1, ScalarReal((double)m));
+    SEXP nms = PROTECT(allocVector(STRSXP, 2));
+    SET_STRING_ELT(nms, 0, mkChar("samples"));
+    SET_STRING_ELT(nms, 1, mkChar("n_variants"));
+    setAttrib(res, R_NamesSymbol, nms);
+    UNPROTECT(2);
+    return res;
+}
@@ -0,0 +1,175 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/hts.h"
+#include "RBCFLib.h"
+#include "rbcf_gtstore.h"
+#include "rbcf_gtsample.h"
+
+/*
+ * R bindings of the sample-major genotype store (see rbcf_gtsample.h).
+ */
+
+static void RC_GTSample_finalizer(SEXP extPtr) {
+    gtsample_t *g = (gtsample_t *)R_ExternalPtrAddr(extPtr);
+    if (!g) return;
+    gtsample_close(g);
+    R_ClearExternalPtr(extPtr);
+}
+
+static gtsample_t *gtsample_from_ptr(SEXP extPtr) {
+    if (TYPEOF(extPtr) != EXTPTRSXP) Rf_error("[GTSample] Not a sample genotype store");
+    gtsample_t *g = (gtsample_t *)R_ExternalPtrAddr(extPtr);
+    if (!g) Rf_error("[GTSample] Store is closed");
+    return g;
+}
+
+SEXP RC_GTSampleBuild(SEXP input, SEXP output, SEXP threads, SEXP compress) {
+    const char *in = CHAR(STRING_ELT(input, 0));
+    const char *out = CHAR(STRING_ELT(output, 0));
+    const char *err = gtsample_build(in, out, asInteger(threads), asLogical(compress) == TRUE);
+    if (err) Rf_error("[GTSample] %s: %s", err, in);
+    return output;
+}
+
+/*
+ * RC_GTSampleOpen(path, source)
+ * Returns list(ptr, samples, variants) with variants = list(chrom, pos,
+ * n_allele, stored), and checks source, as RC_GTStoreOpen.
+ */
+SEXP RC_GTSampleOpen(SEXP path, SEXP source) {
+    const char *fn = CHAR(STRING_ELT(path, 0));
+    gtsample_t *g = gtsample_open(fn);
+    if (!g) Rf_error("[GTSample] Cannot open sample genotype store %s", fn);
+    if (!isNull(source)) {
+        const char *stale = gtstore_source_mismatch(CHAR(STRING_ELT(source, 0)), g->hdr.source_size,
+                                                    g->hdr.source_mtime, g->hdr.source_hash);
+        if (stale) {
+            gtsample_close(g);
+            Rf_error("[GTSample] %s does not match %s: %s", fn, CHAR(STRING_ELT(source, 0)), stale);
+        }
+    }
+
+    SEXP extPtr = PROTECT(R_MakeExternalPtr(g, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(extPtr, (R_CFinalizer_t)RC_GTSample_finalizer, 1);
+
+    SEXP res = gtstore_open_list(extPtr, g->samples, g->hdr.n_samples, g->chroms, g->hdr.n_chroms, g->vars,
+                                 g->hdr.n_variants, sizeof(gtsample_var_t), offsetof(gtsample_var_t, flags),
+                                 GTSAMPLE_F_SKIPPED);
+    UNPROTECT(1);
+    return res;
+}
+
+SEXP RC_GTSampleClose(SEXP extPtr) {
+    RC_GTSample_finalizer(extPtr);
+    return ScalarLogical(1);
+}
+
+/* "0/1", "1|0", "./.", "1" from a pair of allele codes */
+static void format_gt(const uint8_t *c, char *out) {
+    int n = 0;
+    for (int p = 0; p < 2; p++) {
+        int code = c[p] & 0x7f;
+        if (p) {
+            if (code == 1) break;
+            out[n++] = c[1] & 0x80 ? '|' : '/';
+        }
+        if (code < 2) out[n++] = '.';
+        else n += sprintf(out + n, "%d", code - 2);
+    }
+    out[n] = '\0';
+}
+
+/*
+ * RC_GTSampleGenotypes(ptr, samples, region, start, end, dosage)
+ * Genotypes of the samples (1-based indices) for the variants start..end
+ * (1-based, inclusive), restricted to region ("chr", "chr:beg-end") unless
+ * NULL. Returns list(marker, chrom, pos, genotypes) with genotypes a
+ * [variant, sample] matrix of GT strings, or of ALT allele counts if
+ * dosage. NA for records without genotypes in the store, and for the
+ * dosages of genotypes with a missing allele.
+ */
+SEXP RC_GTSampleGenotypes(SEXP extPtr, SEXP sexpSamples, SEXP sexpRegion, SEXP sexpStart,
+                          SEXP sexpEnd, SEXP sexpDosage) {
+    gtsample_t *g = gtsample_from_ptr(extPtr);
+    double start = asReal(sexpStart), end = asReal(sexpEnd);
+    int dosage = asLogical(sexpDosage) == TRUE;
+    if (ISNAN(start) || ISNAN(end) || start < 1 || end > (double)g->hdr.n_variants || end < start - 1) {
+        Rf_error("[GTSample] Variant range %.0f-%.0f out of 1-%" PRId64, start, end, g->hdr.n_variants);
+    }
+    int64_t beg = (int64_t)start - 1, stop = (int64_t)end;
+    if (!isNull(sexpRegion)) {
+        const char *region = CHAR(STRING_ELT(sexpRegion, 0));
+        hts_pos_t from, to;
+        const char *colon = hts_parse_reg64(region, &from, &to);
+        if (!colon) Rf_error("[GTSample] Cannot parse region %s", region);
+        size_t len = (size_t)(colon - region);
+        char *chrom = R_alloc(len + 1, 1);
+        memcpy(chrom, region, len);
+        chrom[len] = '\0';
+        int64_t rbeg, rend;
+        if (gtsample_region(g, chrom, from + 1, to, &rbeg, &rend) < 0) {
+            Rf_error("[GTSample] The store is not sorted, query it by variant range");
+        }
+        if (rbeg > beg) beg = rbeg;
+        if (rend < stop) stop = rend;
+        if (stop < beg) stop = beg;
+    }
+    int nv = (int)(stop - beg), ns = LENGTH(sexpSamples);
+    const int *smp = INTEGER(sexpSamples);
+    for (int k = 0; k < ns; k++) {
+        if (smp[k] == NA_INTEGER || smp[k] < 1 || smp[k] > g->hdr.n_samples) {
+            Rf_error("[GTSample] Invalid sample index %d", smp[k]);
+        }
+    }
+
+    SEXP marker = PROTECT(allocVector(INTSXP, nv));
+    SEXP chrom = PROTECT(allocVector(STRSXP, nv));
+    SEXP pos = PROTECT(allocVector(REALSXP, nv));
+    SEXP gts = PROTECT(allocMatrix(dosage ? INTSXP : STRSXP, nv, ns));
+    for (int r = 0; r < nv; r++) {
+        const gtsample_var_t *v = &g->vars[beg + r];
+        INTEGER(marker)[r] = (int)(beg + r + 1);
+        SET_STRING_ELT(chrom, r, mkChar(g->chroms[v->chrom]));
+        REAL(pos)[r] = (double)v->pos;
+    }
+    uint8_t *codes = (uint8_t *)R_alloc((size_t)2 * nv + 1, 1);
+    char buf[32];
+    for (int k = 0; k < ns; k++) {
+        if (gtsample_codes(g, smp[k] - 1, beg, stop, codes) < 0) {
+            Rf_error("[GTSample] Cannot read sample %s", g->samples[smp[k] - 1]);
+        }
+        for (int r = 0; r < nv; r++) {
+            R_xlen_t o = r + (R_xlen_t)nv * k;
+            const uint8_t *c = codes + 2 * r;
+            int skipped = g->vars[beg + r].flags & GTSAMPLE_F_SKIPPED;
+            if (dosage) {
+                int c1 = c[1] & 0x7f;
+                INTEGER(gts)[o] = skipped || c[0] == 0 || c1 == 0 ? NA_INTEGER
+                                  : (c[0] > 2) + (c1 > 2);
+            } else if (skipped) {
+                SET_STRING_ELT(gts, o, NA_STRING);
+            } else {
+                format_gt(c, buf);
+                SET_STRING_ELT(gts, o, mkChar(buf));
+            }
+        }
+    }
+
+    SEXP res = PROTECT(allocVector(VECSXP, 4));
+    SET_VECTOR_ELT(res, 0, marker);
+    SET_VECTOR_ELT(res, 1, chrom);
+    SET_VECTOR_ELT(res, 2, pos);
+    SET_VECTOR_ELT(res, 3, gts);
+    SEXP nms = PROTECT(allocVector(STRSXP, 4));
+    SET_STRING_ELT(nms, 0, mkChar("marker"));
+    SET_STRING_ELT(nms, 1, mkChar("chrom"));
+    SET_STRING_ELT(nms, 2, mkChar("pos"));
+    SET_STRING_ELT(nms, 3, mkChar("genotypes"));
+    setAttrib(res, R_NamesSymbol, nms);
+    UNPROTECT(6);
+    return res;
+}
@@ -0,0 +1,183 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RBCFLib.h"
+#include "rbcf_gtstore.h"
+
+/*
+ * R bindings of the genotype column store (see rbcf_gtstore.h).
+ */
+
+static void RC_GTStore_finalizer(SEXP extPtr) {
+    gtstore_t *g = (gtstore_t *)R_ExternalPtrAddr(extPtr);
+    if (!g) return;
+    gtstore_close(g);
+    R_ClearExternalPtr(extPtr);
+}
+
+static gtstore_t *gtstore_from_ptr(SEXP extPtr) {
+    if (TYPEOF(extPtr) != EXTPTRSXP) Rf_error("[GTStore] Not a genotype store");
+    gtstore_t *g = (gtstore_t *)R_ExternalPtrAddr(extPtr);
+    if (!g) Rf_error("[GTStore] Store is closed");
+    return g;
+}
+
+SEXP RC_GTStoreBuild(SEXP input, SEXP output, SEXP threads, SEXP compress) {
+    const char *in = CHAR(STRING_ELT(input, 0));
+    const char *out = CHAR(STRING_ELT(output, 0));
+    const char *err = gtstore_build(in, out, asInteger(threads), asLogical(compress) == TRUE);
+    if (err) Rf_error("[GTStore] %s: %s", err, in);
+    return output;
+}
+
+/* the list of RC_GTStoreOpen() and RC_GTSampleOpen(), see RBCFLib.h */
+SEXP gtstore_open_list(SEXP extPtr, char **sample_names, int64_t n_samples, char **chrom_names, int n_chroms,
+                       const void *vars, int64_t n_variants, size_t var_size, size_t flags_offset,
+                       uint32_t skipped) {
+    PROTECT(extPtr);
+    R_xlen_t ns = (R_xlen_t)n_samples, nv = (R_xlen_t)n_variants;
+    SEXP samples = PROTECT(allocVector(STRSXP, ns));
+    for (R_xlen_t s = 0; s < ns; s++) SET_STRING_ELT(samples, s, mkChar(sample_names[s]));
+
+    SEXP chroms = PROTECT(allocVector(STRSXP, n_chroms));
+    for (int c = 0; c < n_chroms; c++) SET_STRING_ELT(chroms, c, mkChar(chrom_names[c]));
+    SEXP chrom = PROTECT(allocVector(STRSXP, nv));
+    SEXP pos = PROTECT(allocVector(REALSXP, nv));
+    SEXP n_allele = PROTECT(allocVector(INTSXP, nv));
+    SEXP stored = PROTECT(allocVector(LGLSXP, nv));
+    for (R_xlen_t i = 0; i < nv; i++) {
+        const char *e = (const char *)vars + i * var_size;
+        const gtstore_loc_t *v = (const gtstore_loc_t *)e;
+        uint32_t flags;
+        memcpy(&flags, e + flags_offset, sizeof(uint32_t));
+        SET_STRING_ELT(chrom, i, STRING_ELT(chroms, v->chrom));
+        REAL(pos)[i] = (double)v->pos;
+        INTEGER(n_allele)[i] = v->n_allele;
+        LOGICAL(stored)[i] = !(flags & skipped);
+    }
+    SEXP variants = PROTECT(allocVector(VECSXP, 4));
+    SET_VECTOR_ELT(variants, 0, chrom);
+    SET_VECTOR_ELT(variants, 1, pos);
+    SET_VECTOR_ELT(variants, 2, n_allele);
+    SET_VECTOR_ELT(variants, 3, stored);
+    SEXP vnames = PROTECT(allocVector(STRSXP, 4));
+    SET_STRING_ELT(vnames, 0, mkChar("chrom"));
+    SET_STRING_ELT(vnames, 1, mkChar("pos"));
+    SET_STRING_ELT(vnames, 2, mkChar("n_allele"));
+    SET_STRING_ELT(vnames, 3, mkChar("stored"));
+    setAttrib(variants, R_NamesSymbol, vnames);
+
+    SEXP res = PROTECT(allocVector(VECSXP, 3));
+    SET_VECTOR_ELT(res, 0, extPtr);
+    SET_VECTOR_ELT(res, 1, samples);
+    SET_VECTOR_ELT(res, 2, variants);
+    SEXP nms = PROTECT(allocVector(STRSXP, 3));
+    SET_STRING_ELT(nms, 0, mkChar("ptr"));
+    SET_STRING_ELT(nms, 1, mkChar("samples"));
+    SET_STRING_ELT(nms, 2, mkChar("variants"));
+    setAttrib(res, R_NamesSymbol, nms);
+    UNPROTECT(11);
+    return res;
+}
+
+/*
+ * RC_GTStoreOpen(path, source)
+ * Returns list(ptr, samples, variants) with variants = list(chrom, pos,
+ * n_allele, stored). Refuses the store if source (NULL: not checked) is
+ * not the file it was built from, as it is now.
+ */
+SEXP RC_GTStoreOpen(SEXP path, SEXP source) {
+    const char *fn = CHAR(STRING_ELT(path, 0));
+    gtstore_t *g = gtstore_open(fn);
+    if (!g) Rf_error("[GTStore] Cannot open genotype store %s", fn);
+    if (!isNull(source)) {
+        const char *stale = gtstore_source_mismatch(CHAR(STRING_ELT(source, 0)), g->hdr.source_size,
+                                                    g->hdr.source_mtime, g->hdr.source_hash);
+        if (stale) {
+            gtstore_close(g);
+            Rf_error("[GTStore] %s does not match %s: %s", fn, CHAR(STRING_ELT(source, 0)), stale);
+        }
+    }
+
+    SEXP extPtr = PROTECT(R_MakeExternalPtr(g, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(extPtr, (R_CFinalizer_t)RC_GTStore_finalizer, 1);
+
+    SEXP res = gtstore_open_list(extPtr, g->samples, g->hdr.n_samples, g->chroms, g->hdr.n_chroms, g->vars,
+                                 g->hdr.n_variants, sizeof(gtstore_var_t), offsetof(gtstore_var_t, flags),
+                                 GTSTORE_F_SKIPPED);
+    UNPROTECT(1);
+    return res;
+}
+
+SEXP RC_GTStoreClose(SEXP extPtr) {
+    RC_GTStore_finalizer(extPtr);
+    return ScalarLogical(1);
+}
+
+/*
+ * RC_GTStoreDosages(ptr, start, end, allele)
+ * Copies of `allele` in every sample for the variants start..end (1-based,
+ * inclusive), as an integer matrix [variant, sample]. NA for missing
+ * genotypes, records without planes and alleles the record does not have.
+ */
+SEXP RC_GTStoreDosages(SEXP extPtr, SEXP sexpStart, SEXP sexpEnd, SEXP sexpAllele) {
+    gtstore_t *g = gtstore_from_ptr(extPtr);
+    double start = asReal(sexpStart), end = asReal(sexpEnd);
+    int allele = asInteger(sexpAllele);
+    if (ISNAN(start) || ISNAN(end) || start < 1 || end > (double)g->hdr.n_variants || end < start - 1) {
+        Rf_error("[GTStore] Variant range %.0f-%.0f out of 1-%" PRId64, start, end, g->hdr.n_variants);
+    }
+    if (allele == NA_INTEGER || allele < 0) Rf_error("[GTStore] Invalid allele");
+    int64_t first = (int64_t)start - 1;
+    int nv = (int)(end - start + 1), ns = (int)g->hdr.n_samples, nw = g->n_words;
+
+    SEXP res = PROTECT(allocMatrix(INTSXP, nv, ns));
+    int *out = INTEGER(res);
+    float *counts = NULL;
+    uint8_t *missing = NULL;
+    if (allele == 0) {
+        // REF needs the ploidy and every ALT plane, see gtstore_allele_counts
+        int max_allele = 1;
+        for (int r = 0; r < nv; r++) {
+            if (g->vars[first + r].n_allele > max_allele) max_allele = g->vars[first + r].n_allele;
+        }
+        counts = (float *)R_alloc((size_t)ns * max_allele + 1, sizeof(float));
+        missing = (uint8_t *)R_alloc((size_t)ns + 1, 1);
+    }
+    for (int r = 0; r < nv; r++) {
+        int64_t i = first + r;
+        const gtstore_var_t *v = &g->vars[i];
+        const uint64_t *p = allele < v->n_allele ? gtstore_planes(g, i) : NULL;
+        if (!p) {
+            if (allele < v->n_allele && !(v->flags & GTSTORE_F_SKIPPED)) {
+                Rf_error("[GTStore] Cannot read variant %" PRId64, i + 1);
+            }
+            for (int s = 0; s < ns; s++) out[r + (R_xlen_t)nv * s] = NA_INTEGER;
+            continue;
+        }
+        if (allele == 0) {
+            gtstore_allele_counts(g, i, NULL, ns, counts, missing);
+            for (int s = 0; s < ns; s++) {
+                out[r + (R_xlen_t)nv * s] = missing[s] ? NA_INTEGER : (int)counts[s];
+            }
+            continue;
+        }
+        const uint64_t *miss = NULL;
+        if (v->flags & GTSTORE_F_MISSING) miss = p, p += nw;
+        if (v->flags & GTSTORE_F_HAPLOID) p += nw;
+        const uint64_t *lo = p + (size_t)2 * (allele - 1) * nw, *hi = lo + nw;
+        for (int w = 0; w < nw; w++) {
+            uint64_t l = lo[w], h = hi[w], m = miss ? miss[w] : 0;
+            int n = ns - w * 64 < 64 ? ns - w * 64 : 64;
+            int *o = out + r + (R_xlen_t)nv * w * 64;
+            for (int b = 0; b < n; b++, o += nv) {
+                *o = (m >> b) & 1 ? NA_INTEGER : (int)((l >> b) & 1) + 2 * (int)((h >> b) & 1);
+            }
+        }
+    }
+    UNPROTECT(1);
+    return res;
+}
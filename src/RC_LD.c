@@ -0,0 +1,339 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "htslib/vcf.h"
+#include "htslib/kstring.h"
+#include "RBCFLib.h"
+#include "rbcf_dosage.h"
+#include "rbcf_linalg.h"
+#include "vbi_context.h"
+#include "vbi_map.h"
+
+/*
+ * LD (correlation) matrices of the variants of a locus: the dosages are
+ * decoded once into unit-norm float rows (rbcf_dosage.h) and multiplied
+ * with the tiled SYRK kernel (rbcf_linalg.h).
+ */
+
+typedef struct {
+    rbcf_std_t std;
+    int ns;
+    float *X;               /* kept rows, ns floats each */
+    int n, m;
+    int *rid, *marker;
+    int64_t *pos;
+    double *af;
+    int64_t *str;           /* offsets of id, ref, alt in strs */
+    kstring_t strs;
+} ld_rows_t;
+
+static void ld_rows_free(ld_rows_t *r) {
+    rbcf_std_destroy(&r->std);
+    free(r->X);
+    free(r->rid);
+    free(r->marker);
+    free(r->pos);
+    free(r->af);
+    free(r->str);
+    free(r->strs.s);
+}
+
+/* 1 if rec was kept, 0 if filtered, -1 out of memory */
+static int ld_rows_push(ld_rows_t *r, const bcf_hdr_t *hdr, bcf1_t *rec, int marker) {
+    if (r->n == r->m) {
+        int m = r->m ? r->m * 2 : 256;
+        float *X = realloc(r->X, (size_t)m * r->ns * sizeof(float) + 1);
+        if (X) r->X = X;
+        int *rid = X ? realloc(r->rid, m * sizeof(int)) : NULL;
+        if (rid) r->rid = rid;
+        int *mk = rid ? realloc(r->marker, m * sizeof(int)) : NULL;
+        if (mk) r->marker = mk;
+        int64_t *pos = mk ? realloc(r->pos, m * sizeof(int64_t)) : NULL;
+        if (pos) r->pos = pos;
+        double *af = pos ? realloc(r->af, m * sizeof(double)) : NULL;
+        if (af) r->af = af;
+        int64_t *str = af ? realloc(r->str, (size_t)m * 3 * sizeof(int64_t)) : NULL;
+        if (!str) return -1;
+        r->str = str;
+        r->m = m;
+    }
+    double af;
+    if (!rbcf_std_dosages(&r->std, hdr, rec, r->X + (size_t)r->n * r->ns, &af)) return 0;
+    bcf_unpack(rec, BCF_UN_STR);
+    int i = r->n++;
+    r->rid[i] = rec->rid;
+    r->pos[i] = rec->pos + 1;
+    r->af[i] = af;
+    r->marker[i] = marker;
+    r->str[3 * i] = r->strs.l;
+    kputs(rec->d.id, &r->strs);
+    kputc('\0', &r->strs);
+    r->str[3 * i + 1] = r->strs.l;
+    kputs(rec->n_allele ? rec->d.allele[0] : ".", &r->strs);
+    kputc('\0', &r->strs);
+    r->str[3 * i + 2] = r->strs.l;
+    for (int a = 1; a < rec->n_allele; a++) {
+        if (a > 1) kputc(',', &r->strs);
+        kputs(rec->d.allele[a], &r->strs);
+    }
+    if (rec->n_allele < 2) kputc('.', &r->strs);
+    return kputc('\0', &r->strs) < 0 ? -1 : 1;
+}
+
+/* banded output: pairs on the same contig at most band bp apart */
+typedef struct {
+    const ld_rows_t *rows;
+    double band;
+    int r2;
+    pthread_mutex_t lock;
+    int *pi, *pj;
+    double *pv;
+    int64_t n, m;
+    int oom;
+} ld_band_t;
+
+static int ld_near(const ld_band_t *b, int i, int j) {
+    const ld_rows_t *r = b->rows;
+    return r->rid[i] == r->rid[j] && fabs((double)(r->pos[i] - r->pos[j])) <= b->band;
+}
+
+static int ld_band_keep(int i0, int i1, int j0, int j1, void *arg) {
+    const ld_band_t *b = (const ld_band_t *)arg;
+    for (int i = i0; i < i1; i++) {
+        for (int j = j0; j < j1 && j <= i; j++) {
+            if (ld_near(b, i, j)) return 1;
+        }
+    }
+    return 0;
+}
+
+static void ld_band_emit(int i0, int i1, int j0, int j1, const double *tile, int ld, void *arg) {
+    ld_band_t *b = (ld_band_t *)arg;
+    pthread_mutex_lock(&b->lock);
+    for (int i = i0; i < i1 && !b->oom; i++) {
+        for (int j = j0; j < j1 && j <= i; j++) {
+            if (!ld_near(b, i, j)) continue;
+            if (b->n == b->m) {
+                int64_t m = b->m ? b->m * 2 : 4096;
+                int *pi = realloc(b->pi, m * sizeof(int));
+                if (pi) b->pi = pi;
+                int *pj = pi ? realloc(b->pj, m * sizeof(int)) : NULL;
+                if (pj) b->pj = pj;
+                double *pv = pj ? realloc(b->pv, m * sizeof(double)) : NULL;
+                if (!pv) {
+                    b->oom = 1;
+                    break;
+                }
+                b->pv = pv;
+                b->m = m;
+            }
+            double v = tile[(size_t)(i - i0) * ld + (j - j0)];
+            b->pi[b->n] = j;
+            b->pj[b->n] = i;
+            b->pv[b->n++] = b->r2 ? v * v : v;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+/*
+ * RC_LDMatrix(src, region, samples, maf_min, r2, band, threads)
+ * src is a VBI context (VCFLoad()) or the path of a VCF/BCF file, which
+ * must be indexed when region is not NULL. samples is NULL for all of
+ * them. Returns list(variants = list(chrom, pos, id, ref, alt, af,
+ * marker), samples, ld) where ld is the dense matrix of r (r^2 if r2),
+ * or with band (bp) list(i, j, r) over the pairs i <= j on the same contig
+ * at most band apart.
+ */
+SEXP RC_LDMatrix(SEXP src, SEXP region, SEXP samples, SEXP maf_min, SEXP r2, SEXP band,
+                 SEXP threads) {
+    int use_vbi = TYPEOF(src) == EXTPTRSXP;
+    const char *reg = isNull(region) ? NULL : CHAR(STRING_ELT(region, 0));
+    int want_r2 = asLogical(r2) == TRUE, n_threads = asInteger(threads);
+    double bp = isNull(band) ? -1 : asReal(band);
+    if (n_threads == NA_INTEGER || n_threads < 1) n_threads = 1;
+    if (use_vbi && !reg) Rf_error("[LD] A region is needed with a VBI context");
+
+    rbcf_stream_t st;
+    memset(&st, 0, sizeof(rbcf_stream_t));
+    bcf_hdr_t *hdr;
+    if (use_vbi) {
+        hdr = vbi_context_header(src);
+    } else {
+        const char *err = rbcf_stream_open(&st, CHAR(STRING_ELT(src, 0)), reg, 1);
+        if (err) Rf_error("[LD] %s: %s", err, CHAR(STRING_ELT(src, 0)));
+        hdr = st.hdr;
+    }
+
+    ld_rows_t rows;
+    memset(&rows, 0, sizeof(ld_rows_t));
+    rows.std.min_maf = asReal(maf_min);
+    rows.std.scale = RBCF_STD_UNIT;
+    rows.ns = bcf_hdr_nsamples(hdr);
+    if (!isNull(samples)) {
+        int *smp = (int *)R_alloc(LENGTH(samples) + 1, sizeof(int));
+        for (int k = 0; k < LENGTH(samples); k++) {
+            const char *name = CHAR(STRING_ELT(samples, k));
+            smp[k] = bcf_hdr_id2int(hdr, BCF_DT_SAMPLE, name);
+            if (smp[k] < 0) {
+                rbcf_stream_close(&st);
+                Rf_error("[LD] Unknown sample %s", name);
+            }
+        }
+        rows.std.smp = smp;
+        rows.std.n = rows.ns = LENGTH(samples);
+    }
+    if (!rows.ns) {
+        rbcf_stream_close(&st);
+        Rf_error("[LD] No samples");
+    }
+
+    // decode the locus once
+    int ret = 0;
+    if (use_vbi) {
+        int nhits = 0;
+        int *hits = vbi_context_region(src, reg, &nhits);
+        bcf1_t *rec = bcf_init();
+        for (int h = 0; h < nhits && rec && ret >= 0; h++) {
+            if (vbi_context_read(src, hits[h], rec) < 0) {
+                ret = -2;
+                break;
+            }
+            ret = ld_rows_push(&rows, hdr, rec, hits[h] + 1);
+        }
+        if (!rec) ret = -1;
+        if (rec) {
+            vbi_map_release(rec);
+            bcf_destroy(rec);
+        }
+        free(hits);
+    } else {
+        bcf1_t *rec;
+        while (ret >= 0 && (rec = rbcf_stream_next(&st))) {
+            ret = ld_rows_push(&rows, hdr, rec, NA_INTEGER);
+        }
+        if (ret >= 0 && st.sr->errnum) ret = -2;
+    }
+    if (ret < 0) {
+        ld_rows_free(&rows);
+        rbcf_stream_close(&st);
+        Rf_error(ret == -1 ? "[LD] Out of memory" : "[LD] Error reading a record");
+    }
+
+    int n = rows.n;
+    SEXP res = PROTECT(allocVector(VECSXP, 3));
+    SEXP vars = PROTECT(allocVector(VECSXP, 7));
+    SEXP chrom = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 0, chrom);
+    SEXP pos = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(vars, 1, pos);
+    SEXP id = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 2, id);
+    SEXP ref = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 3, ref);
+    SEXP alt = allocVector(STRSXP, n);
+    SET_VECTOR_ELT(vars, 4, alt);
+    SEXP af = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(vars, 5, af);
+    SEXP marker = allocVector(INTSXP, n);
+    SET_VECTOR_ELT(vars, 6, marker);
+    for (int i = 0; i < n; i++) {
+        SET_STRING_ELT(chrom, i, mkChar(bcf_hdr_id2name(hdr, rows.rid[i])));
+        REAL(pos)[i] = (double)rows.pos[i];
+        const char *vid = rows.strs.s + rows.str[3 * i];
+        SET_STRING_ELT(id, i, strcmp(vid, ".") ? mkChar(vid) : NA_STRING);
+        SET_STRING_ELT(ref, i, mkChar(rows.strs.s + rows.str[3 * i + 1]));
+        SET_STRING_ELT(alt, i, mkChar(rows.strs.s + rows.str[3 * i + 2]));
+        REAL(af)[i] = rows.af[i];
+        INTEGER(marker)[i] = rows.marker[i];
+    }
+    const char *vnames[] = {"chrom", "pos", "id", "ref", "alt", "af", "marker"};
+    SEXP nms = PROTECT(allocVector(STRSXP, 7));
+    for (int c = 0; c < 7; c++) SET_STRING_ELT(nms, c, mkChar(vnames[c]));
+    setAttrib(vars, R_NamesSymbol, nms);
+    SET_VECTOR_ELT(res, 0, vars);
+    SEXP smp_names = allocVector(STRSXP, rows.ns);
+    SET_VECTOR_ELT(res, 1, smp_names);
+    for (int k = 0; k < rows.ns; k++) {
+        SET_STRING_ELT(smp_names, k, isNull(samples) ? mkChar(hdr->samples[k]) : STRING_ELT(samples, k));
+    }
+    rbcf_stream_close(&st);
+
+    if (bp < 0) {
+        SEXP ld = allocMatrix(REALSXP, n, n);
+        SET_VECTOR_ELT(res, 2, ld);
+        rbcf_syrk(n, rows.ns, rows.X, rows.ns, REAL(ld), n_threads, NULL, NULL, NULL);
+        if (want_r2) {
+            for (R_xlen_t i = 0; i < (R_xlen_t)n * n; i++) REAL(ld)[i] *= REAL(ld)[i];
+        }
+    } else {
+        ld_band_t b;
+        memset(&b, 0, sizeof(ld_band_t));
+        b.rows = &rows;
+        b.band = bp;
+        b.r2 = want_r2;
+        pthread_mutex_init(&b.lock, NULL);
+        rbcf_syrk(n, rows.ns, rows.X, rows.ns, NULL, n_threads, ld_band_keep, ld_band_emit, &b);
+        pthread_mutex_destroy(&b.lock);
+        if (b.oom) {
+            free(b.pi);
+            free(b.pj);
+            free(b.pv);
+            ld_rows_free(&rows);
+            Rf_error("[LD] Out of memory");
+        }
+        // tiles come back in any order
+        SEXP trip = PROTECT(allocVector(VECSXP, 3));
+        SEXP ti = allocVector(INTSXP, b.n);
+        SET_VECTOR_ELT(trip, 0, ti);
+        SEXP tj = allocVector(INTSXP, b.n);
+        SET_VECTOR_ELT(trip, 1, tj);
+        SEXP tv = allocVector(REALSXP, b.n);
+        SET_VECTOR_ELT(trip, 2, tv);
+        int64_t *start = (int64_t *)R_alloc((size_t)n + 1, sizeof(int64_t));
+        memset(start, 0, ((size_t)n + 1) * sizeof(int64_t));
+        for (int64_t p = 0; p < b.n; p++) start[b.pi[p] + 1]++;
+        for (int i = 0; i < n; i++) start[i + 1] += start[i];
+        for (int64_t p = 0; p < b.n; p++) {
+            int64_t o = start[b.pi[p]]++;
+            INTEGER(ti)[o] = b.pi[p] + 1;
+            INTEGER(tj)[o] = b.pj[p] + 1;
+            REAL(tv)[o] = b.pv[p];
+        }
+        // within a row, by column
+        for (int64_t o = 1; o < b.n; o++) {
+            int ci = INTEGER(ti)[o], cj = INTEGER(tj)[o];
+            double cv = REAL(tv)[o];
+            int64_t q = o;
+            while (q > 0 && INTEGER(ti)[q - 1] == ci && INTEGER(tj)[q - 1] > cj) {
+                INTEGER(tj)[q] = INTEGER(tj)[q - 1];
+                REAL(tv)[q] = REAL(tv)[q - 1];
+                q--;
+            }
+            INTEGER(tj)[q] = cj;
+            REAL(tv)[q] = cv;
+        }
+        SEXP tn = PROTECT(allocVector(STRSXP, 3));
+        SET_STRING_ELT(tn, 0, mkChar("i"));
+        SET_STRING_ELT(tn, 1, mkChar("j"));
+        SET_STRING_ELT(tn, 2, mkChar("r"));
+        setAttrib(trip, R_NamesSymbol, tn);
+        SET_VECTOR_ELT(res, 2, trip);
+        UNPROTECT(2);
+        free(b.pi);
+        free(b.pj);
+        free(b.pv);
+    }
+    ld_rows_free(&rows);
+
+    SEXP rn = PROTECT(allocVector(STRSXP, 3));
+    SET_STRING_ELT(rn, 0, mkChar("variants"));
+    SET_STRING_ELT(rn, 1, mkChar("samples"));
+    SET_STRING_ELT(rn, 2, mkChar("ld"));
+    setAttrib(res, R_NamesSymbol, rn);
+    UNPROTECT(4);
+    return res;
+}
@@ -0,0 +1,352 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "htslib/kstring.h"
+#include "RBCFLib.h"
+#include "rbcf_dosage.h"
+#include "rbcf_gtstore.h"
+#include "rbcf_linalg.h"
+
+/*
+ * Passes of the randomized PCA (GenotypePCA() in R/PCA.R). A pass streams
+ * the kept variants, standardized as for the GRM, in blocks Z_b of b rows
+ * (variants) by n columns (samples), and either accumulates
+ * Y += Z_b^T (Z_b Q), for the range finder and power iterations, or keeps
+ * W = Z Q for the final SVD. The n x l matrices live in R, memory here is
+ * one block.
+ */
+
+/* variant source: a VCF/BCF file or a genotype store (rbcf_gtstore.h) */
+typedef struct {
+    rbcf_stream_t st;
+    gtstore_t *g;
+    const int *cols;        /* store columns of the samples, NULL for all */
+    int64_t next;           /* next store variant */
+    float *counts;
+    uint8_t *missing;
+    size_t m_counts;
+    char **reg_chrom;       /* store regions, none for all */
+    hts_pos_t *reg_beg, *reg_end;
+    int n_reg;
+    bcf1_t *rec;            /* current VCF/BCF record */
+    int64_t var;            /* or current store variant */
+} pca_src_t;
+
+static void pca_src_close(pca_src_t *src) {
+    rbcf_stream_close(&src->st);
+    if (src->g) gtstore_close(src->g);
+    for (int r = 0; r < src->n_reg; r++) free(src->reg_chrom[r]);
+    free(src->reg_chrom);
+    free(src->reg_beg);
+    free(src->reg_end);
+    free(src->counts);
+    free(src->missing);
+    memset(src, 0, sizeof(pca_src_t));
+}
+
+/* comma-separated "chr" or "chr:beg-end" regions for a store, -1 if invalid */
+static int pca_src_regions(pca_src_t *src, const char *regions) {
+    kstring_t tmp = {0, 0, NULL};
+    int ret = 0;
+    kputs(regions, &tmp);
+    int n_fields = 0, *offsets = ksplit(&tmp, ',', &n_fields);
+    src->reg_chrom = calloc(n_fields + 1, sizeof(char *));
+    src->reg_beg = malloc((n_fields + 1) * sizeof(hts_pos_t));
+    src->reg_end = malloc((n_fields + 1) * sizeof(hts_pos_t));
+    if (!offsets || !src->reg_chrom || !src->reg_beg || !src->reg_end) ret = -1;
+    for (int r = 0; r < n_fields && !ret; r++) {
+        char *reg = tmp.s + offsets[r];
+        // "chr:beg-" runs to the end of the contig, which hts_parse_reg64 does not take
+        size_t len = strlen(reg);
+        int open_end = len > 1 && reg[len - 1] == '-';
+        if (open_end) reg[len - 1] = '\0';
+        hts_pos_t beg, end;
+        const char *colon = hts_parse_reg64(reg, &beg, &end);
+        if (!colon || !(src->reg_chrom[r] = strndup(reg, colon - reg))) {
+            ret = -1;
+            break;
+        }
+        // "chr:pos" is that position only, as for the synced reader
+        if (*colon && !open_end && !strchr(colon, '-')) end = beg + 1;
+        src->reg_beg[r] = beg;
+        src->reg_end[r] = end;
+        src->n_reg++;
+    }
+    free(offsets);
+    free(tmp.s);
+    return ret;
+}
+
+static int pca_src_in_regions(const pca_src_t *src, const gtstore_var_t *v) {
+    if (!src->n_reg) return 1;
+    for (int r = 0; r < src->n_reg; r++) {
+        if (v->pos - 1 >= src->reg_beg[r] && v->pos - 1 < src->reg_end[r] &&
+            !strcmp(src->g->chroms[v->chrom], src->reg_chrom[r])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* standardized dosages of the next kept variant: 1, 0 at the end, -1 on error */
+static int pca_src_next(pca_src_t *src, rbcf_std_t *std, int ns, float *out, double *af) {
+    if (!src->g) {
+        while ((src->rec = rbcf_stream_next(&src->st))) {
+            if (rbcf_std_dosages(std, src->st.hdr, src->rec, out, af)) return 1;
+        }
+        return src->st.sr->errnum ? -1 : 0;
+    }
+    while (src->next < src->g->hdr.n_variants) {
+        int64_t i = src->next++;
+        const gtstore_var_t *v = &src->g->vars[i];
+        if ((v->flags & GTSTORE_F_SKIPPED) || !pca_src_in_regions(src, v)) continue;
+        size_t need = (size_t)v->n_allele * ns;
+        if (need > src->m_counts) {
+            float *counts = realloc(src->counts, need * sizeof(float));
+            if (!counts) return -1;
+            src->counts = counts;
+            src->m_counts = need;
+        }
+        if (gtstore_allele_counts(src->g, i, src->cols, ns, src->counts, src->missing) < 0) return -1;
+        src->var = i;
+        if (rbcf_std_counts(std, src->counts, v->n_allele, src->missing, ns, out, af)) return 1;
+    }
+    return 0;
+}
+
+/* kept variants, for the loadings */
+typedef struct {
+    int64_t n, m;
+    int64_t *pos;
+    double *af;
+    int64_t *str;           /* offsets of chrom, id, ref, alt in strs */
+    kstring_t strs;
+    double *W;              /* rows of Z Q, l each */
+} pca_vars_t;
+
+static void pca_vars_free(pca_vars_t *vars) {
+    free(vars->pos);
+    free(vars->af);
+    free(vars->str);
+    free(vars->strs.s);
+    free(vars->W);
+}
+
+/* records the current variant of src, with room for its row of W; -1 out of memory */
+static int pca_vars_push(pca_vars_t *vars, const pca_src_t *src, double af, int l) {
+    if (vars->n == vars->m) {
+        int64_t m = vars->m ? vars->m * 2 : 1024;
+        int64_t *pos = realloc(vars->pos, m * sizeof(int64_t));
+        if (pos) vars->pos = pos;
+        double *a = pos ? realloc(vars->af, m * sizeof(double)) : NULL;
+        if (a) vars->af = a;
+        int64_t *str = a ? realloc(vars->str, m * 4 * sizeof(int64_t)) : NULL;
+        if (str) vars->str = str;
+        double *W = str ? realloc(vars->W, (size_t)m * l * sizeof(double)) : NULL;
+        if (!W) return -1;
+        vars->W = W;
+        vars->m = m;
+    }
+    int64_t i = vars->n++;
+    vars->af[i] = af;
+    const char *s[4] = {".", ".", ".", NULL};
+    bcf1_t *rec = src->rec;
+    if (src->g) {
+        const gtstore_var_t *v = &src->g->vars[src->var];
+        vars->pos[i] = v->pos;
+        s[0] = src->g->chroms[v->chrom];
+    } else {
+        bcf_unpack(rec, BCF_UN_STR);
+        vars->pos[i] = rec->pos + 1;
+        s[0] = bcf_hdr_id2name(src->st.hdr, rec->rid);
+        s[1] = rec->d.id;
+        if (rec->n_allele) s[2] = rec->d.allele[0];
+    }
+    for (int f = 0; f < 4; f++) {
+        vars->str[4 * i + f] = vars->strs.l;
+        if (f == 3 && rec && !src->g && rec->n_allele > 1) {
+            for (int a = 1; a < rec->n_allele; a++) {
+                if (a > 1) kputc(',', &vars->strs);
+                kputs(rec->d.allele[a], &vars->strs);
+            }
+        } else {
+            kputs(s[f] ? s[f] : ".", &vars->strs);
+        }
+        if (kputc('\0', &vars->strs) < 0) return -1;
+    }
+    return 0;
+}
+
+static SEXP pca_vars_sexp(const pca_vars_t *vars) {
+    int64_t n = vars->n;
+    SEXP res = PROTECT(allocVector(VECSXP, 6));
+    // chrom, id, ref, alt at their places among chrom, pos, id, ref, alt, af
+    const int slot[4] = {0, 2, 3, 4};
+    SEXP cols[4];
+    for (int f = 0; f < 4; f++) {
+        cols[f] = allocVector(STRSXP, n);
+        SET_VECTOR_ELT(res, slot[f], cols[f]);
+    }
+    SEXP pos = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(res, 1, pos);
+    SEXP af = allocVector(REALSXP, n);
+    SET_VECTOR_ELT(res, 5, af);
+    for (int64_t i = 0; i < n; i++) {
+        for (int f = 0; f < 4; f++) {
+            const char *s = vars->strs.s + vars->str[4 * i + f];
+            SET_STRING_ELT(cols[f], i, f && !strcmp(s, ".") ? NA_STRING : mkChar(s));
+        }
+        REAL(pos)[i] = (double)vars->pos[i];
+        REAL(af)[i] = vars->af[i];
+    }
+    const char *names[] = {"chrom", "pos", "id", "ref", "alt", "af"};
+    SEXP nms = PROTECT(allocVector(STRSXP, 6));
+    for (int f = 0; f < 6; f++) SET_STRING_ELT(nms, f, mkChar(names[f]));
+    setAttrib(res, R_NamesSymbol, nms);
+    UNPROTECT(2);
+    return res;
+}
+
+/*
+ * RC_PCAPass(src, store, region, samples, maf_min, basis, width, keep, block, threads)
+ * src is the path of a VCF/BCF file or, if store, of a genotype store.
+ * basis is the n x l matrix Q, or NULL for a standard normal one of width
+ * columns drawn from R's generator. Returns list(samples, n_variants, Y)
+ * with Y = Z^T Z Q, or if keep list(samples, n_variants, W, variants) with
+ * W = Z Q (m x l).
+ */
+SEXP RC_PCAPass(SEXP src_path, SEXP store, SEXP region, SEXP samples, SEXP maf_min, SEXP basis,
+                SEXP width, SEXP keep, SEXP block, SEXP threads) {
+    const char *fn = CHAR(STRING_ELT(src_path, 0));
+    const char *reg = isNull(region) ? NULL : CHAR(STRING_ELT(region, 0));
+    int use_store = asLogical(store) == TRUE, want_w = asLogical(keep) == TRUE;
+    int n_threads = asInteger(threads), b = asInteger(block);
+    if (n_threads == NA_INTEGER || n_threads < 1) n_threads = 1;
+    if (b == NA_INTEGER || b < 1) Rf_error("[PCA] Invalid block size");
+    int l = isNull(basis) ? asInteger(width) : ncols(basis);
+    if (l == NA_INTEGER || l < 1) Rf_error("[PCA] Invalid number of columns");
+
+    pca_src_t src;
+    memset(&src, 0, sizeof(pca_src_t));
+    int ns;
+    if (use_store) {
+        if (!(src.g = gtstore_open(fn))) Rf_error("[PCA] Cannot open genotype store %s", fn);
+        if (reg && pca_src_regions(&src, reg) < 0) {
+            pca_src_close(&src);
+            Rf_error("[PCA] Cannot parse the regions %s", reg);
+        }
+        ns = (int)src.g->hdr.n_samples;
+    } else {
+        const char *err = rbcf_stream_open(&src.st, fn, reg, n_threads);
+        if (err) Rf_error("[PCA] %s: %s", err, fn);
+        ns = bcf_hdr_nsamples(src.st.hdr);
+    }
+
+    rbcf_std_t std;
+    memset(&std, 0, sizeof(rbcf_std_t));
+    std.min_maf = asReal(maf_min);
+    std.scale = RBCF_STD_BINOM;
+    if (!isNull(samples)) {
+        int *smp = (int *)R_alloc(LENGTH(samples) + 1, sizeof(int));
+        for (int k = 0; k < LENGTH(samples); k++) {
+            const char *name = CHAR(STRING_ELT(samples, k));
+            smp[k] = use_store ? gtstore_sample_index(src.g, name)
+                               : bcf_hdr_id2int(src.st.hdr, BCF_DT_SAMPLE, name);
+            if (smp[k] < 0) {
+                pca_src_close(&src);
+                Rf_error("[PCA] Unknown sample %s", name);
+            }
+        }
+        if (use_store) src.cols = smp;
+        else std.smp = smp;
+        std.n = ns = LENGTH(samples);
+    }
+    if (!ns || (!isNull(basis) && nrows(basis) != ns)) {
+        pca_src_close(&src);
+        Rf_error(ns ? "[PCA] The basis must have one row per sample" : "[PCA] No samples");
+    }
+
+    // the basis in float, as the genotypes
+    float *Q = (float *)R_alloc((size_t)ns * l, sizeof(float));
+    if (isNull(basis)) {
+        GetRNGstate();
+        for (size_t i = 0; i < (size_t)ns * l; i++) Q[i] = (float)norm_rand();
+        PutRNGstate();
+    } else {
+        for (size_t i = 0; i < (size_t)ns * l; i++) Q[i] = (float)REAL(basis)[i];
+    }
+    SEXP Y = R_NilValue;
+    if (!want_w) {
+        Y = PROTECT(allocMatrix(REALSXP, ns, l));
+        memset(REAL(Y), 0, (size_t)ns * l * sizeof(double));
+    }
+
+    pca_vars_t vars;
+    memset(&vars, 0, sizeof(pca_vars_t));
+    float *Z = malloc((size_t)ns * b * sizeof(float));
+    double *Wb = malloc((size_t)b * l * sizeof(double));
+    src.missing = malloc(ns);
+    int64_t m = 0;
+    int ret = Z && Wb && src.missing ? 1 : -1, filled = 0;
+    double *block_af = (double *)R_alloc(b, sizeof(double));
+    while (ret > 0) {
+        ret = pca_src_next(&src, &std, ns, Z + (size_t)filled * ns, &block_af[filled]);
+        if (ret > 0 && want_w) {
+            // metadata now, the W row once the block is multiplied
+            ret = pca_vars_push(&vars, &src, block_af[filled], l) < 0 ? -1 : 1;
+        }
+        if (ret > 0) filled++;
+        if (filled && (filled == b || ret == 0)) {
+            rbcf_gemm_aq(filled, ns, Z, ns, Q, l, Wb, n_threads);
+            if (want_w) {
+                for (int r = 0; r < filled; r++) {
+                    for (int c = 0; c < l; c++) vars.W[(size_t)(m + r) * l + c] = Wb[r + (size_t)filled * c];
+                }
+            } else {
+                rbcf_gemm_atw(filled, ns, Z, ns, Wb, l, REAL(Y), n_threads);
+            }
+            m += filled;
+            filled = 0;
+        }
+    }
+    free(Z);
+    free(Wb);
+    rbcf_std_destroy(&std);
+    if (ret < 0 || !m) {
+        pca_src_close(&src);
+        pca_vars_free(&vars);
+        Rf_error(ret < 0 ? "[PCA] Error reading the variants of %s" : "[PCA] No variant passed the filters in %s", fn);
+    }
+
+    SEXP res = PROTECT(allocVector(VECSXP, want_w ? 4 : 3));
+    SEXP smp_names = allocVector(STRSXP, ns);
+    SET_VECTOR_ELT(res, 0, smp_names);
+    for (int k = 0; k < ns; k++) {
+        if (!isNull(samples)) SET_STRING_ELT(smp_names, k, STRING_ELT(samples, k));
+        else SET_STRING_ELT(smp_names, k, mkChar(use_store ? src.g->samples[k] : src.st.hdr->samples[k]));
+    }
+    pca_src_close(&src);
+    SET_VECTOR_ELT(res, 1, ScalarReal((double)m));
+    if (want_w) {
+        SEXP W = allocMatrix(REALSXP, (int)m, l);
+        SET_VECTOR_ELT(res, 2, W);
+        for (int64_t i = 0; i < m; i++) {
+            for (int c = 0; c < l; c++) REAL(W)[i + (size_t)m * c] = vars.W[(size_t)i * l + c];
+        }
+        SET_VECTOR_ELT(res, 3, pca_vars_sexp(&vars));
+    } else {
+        SET_VECTOR_ELT(res, 2, Y);
+    }
+    pca_vars_free(&vars);
+    SEXP nms = PROTECT(allocVector(STRSXP, want_w ? 4 : 3));
+    SET_STRING_ELT(nms, 0, mkChar("samples"));
+    SET_STRING_ELT(nms, 1, mkChar("n_variants"));
+    SET_STRING_ELT(nms, 2, mkChar(want_w ? "W" : "Y"));
+    if (want_w) SET_STRING_ELT(nms, 3, mkChar("variants"));
+    setAttrib(res, R_NamesSymbol, nms);
+    UNPROTECT(want_w ? 2 : 3);
+    return res;
+}
@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <errno.h>
+#include <math.h>
+#include <pthread.h>
 #include "RBCFLib.h"
 // Global flag to track if SIGPIPE has been handled
 // FIX ME: this is a global state, should be managed
@@ -116,6 +118,183 @@ static void free_argv(char **argv) {
 }
 
 
+/*
+ * Input stage of a pipeline: an R raw vector, character vector (one line per
+ * element) or data frame (TSV with a header line) streamed into the stdin of
+ * the first command by a writer thread. The R objects are resolved to plain
+ * C pointers on the main thread, the writer thread never calls the R API.
+ */
+#define PIPE_INPUT_BUFSIZE (1 << 16)
+
+typedef struct {
+    int type;               // INTSXP, REALSXP, LGLSXP or STRSXP
+    const void *data;       // int*, double* or const char** for strings
+    const char **levels;    // labels of a factor
+    int nlevels;
+} pipe_input_col_t;
+
+typedef struct {
+    int fd;                         // write end of the pipe to the first command
+    const unsigned char *raw;       // raw vector
+    R_xlen_t nraw;
+    const char **lines;             // character vector
+    pipe_input_col_t *cols;         // data frame
+    const char **names;
+    int ncols;
+    R_xlen_t nrows;                 // lines or data frame rows
+    char *buf;
+    size_t nbuf;
+    int err;                        // errno of a failed write, EPIPE if the command stopped reading
+} pipe_input_t;
+
+static const char **pipe_input_strings(SEXP x) {
+    R_xlen_t n = XLENGTH(x);
+    const char **str = (const char **)R_alloc(n ? n : 1, sizeof(*str));
+    for (R_xlen_t i = 0; i < n; i++) {
+        SEXP el = STRING_ELT(x, i);
+        str[i] = el == NA_STRING ? "NA" : CHAR(el);
+    }
+    return str;
+}
+
+// Resolve the input object on the main thread, errors are raised before any fork
+static void pipe_input_init(SEXP input, pipe_input_t *in) {
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+    in->buf = R_alloc(PIPE_INPUT_BUFSIZE, 1);
+    if (TYPEOF(input) == RAWSXP) {
+        in->raw = RAW(input);
+        in->nraw = XLENGTH(input);
+    } else if (TYPEOF(input) == STRSXP) {
+        in->lines = pipe_input_strings(input);
+        in->nrows = XLENGTH(input);
+    } else if (TYPEOF(input) == VECSXP && inherits(input, "data.frame")) {
+        SEXP names = getAttrib(input, R_NamesSymbol);
+        in->ncols = length(input);
+        if (in->ncols == 0) error("The input data frame has no columns");
+        in->names = pipe_input_strings(names);
+        in->nrows = XLENGTH(VECTOR_ELT(input, 0));
+        in->cols = (pipe_input_col_t *)R_alloc(in->ncols, sizeof(*in->cols));
+        for (int j = 0; j < in->ncols; j++) {
+            SEXP col = VECTOR_ELT(input, j);
+            pipe_input_col_t *c = &in->cols[j];
+            memset(c, 0, sizeof(*c));
+            c->type = TYPEOF(col);
+            switch (c->type) {
+                case INTSXP:
+                    c->data = INTEGER(col);
+                    if (isFactor(col)) {
+                        SEXP levels = getAttrib(col, R_LevelsSymbol);
+                        c->levels = pipe_input_strings(levels);
+                        c->nlevels = length(levels);
+                    }
+                    break;
+                case LGLSXP: c->data = LOGICAL(col); break;
+                case REALSXP: c->data = REAL(col); break;
+                case STRSXP: c->data = pipe_input_strings(col); break;
+                default:
+                    error("Unsupported type of the input column '%s': %s",
+                          in->names[j], type2char(c->type));
+            }
+        }
+    } else {
+        error("The input must be a raw vector, a character vector or a data frame");
+    }
+}
+
+static int pipe_input_flush(pipe_input_t *in) {
+    size_t off = 0;
+    while (off < in->nbuf) {
+        ssize_t n = write(in->fd, in->buf + off, in->nbuf - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            in->err = errno;
+            return -1;
+        }
+        off += n;
+    }
+    in->nbuf = 0;
+    return 0;
+}
+
+static int pipe_input_put(pipe_input_t *in, const char *str, size_t len) {
+    while (len > 0) {
+        if (in->nbuf == PIPE_INPUT_BUFSIZE && pipe_input_flush(in) < 0) return -1;
+        size_t n = PIPE_INPUT_BUFSIZE - in->nbuf;
+        if (n > len) n = len;
+        memcpy(in->buf + in->nbuf, str, n);
+        in->nbuf += n;
+        str += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int pipe_input_field(pipe_input_t *in, pipe_input_col_t *c, R_xlen_t i) {
+    char tmp[32];
+    const char *str = tmp;
+    switch (c->type) {
+        case INTSXP: {
+            int v = ((const int *)c->data)[i];
+            if (v == NA_INTEGER) str = "NA";
+            else if (c->levels) str = v >= 1 && v <= c->nlevels ? c->levels[v - 1] : "NA";
+            else snprintf(tmp, sizeof(tmp), "%d", v);
+            break;
+        }
+        case LGLSXP: {
+            int v = ((const int *)c->data)[i];
+            str = v == NA_LOGICAL ? "NA" : (v ? "TRUE" : "FALSE");
+            break;
+        }
+        case REALSXP: {
+            double v = ((const double *)c->data)[i];
+            if (ISNA(v)) str = "NA";
+            else if (ISNAN(v)) str = "NaN";
+            else if (isinf(v)) str = v > 0 ? "Inf" : "-Inf";
+            else snprintf(tmp, sizeof(tmp), "%.15g", v);
+            break;
+        }
+        default: str = ((const char **)c->data)[i];
+    }
+    return pipe_input_put(in, str, strlen(str));
+}
+
+static int pipe_input_write(pipe_input_t *in) {
+    if (in->raw) {
+        for (R_xlen_t off = 0; off < in->nraw; off += PIPE_INPUT_BUFSIZE) {
+            R_xlen_t n = in->nraw - off < PIPE_INPUT_BUFSIZE ? in->nraw - off : PIPE_INPUT_BUFSIZE;
+            if (pipe_input_put(in, (const char *)in->raw + off, n) < 0) return -1;
+        }
+    } else if (in->lines) {
+        for (R_xlen_t i = 0; i < in->nrows; i++) {
+            if (pipe_input_put(in, in->lines[i], strlen(in->lines[i])) < 0) return -1;
+            if (pipe_input_put(in, "\n", 1) < 0) return -1;
+        }
+    } else {
+        for (int j = 0; j < in->ncols; j++) {
+            if (pipe_input_put(in, j ? "\t" : "", j ? 1 : 0) < 0) return -1;
+            if (pipe_input_put(in, in->names[j], strlen(in->names[j])) < 0) return -1;
+        }
+        if (pipe_input_put(in, "\n", 1) < 0) return -1;
+        for (R_xlen_t i = 0; i < in->nrows; i++) {
+            for (int j = 0; j < in->ncols; j++) {
+                if (j && pipe_input_put(in, "\t", 1) < 0) return -1;
+                if (pipe_input_field(in, &in->cols[j], i) < 0) return -1;
+            }
+            if (pipe_input_put(in, "\n", 1) < 0) return -1;
+        }
+    }
+    return pipe_input_flush(in);
+}
+
+// Writer thread: stream the input then close the pipe so that the command sees EOF
+static void *pipe_input_thread(void *arg) {
+    pipe_input_t *in = (pipe_input_t *)arg;
+    pipe_input_write(in);
+    close(in->fd);
+    return NULL;
+}
+
 /**
  * Execute a pipeline of bcftools commands
  * 
@@ -126,6 +305,8 @@ static void free_argv(char **argv) {
  * @param capture_stderr Whether to capture stderr from all commands
  * @param stdout_file File to capture stdout (for last command)
  * @param stderr_file File to capture stderr (for all commands)
+ * @param input Raw vector, character vector or data frame written to the stdin
+ *   of the first command, or NULL
  * 
  * @return Integer vector of exit statuses with 'command' attribute containing combined command
  */
@@ -135,7 +316,8 @@ SEXP RC_bcftools_pipeline(
     SEXP capture_stdout,
     SEXP capture_stderr, 
     SEXP stdout_file,
-    SEXP stderr_file
+    SEXP stderr_file,
+    SEXP input
 ) {
     int num_commands = asInteger(n_commands);
     int pipes[num_commands - 1][2]; // pipes[i] connects command i and i+1
@@ -147,6 +329,15 @@ SEXP RC_bcftools_pipeline(
     int fd_stdout = -1, fd_stderr = -1;
     SEXP res = R_NilValue, cmd = R_NilValue;
     int do_capture_stdout, do_capture_stderr;
+    int has_input = !isNull(input);
+    int input_pipe[2] = {-1, -1};  // stdin of the first command, fed by the writer thread
+    pipe_input_t in = {0};
+    pthread_t input_tid;
+    
+    // Resolve the input before any fork so that errors leave nothing behind
+    if (has_input) {
+        pipe_input_init(input, &in);
+    }
     
     // Setup SIGPIPE handling before any pipe operations
     setup_sigpipe_handling();
@@ -239,6 +430,19 @@ SEXP RC_bcftools_pipeline(
             error("pipe() creation failed");
         }
     }
+    if (has_input && pipe(input_pipe) == -1) {
+        for (int j = 0; j < num_commands - 1; j++) {
+            close(pipes[j][0]);
+            close(pipes[j][1]);
+        }
+        for (int j = 0; j < num_commands; j++) {
+            free_argv(argv_values[j]);
+        }
+        free(argv_values);
+        if (fd_stdout != -1) close(fd_stdout);
+        if (fd_stderr != -1) close(fd_stderr);
+        error("pipe() creation failed for the input");
+    }
     
     // Create child processes for each command
     for (int i = 0; i < num_commands; i++) {
@@ -249,6 +453,10 @@ SEXP RC_bcftools_pipeline(
                 close(pipes[j][0]);
                 close(pipes[j][1]);
             }
+            if (has_input) {
+                close(input_pipe[0]);
+                close(input_pipe[1]);
+            }
             // Kill already created children
             for (int j = 0; j < i; j++) {
                 kill(pids[j], SIGTERM);
@@ -294,7 +502,13 @@ SEXP RC_bcftools_pipeline(
                 }
             }
             
-            // Setup stdin (for all but first command)
+            // Setup stdin (from the input stage for the first command, if any)
+            if (i == 0 && has_input) {
+                if (dup2(input_pipe[0], STDIN_FILENO) == -1) {
+                    perror("dup2 stdin");
+                    raise(SIGKILL);
+                }
+            }
             if (i > 0) {
                 // Take input from previous pipe
                 if (dup2(pipes[i-1][0], STDIN_FILENO) == -1) {
@@ -341,6 +555,11 @@ SEXP RC_bcftools_pipeline(
                     close(pipes[j][1]);
                 }
             }
+            // The write end must be closed for the first command to see EOF
+            if (has_input) {
+                close(input_pipe[0]);
+                close(input_pipe[1]);
+            }
             
             // Additional SIGPIPE protection in child process
             signal(SIGPIPE, SIG_IGN);
@@ -369,12 +588,27 @@ SEXP RC_bcftools_pipeline(
         safe_close_fd(pipes[i][1]);
     }
     
+    // Stream the input while the commands run, on the calling thread
+    // if no writer thread can be started
+    int input_threaded = 0;
+    if (has_input) {
+        safe_close_fd(input_pipe[0]);
+        in.fd = input_pipe[1];
+        input_threaded = pthread_create(&input_tid, NULL, pipe_input_thread, &in) == 0;
+        if (!input_threaded) {
+            pipe_input_thread(&in);
+        }
+    }
+    
     // Wait for all children to finish
     for (int i = 0; i < num_commands; i++) {
         int status;
         waitpid(pids[i], &status, 0);
         statuses[i] = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
     }
+    if (input_threaded) {
+        pthread_join(input_tid, NULL);
+    }
     
     // Now build the command attribute for the result
     // Count total arguments across all commands
@@ -412,6 +646,11 @@ SEXP RC_bcftools_pipeline(
     // Restore original SIGPIPE handling before returning to R
     restore_sigpipe_handling();
     
+    // A command may stop reading early (EPIPE), any other failure is reported
+    if (has_input && in.err && in.err != EPIPE) {
+        warning("Failed to write the input of the pipeline: %s", strerror(in.err));
+    }
+    
     // Create result
     PROTECT(res = allocVector(INTSXP, num_commands));
     for (int i = 0; i < num_commands; i++) {
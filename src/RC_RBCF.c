@@ -33,6 +33,10 @@ THE SOFTWARE.
 #endif
 #include "htslib/tbx.h"
 #include "htslib/kseq.h"
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "bcf_batch.h"
+#include "rbcf_arena.h"
 
 #define VEP_CSQ_KEY "CSQ"
 #define VEP_FORMAT "Format: "
@@ -46,6 +50,19 @@ THE SOFTWARE.
 #define final
 #define null NULL
 
+/**
+ * decode buffers shared by the variant accessors. R calls them one at a
+ * time, so a single arena serves them all and the buffers sized by one
+ * variant are reused by the next instead of being malloc'ed/freed per call
+ */
+static rbcf_arena_t rbcf_scratch;
+
+/** to be called once, at the start of an accessor */
+static rbcf_arena_t* RBcfScratch(void) {
+	rbcf_arena_reset(&rbcf_scratch);
+	return &rbcf_scratch;
+	}
+
 
 /**
  * Structure holding the VCF file , the header and the index
@@ -244,7 +261,7 @@ SEXP RBcfFileOpen(SEXP Rfilename,SEXP sexpRequireIdx) {
                 BCF_WARNING("not bgzf format %s",filename);
 				goto die;
                 }
-			 handler->tbx = tbx_index_load(filename);
+			 handler->tbx = tbx_index_load3(filename, NULL, HTS_IDX_SAVE_REMOTE | HTS_IDX_LAZY);
 			 if(handler->tbx==NULL) {
 				  BCF_WARNING("Cannot open tabix index for %s",filename);
 				  goto die;
@@ -256,7 +273,7 @@ SEXP RBcfFileOpen(SEXP Rfilename,SEXP sexpRequireIdx) {
                 BCF_WARNING("not bgzf format %s",filename);
 				goto die;
                 }
-			 handler->idx = bcf_index_load(filename);
+			 handler->idx = bcf_index_load3(filename, NULL, HTS_IDX_SAVE_REMOTE | HTS_IDX_LAZY);
 			 if(handler->idx==NULL) {
 				  BCF_WARNING("Cannot open idx index for %s",filename);
 				  goto die;
@@ -407,6 +424,266 @@ SEXP RBcfFileWriteCtx(SEXP sexpOut,SEXP sexpCtx) {
 	return ScalarLogical(ret==0);
 	}
 
+/**
+ * BGZF block passthrough for region extraction.
+ *
+ * Unmodified BCF records are already written without re-encoding by
+ * bcf_write1 (bcf1_sync is a no-op on clean records), so the remaining
+ * cost of `view -r` style subsetting is re-deflating the output. Here
+ * every compressed block of the input whose uncompressed bytes belong
+ * only to in-region records is copied verbatim; the bytes around them
+ * (region edges, pieces of records straddling a copied block) go
+ * through the regular BGZF writer. Records straddle blocks freely, so
+ * the bookkeeping is done in uncompressed stream offsets, with block
+ * sizes taken from the BGZF headers/ISIZE trailers of the input.
+ */
+typedef struct bgzf_block_cursor_t {
+	FILE* raw;
+	int64_t caddr; // compressed offset of the current block
+	int64_t csize; // compressed size of the current block
+	int64_t ubeg;  // uncompressed stream offset of the current block
+	int64_t usize; // uncompressed size of the current block
+	} BgzfBlockCursor;
+
+static int bgzfCursorLoad(BgzfBlockCursor* c) {
+	uint8_t h[18], t[4];
+	if(fseeko(c->raw,(off_t)c->caddr,SEEK_SET)!=0) return -1;
+	if(fread(h,1,18,c->raw)!=18) return -1;
+	if(h[0]!=31 || h[1]!=139 || h[2]!=8 || (h[3]&4)==0 || h[12]!='B' || h[13]!='C') return -1;
+	c->csize = (int64_t)(h[16] | (h[17]<<8)) + 1;
+	if(fseeko(c->raw,(off_t)(c->caddr + c->csize - 4),SEEK_SET)!=0) return -1;
+	if(fread(t,1,4,c->raw)!=4) return -1;
+	c->usize = (int64_t)((uint32_t)t[0] | ((uint32_t)t[1]<<8) | ((uint32_t)t[2]<<16) | ((uint32_t)t[3]<<24));
+	return 0;
+	}
+
+static int bgzfCursorNext(BgzfBlockCursor* c) {
+	c->caddr += c->csize;
+	c->ubeg += c->usize;
+	return bgzfCursorLoad(c);
+	}
+
+static int bgzfCopyRawBlock(BgzfBlockCursor* c,BGZF* out,char* buf,size_t buf_size) {
+	if(bgzf_flush(out)!=0) return -1;
+	if(fseeko(c->raw,(off_t)c->caddr,SEEK_SET)!=0) return -1;
+	int64_t remain = c->csize;
+	while(remain>0) {
+		size_t n = remain > (int64_t)buf_size ? buf_size : (size_t)remain;
+		if(fread(buf,1,n,c->raw)!=n) return -1;
+		if(bgzf_raw_write(out,buf,n)!=(ssize_t)n) return -1;
+		out->block_address += n;
+		remain -= n;
+		}
+	return 0;
+	}
+
+/* on-disk BCF record bytes, identical to what bcf_write1 emits for a clean record */
+static void bcfSerializeRecord(const bcf1_t* v,kstring_t* str) {
+	uint32_t x[8];
+	float q = v->qual;
+	x[0] = v->shared.l + 24;
+	x[1] = v->indiv.l;
+	x[2] = (uint32_t)v->rid;
+	x[3] = (uint32_t)v->pos;
+	x[4] = (uint32_t)v->rlen;
+	memcpy(&x[5],&q,4);
+	x[6] = (uint32_t)v->n_info | ((uint32_t)v->n_allele<<16);
+	x[7] = (uint32_t)v->n_fmt<<24 | (v->n_sample & 0xffffff);
+	for(int i=0;i<8;i++) {
+		uint8_t b[4] = { x[i]&0xff, (x[i]>>8)&0xff, (x[i]>>16)&0xff, (x[i]>>24)&0xff };
+		kputsn((char*)b,4,str);
+		}
+	kputsn(v->shared.s,v->shared.l,str);
+	kputsn(v->indiv.s,v->indiv.l,str);
+	}
+
+/**
+ * Extract regions from an indexed VCF/BCF into a new file.
+ * Returns c(records=, copied_bytes=) or NULL on error.
+ */
+SEXP RBcfExtractRegions(SEXP sexpIn,SEXP sexpRegions,SEXP Rfilename,SEXP sexpIndex) {
+	int nprotect=0;
+	htsFile* out = NULL;
+	char* buf = NULL;
+	bcf1_t* rec = NULL;
+	hts_itr_t* itr = NULL;
+	kstring_t pend = {0,0,NULL};
+	BgzfBlockCursor cursor;
+	double n_records = 0, copied_bytes = 0;
+	int ok = 0;
+
+	memset(&cursor,0,sizeof(BgzfBlockCursor));
+	PROTECT(sexpIn);nprotect++;
+	PROTECT(sexpRegions);nprotect++;
+	PROTECT(Rfilename);nprotect++;
+	IF_NULL_UNPROTECT_AND_RETURN_NULL(sexpIn);
+	IF_NULL_UNPROTECT_AND_RETURN_NULL(Rfilename);
+
+	RBcfFilePtr reader = (RBcfFilePtr)R_ExternalPtrAddr(VECTOR_ELT(sexpIn,0));
+	ASSERT_NOT_NULL(reader);
+	bcf_hdr_t* hdr = (bcf_hdr_t*)R_ExternalPtrAddr(VECTOR_ELT(sexpIn,1));
+	ASSERT_NOT_NULL(hdr);
+	const char* infile = CHAR(asChar(VECTOR_ELT(sexpIn,2)));
+	const char* filename = CHAR(asChar(Rfilename));
+
+	if(reader->is_writer==1) {
+		BCF_WARNING("cannot extract from a writer");
+		UNPROTECT(nprotect);
+		return R_NilValue;
+		}
+	if(reader->tbx==NULL && reader->idx==NULL) {
+		BCF_ERROR("Cannot query vcf file \"%s\" (no index available)",infile);
+		}
+
+	char modew[8];
+	strcpy(modew, "w");
+	if(endsWith(filename,".bcf")) strcat(modew, "b");
+	else if(endsWith(filename,".gz") || endsWith(filename,".vcfz")) strcat(modew, "z");
+
+	out = hts_open(filename,modew);
+	if(out==NULL) {
+		BCF_WARNING("Failed to open writer %s.",filename);
+		goto cleanup;
+		}
+	if(bcf_hdr_write(out,hdr)!=0) {
+		BCF_WARNING("Failed to write header for writer %s.",filename);
+		goto cleanup;
+		}
+	rec = bcf_init1();
+	if(rec==NULL) goto cleanup;
+
+	/* blocks can only be shared between two BGZF-compressed BCF streams */
+	int passthrough = reader->idx!=NULL &&
+		reader->fp->format.format==bcf &&
+		reader->fp->format.compression==bgzf &&
+		out->format.format==bcf &&
+		out->format.compression==bgzf;
+	if(passthrough) {
+		cursor.raw = fopen(infile,"rb");
+		buf = (char*)malloc(1<<16);
+		if(cursor.raw==NULL || buf==NULL) passthrough = 0;
+		}
+
+	for(int r=0;r< length(sexpRegions);r++) {
+		if(STRING_ELT(sexpRegions,r)==NA_STRING) continue;
+		const char* region = CHAR(STRING_ELT(sexpRegions,r));
+		if(itr) hts_itr_destroy(itr);
+		itr = NULL;
+
+		if(reader->tbx!=NULL) {
+			itr = tbx_itr_querys(reader->tbx,region);
+			if(itr==NULL) continue;
+			while(tbx_itr_next(reader->fp,reader->tbx,itr,&(reader->tmp_line))>=0) {
+				if(vcf_parse1(&(reader->tmp_line),hdr,rec)<0) {
+					BCF_WARNING("error while reading vcf line in %s",infile);
+					goto cleanup;
+					}
+				if(bcf_write1(out,hdr,rec)!=0) goto cleanup;
+				n_records++;
+				}
+			continue;
+			}
+		itr = bcf_itr_querys(reader->idx,hdr,region);
+		if(itr==NULL) continue;
+		if(!passthrough) {
+			int ret;
+			while((ret=bcf_itr_next(reader->fp,itr,rec))>=0) {
+				if(bcf_write1(out,hdr,rec)!=0) goto cleanup;
+				n_records++;
+				}
+			if(ret < -1) goto cleanup;
+			continue;
+			}
+
+		if(itr->n_off==0) continue;
+		if(bgzf_seek(reader->fp->fp.bgzf,itr->off[0].u,SEEK_SET)<0) {
+			BCF_WARNING("seek failed in %s",infile);
+			goto cleanup;
+			}
+		cursor.caddr = (int64_t)(itr->off[0].u>>16);
+		cursor.ubeg = 0;
+		if(bgzfCursorLoad(&cursor)!=0) {
+			BCF_WARNING("cannot read BGZF block header in %s",infile);
+			goto cleanup;
+			}
+		/* [written, end): in-region bytes read but not yet sent to the output, kept in pend */
+		int64_t u = (int64_t)(itr->off[0].u & 0xFFFF);
+		int64_t written = -1, end = -1;
+		for(;;) {
+			int ret = bcf_read1(reader->fp,hdr,rec);
+			if(ret < -1) {
+				BCF_WARNING("error while reading bcf record in %s",infile);
+				goto cleanup;
+				}
+			int stop = ret<0 || rec->rid!=itr->tid || rec->pos>=itr->end;
+			int keep = !stop && rec->pos + rec->rlen > itr->beg;
+			int64_t len = ret<0 ? 0 : 32 + (int64_t)rec->shared.l + (int64_t)rec->indiv.l;
+			if(!keep) {
+				if(written>=0 && pend.l>0 && bgzf_write(out->fp.bgzf,pend.s,pend.l)!=(ssize_t)pend.l) goto cleanup;
+				pend.l = 0;
+				written = -1;
+				if(stop) break;
+				u += len;
+				continue;
+				}
+			n_records++;
+			if(written<0) written = u;
+			bcfSerializeRecord(rec,&pend);
+			u += len;
+			end = u;
+			/* every input block ending inside the in-region stretch is settled now */
+			while(cursor.ubeg + cursor.usize <= end) {
+				if(cursor.usize>0 && cursor.ubeg>=written) {
+					size_t head = (size_t)(cursor.ubeg - written);
+					if(head>0 && bgzf_write(out->fp.bgzf,pend.s,head)!=(ssize_t)head) goto cleanup;
+					if(bgzfCopyRawBlock(&cursor,out->fp.bgzf,buf,1<<16)!=0) {
+						BCF_WARNING("raw block copy failed for %s",filename);
+						goto cleanup;
+						}
+					copied_bytes += (double)cursor.csize;
+					size_t drop = head + (size_t)cursor.usize;
+					memmove(pend.s,pend.s+drop,pend.l-drop);
+					pend.l -= drop;
+					written = cursor.ubeg + cursor.usize;
+					}
+				if(bgzfCursorNext(&cursor)!=0) break;
+				}
+			}
+		}
+	ok = 1;
+
+	cleanup:
+	if(itr) hts_itr_destroy(itr);
+	if(rec) bcf_destroy1(rec);
+	free(pend.s);
+	free(buf);
+	if(cursor.raw) fclose(cursor.raw);
+	if(out && hts_close(out)!=0) ok = 0;
+	if(!ok) {
+		BCF_WARNING("region extraction to %s failed",filename);
+		UNPROTECT(nprotect);
+		return R_NilValue;
+		}
+
+	if(asLogical(sexpIndex)) {
+		int ret = 0;
+		if(endsWith(filename,".bcf")) ret = bcf_index_build3(filename,NULL,14,0);
+		else if(endsWith(filename,".gz")) ret = tbx_index_build(filename,0,&tbx_conf_vcf);
+		else BCF_WARNING("cannot index uncompressed output %s",filename);
+		if(ret!=0) BCF_WARNING("failed to index %s",filename);
+		}
+
+	SEXP ext = PROTECT(allocVector(REALSXP,2));nprotect++;
+	REAL(ext)[0] = n_records;
+	REAL(ext)[1] = copied_bytes;
+	SEXP names = PROTECT(allocVector(STRSXP,2));nprotect++;
+	SET_STRING_ELT(names,0,mkChar("records"));
+	SET_STRING_ELT(names,1,mkChar("copied_bytes"));
+	setAttrib(ext,R_NamesSymbol,names);
+	UNPROTECT(nprotect);
+	return ext;
+	}
+
 SEXP RBcfSeqNames(SEXP sexpFile) {
 	int i, n=0;
 	SEXP ext;
@@ -782,26 +1059,13 @@ static void RBcf1Finalizer(SEXP handler) {
 	}
 
 
-SEXP RBcfNextLine(SEXP sexpFile) {
+/**
+ * read the next record of the reader into reader->tmp_ctx
+ * returns NULL at the end of the stream or after a failed query
+ */
+static bcf1_t* RBcfReadNext(RBcfFilePtr reader,bcf_hdr_t* hdr) {
 	int ret=0;
-	int nprotect=0;
 	bcf1_t *line = NULL;
-	
-	SEXP ext;
-	PROTECT(sexpFile);nprotect++;
-	IF_NULL_UNPROTECT_AND_RETURN_NULL(sexpFile);
-	
-	RBcfFilePtr reader=(RBcfFilePtr)R_ExternalPtrAddr(VECTOR_ELT(sexpFile,0));
-	ASSERT_NOT_NULL(reader);
-	bcf_hdr_t* hdr =(bcf_hdr_t*)R_ExternalPtrAddr(VECTOR_ELT(sexpFile,1));
-	ASSERT_NOT_NULL(hdr);
-	
-	if( reader->is_writer == 1 ) {
-		BCF_WARNING("try to read from a writer");
-		UNPROTECT(nprotect);
-		return R_NilValue;
-	}
-
 	if( reader->query_failed!=0) {
 		line=NULL;
 		}
@@ -847,6 +1111,29 @@ SEXP RBcfNextLine(SEXP sexpFile) {
     	{
         BCF_ERROR("illegal state");
     	}
+	return line;
+	}
+
+SEXP RBcfNextLine(SEXP sexpFile) {
+	int nprotect=0;
+	bcf1_t *line = NULL;
+	
+	SEXP ext;
+	PROTECT(sexpFile);nprotect++;
+	IF_NULL_UNPROTECT_AND_RETURN_NULL(sexpFile);
+	
+	RBcfFilePtr reader=(RBcfFilePtr)R_ExternalPtrAddr(VECTOR_ELT(sexpFile,0));
+	ASSERT_NOT_NULL(reader);
+	bcf_hdr_t* hdr =(bcf_hdr_t*)R_ExternalPtrAddr(VECTOR_ELT(sexpFile,1));
+	ASSERT_NOT_NULL(hdr);
+	
+	if( reader->is_writer == 1 ) {
+		BCF_WARNING("try to read from a writer");
+		UNPROTECT(nprotect);
+		return R_NilValue;
+	}
+
+	line = RBcfReadNext(reader,hdr);
 	
 	 if ( line !=NULL ) {
 	 	line = bcf_dup(line);
@@ -868,6 +1155,293 @@ SEXP RBcfNextLine(SEXP sexpFile) {
 	return ext;
 	}
 
+static void RBcfBatchFinalizer(SEXP handler) {
+	bcf_batch_t* batch = (bcf_batch_t*)R_ExternalPtrAddr(handler);
+	if(batch==NULL) return;
+	bcf_batch_destroy(batch);
+	R_ClearExternalPtr(handler);
+	}
+
+static int batchIntIsNA(int32_t v) {
+	return v==bcf_int32_missing || v==bcf_int32_vector_end;
+	}
+
+static double batchFloatToR(float v) {
+	return bcf_float_is_missing(v) || bcf_float_is_vector_end(v) ? NA_REAL : (double)v;
+	}
+
+/** one INFO column: atomic vector when every record has at most one value, a list otherwise */
+static SEXP batchInfoColumn(bcf_batch_t* b,bcf_batch_col_t* col) {
+	int nprotect=0;
+	int scalar = 1;
+	SEXP ext;
+	for(int i=0;i< b->n && col->type!=BCF_HT_STR;i++) {
+		if(col->width[i]>1) { scalar=0; break;}
+		}
+	if(col->type==BCF_HT_FLAG) {
+		ext = PROTECT(allocVector(LGLSXP,b->n));nprotect++;
+		for(int i=0;i< b->n;i++) LOGICAL(ext)[i] = ((int32_t*)col->data)[col->offs[i]];
+		}
+	else if(col->type==BCF_HT_STR) {
+		ext = PROTECT(allocVector(STRSXP,b->n));nprotect++;
+		for(int i=0;i< b->n;i++) {
+			SET_STRING_ELT(ext,i,col->width[i]==0?NA_STRING:mkChar((char*)col->data+col->offs[i]));
+			}
+		}
+	else if(scalar) {
+		if(col->type==BCF_HT_REAL) {
+			ext = PROTECT(allocVector(REALSXP,b->n));nprotect++;
+			for(int i=0;i< b->n;i++) REAL(ext)[i] = col->width[i]==0?NA_REAL:batchFloatToR(((float*)col->data)[col->offs[i]]);
+			}
+		else
+			{
+			ext = PROTECT(allocVector(INTSXP,b->n));nprotect++;
+			for(int i=0;i< b->n;i++) {
+				int32_t v = col->width[i]==0?bcf_int32_missing:((int32_t*)col->data)[col->offs[i]];
+				INTEGER(ext)[i] = batchIntIsNA(v)?NA_INTEGER:v;
+				}
+			}
+		}
+	else
+		{
+		ext = PROTECT(allocVector(VECSXP,b->n));nprotect++;
+		for(int i=0;i< b->n;i++) {
+			SEXP v;
+			if(col->type==BCF_HT_REAL) {
+				v = PROTECT(allocVector(REALSXP,col->width[i]));
+				for(int k=0;k< col->width[i];k++) REAL(v)[k]=batchFloatToR(((float*)col->data)[col->offs[i]+k]);
+				}
+			else
+				{
+				v = PROTECT(allocVector(INTSXP,col->width[i]));
+				for(int k=0;k< col->width[i];k++) {
+					int32_t x = ((int32_t*)col->data)[col->offs[i]+k];
+					INTEGER(v)[k] = batchIntIsNA(x)?NA_INTEGER:x;
+					}
+				}
+			SET_VECTOR_ELT(ext,i,v);
+			UNPROTECT(1);
+			}
+		}
+	UNPROTECT(nprotect);
+	return ext;
+	}
+
+/** copy record i of a FORMAT column into dest laid out as dest[row + n*(sample + n_sample*k)] */
+static void batchFormatCopy(bcf_batch_t* b,bcf_batch_col_t* col,int i,SEXP dest,R_xlen_t row,R_xlen_t n,int is_gt) {
+	int w = col->width[i];
+	for(int s=0;s< b->n_sample;s++) {
+		for(int k=0;k< w;k++) {
+			R_xlen_t at = row + n*(s + (R_xlen_t)b->n_sample*k);
+			R_xlen_t from = col->offs[i] + (R_xlen_t)s*w + k;
+			if(col->type==BCF_HT_REAL) {
+				REAL(dest)[at] = batchFloatToR(((float*)col->data)[from]);
+				}
+			else if(col->type==BCF_HT_STR) {
+				const char* p = (char*)col->data + col->offs[i] + (R_xlen_t)s*w;
+				int len=0;
+				while(len<w && p[len]!=0) len++;
+				SET_STRING_ELT(dest,at,len==0?NA_STRING:mkCharLen(p,len));
+				break;
+				}
+			else
+				{
+				int32_t v = ((int32_t*)col->data)[from];
+				if(is_gt) INTEGER(dest)[at] = (v==bcf_int32_vector_end || bcf_gt_is_missing(v))?NA_INTEGER:bcf_gt_allele(v);
+				else INTEGER(dest)[at] = batchIntIsNA(v)?NA_INTEGER:v;
+				}
+			}
+		}
+	}
+
+/**
+ * one FORMAT column: a records x samples matrix when every record has one
+ * value per sample, a records x samples x width array when the width is
+ * constant, a list of samples x width matrices otherwise
+ */
+static SEXP batchFormatColumn(bcf_batch_t* b,bcf_batch_col_t* col) {
+	int nprotect=0;
+	int is_gt = strcmp(col->tag,"GT")==0;
+	int w = b->n>0?col->width[0]:0;
+	SEXPTYPE type = col->type==BCF_HT_REAL?REALSXP:(col->type==BCF_HT_STR?STRSXP:INTSXP);
+	int constant = 1;
+	SEXP ext;
+	for(int i=1;i< b->n;i++) {
+		if(col->width[i]!=w) { constant=0; break;}
+		}
+	// strings are one value per sample
+	if(col->type==BCF_HT_STR) {
+		ext = PROTECT(allocMatrix(STRSXP,b->n,b->n_sample));nprotect++;
+		for(int i=0;i< b->n;i++) {
+			if(col->width[i]==0) {
+				for(int s=0;s< b->n_sample;s++) SET_STRING_ELT(ext,i+(R_xlen_t)b->n*s,NA_STRING);
+				}
+			else
+				{
+				batchFormatCopy(b,col,i,ext,i,b->n,is_gt);
+				}
+			}
+		}
+	else if(constant && w>0) {
+		if(w==1) {
+			ext = PROTECT(allocMatrix(type,b->n,b->n_sample));nprotect++;
+			}
+		else
+			{
+			SEXP dim = PROTECT(allocVector(INTSXP,3));nprotect++;
+			INTEGER(dim)[0]=b->n;
+			INTEGER(dim)[1]=b->n_sample;
+			INTEGER(dim)[2]=w;
+			ext = PROTECT(allocVector(type,(R_xlen_t)b->n*b->n_sample*w));nprotect++;
+			setAttrib(ext,R_DimSymbol,dim);
+			}
+		for(int i=0;i< b->n;i++) batchFormatCopy(b,col,i,ext,i,b->n,is_gt);
+		}
+	else
+		{
+		ext = PROTECT(allocVector(VECSXP,b->n));nprotect++;
+		for(int i=0;i< b->n;i++) {
+			if(col->width[i]==0) continue;
+			SEXP m = PROTECT(allocMatrix(type,1,b->n_sample*col->width[i]));
+			SEXP dim = PROTECT(allocVector(INTSXP,2));
+			INTEGER(dim)[0]=b->n_sample;
+			INTEGER(dim)[1]=col->width[i];
+			// one record: copy as a 1 x samples x width block, i.e. samples x width
+			batchFormatCopy(b,col,i,m,0,1,is_gt);
+			setAttrib(m,R_DimSymbol,dim);
+			SET_VECTOR_ELT(ext,i,m);
+			UNPROTECT(2);
+			}
+		}
+	UNPROTECT(nprotect);
+	return ext;
+	}
+
+/**
+ * read up to 'n' records from the current position/query into a
+ * structure-of-arrays batch and return it as
+ * list(variants=data.frame, info=list, format=list)
+ * returns NULL when no record is left
+ */
+SEXP RBcfReadBatch(SEXP sexpFile,SEXP sexpN,SEXP sexpInfo,SEXP sexpFormat) {
+	int nprotect=0;
+	PROTECT(sexpFile);nprotect++;
+	IF_NULL_UNPROTECT_AND_RETURN_NULL(sexpFile);
+	RBcfFilePtr reader=(RBcfFilePtr)R_ExternalPtrAddr(VECTOR_ELT(sexpFile,0));
+	ASSERT_NOT_NULL(reader);
+	bcf_hdr_t* hdr =(bcf_hdr_t*)R_ExternalPtrAddr(VECTOR_ELT(sexpFile,1));
+	ASSERT_NOT_NULL(hdr);
+	int max_n = asInteger(sexpN);
+
+	if( reader->is_writer == 1 ) {
+		BCF_WARNING("try to read from a writer");
+		UNPROTECT(nprotect);
+		return R_NilValue;
+		}
+	if(max_n==NA_INTEGER || max_n<1) {
+		BCF_WARNING("bad number of records");
+		UNPROTECT(nprotect);
+		return R_NilValue;
+		}
+
+	bcf_batch_t* batch = bcf_batch_init(hdr);
+	ASSERT_NOT_NULL(batch);
+	// released by the finalizer if a read error longjmps out of here
+	SEXP sexpBatch = PROTECT(R_MakeExternalPtr(batch, R_NilValue, R_NilValue));nprotect++;
+	R_RegisterCFinalizerEx(sexpBatch,RBcfBatchFinalizer, TRUE);
+	int n_info = length(sexpInfo);
+	int n_fmt = length(sexpFormat);
+	int* info_cols = (int*)R_alloc(n_info+1,sizeof(int));
+	int* fmt_cols = (int*)R_alloc(n_fmt+1,sizeof(int));
+	for(int i=0;i< n_info;i++) {
+		info_cols[i] = bcf_batch_add_info(batch,hdr,CHAR(STRING_ELT(sexpInfo,i)));
+		if(info_cols[i]<0) BCF_WARNING("INFO/%s is not defined in the header",CHAR(STRING_ELT(sexpInfo,i)));
+		}
+	for(int i=0;i< n_fmt;i++) {
+		fmt_cols[i] = bcf_batch_add_format(batch,hdr,CHAR(STRING_ELT(sexpFormat,i)));
+		if(fmt_cols[i]<0) BCF_WARNING("FORMAT/%s is not defined in the header",CHAR(STRING_ELT(sexpFormat,i)));
+		}
+
+	bcf1_t* line;
+	while(batch->n < max_n && (line=RBcfReadNext(reader,hdr))!=NULL) {
+		if(bcf_batch_push(batch,hdr,line)!=0) {
+			BCF_ERROR("cannot decode record");
+			}
+		}
+	if(batch->n==0) {
+		UNPROTECT(nprotect);
+		return R_NilValue;
+		}
+
+	int n = batch->n;
+	SEXP variants = PROTECT(allocVector(VECSXP,7));nprotect++;
+	SEXP chrom = PROTECT(allocVector(STRSXP,n));nprotect++;
+	SEXP pos = PROTECT(allocVector(INTSXP,n));nprotect++;
+	SEXP id = PROTECT(allocVector(STRSXP,n));nprotect++;
+	SEXP ref = PROTECT(allocVector(STRSXP,n));nprotect++;
+	SEXP alt = PROTECT(allocVector(STRSXP,n));nprotect++;
+	SEXP qual = PROTECT(allocVector(REALSXP,n));nprotect++;
+	SEXP filter = PROTECT(allocVector(STRSXP,n));nprotect++;
+	// one CHARSXP per contig rather than per record
+	int n_ctg = hdr->n[BCF_DT_CTG];
+	SEXP ctg_names = PROTECT(allocVector(STRSXP,n_ctg));nprotect++;
+	for(int c=0;c< n_ctg;c++) SET_STRING_ELT(ctg_names,c,mkChar(bcf_hdr_id2name(hdr,c)));
+	for(int i=0;i< n;i++) {
+		SET_STRING_ELT(chrom,i,batch->rid[i]>=0 && batch->rid[i]<n_ctg?STRING_ELT(ctg_names,batch->rid[i]):NA_STRING);
+		INTEGER(pos)[i] = (int)(batch->pos[i]+1);
+		const char* vid = bcf_batch_id(batch,i);
+		SET_STRING_ELT(id,i,strcmp(vid,".")==0?NA_STRING:mkChar(vid));
+		SET_STRING_ELT(ref,i,mkChar(bcf_batch_ref(batch,i)));
+		SET_STRING_ELT(alt,i,batch->n_allele[i]>1?mkChar(bcf_batch_alt(batch,i)):NA_STRING);
+		REAL(qual)[i] = bcf_float_is_missing(batch->qual[i])?NA_REAL:batch->qual[i];
+		const char* flt = bcf_batch_flt(batch,i);
+		SET_STRING_ELT(filter,i,*flt==0?NA_STRING:mkChar(flt));
+		}
+	const char* vnames[]={"chrom","pos","id","ref","alt","qual","filter"};
+	SEXP sexpvnames = PROTECT(allocVector(STRSXP,7));nprotect++;
+	SEXP vcols[]={chrom,pos,id,ref,alt,qual,filter};
+	for(int c=0;c<7;c++) {
+		SET_VECTOR_ELT(variants,c,vcols[c]);
+		SET_STRING_ELT(sexpvnames,c,mkChar(vnames[c]));
+		}
+	setAttrib(variants,R_NamesSymbol,sexpvnames);
+	SEXP rn = PROTECT(allocVector(INTSXP,2));nprotect++;
+	INTEGER(rn)[0]=NA_INTEGER;
+	INTEGER(rn)[1]=-n;
+	setAttrib(variants,R_RowNamesSymbol,rn);
+	setAttrib(variants,R_ClassSymbol,mkString("data.frame"));
+
+	SEXP info = PROTECT(allocVector(VECSXP,n_info));nprotect++;
+	for(int i=0;i< n_info;i++) {
+		if(info_cols[i]<0) continue;
+		SET_VECTOR_ELT(info,i,batchInfoColumn(batch,&batch->cols[info_cols[i]]));
+		}
+	setAttrib(info,R_NamesSymbol,sexpInfo);
+	SEXP samples = PROTECT(allocVector(STRSXP,batch->n_sample));nprotect++;
+	for(int s=0;s< batch->n_sample;s++) SET_STRING_ELT(samples,s,mkChar(hdr->samples[s]));
+	SEXP format = PROTECT(allocVector(VECSXP,n_fmt));nprotect++;
+	for(int i=0;i< n_fmt;i++) {
+		if(fmt_cols[i]<0) continue;
+		SET_VECTOR_ELT(format,i,batchFormatColumn(batch,&batch->cols[fmt_cols[i]]));
+		}
+	setAttrib(format,R_NamesSymbol,sexpFormat);
+	RBcfBatchFinalizer(sexpBatch);
+
+	SEXP ext = PROTECT(allocVector(VECSXP,4));nprotect++;
+	SET_VECTOR_ELT(ext,0,variants);
+	SET_VECTOR_ELT(ext,1,info);
+	SET_VECTOR_ELT(ext,2,format);
+	SET_VECTOR_ELT(ext,3,samples);
+	SEXP names = PROTECT(allocVector(STRSXP,4));nprotect++;
+	SET_STRING_ELT(names,0,mkChar("variants"));
+	SET_STRING_ELT(names,1,mkChar("info"));
+	SET_STRING_ELT(names,2,mkChar("format"));
+	SET_STRING_ELT(names,3,mkChar("samples"));
+	setAttrib(ext,R_NamesSymbol,names);
+	UNPROTECT(nprotect);
+	return ext;
+	}
+
 SEXP RBcfCtxRid(SEXP sexpCtx) {
 	int nprotect=0;
 	bcf1_t *ctx;
@@ -1258,7 +1832,6 @@ SEXP RBcfCtxVariantMaxPloidy(SEXP sexpCtx) {
 	int nprotect=0;
 	bcf1_t *ctx;
 	bcf_hdr_t* hdr;
-	int32_t *gt_arr = NULL, ngt_arr = 0;
 	SEXP ext;
 	PROTECT(sexpCtx);nprotect++;
 	if(isNull(sexpCtx)) {
@@ -1271,8 +1844,8 @@ SEXP RBcfCtxVariantMaxPloidy(SEXP sexpCtx) {
 	ASSERT_NOT_NULL(ctx);
 	bcf_unpack(ctx,BCF_UN_IND);
 
-	
-	int ngt = bcf_get_genotypes(hdr,ctx, &gt_arr, &ngt_arr);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ngt = bcf_get_genotypes(hdr,ctx, &scratch->buf[RBCF_BUF_GT],&scratch->m_buf[RBCF_BUF_GT]);
 	if ( ngt<=0 ) {
 		ext = ScalarInteger(0);
 		}
@@ -1344,13 +1917,15 @@ SEXP VariantGetGenotype(SEXP sexpCtx,SEXP sexpgtidx) {
 	}
 
 static void scanGenotype(bcf_hdr_t* hdr,bcf1_t *ctx,int sample_idx, struct GenotypeShuttle* shuttle) {
-	int32_t *gt_arr = NULL, ngt_arr = 0;
+	rbcf_arena_t* scratch = RBcfScratch();
 
 	bcf_unpack(ctx,BCF_UN_IND);
 	
 	
 	int j;
-	int ngt = bcf_get_genotypes(hdr,ctx, &gt_arr, &ngt_arr);
+	int ngt = bcf_get_genotypes(hdr,ctx, &scratch->buf[RBCF_BUF_GT],&scratch->m_buf[RBCF_BUF_GT]);
+	if(ngt<=0) return;
+	int32_t *gt_arr = (int32_t*)scratch->buf[RBCF_BUF_GT];
 	int nsmpl = bcf_hdr_nsamples(hdr);
 	int max_ploidy = ngt/nsmpl;
      
@@ -1436,17 +2011,13 @@ SEXP RBcfCtxVariantAllGtAllelesIndexes0(SEXP sexpCtx) {
 	int nsmpl = bcf_hdr_nsamples(hdr);
 
 	// Identify the max-ploidy
-	int32_t *gt_arr = NULL, ngt_arr = 0;
-	int ngt = bcf_get_genotypes(hdr,ctx, &gt_arr, &ngt_arr);
-	if (gt_arr == NULL) {
-		UNPROTECT(nprotect);
-		return R_NilValue;
-	}
-	if ( ngt == 0 ) {
-		free(gt_arr);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ngt = bcf_get_genotypes(hdr,ctx, &scratch->buf[RBCF_BUF_GT],&scratch->m_buf[RBCF_BUF_GT]);
+	if ( ngt <= 0 ) {
 		UNPROTECT(nprotect);
 		return R_NilValue;
 	}
+	int32_t *gt_arr = (int32_t*)scratch->buf[RBCF_BUF_GT];
 
 	int max_ploidy = ngt / nsmpl;
   
@@ -1461,7 +2032,6 @@ SEXP RBcfCtxVariantAllGtAllelesIndexes0(SEXP sexpCtx) {
 		  }
 		}
   }
-	free(gt_arr);
 
 	UNPROTECT(nprotect);
 	return ext;
@@ -1481,17 +2051,13 @@ SEXP RBcfCtxVariantAllGtAllelesAlleleCounts(SEXP sexpCtx, SEXP sexpAlleleIndex)
 	int nsmpl = bcf_hdr_nsamples(hdr);
 
 	// Identify the max-ploidy
-	int32_t *gt_arr = NULL, ngt_arr = 0;
-	int ngt = bcf_get_genotypes(hdr,ctx, &gt_arr, &ngt_arr);
-	if (gt_arr == NULL) {
-		UNPROTECT(nprotect);
-		return R_NilValue;
-	}
-	if ( ngt == 0 ) {
-		free(gt_arr);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ngt = bcf_get_genotypes(hdr,ctx, &scratch->buf[RBCF_BUF_GT],&scratch->m_buf[RBCF_BUF_GT]);
+	if ( ngt <= 0 ) {
 		UNPROTECT(nprotect);
 		return R_NilValue;
 	}
+	int32_t *gt_arr = (int32_t*)scratch->buf[RBCF_BUF_GT];
 
 	int max_ploidy = ngt / nsmpl;
   
@@ -1507,7 +2073,6 @@ SEXP RBcfCtxVariantAllGtAllelesAlleleCounts(SEXP sexpCtx, SEXP sexpAlleleIndex)
 		  }
 		}
   }
-	free(gt_arr);
 
 	UNPROTECT(nprotect);
 	return ext;
@@ -1525,23 +2090,21 @@ SEXP RBcfCtxVariantAllGtStrings(SEXP sexpCtx) {
 	int nsmpl = bcf_hdr_nsamples(hdr);
 
 	// Identify the max-ploidy
-	int32_t *gt_arr = NULL, ngt_arr = 0;
-	int ngt = bcf_get_genotypes(hdr,ctx, &gt_arr, &ngt_arr);
-	if (gt_arr == NULL) {
-		UNPROTECT(nprotect);
-		return R_NilValue;
-	}
-	if ( ngt == 0 ) {
-		free(gt_arr);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ngt = bcf_get_genotypes(hdr,ctx, &scratch->buf[RBCF_BUF_GT],&scratch->m_buf[RBCF_BUF_GT]);
+	if ( ngt <= 0 ) {
 		UNPROTECT(nprotect);
 		return R_NilValue;
 	}
+	int32_t *gt_arr = (int32_t*)scratch->buf[RBCF_BUF_GT];
 	int max_ploidy = ngt / nsmpl;
 
 	// Allocate a temporary array. Needs to store the indizes of the alleles.
 	// We make the assumption that we will never see more than 999 different alleles
 	// and therefore allocate 3+1 characters per allele(-index)
-	char *buf = malloc(max_ploidy * 4 * sizeof(char));
+	size_t buf_size = max_ploidy * 4 * sizeof(char);
+	char *buf = rbcf_arena_alloc(scratch, buf_size);
+	ASSERT_NOT_NULL(buf);
 	char *buf_ptr;
   
 	SEXP ext = PROTECT(allocVector(STRSXP,nsmpl));nprotect++;
@@ -1570,7 +2133,7 @@ SEXP RBcfCtxVariantAllGtStrings(SEXP sexpCtx) {
 		     buf_ptr[1] = '\0';
 				 buf_ptr += 2;
 		  } else {
-				int remaining = buf + sizeof(buf) - buf_ptr;
+				int remaining = buf + buf_size - buf_ptr;
 				int written = snprintf(buf_ptr, remaining, "%d", bcf_gt_allele(gt_arr[k]));
 				if (written > 0 && written < remaining) {
 					buf_ptr += written;
@@ -1579,8 +2142,6 @@ SEXP RBcfCtxVariantAllGtStrings(SEXP sexpCtx) {
 		}
 		SET_STRING_ELT(ext, i, mkChar(buf));
    }
-	free(buf);
-	free(gt_arr);
 
 	UNPROTECT(nprotect);
 	return ext;
@@ -1778,8 +2339,9 @@ SEXP VariantVepTable(SEXP sexpCtx) {
 	if(info==NULL) goto theend;
 	
 	
-	int ndst=0;
-	int ret=bcf_get_info_string(hdr,ctx,VEP_CSQ_KEY,(void**)& csq_str,&ndst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_info_string(hdr,ctx,VEP_CSQ_KEY,&scratch->buf[RBCF_BUF_INFO],&scratch->m_buf[RBCF_BUF_INFO]);
+	csq_str = (char*)scratch->buf[RBCF_BUF_INFO];
 	if(ret<0 ||  csq_str==NULL) goto theend;
 
 	
@@ -1791,7 +2353,7 @@ SEXP VariantVepTable(SEXP sexpCtx) {
 	SEXP colNames = PROTECT(allocVector(STRSXP, fmtTokens->count));nprotect++;
 	SEXP rowNames = PROTECT(Rf_allocVector(STRSXP,transcriptTokens->count)); nprotect++;
 	/* create columns */
-	SEXP* columns=(SEXP*)malloc(sizeof(SEXP)*fmtTokens->count);
+	SEXP* columns=(SEXP*)rbcf_arena_alloc(scratch,sizeof(SEXP)*fmtTokens->count);
 	ASSERT_NOT_NULL(columns);
 	for(int x=0;x<fmtTokens->count;++x)
 		{
@@ -1825,7 +2387,6 @@ SEXP VariantVepTable(SEXP sexpCtx) {
    classgets(ext, cls);
    setAttrib(ext, R_RowNamesSymbol, rowNames);
 	
-	free(columns);
 	FreeTokensPtr(fmtTokens);
 	FreeTokensPtr(transcriptTokens);
 	
@@ -1879,8 +2440,9 @@ SEXP VariantSnpEffTable(SEXP sexpCtx) {
 	if(info==NULL) goto theend;
 	
 	
-	int ndst=0;
-	int ret=bcf_get_info_string(hdr,ctx,SNPEFF_ANN_KEY,(void**)& csq_str,&ndst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_info_string(hdr,ctx,SNPEFF_ANN_KEY,&scratch->buf[RBCF_BUF_INFO],&scratch->m_buf[RBCF_BUF_INFO]);
+	csq_str = (char*)scratch->buf[RBCF_BUF_INFO];
 	if(ret<0 ||  csq_str==NULL) goto theend;
 
 	
@@ -1898,7 +2460,7 @@ SEXP VariantSnpEffTable(SEXP sexpCtx) {
 	SEXP colNames = PROTECT(allocVector(STRSXP, fmtTokens->count));nprotect++;
 	SEXP rowNames = PROTECT(Rf_allocVector(STRSXP,transcriptTokens->count)); nprotect++;
 	/* create columns */
-	SEXP* columns=(SEXP*)malloc(sizeof(SEXP)*fmtTokens->count);
+	SEXP* columns=(SEXP*)rbcf_arena_alloc(scratch,sizeof(SEXP)*fmtTokens->count);
 	ASSERT_NOT_NULL(columns);
 	for(int x=0;x<fmtTokens->count;++x)
 		{
@@ -1932,7 +2494,6 @@ SEXP VariantSnpEffTable(SEXP sexpCtx) {
    classgets(ext, cls);
    setAttrib(ext, R_RowNamesSymbol, rowNames);
 	
-	free(columns);
 	FreeTokensPtr(fmtTokens);
 	FreeTokensPtr(transcriptTokens);
 	
@@ -1958,13 +2519,12 @@ SEXP VariantStringAttribute(SEXP sexpCtx,SEXP sexpatt) {
 	
 	bcf_unpack(ctx, BCF_UN_INFO);
 	
-	char* dst=NULL;
-	int ndst=0;
-	int ret=bcf_get_info_string(hdr,ctx,att,(void**)&dst,&ndst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_info_string(hdr,ctx,att,&scratch->buf[RBCF_BUF_INFO],&scratch->m_buf[RBCF_BUF_INFO]);
+	char* dst = (char*)scratch->buf[RBCF_BUF_INFO];
 	if(!(ret<0 || dst==NULL)) {
 		ext= mkString(dst);
 		}
-	free(dst);
 	UNPROTECT(nprotect);
 	return ext;
 	}
@@ -1984,20 +2544,19 @@ SEXP VariantIntAttribute(SEXP sexpCtx,SEXP sexpatt) {
 	ASSERT_NOT_NULL(att);
 	
 	SEXP ext;
-	int ndst=0;
-	int32_t* dst=NULL;
-	int ret=bcf_get_info_int32(hdr,ctx,att,(void**)&dst,&ndst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_info_int32(hdr,ctx,att,&scratch->buf[RBCF_BUF_INFO],&scratch->m_buf[RBCF_BUF_INFO]);
+	int32_t* dst = (int32_t*)scratch->buf[RBCF_BUF_INFO];
 	if(ret<0 || dst==NULL ) {
 		PROTECT(ext = Rf_allocVector(INTSXP,0)); nprotect++;
 		}
 	else
 		{
-		PROTECT(ext = Rf_allocVector(INTSXP,ndst)); nprotect++;
-	        for(int i=0;i< ndst;i++) {
+		PROTECT(ext = Rf_allocVector(INTSXP,ret)); nprotect++;
+	        for(int i=0;i< ret;i++) {
 	               	INTEGER(ext)[i] = dst[i];
 	                }
 		}
-	free(dst);
 	UNPROTECT(nprotect);
 	return ext;
 	}
@@ -2016,20 +2575,19 @@ SEXP VariantFloatAttribute(SEXP sexpCtx,SEXP sexpatt) {
 	ASSERT_NOT_NULL(hdr);
 	ASSERT_NOT_NULL(att);
 	SEXP ext;
-	int ndst=0;
-	float* dst=NULL;
-	int ret=bcf_get_info_float(hdr,ctx,att,(void**)&dst,&ndst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_info_float(hdr,ctx,att,&scratch->buf[RBCF_BUF_INFO],&scratch->m_buf[RBCF_BUF_INFO]);
+	float* dst = (float*)scratch->buf[RBCF_BUF_INFO];
 	if(ret<0 || dst==NULL ) {
 		PROTECT(ext = Rf_allocVector(REALSXP,0)); nprotect++;
 		}
 	else
 		{
-		PROTECT(ext = Rf_allocVector(REALSXP,ndst)); nprotect++;
-        for(int i=0;i< ndst;i++) {
+		PROTECT(ext = Rf_allocVector(REALSXP,ret)); nprotect++;
+        for(int i=0;i< ret;i++) {
                	REAL(ext)[i] = dst[i];
                 }
 		}
-	free(dst);
 	UNPROTECT(nprotect);
 	return ext;
 	}
@@ -2073,17 +2631,17 @@ SEXP GenotypeStringAttribute(SEXP sexpGt,SEXP sexpatt) {
 	ASSERT_NOT_NULL(hdr);
 	ASSERT_NOT_NULL(att);
 	bcf_unpack(ctx, BCF_UN_FMT);
-	int ndst=0;
-	char** dst=NULL;
-	int ret= bcf_get_format_string(hdr,ctx,att,&dst,&ndst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int nsmpl = bcf_hdr_nsamples(hdr);
+	char*** dstp = rbcf_arena_fmt_str(scratch,nsmpl);
+	int ret= bcf_get_format_string(hdr,ctx,att,dstp,&scratch->m_fmt_str);
 	if(ret>=0 ) {
-		if(dst!=NULL && sample_index < ndst && dst[sample_index]!=NULL)
+		char** dst = *dstp;
+		if(dst!=NULL && sample_index >=0 && sample_index < nsmpl && dst[sample_index]!=NULL)
 			{
 			ext = mkString(dst[sample_index]);
 			}
-		free(dst[0]);
 		}
-	free(dst);
 	UNPROTECT(nprotect);
 	return ext;
 	}
@@ -2111,11 +2669,11 @@ SEXP GenotypeInt32Attribute(SEXP sexpGt,SEXP sexpatt) {
 	
 
 	if(bcf_hdr_idinfo_exists(hdr,BCF_HL_FMT,tag_id)) {
-		int ndst=0;
-		int32_t* dst=NULL;
-		int ret=bcf_get_format_int32(hdr,ctx,att,(void**)&dst,&ndst);
+		rbcf_arena_t* scratch = RBcfScratch();
+		int ret=bcf_get_format_int32(hdr,ctx,att,&scratch->buf[RBCF_BUF_FMT],&scratch->m_buf[RBCF_BUF_FMT]);
+		int32_t* dst = (int32_t*)scratch->buf[RBCF_BUF_FMT];
 		if(ret>=0 && dst!=NULL ) {
-			int per_sample = ndst/bcf_hdr_nsamples(hdr);
+			int per_sample = ret/bcf_hdr_nsamples(hdr);
 			int32_t *ptr = dst + sample_index*per_sample;
 			for (int j=0; j< per_sample ; j++) {
 			    int32_t val=ptr[j];
@@ -2124,7 +2682,6 @@ SEXP GenotypeInt32Attribute(SEXP sexpGt,SEXP sexpatt) {
 			    Int32ArrayPush(array,val);
 			    }
 			}
-		free(dst);
 		}
 
 	SEXP ext = PROTECT(allocVector(INTSXP,array->size));nprotect++;	
@@ -2163,11 +2720,11 @@ SEXP GenotypeFloatAttribute(SEXP sexpGt,SEXP sexpatt) {
 	
 
 	if(bcf_hdr_idinfo_exists(hdr,BCF_HL_FMT,tag_id)) {
-		int ndst=0;
-		float* dst=NULL;
-		int ret=bcf_get_format_float(hdr,ctx,att,(void**)&dst,&ndst);
+		rbcf_arena_t* scratch = RBcfScratch();
+		int ret=bcf_get_format_float(hdr,ctx,att,&scratch->buf[RBCF_BUF_FMT],&scratch->m_buf[RBCF_BUF_FMT]);
+		float* dst = (float*)scratch->buf[RBCF_BUF_FMT];
 		if(ret>=0 && dst!=NULL ) {
-			int per_sample = ndst/bcf_hdr_nsamples(hdr);
+			int per_sample = ret/bcf_hdr_nsamples(hdr);
 			float *ptr = dst + sample_index*per_sample;
 			for (int j=0; j< per_sample ; j++) {
 			    float val=ptr[j];
@@ -2176,7 +2733,6 @@ SEXP GenotypeFloatAttribute(SEXP sexpGt,SEXP sexpatt) {
 			    FloatArrayPush(array,val);
 			    }
 			}
-		free(dst);
 		}
 
 	SEXP ext = PROTECT(allocVector(REALSXP,array->size));nprotect++;	
@@ -2208,23 +2764,18 @@ SEXP VariantGenotypesFlagAttribute(SEXP sexpCtx,SEXP sexpatt) {
 		return R_NilValue;
 	}
 	
-	int ndst=0;
-	int32_t* dst=NULL;
-	int ret = bcf_get_format_int32(hdr,ctx,att,(void**)&dst,&ndst);
-	if(dst == NULL) {
-		UNPROTECT(nprotect);
-		return R_NilValue;
-	}
-	if(ret==0) {
-		free(dst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_format_int32(hdr,ctx,att,&scratch->buf[RBCF_BUF_FMT],&scratch->m_buf[RBCF_BUF_FMT]);
+	int32_t* dst = (int32_t*)scratch->buf[RBCF_BUF_FMT];
+	if(ret<=0 || dst == NULL) {
 		UNPROTECT(nprotect);
 		return R_NilValue;
 	}
 		
 	// Copy the results
-	SEXP ext = PROTECT(allocVector(LGLSXP,ndst));nprotect++;	
+	SEXP ext = PROTECT(allocVector(LGLSXP,ret));nprotect++;	
 	int j = 0;
-	for (; j< ndst; j++) {
+	for (; j< ret; j++) {
 	  int32_t val = dst[j];
 	  if (val==bcf_int32_vector_end) {
 	  	INTEGER(ext)[j] = R_NaInt;
@@ -2232,7 +2783,6 @@ SEXP VariantGenotypesFlagAttribute(SEXP sexpCtx,SEXP sexpatt) {
 			INTEGER(ext)[j] = val == 0 ? 0 : 1;
 		}
 	}
-	free(dst);
 		
 	UNPROTECT(nprotect);
 	return ext;
@@ -2257,23 +2807,18 @@ SEXP VariantGenotypesInt32Attribute(SEXP sexpCtx,SEXP sexpatt) {
 		return R_NilValue;
 	}
 	
-	int ndst=0;
-	int32_t* dst=NULL;
-	int ret=bcf_get_format_int32(hdr,ctx,att,(void**)&dst,&ndst);
-	if(dst == NULL) {
-		UNPROTECT(nprotect);
-		return R_NilValue;
-	}
-	if(ret==0) {
-		free(dst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_format_int32(hdr,ctx,att,&scratch->buf[RBCF_BUF_FMT],&scratch->m_buf[RBCF_BUF_FMT]);
+	int32_t* dst = (int32_t*)scratch->buf[RBCF_BUF_FMT];
+	if(ret<=0 || dst == NULL) {
 		UNPROTECT(nprotect);
 		return R_NilValue;
 	}
 		
 	// Copy the results
-	SEXP ext = PROTECT(allocVector(INTSXP,ndst));nprotect++;	
+	SEXP ext = PROTECT(allocVector(INTSXP,ret));nprotect++;	
 	int j = 0;
-	for (; j< ndst; j++) {
+	for (; j< ret; j++) {
 	  int32_t val = dst[j];
 	  if (val==bcf_int32_vector_end) {
 	  	INTEGER(ext)[j] = R_NaInt;
@@ -2281,7 +2826,6 @@ SEXP VariantGenotypesInt32Attribute(SEXP sexpCtx,SEXP sexpatt) {
 			INTEGER(ext)[j] = val;
 		}
 	}
-	free(dst);
 		
 	UNPROTECT(nprotect);
 	return ext;
@@ -2305,31 +2849,25 @@ SEXP VariantGenotypesFloatAttribute(SEXP sexpCtx,SEXP sexpatt) {
 		return R_NilValue;
 	}
 	
-	int ndst=0;
-	int32_t* dst=NULL;
-	int ret=bcf_get_format_float(hdr,ctx,att,(void**)&dst,&ndst);
-	if(dst == NULL) {
-		UNPROTECT(nprotect);
-		return R_NilValue;
-	}
-	if(ret==0) {
-		free(dst);
+	rbcf_arena_t* scratch = RBcfScratch();
+	int ret=bcf_get_format_float(hdr,ctx,att,&scratch->buf[RBCF_BUF_FMT],&scratch->m_buf[RBCF_BUF_FMT]);
+	float* dst = (float*)scratch->buf[RBCF_BUF_FMT];
+	if(ret<=0 || dst == NULL) {
 		UNPROTECT(nprotect);
 		return R_NilValue;
 	}
 		
 	// Copy the results
-	SEXP ext = PROTECT(allocVector(REALSXP,ndst));nprotect++;	
+	SEXP ext = PROTECT(allocVector(REALSXP,ret));nprotect++;	
 	int j = 0;
-	for (; j< ndst; j++) {
-	  int32_t val = dst[j];
-	  if (val==bcf_float_vector_end) {
+	for (; j< ret; j++) {
+	  float val = dst[j];
+	  if (bcf_float_is_vector_end(val)) {
 	  	REAL(ext)[j] = R_NaReal;
 		} else {
 			REAL(ext)[j] = val;
 		}
 	}
-	free(dst);
 		
 	UNPROTECT(nprotect);
 	return ext;
@@ -0,0 +1,366 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "htslib/hts.h"
+#include "htslib/tbx.h"
+#include "htslib/kstring.h"
+#include "htslib/kseq.h"
+#include "RBCFLib.h"
+#include "vbi_index_capi.h"
+
+/*
+ * Tabix-indexed TSV reader.
+ *
+ * A context keeps the BGZF handle and the .tbi/.csi open across calls so
+ * region queries only pay for the blocks they touch. Rows are split and
+ * converted straight into typed column buffers following a schema of
+ * per-column type codes (see TSV_* below); no intermediate character
+ * matrix is built on the R side.
+ */
+
+enum { TSV_SKIP = 0, TSV_CHARACTER = 1, TSV_INTEGER = 2, TSV_DOUBLE = 3, TSV_LOGICAL = 4 };
+
+typedef struct {
+    htsFile *fp;
+    tbx_t *tbx;
+    kstring_t line;
+} TabixTsvContext, *TabixTsvContextPtr;
+
+typedef struct {
+    int type;
+    size_t n, m;
+    int *ival;          /* integer and logical columns */
+    double *dval;
+    kstring_t sbuf;     /* NUL-separated character values */
+    size_t *soff;       /* offset into sbuf, (size_t)-1 for NA */
+} tsv_column_t;
+
+static void tabix_tsv_free(TabixTsvContextPtr ctx) {
+    if (!ctx) return;
+    if (ctx->tbx) tbx_destroy(ctx->tbx);
+    if (ctx->fp) hts_close(ctx->fp);
+    free(ctx->line.s);
+    R_Free(ctx);
+}
+
+static void RC_tabix_finalizer(SEXP extPtr) {
+    TabixTsvContextPtr ctx = (TabixTsvContextPtr) R_ExternalPtrAddr(extPtr);
+    if (ctx) {
+        tabix_tsv_free(ctx);
+        R_SetExternalPtrAddr(extPtr, NULL);
+    }
+}
+
+static TabixTsvContextPtr tabix_ctx(SEXP extPtr) {
+    if (TYPEOF(extPtr) != EXTPTRSXP) Rf_error("[Tabix] Invalid context");
+    TabixTsvContextPtr ctx = (TabixTsvContextPtr) R_ExternalPtrAddr(extPtr);
+    if (!ctx || !ctx->fp || !ctx->tbx) Rf_error("[Tabix] Context is closed");
+    return ctx;
+}
+
+/* split a line in place on tabs, returns the number of fields */
+static int split_tabs(char *s, size_t len, char ***fields, int *mfields) {
+    int n = 0;
+    char *p = s, *end = s + len;
+    while (1) {
+        if (n == *mfields) {
+            *mfields = *mfields ? *mfields * 2 : 16;
+            *fields = realloc(*fields, *mfields * sizeof(char *));
+        }
+        (*fields)[n++] = p;
+        char *tab = memchr(p, '\t', end - p);
+        if (!tab) break;
+        *tab = '\0';
+        p = tab + 1;
+    }
+    // drop a trailing '\r' from CRLF files
+    if (len > 0 && s[len - 1] == '\r') s[len - 1] = '\0';
+    return n;
+}
+
+/*
+ * RC_tabix_open(path)
+ * Returns list(ptr, columns, seqnames). Column names come from the last
+ * header line (meta-char or skipped lines), otherwise V1..Vn.
+ */
+SEXP RC_tabix_open(SEXP path) {
+    const char *fn = CHAR(STRING_ELT(path, 0));
+    TabixTsvContextPtr ctx = (TabixTsvContextPtr) R_Calloc(1, TabixTsvContext);
+
+    ctx->fp = hts_open(fn, "r");
+    if (!ctx->fp) {
+        tabix_tsv_free(ctx);
+        Rf_error("[Tabix] Failed to open %s", fn);
+    }
+    if (hts_get_format(ctx->fp)->compression != bgzf) {
+        tabix_tsv_free(ctx);
+        Rf_error("[Tabix] %s is not BGZF-compressed", fn);
+    }
+    ctx->tbx = tbx_index_load3(fn, NULL, HTS_IDX_SAVE_REMOTE | HTS_IDX_LAZY);
+    if (!ctx->tbx) {
+        tabix_tsv_free(ctx);
+        Rf_error("[Tabix] Cannot open tabix index for %s", fn);
+    }
+
+    // header scan: keep the last header line and size the first record
+    kstring_t header = {0, 0, NULL};
+    char **fields = NULL;
+    int mfields = 0, ncol = 0, lineno = 0;
+    while (hts_getline(ctx->fp, KS_SEP_LINE, &ctx->line) >= 0) {
+        if (lineno++ < ctx->tbx->conf.line_skip || (ctx->line.l && ctx->line.s[0] == ctx->tbx->conf.meta_char)) {
+            header.l = 0;
+            kputsn(ctx->line.s, ctx->line.l, &header);
+            continue;
+        }
+        ncol = split_tabs(ctx->line.s, ctx->line.l, &fields, &mfields);
+        break;
+    }
+
+    int nhdr = 0;
+    char *hstart = header.s;
+    if (header.l) {
+        while (*hstart == ctx->tbx->conf.meta_char) { hstart++; header.l--; }
+        nhdr = split_tabs(hstart, header.l, &fields, &mfields);
+    }
+    if (ncol == 0) ncol = nhdr;
+
+    SEXP columns = PROTECT(allocVector(STRSXP, ncol));
+    for (int j = 0; j < ncol; j++) {
+        if (nhdr == ncol) {
+            SET_STRING_ELT(columns, j, mkChar(fields[j]));
+        } else {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "V%d", j + 1);
+            SET_STRING_ELT(columns, j, mkChar(buf));
+        }
+    }
+    free(fields);
+    free(header.s);
+
+    int nseq = 0;
+    const char **names = tbx_seqnames(ctx->tbx, &nseq);
+    SEXP seqnames = PROTECT(allocVector(STRSXP, nseq));
+    for (int i = 0; i < nseq; i++) SET_STRING_ELT(seqnames, i, mkChar(names[i]));
+    free(names);
+
+    SEXP extPtr = PROTECT(R_MakeExternalPtr(ctx, R_NilValue, R_NilValue));
+    R_RegisterCFinalizerEx(extPtr, (R_CFinalizer_t)RC_tabix_finalizer, 1);
+
+    SEXP res = PROTECT(allocVector(VECSXP, 3));
+    SET_VECTOR_ELT(res, 0, extPtr);
+    SET_VECTOR_ELT(res, 1, columns);
+    SET_VECTOR_ELT(res, 2, seqnames);
+    SEXP nms = PROTECT(allocVector(STRSXP, 3));
+    SET_STRING_ELT(nms, 0, mkChar("ptr"));
+    SET_STRING_ELT(nms, 1, mkChar("columns"));
+    SET_STRING_ELT(nms, 2, mkChar("seqnames"));
+    setAttrib(res, R_NamesSymbol, nms);
+    UNPROTECT(5);
+    return res;
+}
+
+SEXP RC_tabix_close(SEXP extPtr) {
+    RC_tabix_finalizer(extPtr);
+    return ScalarLogical(1);
+}
+
+static int is_na_token(const char *s) {
+    return s[0] == '\0' || (s[0] == '.' && s[1] == '\0') || strcmp(s, "NA") == 0;
+}
+
+static void column_grow(tsv_column_t *col) {
+    if (col->n < col->m) return;
+    col->m = col->m ? col->m * 2 : 1024;
+    switch (col->type) {
+        case TSV_INTEGER:
+        case TSV_LOGICAL:
+            col->ival = realloc(col->ival, col->m * sizeof(int));
+            break;
+        case TSV_DOUBLE:
+            col->dval = realloc(col->dval, col->m * sizeof(double));
+            break;
+        case TSV_CHARACTER:
+            col->soff = realloc(col->soff, col->m * sizeof(size_t));
+            break;
+    }
+}
+
+/* returns 1 if the token could not be converted (stored as NA) */
+static int column_push(tsv_column_t *col, const char *tok) {
+    column_grow(col);
+    size_t i = col->n++;
+    int na = tok == NULL || is_na_token(tok);
+    char *end;
+    switch (col->type) {
+        case TSV_CHARACTER:
+            if (tok == NULL || strcmp(tok, "NA") == 0) {
+                col->soff[i] = (size_t)-1;
+            } else {
+                col->soff[i] = col->sbuf.l;
+                kputsn(tok, strlen(tok), &col->sbuf);
+                kputc('\0', &col->sbuf);
+            }
+            return 0;
+        case TSV_INTEGER: {
+            if (na) { col->ival[i] = NA_INTEGER; return 0; }
+            errno = 0;
+            long v = strtol(tok, &end, 10);
+            if (*end != '\0' || errno || v > INT_MAX || v <= INT_MIN) {
+                col->ival[i] = NA_INTEGER;
+                return 1;
+            }
+            col->ival[i] = (int) v;
+            return 0;
+        }
+        case TSV_DOUBLE: {
+            if (na) { col->dval[i] = NA_REAL; return 0; }
+            double v = strtod(tok, &end);
+            if (*end != '\0') {
+                col->dval[i] = NA_REAL;
+                return 1;
+            }
+            col->dval[i] = v;
+            return 0;
+        }
+        case TSV_LOGICAL:
+            if (na) { col->ival[i] = NA_LOGICAL; return 0; }
+            if (!strcmp(tok, "TRUE") || !strcmp(tok, "true") || !strcmp(tok, "T") || !strcmp(tok, "1")) {
+                col->ival[i] = 1;
+            } else if (!strcmp(tok, "FALSE") || !strcmp(tok, "false") || !strcmp(tok, "F") || !strcmp(tok, "0")) {
+                col->ival[i] = 0;
+            } else {
+                col->ival[i] = NA_LOGICAL;
+                return 1;
+            }
+            return 0;
+    }
+    return 0;
+}
+
+static void columns_free(tsv_column_t *cols, int n) {
+    for (int j = 0; j < n; j++) {
+        free(cols[j].ival);
+        free(cols[j].dval);
+        free(cols[j].soff);
+        free(cols[j].sbuf.s);
+    }
+    free(cols);
+}
+
+/*
+ * RC_tabix_query(ptr, regions, types, names, region_index)
+ * types: integer type code per file column (TSV_SKIP drops the column).
+ * Rows are returned region by region in the order the regions were given.
+ */
+SEXP RC_tabix_query(SEXP extPtr, SEXP regions, SEXP types, SEXP names, SEXP region_index) {
+    TabixTsvContextPtr ctx = tabix_ctx(extPtr);
+    int nreg = length(regions);
+    int ntype = length(types);
+    int with_region = asLogical(region_index) == TRUE;
+    const int *type = INTEGER(types);
+
+    int nout = 0;
+    for (int j = 0; j < ntype; j++) if (type[j] != TSV_SKIP) nout++;
+
+    tsv_column_t *cols = calloc(ntype, sizeof(tsv_column_t));
+    for (int j = 0; j < ntype; j++) cols[j].type = type[j];
+    int *reg_idx = NULL;
+    size_t nrow = 0, mrow = 0, nbad = 0;
+    char **fields = NULL;
+    int mfields = 0, interrupted = 0;
+
+    for (int r = 0; r < nreg && !interrupted; r++) {
+        if (STRING_ELT(regions, r) == NA_STRING) continue;
+        hts_itr_t *itr = tbx_itr_querys(ctx->tbx, CHAR(STRING_ELT(regions, r)));
+        // unknown contig or empty region: nothing to return
+        if (!itr) continue;
+        while (tbx_itr_next(ctx->fp, ctx->tbx, itr, &ctx->line) >= 0) {
+            int nf = split_tabs(ctx->line.s, ctx->line.l, &fields, &mfields);
+            for (int j = 0; j < ntype; j++) {
+                if (type[j] == TSV_SKIP) continue;
+                nbad += column_push(&cols[j], j < nf ? fields[j] : NULL);
+            }
+            if (with_region) {
+                if (nrow == mrow) {
+                    mrow = mrow ? mrow * 2 : 1024;
+                    reg_idx = realloc(reg_idx, mrow * sizeof(int));
+                }
+                reg_idx[nrow] = r + 1;
+            }
+            nrow++;
+            if ((nrow & 0xFFFF) == 0 && check_interrupt()) { interrupted = 1; break; }
+        }
+        tbx_itr_destroy(itr);
+    }
+    free(fields);
+    if (interrupted) {
+        columns_free(cols, ntype);
+        free(reg_idx);
+        Rf_error("[Tabix] Query interrupted");
+    }
+    if (nrow > INT_MAX) {
+        columns_free(cols, ntype);
+        free(reg_idx);
+        Rf_error("[Tabix] Too many rows returned (%zu)", nrow);
+    }
+
+    int ncol_out = nout + (with_region ? 1 : 0);
+    SEXP df = PROTECT(allocVector(VECSXP, ncol_out));
+    SEXP df_names = PROTECT(allocVector(STRSXP, ncol_out));
+    int k = 0;
+    if (with_region) {
+        SEXP v = allocVector(INTSXP, (R_xlen_t) nrow);
+        SET_VECTOR_ELT(df, k, v);
+        if (nrow) memcpy(INTEGER(v), reg_idx, nrow * sizeof(int));
+        SET_STRING_ELT(df_names, k++, mkChar("region_index"));
+    }
+    for (int j = 0; j < ntype; j++) {
+        tsv_column_t *col = &cols[j];
+        SEXP v = R_NilValue;
+        switch (col->type) {
+            case TSV_SKIP:
+                continue;
+            case TSV_CHARACTER:
+                v = allocVector(STRSXP, (R_xlen_t) nrow);
+                SET_VECTOR_ELT(df, k, v);
+                for (size_t i = 0; i < nrow; i++) {
+                    SET_STRING_ELT(v, i, col->soff[i] == (size_t)-1 ? NA_STRING
+                                   : mkCharCE(col->sbuf.s + col->soff[i], CE_UTF8));
+                }
+                break;
+            case TSV_INTEGER:
+                v = allocVector(INTSXP, (R_xlen_t) nrow);
+                SET_VECTOR_ELT(df, k, v);
+                if (nrow) memcpy(INTEGER(v), col->ival, nrow * sizeof(int));
+                break;
+            case TSV_DOUBLE:
+                v = allocVector(REALSXP, (R_xlen_t) nrow);
+                SET_VECTOR_ELT(df, k, v);
+                if (nrow) memcpy(REAL(v), col->dval, nrow * sizeof(double));
+                break;
+            case TSV_LOGICAL:
+                v = allocVector(LGLSXP, (R_xlen_t) nrow);
+                SET_VECTOR_ELT(df, k, v);
+                if (nrow) memcpy(LOGICAL(v), col->ival, nrow * sizeof(int));
+                break;
+        }
+        SET_STRING_ELT(df_names, k++, j < length(names) ? STRING_ELT(names, j) : mkChar(""));
+    }
+    columns_free(cols, ntype);
+    free(reg_idx);
+
+    setAttrib(df, R_NamesSymbol, df_names);
+    SEXP rn = PROTECT(allocVector(INTSXP, 2));
+    INTEGER(rn)[0] = NA_INTEGER;
+    INTEGER(rn)[1] = -(int)nrow;
+    setAttrib(df, R_RowNamesSymbol, rn);
+    setAttrib(df, R_ClassSymbol, mkString("data.frame"));
+    if (nbad > 0) {
+        Rf_warning("[Tabix] %zu value(s) could not be converted to the requested type and were set to NA", nbad);
+    }
+    UNPROTECT(3);
+    return df;
+}
@@ -0,0 +1,234 @@
+#include <Rinternals.h>
+#include <R.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+#include "RBCFLib.h"
+#include "vbi_daemon.h"
+
+// queries as consecutive NUL-terminated strings; NA becomes "" (no hits)
+static char *vbid_pack_queries(SEXP queries, uint64_t *nbytes) {
+    R_xlen_t n = XLENGTH(queries);
+    uint64_t len = 0;
+    for (R_xlen_t i = 0; i < n; i++) {
+        SEXP s = STRING_ELT(queries, i);
+        len += (s == NA_STRING ? 0 : LENGTH(s)) + 1;
+    }
+    char *buf = R_alloc(len + 1, 1), *p = buf;
+    for (R_xlen_t i = 0; i < n; i++) {
+        SEXP s = STRING_ELT(queries, i);
+        size_t l = s == NA_STRING ? 0 : LENGTH(s);
+        if (l) memcpy(p, CHAR(s), l);
+        p[l] = 0;
+        p += l + 1;
+    }
+    *nbytes = len;
+    return buf;
+}
+
+// list(query, marker, chrom, pos) of the hits; frees them
+static SEXP vbid_hits_sexp(vbid_hits_t *h, const char **names, uint32_t nchrom) {
+    const char *nms[] = {"query", "marker", "chrom", "pos", ""};
+    SEXP out = PROTECT(mkNamed(VECSXP, nms));
+    SEXP query = allocVector(INTSXP, h->n);
+    SET_VECTOR_ELT(out, 0, query);
+    SEXP marker = allocVector(INTSXP, h->n);
+    SET_VECTOR_ELT(out, 1, marker);
+    SEXP chrom = allocVector(STRSXP, h->n);
+    SET_VECTOR_ELT(out, 2, chrom);
+    SEXP pos = allocVector(REALSXP, h->n);
+    SET_VECTOR_ELT(out, 3, pos);
+    if (h->n) {
+        memcpy(INTEGER(query), h->query, h->n * sizeof(int));
+        memcpy(INTEGER(marker), h->marker, h->n * sizeof(int));
+    }
+    // one CHARSXP per contig
+    SEXP chars = PROTECT(allocVector(STRSXP, nchrom));
+    for (uint32_t i = 0; i < nchrom; i++) SET_STRING_ELT(chars, i, mkChar(names[i]));
+    for (int64_t i = 0; i < h->n; i++) {
+        int32_t c = h->chrom[i];
+        SET_STRING_ELT(chrom, i, c >= 0 && (uint32_t) c < nchrom ? STRING_ELT(chars, c) : NA_STRING);
+        REAL(pos)[i] = (double) h->pos[i];
+    }
+    vbid_hits_free(h);
+    UNPROTECT(2);
+    return out;
+}
+
+static int vbid_op(SEXP op) {
+    const char *s = CHAR(STRING_ELT(op, 0));
+    if (!strcmp(s, "region")) return VBID_OP_REGION;
+    if (!strcmp(s, "id")) return VBID_OP_ID;
+    if (!strcmp(s, "status")) return VBID_OP_STATUS;
+    if (!strcmp(s, "stop")) return VBID_OP_STOP;
+    Rf_error("[VBI] Unknown daemon request: %s", s);
+    return 0;
+}
+
+/*
+ * RC_VBID_query_local(vbi_ptr, op, queries)
+ * Region ("region") or ID ("id") queries against an index loaded in this
+ * process, with the same results as a daemon.
+ */
+SEXP RC_VBID_query_local(SEXP vbi_ptr, SEXP op, SEXP queries) {
+    if (TYPEOF(vbi_ptr) != EXTPTRSXP) Rf_error("[VBI] Not a VBI index pointer");
+    vbi_index_t *idx = (vbi_index_t *) R_ExternalPtrAddr(vbi_ptr);
+    if (!idx) Rf_error("[VBI] Index pointer is NULL");
+    uint64_t nbytes;
+    char *buf = vbid_pack_queries(queries, &nbytes);
+    vbid_hits_t h = {0};
+    char err[256];
+    if (vbid_query(idx, vbid_op(op), buf, (uint32_t) XLENGTH(queries), &h, err, sizeof(err)) < 0) {
+        vbid_hits_free(&h);
+        Rf_error("[VBI] %s", err);
+    }
+    return vbid_hits_sexp(&h, (const char **) idx->chrom_names, idx->n_chroms);
+}
+
+/*
+ * RC_VBID_request(socket, op, vbi_path, queries)
+ * Sends one request to the daemon on socket. NULL when no daemon answers,
+ * so that the caller can fall back to RC_VBID_query_local. Queries return
+ * their hits as in RC_VBID_query_local, "status" the daemon's text and
+ * "stop" TRUE.
+ */
+SEXP RC_VBID_request(SEXP socket, SEXP op, SEXP vbi_path, SEXP queries) {
+    int o = vbid_op(op);
+    const char *path = isNull(vbi_path) ? NULL : CHAR(STRING_ELT(vbi_path, 0));
+    uint64_t nbytes = 0;
+    char *buf = isNull(queries) ? NULL : vbid_pack_queries(queries, &nbytes);
+    int fd = vbid_connect(CHAR(STRING_ELT(socket, 0)));
+    if (fd < 0) return R_NilValue;
+    vbid_hits_t h = {0};
+    uint32_t nchrom;
+    char *text;
+    uint64_t ntext;
+    int status = vbid_request(fd, o, path, buf, isNull(queries) ? 0 : (uint32_t) XLENGTH(queries),
+                              nbytes, &h, &nchrom, &text, &ntext);
+#ifndef _WIN32
+    close(fd);
+#endif
+    if (status == -2) {
+        vbid_hits_free(&h);
+        free(text);
+        return R_NilValue;
+    }
+    if (status < 0) {
+        char msg[1024];
+        snprintf(msg, sizeof(msg), "%s", text ? text : "daemon error");
+        vbid_hits_free(&h);
+        free(text);
+        Rf_error("[VBI] Daemon: %s", msg);
+    }
+    if (o == VBID_OP_STOP) {
+        free(text);
+        return ScalarLogical(TRUE);
+    }
+    if (o == VBID_OP_STATUS) {
+        SEXP out = PROTECT(mkString(text ? text : ""));
+        free(text);
+        UNPROTECT(1);
+        return out;
+    }
+    // the contig names, NUL-terminated
+    const char **names = (const char **) R_alloc(nchrom + 1, sizeof(char *));
+    uint64_t k = 0;
+    for (uint32_t i = 0; i < nchrom; i++) {
+        names[i] = k < ntext ? text + k : "";
+        while (k < ntext && text[k]) k++;
+        k++;
+    }
+    SEXP out = PROTECT(vbid_hits_sexp(&h, names, nchrom));
+    free(text);
+    UNPROTECT(1);
+    return out;
+}
+
+#ifndef _WIN32
+static int vbid_interrupted(void) {
+    return check_interrupt();
+}
+#endif
+
+/*
+ * RC_VBID_start(socket, idle, detach)
+ * Listens on socket, then serves in a detached process (returning its pid)
+ * or in this one until stopped or interrupted (returning NULL).
+ */
+SEXP RC_VBID_start(SEXP socket, SEXP idle, SEXP detach) {
+#ifdef _WIN32
+    Rf_error("[VBI] The VBI daemon is not supported on Windows");
+    return R_NilValue;
+#else
+    const char *path = CHAR(STRING_ELT(socket, 0));
+    int idle_s = asInteger(idle);
+    if (idle_s == NA_INTEGER || idle_s < 0) idle_s = 0;
+    char err[512];
+    int fd = vbid_listen(path, err, sizeof(err));
+    if (fd < 0) Rf_error("[VBI] %s", err);
+    if (asLogical(detach) != TRUE) {
+        vbid_serve(fd, path, idle_s, vbid_interrupted);
+        return R_NilValue;
+    }
+    // double fork: the daemon is reparented and outlives this session
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+        close(fd);
+        unlink(path);
+        Rf_error("[VBI] pipe() failed: %s", strerror(errno));
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fd);
+        close(pfd[0]);
+        close(pfd[1]);
+        unlink(path);
+        Rf_error("[VBI] fork() failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        close(pfd[0]);
+        setsid();
+        pid_t daemon = fork();
+        if (daemon == 0) {
+            int null = open("/dev/null", O_RDWR);
+            if (null >= 0) {
+                dup2(null, 0);
+                dup2(null, 1);
+                dup2(null, 2);
+                if (null > 2) close(null);
+            }
+            // drop the files of the R session, keep the socket
+            long maxfd = sysconf(_SC_OPEN_MAX);
+            if (maxfd < 0 || maxfd > 65536) maxfd = 65536;
+            for (int i = 3; i < maxfd; i++) if (i != fd) close(i);
+            signal(SIGINT, SIG_IGN);
+            signal(SIGPIPE, SIG_IGN);
+            vbid_serve(fd, path, idle_s, NULL);
+            // Use raise(SIGKILL) instead of _exit to avoid R finalization code
+            raise(SIGKILL);
+        }
+        ssize_t w = write(pfd[1], &daemon, sizeof(daemon));
+        (void) w;
+        raise(SIGKILL);
+    }
+    close(fd);
+    close(pfd[1]);
+    int status;
+    waitpid(pid, &status, 0);
+    pid_t daemon = -1;
+    ssize_t r;
+    do r = read(pfd[0], &daemon, sizeof(daemon)); while (r < 0 && errno == EINTR);
+    close(pfd[0]);
+    if (r != sizeof(daemon) || daemon < 0) {
+        unlink(path);
+        Rf_error("[VBI] Failed to start the daemon");
+    }
+    return ScalarInteger((int) daemon);
+#endif
+}
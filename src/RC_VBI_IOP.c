@@ -5,11 +5,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
 #include "htslib/hts.h"
 #include "htslib/bgzf.h"
 #include "htslib/vcf.h"
 #include "htslib/hfile.h"
 #include "vbi_index_capi.h"
+#include "vbi_map.h"
+#include "vbi_context.h"
+#include "bcf_batch.h"
+#include "rbcf_arena.h"
 #include "cgranges.h"
 
 // VCF/BCF header metadata structures
@@ -83,6 +89,9 @@ typedef struct vbi_vcf_context_t {
     kstring_t tmp_line;
     int query_failed;
     VcfHeaderMetadata *header_meta;
+    rbcf_arena_t arena;  // scratch memory, reset at the start of each query
+    vbi_map_t map;       // uncompressed BCF mapped into memory, see vbi_map.h
+    bcf_batch_t *batch;  // decode batch of the queries, kept between them
 } VBIVcfContext, *VBIVcfContextPtr;
 
 // CGRanges pointer type definition
@@ -99,18 +108,19 @@ SEXP RC_cgranges_destroy(SEXP cr_ptr);
 // Replace old forward declaration with new helper signature
 static SEXP vbi_query_variants_basic(VBIVcfContextPtr ctx, int *hits, int nfound,
                                     int inc_info, int inc_format, int inc_genotypes);
-// Forward declarations from vbi_index.c and vbi_index_capi.h
-int do_index(const char *infile, const char *outfile, int n_threads);
+// Forward declarations
 SEXP RC_VBI_index_memory_usage(SEXP extPtr);
 void RC_VBI_vcf_context_finalizer(SEXP extPtr);
 
 // VBI indexing wrapper function
-SEXP RC_VBI_index(SEXP vcf_path, SEXP vbi_path, SEXP threads) {
+SEXP RC_VBI_index(SEXP vcf_path, SEXP vbi_path, SEXP threads, SEXP keys, SEXP payload) {
     const char *vcf = CHAR(STRING_ELT(vcf_path, 0));
     const char *vbi = CHAR(STRING_ELT(vbi_path, 0));
     int nthreads = asInteger(threads);
+    int flags = (asLogical(keys) == TRUE ? VBI_INDEX_KEYS : 0) |
+                (asLogical(payload) == TRUE ? VBI_INDEX_PAYLOAD : 0);
     
-    int result = do_index(vcf, vbi, nthreads);
+    int result = do_index(vcf, vbi, nthreads, flags);
     if (result != 0) {
         Rf_error("[VBI] Indexing failed for %s", vcf);
     }
@@ -307,8 +317,6 @@ SEXP RC_cgranges_destroy(SEXP cr_ptr);
 // Replace old forward declaration with new helper signature
 static SEXP vbi_query_variants_basic(VBIVcfContextPtr ctx, int *hits, int nfound,
                                     int inc_info, int inc_format, int inc_genotypes);
-// Forward declarations from vbi_index.c and vbi_index_capi.h
-int do_index(const char *infile, const char *outfile, int n_threads);
 void RC_VBI_vcf_context_finalizer(SEXP extPtr);
 
 
@@ -326,7 +334,7 @@ SEXP RC_VBI_print_index(SEXP vbi_ptr, SEXP n) {
 }
 
 // Create VBI VCF context combining VCF file and VBI index
-SEXP RC_VBI_vcf_load(SEXP vcf_path, SEXP vbi_path) {
+SEXP RC_VBI_vcf_load(SEXP vcf_path, SEXP vbi_path, SEXP use_map) {
     const char *vcf = CHAR(STRING_ELT(vcf_path, 0));
     const char *vbi = NULL;
     char *auto_vbi = NULL;  // Track if we allocated memory
@@ -345,13 +353,14 @@ SEXP RC_VBI_vcf_load(SEXP vcf_path, SEXP vbi_path) {
     VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_Calloc(1, VBIVcfContext);
     ctx->query_failed = 0;
     memset(&ctx->tmp_line, 0, sizeof(kstring_t));
+    rbcf_arena_init(&ctx->arena);
     
     // Load VBI index, create if it doesn't exist
     ctx->vbi_idx = vbi_index_load(vbi);
     if (!ctx->vbi_idx) {
         // Try to create the index if it doesn't exist
         Rprintf("[VBI] Index not found at %s, creating...\n", vbi);
-        int result = do_index(vcf, vbi, 1); // Use 1 thread for indexing
+        int result = do_index(vcf, vbi, 1, 0); // Use 1 thread for indexing
         if (result != 0) {
             if (auto_vbi) free(auto_vbi);
             R_Free(ctx);
@@ -399,6 +408,13 @@ SEXP RC_VBI_vcf_load(SEXP vcf_path, SEXP vbi_path) {
     
     // Parse header metadata
     ctx->header_meta = parse_vcf_header_metadata(ctx->hdr);
+
+    // Records are decoded straight from the mapping where they are stored
+    // uncompressed; other files keep the regular read path
+    if (asLogical(use_map) == TRUE) {
+        if (ctx->fp->format.format != bcf || vbi_map_open(&ctx->map, vcf) != 0)
+            Rf_warning("[VBI] %s is not an uncompressed BCF file, reading it without mmap", vcf);
+    }
     
     // Clean up auto-allocated memory
     if (auto_vbi) free(auto_vbi);
@@ -419,6 +435,11 @@ void RC_VBI_vcf_context_finalizer(SEXP extPtr) {
         if (ctx->vbi_idx) vbi_index_free(ctx->vbi_idx);
         if (ctx->tmp_line.s) free(ctx->tmp_line.s);
         if (ctx->header_meta) free_vcf_header_metadata(ctx->header_meta);
+        // records may still point into the mapping
+        for (int i = 0; i < ctx->arena.n_recs; i++) vbi_map_release(ctx->arena.recs[i]);
+        vbi_map_close(&ctx->map);
+        rbcf_arena_destroy(&ctx->arena);
+        bcf_batch_destroy(ctx->batch);
         R_Free(ctx);
         R_SetExternalPtrAddr(extPtr, NULL);
     }
@@ -596,8 +617,39 @@ SEXP RC_VBI_extract_ranges(SEXP idx_ptr, SEXP n) {
     return df;
 }
 
+// Reads marker idx_var into rec: from the mapping when the file is mapped,
+// otherwise by seeking to its offset. Returns 0, or -1 on failure.
+static int vbi_read_marker(VBIVcfContextPtr ctx, int idx_var, bcf1_t *rec) {
+    int64_t off = ctx->vbi_idx->offsets[idx_var];
+    if (ctx->map.base) {
+        // 1: the record sits in a compressed block, read it below
+        int ret = vbi_map_record(&ctx->map, off, rec);
+        if (ret == 0) return rec->rid >= 0 && rec->rid < ctx->hdr->n[BCF_DT_CTG] ? 0 : -1;
+        if (ret != 1) return -1;
+    }
+    int seek_ok = 0;
+    vbi_map_release(rec);
+    if (ctx->fp->format.compression == bgzf) {
+        BGZF *bg = (BGZF *)ctx->fp->fp.bgzf;
+        seek_ok = (bgzf_seek(bg, off, SEEK_SET) == 0);
+    } else if (ctx->fp->format.format == bcf) {
+        // raw BCF is still read through a BGZF handle, whose
+        // offsets are block address << 16 | offset in block
+        BGZF *bg = (BGZF *)ctx->fp->fp.bgzf;
+        seek_ok = (bgzf_useek(bg, (off >> 16) + (off & 0xffff), SEEK_SET) == 0);
+    } else {
+        hFILE *hf = (hFILE *)ctx->fp->fp.hfile;
+        seek_ok = (hseek(hf, (off_t)off, SEEK_SET) == 0);
+    }
+    return seek_ok && bcf_read(ctx->fp, ctx->hdr, rec) >= 0 ? 0 : -1;
+}
+
 // Shared helper to build a data.frame for a set of variant indices (hits)
 // Columns: chrom,pos,id,ref,alt,qual,filter,n_allele,index,[CSQ],[ANN]
+// Records are decoded VBI_BATCH_SIZE at a time into a bcf_batch_t; the
+// R columns are then filled from its arrays. INFO/FORMAT_IDS need every
+// tag of a record, so they are still rendered from the records themselves.
+#define VBI_BATCH_SIZE 1024
 static SEXP vbi_query_variants_basic(VBIVcfContextPtr ctx, int *hits, int nfound,
                                     int inc_info, int inc_format, int inc_genotypes) {
     if (nfound <= 0) {
@@ -646,76 +698,122 @@ static SEXP vbi_query_variants_basic(VBIVcfContextPtr ctx, int *hits, int nfound
     if (format_cols){ fmt_col = PROTECT(allocVector(STRSXP, nfound)); protect_count++; }
     if (gt_cols) { gt_col = PROTECT(allocVector(STRSXP, nfound)); protect_count++; }
 
-    bcf1_t *rec = bcf_init();
-    kstring_t kalt = {0,0,0};
-    kstring_t kflt = {0,0,0};
-    kstring_t ktmp = {0,0,0};
-    for (int i=0;i<nfound;i++) {
-        int idx_var = hits[i];
-        int seek_ok = 0;
-        if (ctx->fp->format.compression == bgzf) {
-            BGZF *bg = (BGZF *)ctx->fp->fp.bgzf;
-            seek_ok = (bgzf_seek(bg, ctx->vbi_idx->offsets[idx_var], SEEK_SET) == 0);
-        } else {
-            hFILE *hf = (hFILE *)ctx->fp->fp.hfile;
-            seek_ok = (hseek(hf, (off_t)ctx->vbi_idx->offsets[idx_var], SEEK_SET) == 0);
-        }
-        if (!seek_ok || bcf_read(ctx->fp, ctx->hdr, rec) < 0) {
-            SET_STRING_ELT(chrom_col,i,NA_STRING); INTEGER(pos_col)[i]=NA_INTEGER; SET_STRING_ELT(id_col,i,NA_STRING);
-            SET_STRING_ELT(ref_col,i,NA_STRING); SET_STRING_ELT(alt_col,i,NA_STRING); REAL(qual_col)[i]=NA_REAL;
-            SET_STRING_ELT(filter_col,i,NA_STRING); INTEGER(nallele_col)[i]=NA_INTEGER; INTEGER(index_col)[i]=NA_INTEGER;
-            if (with_csq) SET_VECTOR_ELT(csq_col,i,R_NilValue);
-            if (with_ann) SET_VECTOR_ELT(ann_col,i,R_NilValue);
-            if (info_cols) SET_STRING_ELT(info_col,i,NA_STRING);
-            if (format_cols) SET_STRING_ELT(fmt_col,i,NA_STRING);
-            if (gt_cols) SET_STRING_ELT(gt_col,i,NA_STRING);
-            continue;
-        }
-        bcf_unpack(rec, BCF_UN_STR|BCF_UN_INFO| (inc_format||inc_genotypes?BCF_UN_FMT:0) | BCF_UN_FLT);
-        const char *chrom = bcf_hdr_id2name(ctx->hdr, rec->rid);
-        SET_STRING_ELT(chrom_col,i, chrom?mkChar(chrom):NA_STRING);
-        INTEGER(pos_col)[i] = rec->pos + 1;
-        SET_STRING_ELT(id_col,i, (rec->d.id && strcmp(rec->d.id, ".")!=0)? mkChar(rec->d.id): NA_STRING);
-        if (rec->d.allele && rec->n_allele>0){
-            SET_STRING_ELT(ref_col,i, mkChar(rec->d.allele[0]));
-            kalt.l=0; if (rec->n_allele>1){ for(int a=1;a<rec->n_allele;a++){ if(a>1) kputc(',',&kalt); kputs(rec->d.allele[a],&kalt);} SET_STRING_ELT(alt_col,i,mkChar(kalt.s)); } else SET_STRING_ELT(alt_col,i,mkChar("."));
-        } else { SET_STRING_ELT(ref_col,i,NA_STRING); SET_STRING_ELT(alt_col,i,NA_STRING);}        
-        INTEGER(nallele_col)[i]=rec->n_allele; INTEGER(index_col)[i]=idx_var+1; REAL(qual_col)[i]= bcf_float_is_missing(rec->qual)? NA_REAL: rec->qual;
-        kflt.l=0; if(rec->d.n_flt==0){ kputs("PASS",&kflt);} else { for(int f=0;f<rec->d.n_flt;f++){ if(f) kputc(';',&kflt); const char *flt=bcf_hdr_int2id(ctx->hdr, BCF_DT_ID, rec->d.flt[f]); if(flt) kputs(flt,&kflt);} }
-        SET_STRING_ELT(filter_col,i, kflt.s?mkChar(kflt.s):mkChar(""));
-        if (with_csq) SET_VECTOR_ELT(csq_col,i,R_NilValue); // placeholder
-        if (with_ann) SET_VECTOR_ELT(ann_col,i,R_NilValue); // placeholder
-        if (info_cols){
-            // concatenate key=value for all INFO present (simple, may be large)
-            ktmp.l=0; bcf_info_t *inf=NULL; for(int j=0;j<rec->n_info;j++){ inf=&rec->d.info[j]; const char *key = bcf_hdr_int2id(ctx->hdr,BCF_DT_ID,inf->key); if(!key) continue; if(j) kputc(';',&ktmp); kputs(key,&ktmp); if(inf->len>0 && inf->type!=BCF_BT_NULL){ kputc('=',&ktmp); if(inf->type==BCF_BT_INT32){ for(int k=0;k<inf->len;k++){ if(k) kputc(',',&ktmp); kputw(((int32_t*)inf->vptr)[k],&ktmp);} } else if(inf->type==BCF_BT_FLOAT){ for(int k=0;k<inf->len;k++){ if(k) kputc(',',&ktmp); ksprintf(&ktmp,"%g",((float*)inf->vptr)[k]); } } else if(inf->type==BCF_BT_CHAR){ kputsn(inf->vptr,inf->len,&ktmp);} }
+    // records and the row map come from the context arena: they are reused
+    // by the next query and reclaimed by its reset if we error out here
+    int chunk = nfound < VBI_BATCH_SIZE ? nfound : VBI_BATCH_SIZE;
+    rbcf_arena_t *arena = &ctx->arena;
+    bcf1_t **recs = (bcf1_t **) rbcf_arena_alloc(arena, sizeof(bcf1_t *) * chunk);
+    int *row2batch = (int *) rbcf_arena_alloc(arena, sizeof(int) * chunk);
+    if (!recs || !row2batch) Rf_error("[VBI] OOM");
+    for (int j = 0; j < chunk; j++) {
+        recs[j] = rbcf_arena_rec(arena, j);
+        if (!recs[j]) Rf_error("[VBI] OOM variant ctx");
+    }
+    // the batch is held by the context, not by this frame: an R error below
+    // leaves it there for the next query instead of leaking it. Its only
+    // column is GT, so it is rebuilt when a query wants the other set
+    bcf_batch_t *batch = ctx->batch;
+    if (batch && (batch->n_cols > 0) != (inc_genotypes != 0)) {
+        bcf_batch_destroy(batch);
+        ctx->batch = batch = NULL;
+    }
+    if (!batch) {
+        if (!(ctx->batch = batch = bcf_batch_init(ctx->hdr))) Rf_error("[VBI] OOM");
+        if (inc_genotypes) bcf_batch_add_format(batch, ctx->hdr, "GT");
+    }
+    int gt_idx = batch->n_cols > 0 ? 0 : -1;
+    batch->unpack = BCF_UN_STR | BCF_UN_FLT;
+    if (gt_idx >= 0) batch->unpack |= BCF_UN_FMT;
+    if (inc_info) batch->unpack |= BCF_UN_INFO;
+    if (inc_format) batch->unpack |= BCF_UN_FMT;
+    // cache the ids of CHROM once per query rather than per record
+    int n_ctg = ctx->hdr->n[BCF_DT_CTG];
+    SEXP ctg_names = PROTECT(allocVector(STRSXP, n_ctg)); protect_count++;
+    for (int c = 0; c < n_ctg; c++) {
+        const char *name = bcf_hdr_id2name(ctx->hdr, c);
+        SET_STRING_ELT(ctg_names, c, name ? mkChar(name) : NA_STRING);
+    }
+
+    kstring_t *ktmp = &arena->str;
+    for (int r0 = 0; r0 < nfound; r0 += chunk) {
+        int r1 = r0 + chunk < nfound ? r0 + chunk : nfound;
+        bcf_batch_clear(batch);
+        for (int i = r0; i < r1; i++) {
+            int idx_var = hits[i];
+            bcf1_t *rec = recs[i - r0];
+            row2batch[i - r0] = -1;
+            if (vbi_read_marker(ctx, idx_var, rec) == 0 && bcf_batch_push(batch, ctx->hdr, rec) == 0) {
+                row2batch[i - r0] = batch->n - 1;
             }
-            SET_STRING_ELT(info_col,i, ktmp.s?mkChar(ktmp.s):NA_STRING);
-        }
-        if (format_cols){
-            ktmp.l=0; for(int j=0;j<rec->n_fmt;j++){ if(j) kputc(';',&ktmp); const char *fid=bcf_hdr_int2id(ctx->hdr,BCF_DT_ID,rec->d.fmt[j].id); if(fid) kputs(fid,&ktmp);} SET_STRING_ELT(fmt_col,i, ktmp.s?mkChar(ktmp.s):NA_STRING);
         }
-        if (gt_cols){
-            ktmp.l=0; int ngt_arr=0; int32_t *gt=NULL; int ngt=bcf_get_genotypes(ctx->hdr, rec, &gt, &ngt_arr);
-            int ns= bcf_hdr_nsamples(ctx->hdr);
-            if(ngt>0 && ns>0){
-                int ploidy = ngt / ns;
-                for(int s=0;s<ns;s++){
-                    if(s) kputc(';',&ktmp);
-                    for(int p=0;p<ploidy;p++){
-                        if(p) kputc('/', &ktmp);
-                        int32_t g = gt[s*ploidy + p];
-                        if (g==bcf_int32_vector_end) break;
-                        if (g==bcf_gt_missing) { kputc('.',&ktmp); continue; }
-                        ksprintf(&ktmp, "%d", bcf_gt_allele(g));
+        bcf_batch_col_t *gt = gt_idx >= 0 ? &batch->cols[gt_idx] : NULL;
+        for (int i = r0; i < r1; i++) {
+            int b = row2batch[i - r0];
+            if (b < 0) {
+                SET_STRING_ELT(chrom_col,i,NA_STRING); INTEGER(pos_col)[i]=NA_INTEGER; SET_STRING_ELT(id_col,i,NA_STRING);
+                SET_STRING_ELT(ref_col,i,NA_STRING); SET_STRING_ELT(alt_col,i,NA_STRING); REAL(qual_col)[i]=NA_REAL;
+                SET_STRING_ELT(filter_col,i,NA_STRING); INTEGER(nallele_col)[i]=NA_INTEGER; INTEGER(index_col)[i]=NA_INTEGER;
+                if (with_csq) SET_VECTOR_ELT(csq_col,i,R_NilValue);
+                if (with_ann) SET_VECTOR_ELT(ann_col,i,R_NilValue);
+                if (info_cols) SET_STRING_ELT(info_col,i,NA_STRING);
+                if (format_cols) SET_STRING_ELT(fmt_col,i,NA_STRING);
+                if (gt_cols) SET_STRING_ELT(gt_col,i,NA_STRING);
+                continue;
+            }
+            int rid = batch->rid[b];
+            SET_STRING_ELT(chrom_col,i, rid >= 0 && rid < n_ctg ? STRING_ELT(ctg_names, rid) : NA_STRING);
+            INTEGER(pos_col)[i] = (int)(batch->pos[b] + 1);
+            const char *vid = bcf_batch_id(batch, b);
+            SET_STRING_ELT(id_col,i, strcmp(vid, ".")!=0 ? mkChar(vid) : NA_STRING);
+            if (batch->n_allele[b] > 0) {
+                SET_STRING_ELT(ref_col,i, mkChar(bcf_batch_ref(batch, b)));
+                SET_STRING_ELT(alt_col,i, mkChar(batch->n_allele[b] > 1 ? bcf_batch_alt(batch, b) : "."));
+            } else { SET_STRING_ELT(ref_col,i,NA_STRING); SET_STRING_ELT(alt_col,i,NA_STRING); }
+            INTEGER(nallele_col)[i]=batch->n_allele[b]; INTEGER(index_col)[i]=hits[i]+1;
+            REAL(qual_col)[i]= bcf_float_is_missing(batch->qual[b])? NA_REAL: batch->qual[b];
+            const char *flt = bcf_batch_flt(batch, b);
+            SET_STRING_ELT(filter_col,i, mkChar(*flt ? flt : "PASS"));
+            if (with_csq) SET_VECTOR_ELT(csq_col,i,R_NilValue); // placeholder
+            if (with_ann) SET_VECTOR_ELT(ann_col,i,R_NilValue); // placeholder
+            bcf1_t *rec = recs[i - r0];
+            if (info_cols){
+                // concatenate key=value for all INFO present (simple, may be large)
+                ktmp->l=0; kputs("", ktmp); bcf_info_t *inf=NULL; for(int j=0;j<rec->n_info;j++){ inf=&rec->d.info[j]; const char *key = bcf_hdr_int2id(ctx->hdr,BCF_DT_ID,inf->key); if(!key) continue; if(j) kputc(';',ktmp); kputs(key,ktmp); if(inf->len>0 && inf->type!=BCF_BT_NULL){ kputc('=',ktmp); if(inf->type==BCF_BT_INT32){ for(int k=0;k<inf->len;k++){ if(k) kputc(',',ktmp); kputw(((int32_t*)inf->vptr)[k],ktmp);} } else if(inf->type==BCF_BT_FLOAT){ for(int k=0;k<inf->len;k++){ if(k) kputc(',',ktmp); ksprintf(ktmp,"%g",((float*)inf->vptr)[k]); } } else if(inf->type==BCF_BT_CHAR){ kputsn(inf->vptr,inf->len,ktmp);} }
+                }
+                SET_STRING_ELT(info_col,i, mkChar(ktmp->s));
+            }
+            if (format_cols){
+                ktmp->l=0; kputs("", ktmp); for(int j=0;j<rec->n_fmt;j++){ if(j) kputc(';',ktmp); const char *fid=bcf_hdr_int2id(ctx->hdr,BCF_DT_ID,rec->d.fmt[j].id); if(fid) kputs(fid,ktmp);} SET_STRING_ELT(fmt_col,i, mkChar(ktmp->s));
+            }
+            if (gt_cols){
+                int ploidy = gt ? gt->width[b] : 0;
+                if (ploidy > 0 && batch->n_sample > 0) {
+                    const int32_t *g = (const int32_t *)gt->data + gt->offs[b];
+                    ktmp->l=0;
+                    for(int smp=0;smp<batch->n_sample;smp++){
+                        if(smp) kputc(';',ktmp);
+                        for(int p=0;p<ploidy;p++){
+                            int32_t a = g[smp*ploidy + p];
+                            if (a==bcf_int32_vector_end) break;
+                            if(p) kputc('/', ktmp);
+                            if (bcf_gt_is_missing(a)) { kputc('.',ktmp); continue; }
+                            kputw(bcf_gt_allele(a), ktmp);
+                        }
                     }
+                    SET_STRING_ELT(gt_col,i, mkChar(ktmp->s));
+                } else {
+                    SET_STRING_ELT(gt_col,i, NA_STRING);
                 }
             }
-            if(gt) free(gt);
-            SET_STRING_ELT(gt_col,i, ktmp.s?mkChar(ktmp.s):NA_STRING);
         }
     }
-    bcf_destroy(rec);
-    if(kalt.s) free(kalt.s); if(kflt.s) free(kflt.s); if(ktmp.s) free(ktmp.s);
+    // as for the arena, a batch grown past RBCF_ARENA_KEEP is not kept
+    size_t kept = batch->str.m;
+    for (int c = 0; c < batch->n_cols; c++) kept += batch->cols[c].m_data * sizeof(int32_t);
+    if (kept > RBCF_ARENA_KEEP) {
+        bcf_batch_destroy(batch);
+        ctx->batch = NULL;
+    }
     // assemble df columns
     col=0; // reset column counter (fix redefinition)
     SET_VECTOR_ELT(df,col,chrom_col); SET_STRING_ELT(names,col++,mkChar("chrom"));
@@ -906,17 +1004,230 @@ SEXP RC_VBI_query_by_indices(SEXP vcf_path, SEXP idx_ptr, SEXP start_idx, SEXP e
     int *hits = (int*) malloc(sizeof(int)*nfound); if(!hits) Rf_error("[VBI] OOM");
     for(int i=0;i<nfound;i++) hits[i]= start + i;
     VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_Calloc(1, VBIVcfContext);
-    ctx->query_failed=0; memset(&ctx->tmp_line,0,sizeof(kstring_t));
+    ctx->query_failed=0; memset(&ctx->tmp_line,0,sizeof(kstring_t)); rbcf_arena_init(&ctx->arena);
     ctx->fp = hts_open(vcf, "r"); if(!ctx->fp){ R_Free(ctx); free(hits); Rf_error("Failed to open %s", vcf);}    
     ctx->hdr = bcf_hdr_read(ctx->fp); if(!ctx->hdr){ hts_close(ctx->fp); R_Free(ctx); free(hits); Rf_error("Failed header %s", vcf);}    
     ctx->vbi_idx = idx; ctx->tmp_ctx = bcf_init(); if(!ctx->tmp_ctx){ bcf_hdr_destroy(ctx->hdr); hts_close(ctx->fp); R_Free(ctx); free(hits); Rf_error("[VBI] OOM variant ctx"); }
     SEXP out = vbi_query_variants_basic(ctx, hits, nfound, 0,0,0);
-    if(ctx->tmp_ctx) bcf_destroy(ctx->tmp_ctx); if(ctx->hdr) bcf_hdr_destroy(ctx->hdr); if(ctx->fp) hts_close(ctx->fp); if(ctx->tmp_line.s) free(ctx->tmp_line.s); R_Free(ctx); free(hits);
+    if(ctx->tmp_ctx) bcf_destroy(ctx->tmp_ctx); if(ctx->hdr) bcf_hdr_destroy(ctx->hdr); if(ctx->fp) hts_close(ctx->fp); if(ctx->tmp_line.s) free(ctx->tmp_line.s); rbcf_arena_destroy(&ctx->arena); bcf_batch_destroy(ctx->batch); R_Free(ctx); free(hits);
+    return out;
+}
+
+// Payload filters (VBIIndex(Payload = TRUE))
+
+static const char *vbi_type_names[] = {"snp", "mnp", "indel", "other", "bnd", "overlap", "ins", "del"};
+
+static vbi_payload_t *vbi_payload_from_ctx(vbi_index_t *idx) {
+    if (!idx->payload) Rf_error("[VBI] Index has no payload, rebuild it with VBIIndex(Payload = TRUE)");
+    return idx->payload;
+}
+
+/*
+ * Fills f from filter = NULL or list(af, maf, min_an, types): af and maf
+ * are c(min, max), types a character vector of vbi_type_names or "ref".
+ * Returns 0 for NULL (no filtering).
+ */
+static int vbi_payload_filter_from_sexp(vbi_index_t *idx, SEXP filter, vbi_payload_filter_t *f) {
+    if (isNull(filter)) return 0;
+    if (TYPEOF(filter) != VECSXP || LENGTH(filter) != 4) Rf_error("[VBI] Invalid payload filter");
+    vbi_payload_from_ctx(idx);
+    memset(f, 0, sizeof(*f));
+    f->min_af = f->min_maf = 0;
+    f->max_af = 1;
+    f->max_maf = 0.5;
+    f->types = -1;
+    SEXP af = VECTOR_ELT(filter, 0), maf = VECTOR_ELT(filter, 1);
+    SEXP min_an = VECTOR_ELT(filter, 2), types = VECTOR_ELT(filter, 3);
+    if (!isNull(af)) {
+        f->use_af = 1;
+        f->min_af = REAL(af)[0];
+        f->max_af = REAL(af)[1];
+    }
+    if (!isNull(maf)) {
+        f->use_af = 1;
+        f->min_maf = REAL(maf)[0];
+        f->max_maf = REAL(maf)[1];
+    }
+    if (!isNull(min_an)) f->min_an = asInteger(min_an);
+    if (!isNull(types)) {
+        f->types = 0;
+        for (int i = 0; i < LENGTH(types); i++) {
+            const char *t = CHAR(STRING_ELT(types, i));
+            int k = 0, n = sizeof(vbi_type_names) / sizeof(*vbi_type_names);
+            if (strcmp(t, "ref") == 0) { f->ref = 1; continue; }
+            while (k < n && strcmp(t, vbi_type_names[k]) != 0) k++;
+            if (k == n) Rf_error("[VBI] Unknown variant type '%s'", t);
+            f->types |= 1 << k;
+        }
+    }
+    return 1;
+}
+
+/*
+ * RC_VBI_payload(ctx, region, filter)
+ * Payload of the markers in region (all markers if NULL) that pass the
+ * filter, without reading any record: list(marker, chrom, pos, n_allele,
+ * type, ac, an, af), marker 1-based.
+ */
+SEXP RC_VBI_payload(SEXP vbi_vcf_ctx, SEXP region_str, SEXP filter) {
+    VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_ExternalPtrAddr(vbi_vcf_ctx);
+    if (!ctx) Rf_error("[VBI] VCF context pointer is NULL");
+    if (!ctx->vbi_idx) Rf_error("[VBI] No VBI index available in context");
+    vbi_index_t *idx = ctx->vbi_idx;
+    const vbi_payload_t *payload = vbi_payload_from_ctx(idx);
+    vbi_payload_filter_t pf;
+    int use_filter = vbi_payload_filter_from_sexp(idx, filter, &pf);
+
+    rbcf_arena_reset(&ctx->arena);
+    int n = 0, *hits = NULL;
+    if (isNull(region_str)) {
+        if (idx->num_marker > INT_MAX) Rf_error("[VBI] Too many markers, give a region");
+        n = (int) idx->num_marker;
+        hits = (int *) rbcf_arena_alloc(&ctx->arena, sizeof(int) * (n + 1));
+        if (!hits) Rf_error("[VBI] OOM");
+        for (int i = 0; i < n; i++) hits[i] = i;
+    } else {
+        int *found = vbi_index_query_region(idx, CHAR(STRING_ELT(region_str, 0)), &n);
+        hits = (int *) rbcf_arena_alloc(&ctx->arena, sizeof(int) * (n + 1));
+        if (!hits) { free(found); Rf_error("[VBI] OOM"); }
+        if (n) memcpy(hits, found, sizeof(int) * n);
+        free(found);
+    }
+    if (use_filter) n = vbi_payload_filter_hits(idx, hits, n, &pf);
+
+    const char *names[] = {"marker", "chrom", "pos", "n_allele", "type", "ac", "an", "af"};
+    SEXPTYPE types[] = {INTSXP, STRSXP, REALSXP, INTSXP, STRSXP, INTSXP, INTSXP, REALSXP};
+    SEXP out = PROTECT(allocVector(VECSXP, 8));
+    SEXP nms = PROTECT(allocVector(STRSXP, 8));
+    for (int c = 0; c < 8; c++) {
+        SET_VECTOR_ELT(out, c, allocVector(types[c], n));
+        SET_STRING_ELT(nms, c, mkChar(names[c]));
+    }
+    setAttrib(out, R_NamesSymbol, nms);
+    SEXP chroms = PROTECT(allocVector(STRSXP, idx->n_chroms));
+    for (int c = 0; c < idx->n_chroms; c++) SET_STRING_ELT(chroms, c, mkChar(idx->chrom_names[c]));
+    // type strings, cached per distinct mask
+    SEXP type_str = PROTECT(allocVector(STRSXP, 1 << 8));
+    char have[1 << 8] = {0}, buf[64];
+    for (int i = 0; i < n; i++) {
+        int m = hits[i];
+        const vbi_payload_t *p = &payload[m];
+        INTEGER(VECTOR_ELT(out, 0))[i] = m + 1;
+        SET_STRING_ELT(VECTOR_ELT(out, 1), i, STRING_ELT(chroms, idx->chrom_ids[m]));
+        REAL(VECTOR_ELT(out, 2))[i] = (double) idx->positions[m];
+        INTEGER(VECTOR_ELT(out, 3))[i] = p->n_allele;
+        int t = p->type & 0xff;
+        if (!have[t]) {
+            // ins and del are implied by indel
+            buf[0] = 0;
+            for (int k = 0; k < 6; k++) {
+                if (!(t & (1 << k))) continue;
+                if (buf[0]) strcat(buf, ",");
+                strcat(buf, vbi_type_names[k]);
+            }
+            SET_STRING_ELT(type_str, t, mkChar(buf[0] ? buf : "ref"));
+            have[t] = 1;
+        }
+        SET_STRING_ELT(VECTOR_ELT(out, 4), i, STRING_ELT(type_str, t));
+        INTEGER(VECTOR_ELT(out, 5))[i] = p->ac < 0 ? NA_INTEGER : p->ac;
+        INTEGER(VECTOR_ELT(out, 6))[i] = p->an < 0 ? NA_INTEGER : p->an;
+        REAL(VECTOR_ELT(out, 7))[i] = isnan(p->af) ? NA_REAL : p->af;
+    }
+    UNPROTECT(4);
+    return out;
+}
+
+// Cursors: the hit list of a query, read back a few records at a time
+
+typedef struct {
+    int *hits;      // 0-based markers
+    int n, pos;     // number of hits, next one to read
+} vbi_cursor_t;
+
+static void vbi_cursor_finalizer(SEXP extPtr) {
+    vbi_cursor_t *cur = (vbi_cursor_t *) R_ExternalPtrAddr(extPtr);
+    if (!cur) return;
+    free(cur->hits);
+    free(cur);
+    R_ClearExternalPtr(extPtr);
+}
+
+/*
+ * RC_VBI_cursor_open(ctx, region, start_idx, end_idx, filter)
+ * Hits of a region, or of the markers start_idx..end_idx (1-based,
+ * inclusive) when region is NULL, after the payload filter. The cursor
+ * keeps the context alive; records are only read by RC_VBI_cursor_next.
+ */
+SEXP RC_VBI_cursor_open(SEXP vbi_vcf_ctx, SEXP region_str, SEXP start_idx, SEXP end_idx, SEXP filter) {
+    VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_ExternalPtrAddr(vbi_vcf_ctx);
+    if (!ctx) Rf_error("[VBI] VCF context pointer is NULL");
+    if (!ctx->vbi_idx) Rf_error("[VBI] No VBI index available in context");
+    vbi_index_t *idx = ctx->vbi_idx;
+    vbi_payload_filter_t pf;
+    int use_filter = vbi_payload_filter_from_sexp(idx, filter, &pf);
+
+    vbi_cursor_t *cur = calloc(1, sizeof(vbi_cursor_t));
+    if (!cur) Rf_error("[VBI] OOM");
+    if (!isNull(region_str)) {
+        cur->hits = vbi_index_query_region(idx, CHAR(STRING_ELT(region_str, 0)), &cur->n);
+        if (!cur->hits) cur->n = 0;
+    } else {
+        int64_t start = (int64_t) asReal(start_idx) - 1, end = (int64_t) asReal(end_idx) - 1;
+        if (start < 0) start = 0;
+        if (end >= idx->num_marker) end = idx->num_marker - 1;
+        if (end - start + 1 > INT_MAX) { free(cur); Rf_error("[VBI] Too many markers for one cursor"); }
+        cur->n = end < start ? 0 : (int) (end - start + 1);
+        cur->hits = malloc(sizeof(int) * (cur->n + 1));
+        if (!cur->hits) { free(cur); Rf_error("[VBI] OOM"); }
+        for (int i = 0; i < cur->n; i++) cur->hits[i] = (int) start + i;
+    }
+    if (cur->hits && use_filter) cur->n = vbi_payload_filter_hits(idx, cur->hits, cur->n, &pf);
+
+    SEXP extPtr = PROTECT(R_MakeExternalPtr(cur, R_NilValue, vbi_vcf_ctx));
+    R_RegisterCFinalizerEx(extPtr, (R_CFinalizer_t) vbi_cursor_finalizer, 1);
+    UNPROTECT(1);
+    return extPtr;
+}
+
+/*
+ * RC_VBI_cursor_next(cursor, n, include_info, include_format, include_genotypes)
+ * The next n records as the data.frame of the query functions, NULL once
+ * the hits are exhausted.
+ */
+SEXP RC_VBI_cursor_next(SEXP cursor, SEXP n, SEXP include_info, SEXP include_format, SEXP include_genotypes) {
+    vbi_cursor_t *cur = (vbi_cursor_t *) R_ExternalPtrAddr(cursor);
+    if (!cur) Rf_error("[VBI] Cursor is closed");
+    VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_ExternalPtrAddr(R_ExternalPtrProtected(cursor));
+    if (!ctx) Rf_error("[VBI] VCF context pointer is NULL");
+    int k = asInteger(n);
+    if (k == NA_INTEGER || k < 1) Rf_error("[VBI] n must be a positive number of records");
+    if (cur->pos >= cur->n) return R_NilValue;
+    if (k > cur->n - cur->pos) k = cur->n - cur->pos;
+    rbcf_arena_reset(&ctx->arena);
+    SEXP out = vbi_query_variants_basic(ctx, cur->hits + cur->pos, k, asLogical(include_info),
+                                        asLogical(include_format), asLogical(include_genotypes));
+    cur->pos += k;
     return out;
 }
 
+// c(read, total) hits of a cursor
+SEXP RC_VBI_cursor_info(SEXP cursor) {
+    vbi_cursor_t *cur = (vbi_cursor_t *) R_ExternalPtrAddr(cursor);
+    if (!cur) Rf_error("[VBI] Cursor is closed");
+    SEXP out = PROTECT(allocVector(REALSXP, 2));
+    REAL(out)[0] = cur->pos;
+    REAL(out)[1] = cur->n;
+    UNPROTECT(1);
+    return out;
+}
+
+SEXP RC_VBI_cursor_close(SEXP cursor) {
+    vbi_cursor_finalizer(cursor);
+    return R_NilValue;
+}
+
 // Linear scan region query using VBI index
-SEXP RC_VBI_query_region(SEXP vbi_vcf_ctx, SEXP region_str, SEXP include_info, SEXP include_format, SEXP include_genotypes) {
+SEXP RC_VBI_query_region(SEXP vbi_vcf_ctx, SEXP region_str, SEXP include_info, SEXP include_format, SEXP include_genotypes, SEXP filter) {
     VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_ExternalPtrAddr(vbi_vcf_ctx);
     if (!ctx) Rf_error("[VBI] VCF context pointer is NULL");
     if (!ctx->vbi_idx) Rf_error("[VBI] No VBI index available in context");
@@ -924,8 +1235,13 @@ SEXP RC_VBI_query_region(SEXP vbi_vcf_ctx, SEXP region_str, SEXP include_info, S
     int inc_format = asLogical(include_format);
     int inc_genotypes = asLogical(include_genotypes);
     const char *reg = CHAR(STRING_ELT(region_str, 0));
+    vbi_payload_filter_t pf;
+    int use_filter = vbi_payload_filter_from_sexp(ctx->vbi_idx, filter, &pf);
+    rbcf_arena_reset(&ctx->arena);
     int nfound = 0;
     int *indices = vbi_index_query_region(ctx->vbi_idx, reg, &nfound);
+    // drop the markers failing the filter before any record is read
+    if (indices && use_filter) nfound = vbi_payload_filter_hits(ctx->vbi_idx, indices, nfound, &pf);
     if (!indices || nfound == 0) {
         if (indices) free(indices);
         SEXP df = PROTECT(allocVector(VECSXP, 0));
@@ -956,7 +1272,8 @@ SEXP RC_VBI_query_range(SEXP vbi_vcf_ctx, SEXP chrom, SEXP start, SEXP end, SEXP
     int nfound = 0;
     // Linear scan: collect all indices matching chrom and position in [st, en]
     vbi_index_t *idx = ctx->vbi_idx;
-    int *hits = (int*) malloc(sizeof(int) * idx->num_marker);
+    rbcf_arena_reset(&ctx->arena);
+    int *hits = (int*) rbcf_arena_alloc(&ctx->arena, sizeof(int) * idx->num_marker);
     if (!hits) Rf_error("[VBI] OOM");
     for (int i = 0; i < idx->num_marker; i++) {
         const char *c = idx->chrom_names[idx->chrom_ids[i]];
@@ -978,7 +1295,6 @@ SEXP RC_VBI_query_range(SEXP vbi_vcf_ctx, SEXP chrom, SEXP start, SEXP end, SEXP
         UNPROTECT(3);
         out = df;
     }
-    free(hits);
     return out;
 }
 
@@ -1279,11 +1595,10 @@ SEXP RC_VBI_query_by_indices_ctx(SEXP vbi_vcf_ctx, SEXP start_idx, SEXP end_idx,
         return df;
     }
     int nfound = end - start + 1;
-    int *hits = (int*) malloc(sizeof(int)*nfound); if(!hits) Rf_error("[VBI] OOM");
+    rbcf_arena_reset(&ctx->arena);
+    int *hits = (int*) rbcf_arena_alloc(&ctx->arena, sizeof(int)*nfound); if(!hits) Rf_error("[VBI] OOM");
     for(int i=0;i<nfound;i++) hits[i]= start + i;
-    SEXP out = vbi_query_variants_basic(ctx, hits, nfound, inc_info, inc_format, inc_geno);
-    free(hits);
-    return out;
+    return vbi_query_variants_basic(ctx, hits, nfound, inc_info, inc_format, inc_geno);
 }
 
 // CGRanges-optimized region query using existing VBI VCF context
@@ -1296,6 +1611,7 @@ SEXP RC_VBI_query_region_cgranges_ctx(SEXP vbi_vcf_ctx, SEXP region_str, SEXP in
     int inc_format = asLogical(include_format);
     int inc_genotypes = asLogical(include_genotypes);
     const char *reg = CHAR(STRING_ELT(region_str, 0));
+    rbcf_arena_reset(&ctx->arena);
     
     // Use cgranges for fast interval tree query
     int nfound = 0;
@@ -1319,6 +1635,175 @@ SEXP RC_VBI_query_region_cgranges_ctx(SEXP vbi_vcf_ctx, SEXP region_str, SEXP in
 }
 
 
+// Lookups in the ID and allele-key tables (VBIIndex(Keys = TRUE))
+
+// first entry of `key` in a sorted table; *end is one past its last entry
+static int64_t vbi_key_range(const vbi_key_t *keys, int64_t n, uint64_t key, int64_t *end) {
+    int64_t lo = vbi_key_find(keys, n, key), hi = lo;
+    if (lo >= 0) while (hi < n && keys[hi].key == key) hi++;
+    *end = hi;
+    return lo;
+}
+
+static vbi_index_t *vbi_keys_from_ctx(SEXP vbi_vcf_ctx, int allele) {
+    VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_ExternalPtrAddr(vbi_vcf_ctx);
+    if (!ctx) Rf_error("[VBI] VCF context pointer is NULL");
+    if (!ctx->vbi_idx) Rf_error("[VBI] No VBI index available in context");
+    if (!(allele ? ctx->vbi_idx->allele_keys : ctx->vbi_idx->id_keys)) {
+        Rf_error("[VBI] Index has no %s table, rebuild it with VBIIndex(Keys = TRUE)", allele ? "allele" : "ID");
+    }
+    return ctx->vbi_idx;
+}
+
+// list(query, marker[, swapped]), 1-based
+static SEXP vbi_lookup_pairs(R_xlen_t nhits, int with_swapped) {
+    int n = with_swapped ? 3 : 2;
+    SEXP out = PROTECT(allocVector(VECSXP, n));
+    SEXP nms = PROTECT(allocVector(STRSXP, n));
+    SET_VECTOR_ELT(out, 0, allocVector(INTSXP, nhits));
+    SET_VECTOR_ELT(out, 1, allocVector(INTSXP, nhits));
+    SET_STRING_ELT(nms, 0, mkChar("query"));
+    SET_STRING_ELT(nms, 1, mkChar("marker"));
+    if (with_swapped) {
+        SET_VECTOR_ELT(out, 2, allocVector(LGLSXP, nhits));
+        SET_STRING_ELT(nms, 2, mkChar("swapped"));
+    }
+    setAttrib(out, R_NamesSymbol, nms);
+    UNPROTECT(2);
+    return out;
+}
+
+/*
+ * RC_VBI_lookup_ids(ctx, ids, all)
+ * Markers whose ID column holds each of `ids`. With all = FALSE, the first
+ * (1-based) marker of each ID or NA; otherwise every hit as list(query,
+ * marker), ordered by query then marker.
+ */
+SEXP RC_VBI_lookup_ids(SEXP vbi_vcf_ctx, SEXP ids, SEXP all) {
+    vbi_index_t *idx = vbi_keys_from_ctx(vbi_vcf_ctx, 0);
+    const vbi_key_t *keys = idx->id_keys;
+    R_xlen_t nq = XLENGTH(ids);
+    int64_t *beg = (int64_t *) R_alloc(nq + 1, sizeof(int64_t));
+    int64_t *end = (int64_t *) R_alloc(nq + 1, sizeof(int64_t));
+    R_xlen_t nhits = 0;
+    for (R_xlen_t q = 0; q < nq; q++) {
+        SEXP s = STRING_ELT(ids, q);
+        beg[q] = end[q] = -1;
+        if (s == NA_STRING) continue;
+        beg[q] = vbi_key_range(keys, idx->n_id_keys, vbi_id_key(CHAR(s), LENGTH(s)), &end[q]);
+        nhits += end[q] - beg[q];
+    }
+    if (asLogical(all) != TRUE) {
+        SEXP out = PROTECT(allocVector(INTSXP, nq));
+        for (R_xlen_t q = 0; q < nq; q++) {
+            INTEGER(out)[q] = beg[q] >= 0 ? (int)keys[beg[q]].marker + 1 : NA_INTEGER;
+        }
+        UNPROTECT(1);
+        return out;
+    }
+    SEXP out = PROTECT(vbi_lookup_pairs(nhits, 0));
+    int *query = INTEGER(VECTOR_ELT(out, 0)), *marker = INTEGER(VECTOR_ELT(out, 1));
+    R_xlen_t k = 0;
+    for (R_xlen_t q = 0; q < nq; q++) {
+        for (int64_t i = beg[q]; i < end[q]; i++, k++) {
+            query[k] = (int)q + 1;
+            marker[k] = (int)keys[i].marker + 1;
+        }
+    }
+    UNPROTECT(1);
+    return out;
+}
+
+/*
+ * RC_VBI_lookup_alleles(ctx, chrom, pos, ref, alt, swap, all)
+ * Markers carrying each chrom:pos:ref>alt, matched after normalization
+ * (see vbi_allele_key). With swap, a variant given as alt>ref also
+ * matches and is flagged in the "swapped" attribute or column. Results
+ * are shaped as in RC_VBI_lookup_ids.
+ */
+SEXP RC_VBI_lookup_alleles(SEXP vbi_vcf_ctx, SEXP chrom, SEXP pos, SEXP ref, SEXP alt, SEXP swap, SEXP all) {
+    vbi_index_t *idx = vbi_keys_from_ctx(vbi_vcf_ctx, 1);
+    const vbi_key_t *keys = idx->allele_keys;
+    int64_t nkeys = idx->n_allele_keys;
+    int do_swap = asLogical(swap) == TRUE, do_all = asLogical(all) == TRUE;
+    R_xlen_t nq = XLENGTH(chrom);
+    if (XLENGTH(pos) != nq || XLENGTH(ref) != nq || XLENGTH(alt) != nq) {
+        Rf_error("[VBI] chrom, pos, ref and alt must have the same length");
+    }
+    // key ranges of each query as given, then swapped
+    int64_t *beg = (int64_t *) R_alloc(2 * nq + 1, sizeof(int64_t));
+    int64_t *end = (int64_t *) R_alloc(2 * nq + 1, sizeof(int64_t));
+    R_xlen_t nhits = 0;
+    for (R_xlen_t q = 0; q < nq; q++) {
+        int64_t *b = beg + 2 * q, *e = end + 2 * q;
+        b[0] = e[0] = b[1] = e[1] = -1;
+        SEXP c = STRING_ELT(chrom, q), r = STRING_ELT(ref, q), a = STRING_ELT(alt, q);
+        double p = REAL(pos)[q];
+        if (c == NA_STRING || r == NA_STRING || a == NA_STRING || ISNAN(p)) continue;
+        b[0] = vbi_key_range(keys, nkeys, vbi_allele_key(CHAR(c), (int64_t)p, CHAR(r), CHAR(a)), &e[0]);
+        if (do_swap) b[1] = vbi_key_range(keys, nkeys, vbi_allele_key(CHAR(c), (int64_t)p, CHAR(a), CHAR(r)), &e[1]);
+        nhits += e[0] - b[0] + e[1] - b[1];
+    }
+    // both ranges are sorted by marker: merge them per query
+    SEXP out;
+    int *query = NULL, *marker = NULL, *swapped = NULL;
+    if (do_all) {
+        out = PROTECT(vbi_lookup_pairs(nhits, do_swap));
+        query = INTEGER(VECTOR_ELT(out, 0));
+        marker = INTEGER(VECTOR_ELT(out, 1));
+        if (do_swap) swapped = LOGICAL(VECTOR_ELT(out, 2));
+    } else {
+        out = PROTECT(allocVector(INTSXP, nq));
+        marker = INTEGER(out);
+        if (do_swap) {
+            SEXP sw = PROTECT(allocVector(LGLSXP, nq));
+            setAttrib(out, install("swapped"), sw);
+            swapped = LOGICAL(sw);
+            UNPROTECT(1);
+        }
+    }
+    R_xlen_t k = 0;
+    for (R_xlen_t q = 0; q < nq; q++) {
+        const char *cs = STRING_ELT(chrom, q) == NA_STRING ? NULL : CHAR(STRING_ELT(chrom, q));
+        int64_t i = beg[2 * q], ie = end[2 * q], j = beg[2 * q + 1], je = end[2 * q + 1];
+        R_xlen_t first = k;
+        while (i < ie || j < je) {
+            int w = i < ie && (j >= je || keys[i].marker <= keys[j].marker) ? 0 : 1;
+            int64_t m = w ? keys[j++].marker : keys[i++].marker;
+            // the contig only enters the key through the hash: check it
+            if (strcmp(idx->chrom_names[idx->chrom_ids[m]], cs) != 0) continue;
+            if (!do_all) {
+                marker[q] = (int)m + 1;
+                if (swapped) swapped[q] = w;
+                k++;
+                break;
+            }
+            if (k > first && marker[k - 1] == (int)m + 1) continue;
+            query[k] = (int)q + 1;
+            marker[k] = (int)m + 1;
+            if (swapped) swapped[k] = w;
+            k++;
+        }
+        if (!do_all && k == first) {
+            marker[q] = NA_INTEGER;
+            if (swapped) swapped[q] = NA_LOGICAL;
+        }
+    }
+    if (do_all && k < nhits) {
+        // drop the slots of the hits on other contigs
+        SEXP trimmed = PROTECT(vbi_lookup_pairs(k, do_swap));
+        for (int c = 0; c < LENGTH(out); c++) {
+            SEXP src = VECTOR_ELT(out, c), dst = VECTOR_ELT(trimmed, c);
+            memcpy(INTEGER(dst), INTEGER(src), k * sizeof(int));
+        }
+        UNPROTECT(2);
+        return trimmed;
+    }
+    UNPROTECT(1);
+    return out;
+}
+
+
 SEXP RC_VBI_index_memory_usage(SEXP extPtr) {
     vbi_index_t *idx = (vbi_index_t*) R_ExternalPtrAddr(extPtr);
     if (!idx) return ScalarReal(NA_REAL);
@@ -1326,6 +1811,8 @@ SEXP RC_VBI_index_memory_usage(SEXP extPtr) {
     if (idx->chrom_ids) vbi_bytes += idx->num_marker * sizeof(int32_t);
     if (idx->positions) vbi_bytes += idx->num_marker * sizeof(int64_t);
     if (idx->offsets) vbi_bytes += idx->num_marker * sizeof(int64_t);
+    vbi_bytes += (idx->n_id_keys + idx->n_allele_keys) * sizeof(vbi_key_t);
+    if (idx->payload) vbi_bytes += idx->num_marker * sizeof(vbi_payload_t);
     if (idx->chrom_names) {
         for (int i = 0; i < idx->n_chroms; ++i) {
             if (idx->chrom_names[i]) vbi_bytes += strlen(idx->chrom_names[i]) + 1;
@@ -1355,4 +1842,40 @@ SEXP RC_VBI_index_memory_usage(SEXP extPtr) {
     setAttrib(out, R_NamesSymbol, nms);
     UNPROTECT(2);
     return out;
-}
\ No newline at end of file
+}
+// Record access for the other modules, see vbi_context.h
+
+static VBIVcfContextPtr vbi_context_ptr(SEXP vbi_vcf_ctx) {
+    if (TYPEOF(vbi_vcf_ctx) != EXTPTRSXP) Rf_error("[VBI] Not a VCF context, see VCFLoad()");
+    VBIVcfContextPtr ctx = (VBIVcfContextPtr) R_ExternalPtrAddr(vbi_vcf_ctx);
+    if (!ctx) Rf_error("[VBI] VCF context pointer is NULL");
+    if (!ctx->vbi_idx) Rf_error("[VBI] No VBI index available in context");
+    return ctx;
+}
+
+bcf_hdr_t *vbi_context_header(SEXP vbi_vcf_ctx) {
+    return vbi_context_ptr(vbi_vcf_ctx)->hdr;
+}
+
+vbi_index_t *vbi_context_index(SEXP vbi_vcf_ctx) {
+    return vbi_context_ptr(vbi_vcf_ctx)->vbi_idx;
+}
+
+int *vbi_context_region(SEXP vbi_vcf_ctx, const char *region, int *n) {
+    VBIVcfContextPtr ctx = vbi_context_ptr(vbi_vcf_ctx);
+    *n = 0;
+    return vbi_index_query_region(ctx->vbi_idx, region, n);
+}
+
+int vbi_context_read(SEXP vbi_vcf_ctx, int marker, bcf1_t *rec) {
+    VBIVcfContextPtr ctx = vbi_context_ptr(vbi_vcf_ctx);
+    if (marker < 0 || marker >= ctx->vbi_idx->num_marker) return -1;
+    return vbi_read_marker(ctx, marker, rec);
+}
+
+cgranges_t *cgranges_context(SEXP cr_ptr) {
+    if (TYPEOF(cr_ptr) != EXTPTRSXP) Rf_error("[cgranges] Not a cgranges pointer");
+    cgranges_ptr_t *ptr = (cgranges_ptr_t*) R_ExternalPtrAddr(cr_ptr);
+    if (!ptr || !ptr->cr) Rf_error("[cgranges] Null pointer");
+    return ptr->cr;
+}
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bcf_batch.h"
+
+bcf_batch_t *bcf_batch_init(const bcf_hdr_t *hdr) {
+    bcf_batch_t *b = calloc(1, sizeof(bcf_batch_t));
+    if (!b) return NULL;
+    b->n_sample = bcf_hdr_nsamples(hdr);
+    b->unpack = BCF_UN_STR | BCF_UN_FLT;
+    return b;
+}
+
+void bcf_batch_destroy(bcf_batch_t *b) {
+    if (!b) return;
+    for (int c = 0; c < b->n_cols; c++) {
+        free(b->cols[c].tag);
+        free(b->cols[c].data);
+        free(b->cols[c].offs);
+        free(b->cols[c].width);
+    }
+    free(b->cols);
+    free(b->rid);
+    free(b->pos);
+    free(b->rlen);
+    free(b->qual);
+    free(b->n_allele);
+    free(b->str.s);
+    free(b->id_off);
+    free(b->ref_off);
+    free(b->alt_off);
+    free(b->flt_off);
+    free(b);
+}
+
+void bcf_batch_clear(bcf_batch_t *b) {
+    b->n = 0;
+    b->str.l = 0;
+    for (int c = 0; c < b->n_cols; c++) b->cols[c].n_data = 0;
+}
+
+static int batch_add_col(bcf_batch_t *b, const bcf_hdr_t *hdr, const char *tag, int is_format) {
+    int hl = is_format ? BCF_HL_FMT : BCF_HL_INFO;
+    int id = bcf_hdr_id2int(hdr, BCF_DT_ID, tag);
+    if (id < 0 || !bcf_hdr_idinfo_exists(hdr, hl, id)) return -1;
+    for (int c = 0; c < b->n_cols; c++)
+        if (b->cols[c].id == id && b->cols[c].is_format == is_format) return c;
+    if (b->n_cols == b->m_cols) {
+        int m = b->m_cols ? b->m_cols * 2 : 4;
+        bcf_batch_col_t *cols = realloc(b->cols, m * sizeof(bcf_batch_col_t));
+        if (!cols) return -1;
+        b->cols = cols;
+        b->m_cols = m;
+    }
+    bcf_batch_col_t *col = &b->cols[b->n_cols];
+    memset(col, 0, sizeof(bcf_batch_col_t));
+    col->tag = strdup(tag);
+    if (!col->tag) return -1;
+    col->id = id;
+    col->type = bcf_hdr_id2type(hdr, hl, id);
+    // GT is declared as a String but encoded as integers
+    if (is_format && strcmp(tag, "GT") == 0) col->type = BCF_HT_INT;
+    col->is_format = is_format;
+    // existing records have no value for a column added mid-batch
+    col->offs = calloc(b->m + 1, sizeof(int64_t));
+    col->width = calloc(b->m ? b->m : 1, sizeof(int32_t));
+    if (!col->offs || !col->width) {
+        free(col->tag);
+        free(col->offs);
+        free(col->width);
+        return -1;
+    }
+    b->unpack |= is_format ? BCF_UN_FMT : BCF_UN_INFO;
+    return b->n_cols++;
+}
+
+int bcf_batch_add_info(bcf_batch_t *b, const bcf_hdr_t *hdr, const char *tag) {
+    return batch_add_col(b, hdr, tag, 0);
+}
+
+int bcf_batch_add_format(bcf_batch_t *b, const bcf_hdr_t *hdr, const char *tag) {
+    return batch_add_col(b, hdr, tag, 1);
+}
+
+#define GROW(ptr, m) do { \
+    void *tmp_ = realloc((ptr), (size_t)(m) * sizeof(*(ptr))); \
+    if (!tmp_) return -1; \
+    (ptr) = tmp_; \
+} while (0)
+
+static int batch_grow(bcf_batch_t *b) {
+    int m = b->m ? b->m * 2 : 256;
+    GROW(b->rid, m);
+    GROW(b->pos, m);
+    GROW(b->rlen, m);
+    GROW(b->qual, m);
+    GROW(b->n_allele, m);
+    GROW(b->id_off, m);
+    GROW(b->ref_off, m);
+    GROW(b->alt_off, m);
+    GROW(b->flt_off, m);
+    for (int c = 0; c < b->n_cols; c++) {
+        GROW(b->cols[c].offs, m + 1);
+        GROW(b->cols[c].width, m);
+    }
+    b->m = m;
+    return 0;
+}
+
+static int col_reserve(bcf_batch_col_t *col, size_t extra) {
+    size_t need = col->n_data + extra;
+    if (need <= col->m_data) return 0;
+    size_t m = col->m_data ? col->m_data : 1024;
+    while (m < need) m *= 2;
+    size_t elt = col->type == BCF_HT_STR ? 1 : 4;
+    void *tmp = realloc(col->data, m * elt);
+    if (!tmp) return -1;
+    col->data = tmp;
+    col->m_data = m;
+    return 0;
+}
+
+/* widen n typed values to int32, mapping the missing/end sentinels */
+static void decode_int32(const uint8_t *p, int type, int n, int32_t *out) {
+    switch (type) {
+    case BCF_BT_INT8:
+        for (int i = 0; i < n; i++) {
+            int8_t v = ((const int8_t *)p)[i];
+            out[i] = v == bcf_int8_missing ? bcf_int32_missing :
+                     v == bcf_int8_vector_end ? bcf_int32_vector_end : v;
+        }
+        break;
+    case BCF_BT_INT16:
+        for (int i = 0; i < n; i++) {
+            int16_t v;
+            memcpy(&v, p + 2 * i, 2);
+            out[i] = v == bcf_int16_missing ? bcf_int32_missing :
+                     v == bcf_int16_vector_end ? bcf_int32_vector_end : v;
+        }
+        break;
+    case BCF_BT_INT32:
+        memcpy(out, p, (size_t)n * 4);
+        break;
+    default:
+        for (int i = 0; i < n; i++) out[i] = bcf_int32_missing;
+    }
+}
+
+/* values that do not match the header type are reported as missing */
+static void decode_float(const uint8_t *p, int type, int n, float *out) {
+    if (type == BCF_BT_FLOAT) {
+        memcpy(out, p, (size_t)n * 4);
+        return;
+    }
+    for (int i = 0; i < n; i++) bcf_float_set_missing(out[i]);
+}
+
+static int col_push_info(bcf_batch_col_t *col, bcf1_t *rec, int i) {
+    bcf_info_t *inf = bcf_get_info_id(rec, col->id);
+    int len = 0;
+    if (col->type == BCF_HT_FLAG) {
+        if (col_reserve(col, 1) < 0) return -1;
+        ((int32_t *)col->data)[col->n_data] = inf != NULL;
+        len = 1;
+    } else if (inf && inf->vptr) {
+        len = inf->len;
+        if (col_reserve(col, len + (col->type == BCF_HT_STR)) < 0) return -1;
+        if (col->type == BCF_HT_STR) {
+            char *dst = (char *)col->data + col->n_data;
+            memcpy(dst, inf->vptr, len);
+            // strings are stored NUL-terminated, the width excludes it
+            dst[len] = '\0';
+            col->n_data++;
+        } else if (col->type == BCF_HT_REAL) {
+            decode_float(inf->vptr, inf->type, len, (float *)col->data + col->n_data);
+        } else {
+            decode_int32(inf->vptr, inf->type, len, (int32_t *)col->data + col->n_data);
+        }
+    }
+    col->n_data += len;
+    col->width[i] = len;
+    col->offs[i + 1] = col->n_data;
+    return 0;
+}
+
+static int col_push_format(bcf_batch_col_t *col, bcf1_t *rec, int i, int n_sample) {
+    bcf_fmt_t *fmt = bcf_get_fmt_id(rec, col->id);
+    int w = 0;
+    if (fmt && fmt->p && n_sample > 0) {
+        w = fmt->n;
+        size_t n = (size_t)w * n_sample;
+        if (col_reserve(col, n) < 0) return -1;
+        if (col->type == BCF_HT_STR) {
+            memcpy((char *)col->data + col->n_data, fmt->p, n);
+        } else if (col->type == BCF_HT_REAL) {
+            decode_float(fmt->p, fmt->type, (int)n, (float *)col->data + col->n_data);
+        } else {
+            decode_int32(fmt->p, fmt->type, (int)n, (int32_t *)col->data + col->n_data);
+        }
+        col->n_data += n;
+    }
+    col->width[i] = w;
+    col->offs[i + 1] = col->n_data;
+    return 0;
+}
+
+int bcf_batch_push(bcf_batch_t *b, const bcf_hdr_t *hdr, bcf1_t *rec) {
+    if (b->n == b->m && batch_grow(b) < 0) return -1;
+    if (bcf_unpack(rec, b->unpack) < 0) return -1;
+    int i = b->n;
+    b->rid[i] = rec->rid;
+    b->pos[i] = rec->pos;
+    b->rlen[i] = rec->rlen;
+    b->qual[i] = rec->qual;
+    b->n_allele[i] = rec->n_allele;
+
+    b->id_off[i] = b->str.l;
+    if (kputs(rec->d.id ? rec->d.id : ".", &b->str) < 0 || kputc('\0', &b->str) < 0) return -1;
+    b->ref_off[i] = b->str.l;
+    if (rec->n_allele > 0 && kputs(rec->d.allele[0], &b->str) < 0) return -1;
+    if (kputc('\0', &b->str) < 0) return -1;
+    b->alt_off[i] = b->str.l;
+    for (int a = 1; a < rec->n_allele; a++) {
+        if (a > 1 && kputc(',', &b->str) < 0) return -1;
+        if (kputs(rec->d.allele[a], &b->str) < 0) return -1;
+    }
+    if (kputc('\0', &b->str) < 0) return -1;
+    b->flt_off[i] = b->str.l;
+    // an unfiltered record ('.') leaves an empty string
+    for (int f = 0; f < rec->d.n_flt; f++) {
+        const char *flt = bcf_hdr_int2id(hdr, BCF_DT_ID, rec->d.flt[f]);
+        if (f && kputc(';', &b->str) < 0) return -1;
+        if (flt && kputs(flt, &b->str) < 0) return -1;
+    }
+    if (kputc('\0', &b->str) < 0) return -1;
+
+    for (int c = 0; c < b->n_cols; c++) {
+        bcf_batch_col_t *col = &b->cols[c];
+        if (i == 0) col->offs[0] = 0;
+        int ret = col->is_format ? col_push_format(col, rec, i, b->n_sample)
+                                 : col_push_info(col, rec, i);
+        if (ret < 0) return -1;
+    }
+    b->n++;
+    return 0;
+}
+
+int bcf_batch_read(htsFile *fp, bcf_hdr_t *hdr, hts_itr_t *itr, bcf1_t *rec,
+                   bcf_batch_t *b, int max) {
+    int n = 0;
+    while (n < max) {
+        int ret = itr ? bcf_itr_next(fp, itr, rec) : bcf_read(fp, hdr, rec);
+        if (ret == -1) break;
+        if (ret < -1) return -1;
+        if (bcf_batch_push(b, hdr, rec) < 0) return -1;
+        n++;
+    }
+    return n;
+}
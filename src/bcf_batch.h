@@ -0,0 +1,77 @@
+#ifndef BCF_BATCH_H
+#define BCF_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "htslib/kstring.h"
+
+/*
+ * Structure-of-arrays batch of VCF/BCF records.
+ *
+ * Records are decoded into one array per site field and one ragged column
+ * per requested INFO/FORMAT tag. Tags are resolved against the header once,
+ * when the column is added, and looked up by numeric id in each record
+ * afterwards, so the per-record cost is a scan of the record's own tags and
+ * a copy into the column.
+ *
+ * Integer values are widened to int32 and keep the bcf_int32_missing /
+ * bcf_int32_vector_end sentinels; floats keep bcf_float_missing /
+ * bcf_float_vector_end. GT keeps its bcf_gt_* encoding.
+ */
+
+typedef struct {
+    char *tag;
+    int id;              /* header id, BCF_DT_ID */
+    int type;            /* BCF_HT_INT, BCF_HT_REAL, BCF_HT_FLAG or BCF_HT_STR */
+    int is_format;
+    void *data;          /* int32_t, float or char values */
+    size_t n_data, m_data;
+    int64_t *offs;       /* record i owns data[offs[i]..offs[i+1]) */
+    int32_t *width;      /* values per sample for FORMAT, values for INFO */
+} bcf_batch_col_t;
+
+typedef struct {
+    int n, m;            /* records in the batch / capacity */
+    int n_sample;
+    int32_t *rid;
+    hts_pos_t *pos;      /* 0-based */
+    hts_pos_t *rlen;
+    float *qual;
+    int32_t *n_allele;
+    kstring_t str;       /* NUL-terminated id, ref, alt and filter strings,
+                            filter is "" for a record without FILTER */
+    size_t *id_off, *ref_off, *alt_off, *flt_off;
+    int n_cols, m_cols;
+    bcf_batch_col_t *cols;
+    int unpack;          /* bcf_unpack flags needed by the columns */
+} bcf_batch_t;
+
+bcf_batch_t *bcf_batch_init(const bcf_hdr_t *hdr);
+void bcf_batch_destroy(bcf_batch_t *b);
+/* drop the records, keep the columns and their buffers */
+void bcf_batch_clear(bcf_batch_t *b);
+
+/* register a column; returns its index, -1 if the tag is not in the header */
+int bcf_batch_add_info(bcf_batch_t *b, const bcf_hdr_t *hdr, const char *tag);
+int bcf_batch_add_format(bcf_batch_t *b, const bcf_hdr_t *hdr, const char *tag);
+
+/* decode one record at the end of the batch; returns 0 or -1 on failure */
+int bcf_batch_push(bcf_batch_t *b, const bcf_hdr_t *hdr, bcf1_t *rec);
+
+/*
+ * Fill the batch with up to max records from a BCF/VCF stream, or from a
+ * BCF iterator when itr is not NULL (tabix iterators yield text and are
+ * not supported). rec is scratch space. Returns the number of records
+ * decoded, 0 at the end of the stream, -1 on error.
+ */
+int bcf_batch_read(htsFile *fp, bcf_hdr_t *hdr, hts_itr_t *itr, bcf1_t *rec,
+                   bcf_batch_t *b, int max);
+
+#define bcf_batch_id(b, i)  ((b)->str.s + (b)->id_off[i])
+#define bcf_batch_ref(b, i) ((b)->str.s + (b)->ref_off[i])
+#define bcf_batch_alt(b, i) ((b)->str.s + (b)->alt_off[i])
+#define bcf_batch_flt(b, i) ((b)->str.s + (b)->flt_off[i])
+
+#endif // BCF_BATCH_H
@@ -40,6 +40,7 @@ DEALINGS IN THE SOFTWARE.  */
 #include <time.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <pthread.h>
 
 #ifdef HAVE_LIBLZMA
 #ifdef HAVE_LZMA_H
@@ -2230,6 +2231,21 @@ typedef struct {
     uint64_t *offset;
 } lidx_t;
 
+// State of an index loaded with HTS_IDX_LAZY: the inflated body of the
+// file is kept, and the bins and linear index of a reference are decoded
+// from it on first use.
+typedef struct {
+    pthread_mutex_t lock;
+    uint8_t *data;  // index body, from the first reference; freed when all are decoded
+    size_t len;
+    size_t *off;    // offset of each reference in data
+    uint8_t *done;  // 1 once decoded, 2 if decoding failed
+    int n, n_left;  // references in the file, and not yet decoded
+} idx_lazy_t;
+
+static int idx_lazy_load(const hts_idx_t *idx, int tid);
+static int idx_lazy_load_all(const hts_idx_t *idx);
+
 struct hts_idx_t {
     int fmt, min_shift, n_lvls, n_bins;
     uint32_t l_meta;
@@ -2248,6 +2264,7 @@ struct hts_idx_t {
         uint64_t n_mapped, n_unmapped;
     } z; // keep internal states
     BGZF *otf_fp;  // Index on-the-fly output file
+    idx_lazy_t *lazy; // NULL unless loaded with HTS_IDX_LAZY
 };
 
 static char * idx_format_name(int fmt) {
@@ -2466,6 +2483,7 @@ int hts_idx_finish(hts_idx_t *idx, uint64_t final_offset)
 {
     int i, ret = 0;
     if (idx == NULL || idx->z.finished) return 0; // do not run this function on an empty index or multiple times
+    if (idx_lazy_load_all(idx) < 0) return -1;
     if (idx->z.save_tid >= 0) {
         ret |= insert_to_b(idx->bidx[idx->z.save_tid], idx->z.save_bin, idx->z.save_off, final_offset);
         ret |= insert_to_b(idx->bidx[idx->z.save_tid], META_BIN(idx), idx->z.off_beg, final_offset);
@@ -2511,6 +2529,8 @@ int hts_idx_push(hts_idx_t *idx, int tid, hts_pos_t beg, hts_pos_t end, uint64_t
     if (tid<0) beg = -1, end = 0;
     if (hts_idx_check_range(idx, tid, beg, end) < 0)
         return -1;
+    if (idx_lazy_load_all(idx) < 0)
+        return -1;
     if (tid >= idx->m) { // enlarge the index
         uint32_t new_m = idx->m * 2 > tid + 1 ? idx->m * 2 : tid + 1;
         bidx_t **new_bidx;
@@ -2634,9 +2654,18 @@ void hts_idx_amend_last(hts_idx_t *idx, uint64_t offset)
     idx->z.last_off = offset;
 }
 
-void hts_idx_destroy(hts_idx_t *idx)
+static void idx_free_bidx(bidx_t *bidx)
 {
     khint_t k;
+    if (bidx == 0) return;
+    for (k = kh_begin(bidx); k != kh_end(bidx); ++k)
+        if (kh_exist(bidx, k))
+            free(kh_value(bidx, k).list);
+    kh_destroy(bin, bidx);
+}
+
+void hts_idx_destroy(hts_idx_t *idx)
+{
     int i;
     if (idx == 0) return;
 
@@ -2649,13 +2678,15 @@ void hts_idx_destroy(hts_idx_t *idx)
     }
 
     for (i = 0; i < idx->m; ++i) {
-        bidx_t *bidx = idx->bidx[i];
         free(idx->lidx[i].offset);
-        if (bidx == 0) continue;
-        for (k = kh_begin(bidx); k != kh_end(bidx); ++k)
-            if (kh_exist(bidx, k))
-                free(kh_value(bidx, k).list);
-        kh_destroy(bin, bidx);
+        idx_free_bidx(idx->bidx[i]);
+    }
+    if (idx->lazy) {
+        pthread_mutex_destroy(&idx->lazy->lock);
+        free(idx->lazy->data);
+        free(idx->lazy->off);
+        free(idx->lazy->done);
+        free(idx->lazy);
     }
     free(idx->bidx); free(idx->lidx); free(idx->meta);
     free(idx);
@@ -2712,6 +2743,8 @@ static int idx_save_core(const hts_idx_t *idx, BGZF *fp, int fmt)
 
     #define check(ret) if ((ret) < 0) return -1
 
+    check(idx_lazy_load_all(idx));
+
     // VCF TBI/CSI only writes IDs for non-empty bins (ie covered references)
     //
     // NOTE: CSI meta is undefined in spec, so this code has an assumption
@@ -2895,6 +2928,7 @@ static int idx_read_core(hts_idx_t *idx, BGZF *fp, int fmt)
             if (absent <  0) return -2; // No memory
             if (absent == 0) return -3; // Duplicate bin number
             p = &kh_val(h, k);
+            p->list = NULL; // freed by hts_idx_destroy() if reading fails
             if (fmt == HTS_FMT_CSI) {
                 if (bgzf_read(fp, &p->loff, 8) != 8) return -1;
                 if (is_be) ed_swap_8p(&p->loff);
@@ -2937,7 +2971,170 @@ static int idx_read_core(hts_idx_t *idx, BGZF *fp, int fmt)
     return 0;
 }
 
-static hts_idx_t *idx_read(const char *fn)
+// Reads the rest of the index into memory and records where the data of
+// each reference starts, checking that all of it is within bounds so that
+// idx_lazy_decode() need not.
+static int idx_lazy_init(hts_idx_t *idx, BGZF *fp)
+{
+    idx_lazy_t *lz;
+    size_t cap = 1 << 16, p = 0;
+    ssize_t r;
+    int32_t i, j, n;
+
+    if ((lz = (idx_lazy_t*)calloc(1, sizeof(idx_lazy_t))) == NULL) return -2;
+    idx->lazy = lz; // freed by hts_idx_destroy() from here on
+    if (pthread_mutex_init(&lz->lock, NULL) != 0) {
+        free(lz);
+        idx->lazy = NULL;
+        return -2;
+    }
+    lz->n = lz->n_left = idx->n;
+    if ((lz->data = (uint8_t*)malloc(cap)) == NULL) return -2;
+    while ((r = bgzf_read(fp, lz->data + lz->len, cap - lz->len)) > 0) {
+        lz->len += r;
+        if (lz->len == cap) {
+            uint8_t *data;
+            if (cap > SIZE_MAX / 2) return -2;
+            if ((data = (uint8_t*)realloc(lz->data, cap * 2)) == NULL) return -2;
+            lz->data = data;
+            cap *= 2;
+        }
+    }
+    if (r < 0) return -1;
+    lz->off = (size_t*)malloc((idx->n ? idx->n : 1) * sizeof(size_t));
+    lz->done = (uint8_t*)calloc(idx->n ? idx->n : 1, 1);
+    if (lz->off == NULL || lz->done == NULL) return -2;
+
+    #define need(l) if (lz->len - p < (size_t) (l)) return -1
+    for (i = 0; i < idx->n; ++i) {
+        lz->off[i] = p;
+        need(4);
+        n = le_to_i32(lz->data + p); p += 4;
+        if (n < 0) return -3;
+        for (j = 0; j < n; ++j) {
+            int32_t n_chunk;
+            need(idx->fmt == HTS_FMT_CSI ? 16 : 8);
+            p += idx->fmt == HTS_FMT_CSI ? 12 : 4; // bin number and loff
+            n_chunk = le_to_i32(lz->data + p); p += 4;
+            if (n_chunk < 0) return -3;
+            if ((size_t) n_chunk > (lz->len - p) / 16) return -1;
+            p += (size_t) n_chunk << 4;
+        }
+        if (idx->fmt != HTS_FMT_CSI) {
+            uint32_t n_intv;
+            need(4);
+            n_intv = le_to_u32(lz->data + p); p += 4;
+            if ((size_t) n_intv > (lz->len - p) / 8) return -1;
+            p += (size_t) n_intv << 3;
+        }
+    }
+    #undef need
+    idx->n_no_coor = lz->len - p >= 8 ? le_to_u64(lz->data + p) : 0;
+    if (lz->n_left == 0) {
+        free(lz->data);
+        lz->data = NULL;
+    }
+    return 0;
+}
+
+// Decodes the bins and linear index of reference tid, as idx_read_core()
+// does when reading the whole index.  Called with the lock held.
+static int idx_lazy_decode(hts_idx_t *idx, int tid)
+{
+    const uint8_t *p = idx->lazy->data + idx->lazy->off[tid];
+    lidx_t *l = &idx->lidx[tid];
+    bidx_t *h;
+    int32_t i, j, n;
+    int absent;
+
+    h = idx->bidx[tid] = kh_init(bin);
+    if (h == NULL) return -2;
+    n = le_to_i32(p); p += 4;
+    for (j = 0; j < n; ++j) {
+        bins_t *b;
+        khint_t k = kh_put(bin, h, le_to_u32(p), &absent);
+        if (absent <  0) return -2; // No memory
+        if (absent == 0) return -3; // Duplicate bin number
+        p += 4;
+        b = &kh_val(h, k);
+        b->list = NULL;
+        if (idx->fmt == HTS_FMT_CSI) {
+            b->loff = le_to_u64(p); p += 8;
+        } else b->loff = 0;
+        b->n = b->m = le_to_i32(p); p += 4;
+        if (b->n && (b->list = (hts_pair64_t*)malloc(b->n * sizeof(hts_pair64_t))) == NULL)
+            return -2;
+        for (i = 0; i < b->n; ++i, p += 16) {
+            b->list[i].u = le_to_u64(p);
+            b->list[i].v = le_to_u64(p + 8);
+        }
+    }
+    if (idx->fmt != HTS_FMT_CSI) { // load linear index
+        int64_t k;
+        l->n = l->m = le_to_u32(p); p += 4;
+        if (l->n && (l->offset = (uint64_t*)malloc(l->n * sizeof(uint64_t))) == NULL)
+            return -2;
+        for (k = 0; k < l->n; ++k, p += 8)
+            l->offset[k] = le_to_u64(p);
+        for (i = k = 0; k < l->n && l->offset[k] == 0; i = ++k); // stop at the first non-zero entry
+        for (k = l->n-1; k > i; k--) // fill missing values; may happen given older samtools and tabix
+            if (l->offset[k-1] == 0) l->offset[k-1] = l->offset[k];
+        update_loff(idx, tid, 0);
+    }
+    return 0;
+}
+
+// Makes the bins of reference tid available in idx->bidx[tid], decoding
+// them first if the index was loaded with HTS_IDX_LAZY.  The index is
+// shared between threads, hence the lock; decoding only changes the
+// entries of tid.
+static int idx_lazy_load(const hts_idx_t *cidx, int tid)
+{
+    hts_idx_t *idx = (hts_idx_t *) cidx;
+    idx_lazy_t *lz = idx->lazy;
+    int ret = 0;
+    if (lz == NULL || tid < 0 || tid >= lz->n) return 0;
+    pthread_mutex_lock(&lz->lock);
+    if (lz->done[tid] == 0) {
+        ret = idx_lazy_decode(idx, tid);
+        if (ret < 0) {
+            hts_log_error("Could not decode the index of reference %d%s", tid,
+                          ret == -2 ? ": out of memory" : "");
+            idx_free_bidx(idx->bidx[tid]);
+            idx->bidx[tid] = NULL;
+            free(idx->lidx[tid].offset);
+            memset(&idx->lidx[tid], 0, sizeof(lidx_t));
+            lz->done[tid] = 2;
+        } else {
+            lz->done[tid] = 1;
+        }
+        if (--lz->n_left == 0) {
+            free(lz->data);
+            lz->data = NULL;
+        }
+    } else if (lz->done[tid] == 2) {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&lz->lock);
+    return ret < 0 ? -1 : 0;
+}
+
+static int idx_lazy_load_all(const hts_idx_t *idx)
+{
+    int i, ret = 0;
+    if (idx->lazy == NULL) return 0;
+    for (i = 0; i < idx->lazy->n; ++i)
+        if (idx_lazy_load(idx, i) < 0) ret = -1;
+    return ret;
+}
+
+static int idx_read_body(hts_idx_t *idx, BGZF *fp, int fmt, int flags)
+{
+    if (flags & HTS_IDX_LAZY) return idx_lazy_init(idx, fp);
+    return idx_read_core(idx, fp, fmt);
+}
+
+static hts_idx_t *idx_read(const char *fn, int flags)
 {
     uint8_t magic[4];
     int i, is_be;
@@ -2966,7 +3163,7 @@ static hts_idx_t *idx_read(const char *fn)
         idx->l_meta = x[2];
         idx->meta = meta;
         meta = NULL;
-        if (idx_read_core(idx, fp, HTS_FMT_CSI) < 0) goto fail;
+        if (idx_read_body(idx, fp, HTS_FMT_CSI, flags) < 0) goto fail;
     }
     else if (memcmp(magic, "TBI\1", 4) == 0) {
         uint8_t x[8 * 4];
@@ -2987,7 +3184,7 @@ static hts_idx_t *idx_read(const char *fn)
         if (bgzf_read(fp, idx->meta + 28, n) != n) goto fail;
         // Prevent possible strlen past the end in tbx_index_load2
         idx->meta[idx->l_meta] = '\0';
-        if (idx_read_core(idx, fp, HTS_FMT_TBI) < 0) goto fail;
+        if (idx_read_body(idx, fp, HTS_FMT_TBI, flags) < 0) goto fail;
     }
     else if (memcmp(magic, "BAI\1", 4) == 0) {
         uint32_t n;
@@ -2995,7 +3192,7 @@ static hts_idx_t *idx_read(const char *fn)
         if (is_be) ed_swap_4p(&n);
         if (n > INT32_MAX) goto fail;
         if ((idx = hts_idx_init(n, HTS_FMT_BAI, 0, 14, 5)) == NULL) goto fail;
-        if (idx_read_core(idx, fp, HTS_FMT_BAI) < 0) goto fail;
+        if (idx_read_body(idx, fp, HTS_FMT_BAI, flags) < 0) goto fail;
     }
     else { errno = EINVAL; goto fail; }
 
@@ -3050,7 +3247,8 @@ const char **hts_idx_seqnames(const hts_idx_t *idx, int *n, hts_id2name_f getid,
     for (i=0; i<idx->n; i++)
     {
         bidx_t *bidx = idx->bidx[i];
-        if ( !bidx ) continue;
+        // references of a lazily loaded index are all in the file
+        if ( !bidx && !(idx->lazy && i < idx->lazy->n) ) continue;
         names[tid++] = getid(hdr,i);
     }
     *n = tid;
@@ -3070,6 +3268,7 @@ int hts_idx_get_stat(const hts_idx_t* idx, int tid, uint64_t* mapped, uint64_t*
         return -1;
     }
 
+    if (idx_lazy_load(idx, tid) < 0) return -1;
     bidx_t *h = idx->bidx[tid];
     if (!h) return -1;
     khint_t k = kh_get(bin, h, META_BIN(idx));
@@ -3261,7 +3460,8 @@ static inline int reg2intervals(hts_itr_t *iter, const hts_idx_t *idx, int tid,
     size_t reg_bin_count = 0, hash_bin_count;
     int res;
 
-    if (!iter || !idx || (bidx = idx->bidx[tid]) == NULL || beg > end)
+    if (!iter || !idx || idx_lazy_load(idx, tid) < 0
+        || (bidx = idx->bidx[tid]) == NULL || beg > end)
         return -1;
 
     hash_bin_count = kh_n_buckets(bidx);
@@ -3328,6 +3528,7 @@ uint64_t hts_itr_off(const hts_idx_t* idx, int tid) {
     khint_t k;
     switch (tid) {
     case HTS_IDX_START:
+        if (idx_lazy_load_all(idx) < 0) return (uint64_t) -1;
         // Find the smallest offset, note that sequence ids may not be ordered sequentially
         for (i = 0; i < idx->n; i++) {
             bidx = idx->bidx[i];
@@ -3349,6 +3550,7 @@ uint64_t hts_itr_off(const hts_idx_t* idx, int tid) {
            case references at the end of the file have no mapped reads,
            or sequence ids are not ordered sequentially.
            See issue samtools#568 and commits b2aab8, 60c22d and cc207d. */
+        if (idx_lazy_load_all(idx) < 0) return (uint64_t) -1;
         for (i = 0; i < idx->n; i++) {
             bidx = idx->bidx[i];
             k = kh_get(bin, bidx, META_BIN(idx));
@@ -3405,6 +3607,9 @@ hts_itr_t *hts_itr_query(const hts_idx_t *idx, int tid, hts_pos_t beg, hts_pos_t
                 free(iter);
                 iter = NULL;
             }
+        } else if (idx_lazy_load(idx, tid) < 0) {
+            free(iter);
+            iter = NULL;
         } else if (tid >= idx->n || (bidx = idx->bidx[tid]) == NULL) {
             iter->finished = 1;
         } else {
@@ -3589,6 +3794,8 @@ int hts_itr_multi_bam(const hts_idx_t *idx, hts_itr_t *iter)
                 }
             }
         } else {
+            if (idx_lazy_load(idx, tid) < 0)
+                return -1;
             if (tid >= idx->n || (bidx = idx->bidx[tid]) == NULL || !kh_size(bidx))
                 continue;
 
@@ -4920,7 +5127,7 @@ static hts_idx_t *idx_find_and_load(const char *fn, int fmt, int flags)
     if (flags & HTS_IDX_SAVE_REMOTE)
         idx = hts_idx_load3(fn, fnidx, fmt, flags);
     else
-        idx = idx_read(fnidx);
+        idx = idx_read(fnidx, flags);
     free(fnidx);
     return idx;
 }
@@ -4964,7 +5171,7 @@ hts_idx_t *hts_idx_load3(const char *fn, const char *fnidx, int fmt, int flags)
         }
     }
 
-    hts_idx_t *idx = idx_read(fnidx);
+    hts_idx_t *idx = idx_read(fnidx, flags);
     if (!idx && !(flags & HTS_IDX_SILENT_FAIL))
         hts_log_error("Could not load local index file '%s'%s%s", fnidx,
                       errno ? " : " : "", errno ? strerror(errno) : "");
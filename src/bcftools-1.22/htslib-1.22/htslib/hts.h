@@ -1035,6 +1035,8 @@ hts_idx_t *hts_idx_load2(const char *fn, const char *fnidx);
 
         HTS_IDX_SAVE_REMOTE   Save a local copy of any remote indexes
         HTS_IDX_SILENT_FAIL   Fail silently if the index is not present
+        HTS_IDX_LAZY          Decode the bins of a reference on its first
+                              query instead of all of them on load
 
     The index struct returned by a successful call should be freed
     via hts_idx_destroy() when it is no longer needed.
@@ -1045,6 +1047,7 @@ hts_idx_t *hts_idx_load3(const char *fn, const char *fnidx, int fmt, int flags);
 /// Flags for hts_idx_load3() ( and also sam_idx_load3(), tbx_idx_load3() )
 #define HTS_IDX_SAVE_REMOTE 1
 #define HTS_IDX_SILENT_FAIL 2
+#define HTS_IDX_LAZY        4
 
 ///////////////////////////////////////////////////////////
 // Functions for accessing meta-data stored in indexes
@@ -124,6 +124,8 @@ extern const tbx_conf_t tbx_conf_gff, tbx_conf_bed, tbx_conf_psltbl, tbx_conf_sa
 
         HTS_IDX_SAVE_REMOTE   Save a local copy of any remote indexes
         HTS_IDX_SILENT_FAIL   Fail silently if the index is not present
+        HTS_IDX_LAZY          Decode the bins of a reference on its first
+                              query instead of all of them on load
 
     The index struct returned by a successful call should be freed
     via tbx_destroy() when it is no longer needed.
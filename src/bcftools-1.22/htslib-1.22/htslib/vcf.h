@@ -1350,6 +1350,8 @@ which works for both BCF and VCF.
 
         HTS_IDX_SAVE_REMOTE   Save a local copy of any remote indexes
         HTS_IDX_SILENT_FAIL   Fail silently if the index is not present
+        HTS_IDX_LAZY          Decode the bins of a reference on its first
+                              query instead of all of them on load
 
      Equivalent to hts_idx_load3(fn, fnidx, HTS_FMT_CSI, flags);
 */
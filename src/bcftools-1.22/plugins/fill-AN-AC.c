@@ -28,8 +28,14 @@ DEALINGS IN THE SOFTWARE.  */
 #include <htslib/vcf.h>
 #include <htslib/vcfutils.h>
 
+typedef struct
+{
+    int *arr, marr;
+}
+state_t;
+
 bcf_hdr_t *in_hdr, *out_hdr;
-int *arr = NULL, marr = 0;
+static state_t main_state;
 
 const char *about(void)
 {
@@ -45,23 +51,45 @@ int init(int argc, char **argv, bcf_hdr_t *in, bcf_hdr_t *out)
     return 0;
 }
 
-bcf1_t *process(bcf1_t *rec)
+static void fill_an_ac(state_t *st, bcf1_t *rec)
 {
-    hts_expand(int,rec->n_allele,marr,arr);
-    int ret = bcf_calc_ac(in_hdr,rec,arr,BCF_UN_FMT);
+    hts_expand(int,rec->n_allele,st->marr,st->arr);
+    int ret = bcf_calc_ac(in_hdr,rec,st->arr,BCF_UN_FMT);
     if ( ret>0 )
     {
         int i, an = 0;
-        for (i=0; i<rec->n_allele; i++) an += arr[i];
+        for (i=0; i<rec->n_allele; i++) an += st->arr[i];
         bcf_update_info_int32(out_hdr, rec, "AN", &an, 1);
-        bcf_update_info_int32(out_hdr, rec, "AC", arr+1, rec->n_allele-1);
+        bcf_update_info_int32(out_hdr, rec, "AC", st->arr+1, rec->n_allele-1);
     }
+}
+
+bcf1_t *process(bcf1_t *rec)
+{
+    fill_an_ac(&main_state, rec);
     return rec;
 }
 
-void destroy(void)
+void *init_thread(void)
 {
-    free(arr);
+    return calloc(1,sizeof(state_t));
 }
 
+int process_batch(void *state, bcf1_t **rec, int nrec)
+{
+    int i;
+    for (i=0; i<nrec; i++) fill_an_ac((state_t*)state, rec[i]);
+    return 0;
+}
 
+void destroy_thread(void *state)
+{
+    state_t *st = (state_t*) state;
+    free(st->arr);
+    free(st);
+}
+
+void destroy(void)
+{
+    free(main_state.arr);
+}
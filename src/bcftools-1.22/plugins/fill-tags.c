@@ -60,7 +60,7 @@ typedef struct _pop_t pop_t;
 typedef int (*fill_tag_f)(args_t *, bcf1_t *, pop_t *, ftf_t *);
 struct _ftf_t
 {
-    char *src_tag, *dst_tag;
+    char *src_tag, *dst_tag, *expr;
     fill_tag_f func;
     float *fval;
     int32_t *ival;
@@ -270,6 +270,7 @@ void ftf_destroy(pop_t *pop)
         ftf_t *ftf = &pop->ftf[i];
         free(ftf->src_tag);
         free(ftf->dst_tag);
+        free(ftf->expr);
         free(ftf->fval);
         free(ftf->ival);
         if ( ftf->filter ) filter_destroy(ftf->filter);
@@ -360,6 +361,19 @@ do { \
 } while (0)
 
 
+static void ftf_init_filter(args_t *args, pop_t *pop, ftf_t *ftf)
+{
+    ftf->filter = filter_init(args->in_hdr, ftf->expr);
+    if ( *pop->name )
+    {
+        uint8_t *samples = (uint8_t*)calloc(bcf_hdr_nsamples(args->in_hdr),1);
+        int j;
+        for (j=0; j<pop->nsmpl; j++) samples[ pop->smpl[j] ] = 1;
+        filter_set_samples(ftf->filter, samples);
+        free(samples);
+    }
+}
+
 int parse_func_pop(args_t *args, pop_t *pop, char *tag_expr, char *expr)
 {
     pop->nftf++;
@@ -400,7 +414,6 @@ int parse_func_pop(args_t *args, pop_t *pop, char *tag_expr, char *expr)
         filter = strdup(expr);
 
     ftf->func = ftf_filter_expr;
-    uint8_t *samples = (uint8_t*)calloc(bcf_hdr_nsamples(args->in_hdr),1);
 
     args->str.l = 0;
     ksprintf(&args->str, "%s%s", ftf->dst_tag,pop->suffix);
@@ -452,17 +465,9 @@ int parse_func_pop(args_t *args, pop_t *pop, char *tag_expr, char *expr)
         kputs("\">", &args->str);
         bcf_hdr_append(args->out_hdr, args->str.s);
     }
-    ftf->filter = filter_init(args->in_hdr, filter);
+    ftf->expr = filter;
+    ftf_init_filter(args, pop, ftf);
     args->unpack |= filter_max_unpack(ftf->filter);
-    memset(samples,0,sizeof(*samples)*bcf_hdr_nsamples(args->in_hdr));
-    if ( *pop->name )
-    {
-        int j;
-        for (j=0; j<pop->nsmpl; j++) samples[ pop->smpl[j] ] = 1;
-        filter_set_samples(ftf->filter, samples);
-    }
-    free(samples);
-    free(filter);
     return SET_FUNC;
 }
 int parse_func(args_t *args, char *tag_expr, char *expr)
@@ -710,7 +715,7 @@ static int cmpfloat_desc(const void *a, const void *b)
     if ( fa>fb ) return -1;
     return 0;
 }
-static void process_fmt(bcf1_t *rec)
+static void process_fmt(args_t *args, bcf1_t *rec)
 {
     int i,j, nsmpl = bcf_hdr_nsamples(args->in_hdr);;
 
@@ -936,7 +941,7 @@ static void process_fmt(bcf1_t *rec)
         }
     }
 }
-static void process_info_af(bcf1_t *rec)
+static void process_info_af(args_t *args, bcf1_t *rec)
 {
     if ( !(args->tags & SET_AF) ) return;
     if ( bcf_hdr_nsamples(args->in_hdr) ) return;
@@ -956,7 +961,7 @@ static void process_info_af(bcf1_t *rec)
     if ( bcf_update_info_float(args->out_hdr,rec,"AF", args->farr, n)!=0 )
         error("Error occurred while updating %s at %s:%"PRId64"\n", args->str.s,bcf_seqname(args->in_hdr,rec),(int64_t) rec->pos+1);
 }
-static void process_vaf(bcf1_t *rec, int mode)
+static void process_vaf(args_t *args, bcf1_t *rec, int mode)
 {
     int nsmpl = bcf_hdr_nsamples(args->in_hdr);
     int nval  = args->niarr / nsmpl;
@@ -991,7 +996,7 @@ static void process_vaf(bcf1_t *rec, int mode)
     if ( bcf_update_format_float(args->out_hdr,rec,(mode & SET_VAF) ? "VAF" : "VAF1", args->farr, nfarr)!=0 )
         error("Error occurred while updating %s at %s:%"PRId64"\n", args->str.s,bcf_seqname(args->in_hdr,rec),(int64_t) rec->pos+1);
 }
-static void process_vaf_vaf1(bcf1_t *rec)
+static void process_vaf_vaf1(args_t *args, bcf1_t *rec)
 {
     if ( !(args->tags & (SET_VAF|SET_VAF1)) ) return;
     if ( rec->n_allele <= 1 ) return;
@@ -1009,11 +1014,11 @@ static void process_vaf_vaf1(bcf1_t *rec)
     int nsmpl = bcf_hdr_nsamples(args->in_hdr);
     if ( args->niarr != nsmpl*rec->n_allele ) return;   // incorrect number of values (possibly all missing)
 
-    if ( args->tags & SET_VAF ) process_vaf(rec, SET_VAF);
-    if ( args->tags & SET_VAF1 ) process_vaf(rec, SET_VAF1);
+    if ( args->tags & SET_VAF ) process_vaf(args, rec, SET_VAF);
+    if ( args->tags & SET_VAF1 ) process_vaf(args, rec, SET_VAF1);
 }
 
-bcf1_t *process(bcf1_t *rec)
+static bcf1_t *fill_tags(args_t *args, bcf1_t *rec)
 {
     int i,j;
 
@@ -1024,9 +1029,9 @@ bcf1_t *process(bcf1_t *rec)
 
     if ( args->unpack & BCF_UN_FMT )
     {
-        process_fmt(rec);
-        process_info_af(rec);
-        process_vaf_vaf1(rec);
+        process_fmt(args, rec);
+        process_info_af(args, rec);
+        process_vaf_vaf1(args, rec);
     }
 
     if ( args->tags & SET_END )
@@ -1056,6 +1061,78 @@ bcf1_t *process(bcf1_t *rec)
     return rec;
 }
 
+bcf1_t *process(bcf1_t *rec)
+{
+    return fill_tags(args, rec);
+}
+
+// the worker threads share the options and populations, with their own counts, filters and buffers
+void *init_thread(void)
+{
+    int i,j, nsmpl = bcf_hdr_nsamples(args->in_hdr);
+    args_t *thr = (args_t*) malloc(sizeof(args_t));
+    *thr = *args;
+    thr->farr = NULL; thr->mfarr = 0;
+    thr->iarr = NULL; thr->miarr = 0;
+    thr->hwe_probs = NULL; thr->mhwe_probs = 0;
+    thr->bset = NULL;
+    memset(&thr->str,0,sizeof(thr->str));
+    thr->pop = (pop_t*) malloc(args->npop*sizeof(*thr->pop));
+    for (i=0; i<args->npop; i++)
+    {
+        pop_t *pop = &thr->pop[i];
+        *pop = args->pop[i];
+        pop->counts  = NULL;
+        pop->mcounts = 0;
+        pop->ftf = pop->nftf ? (ftf_t*) malloc(pop->nftf*sizeof(*pop->ftf)) : NULL;
+        for (j=0; j<pop->nftf; j++)
+        {
+            ftf_t *ftf = &pop->ftf[j];
+            *ftf = args->pop[i].ftf[j];
+            ftf->fval = NULL; ftf->nfval = 0;
+            ftf->ival = NULL; ftf->nival = 0;
+            ftf_init_filter(thr, pop, ftf);
+        }
+    }
+    thr->smpl2pop = (pop_t**) malloc(nsmpl*(args->npop+1)*sizeof(pop_t*));
+    for (i=0; i<nsmpl*(args->npop+1); i++)
+        thr->smpl2pop[i] = args->smpl2pop[i] ? thr->pop + (args->smpl2pop[i] - args->pop) : NULL;
+    return thr;
+}
+
+int process_batch(void *state, bcf1_t **rec, int nrec)
+{
+    int i;
+    for (i=0; i<nrec; i++) fill_tags((args_t*)state, rec[i]);
+    return 0;
+}
+
+void destroy_thread(void *state)
+{
+    args_t *thr = (args_t*) state;
+    int i,j;
+    for (i=0; i<thr->npop; i++)
+    {
+        pop_t *pop = &thr->pop[i];
+        for (j=0; j<pop->nftf; j++)
+        {
+            free(pop->ftf[j].fval);
+            free(pop->ftf[j].ival);
+            filter_destroy(pop->ftf[j].filter);
+        }
+        free(pop->ftf);
+        free(pop->counts);
+    }
+    kbs_destroy(thr->bset);
+    free(thr->str.s);
+    free(thr->pop);
+    free(thr->smpl2pop);
+    free(thr->iarr);
+    free(thr->farr);
+    free(thr->hwe_probs);
+    free(thr);
+}
+
 void destroy(void)
 {
     int i;
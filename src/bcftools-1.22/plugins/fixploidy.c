@@ -29,6 +29,7 @@
 #include <getopt.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <htslib/vcf.h>
 #include <htslib/kseq.h>
 #include "bcftools.h"
@@ -36,11 +37,22 @@
 
 static bcf_hdr_t *in_hdr = NULL, *out_hdr = NULL;
 static int *sample2sex = NULL;
-static int n_sample = 0, nsex = 0, *sex2ploidy = NULL;
-static int32_t ngt_arr = 0, *gt_arr = NULL, *gt_arr2 = NULL, ngt_arr2 = 0;
+static int n_sample = 0, nsex = 0;
 static ploidy_t *ploidy = NULL;
 static int force_ploidy = -1;
 
+// per-thread buffers
+typedef struct
+{
+    int32_t ngt_arr, *gt_arr, *gt_arr2, ngt_arr2;
+    int *sex2ploidy;
+}
+state_t;
+static state_t main_state;
+
+// the ploidy iterator is shared and its region index is built on first use
+static pthread_mutex_t ploidy_lock = PTHREAD_MUTEX_INITIALIZER;
+
 const char *about(void)
 {
     return "Fix ploidy.\n";
@@ -175,38 +187,42 @@ int init(int argc, char **argv, bcf_hdr_t *in, bcf_hdr_t *out)
         for (i=0; i<n_sample; i++) sample2sex[i] = dflt_sex_id; // by default all are F
         if ( sex_fname ) set_samples(sex_fname, in, ploidy, sample2sex);
         nsex = ploidy_nsex(ploidy);
-        sex2ploidy = (int*) malloc(sizeof(int)*nsex);
+        main_state.sex2ploidy = (int*) malloc(sizeof(int)*nsex);
     }
 
     return 0;
 }
 
 
-bcf1_t *process(bcf1_t *rec)
+static void fix_ploidy(state_t *st, bcf1_t *rec)
 {
     int i,j, max_ploidy;
 
-    int ngts = bcf_get_genotypes(in_hdr, rec, &gt_arr, &ngt_arr);
+    int ngts = bcf_get_genotypes(in_hdr, rec, &st->gt_arr, &st->ngt_arr);
     if ( ngts<0 )
-        return rec;     // GT field not present
+        return;     // GT field not present
 
     if ( ngts % n_sample )
         error("Error at %s:%"PRId64": wrong number of GT fields\n",bcf_seqname(in_hdr,rec),(int64_t) rec->pos+1);
 
     if ( force_ploidy==-1 )
-        ploidy_query(ploidy, (char*)bcf_seqname(in_hdr,rec), rec->pos, sex2ploidy,NULL,&max_ploidy);
+    {
+        pthread_mutex_lock(&ploidy_lock);
+        ploidy_query(ploidy, (char*)bcf_seqname(in_hdr,rec), rec->pos, st->sex2ploidy,NULL,&max_ploidy);
+        pthread_mutex_unlock(&ploidy_lock);
+    }
     else
         max_ploidy = force_ploidy;
 
     ngts /= n_sample;
     if ( ngts < max_ploidy )
     {
-        hts_expand(int32_t,max_ploidy*n_sample,ngt_arr2,gt_arr2);
+        hts_expand(int32_t,max_ploidy*n_sample,st->ngt_arr2,st->gt_arr2);
         for (i=0; i<n_sample; i++)
         {
-            int ploidy = force_ploidy!=-1 ? force_ploidy : sex2ploidy[ sample2sex[i] ];
-            int32_t *src = &gt_arr[i*ngts];
-            int32_t *dst = &gt_arr2[i*max_ploidy];
+            int ploidy = force_ploidy!=-1 ? force_ploidy : st->sex2ploidy[ sample2sex[i] ];
+            int32_t *src = &st->gt_arr[i*ngts];
+            int32_t *dst = &st->gt_arr2[i*max_ploidy];
             j = 0;
             if ( !ploidy ) { dst[j] = bcf_gt_missing; j++; }
             else
@@ -215,15 +231,15 @@ bcf1_t *process(bcf1_t *rec)
             while ( j<ploidy ) { dst[j] = dst[j-1]; j++; } // expand "." to "./." and "0" to "0/0"
             while ( j<max_ploidy ) { dst[j] = bcf_int32_vector_end; j++; }
         }
-        if ( bcf_update_genotypes(out_hdr,rec,gt_arr2,n_sample*max_ploidy) )
+        if ( bcf_update_genotypes(out_hdr,rec,st->gt_arr2,n_sample*max_ploidy) )
             error("Could not update GT field at %s:%"PRId64"\n", bcf_seqname(in_hdr,rec),(int64_t) rec->pos+1);
     }
     else if ( ngts!=1 || max_ploidy!=1 )
     {
         for (i=0; i<n_sample; i++)
         {
-            int ploidy = force_ploidy!=-1 ? force_ploidy : sex2ploidy[ sample2sex[i] ];
-            int32_t *gts = &gt_arr[i*ngts];
+            int ploidy = force_ploidy!=-1 ? force_ploidy : st->sex2ploidy[ sample2sex[i] ];
+            int32_t *gts = &st->gt_arr[i*ngts];
             j = 0;
             if ( !ploidy ) { gts[j] = bcf_gt_missing; j++; }
             else 
@@ -232,19 +248,47 @@ bcf1_t *process(bcf1_t *rec)
             while ( j<ploidy ) { gts[j] = gts[j-1]; j++; } // expand "." to "./." and "0" to "0/0"
             while ( j<ngts ) { gts[j] = bcf_int32_vector_end; j++; }
         }
-        if ( bcf_update_genotypes(out_hdr,rec,gt_arr,n_sample*ngts) )
+        if ( bcf_update_genotypes(out_hdr,rec,st->gt_arr,n_sample*ngts) )
             error("Could not update GT field at %s:%"PRId64"\n", bcf_seqname(in_hdr,rec),(int64_t) rec->pos+1);
     }
+}
+
+bcf1_t *process(bcf1_t *rec)
+{
+    fix_ploidy(&main_state, rec);
     return rec;
 }
 
+void *init_thread(void)
+{
+    state_t *st = (state_t*) calloc(1,sizeof(state_t));
+    if ( force_ploidy==-1 ) st->sex2ploidy = (int*) malloc(sizeof(int)*nsex);
+    return st;
+}
+
+int process_batch(void *state, bcf1_t **rec, int nrec)
+{
+    int i;
+    for (i=0; i<nrec; i++) fix_ploidy((state_t*)state, rec[i]);
+    return 0;
+}
+
+void destroy_thread(void *state)
+{
+    state_t *st = (state_t*) state;
+    free(st->gt_arr);
+    free(st->gt_arr2);
+    free(st->sex2ploidy);
+    free(st);
+}
+
 
 void destroy(void)
 {
-    free(gt_arr);
-    free(gt_arr2);
+    free(main_state.gt_arr);
+    free(main_state.gt_arr2);
     free(sample2sex);
-    free(sex2ploidy);
+    free(main_state.sex2ploidy);
     if ( ploidy ) ploidy_destroy(ploidy);
 }
 
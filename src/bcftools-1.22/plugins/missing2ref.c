@@ -29,12 +29,19 @@ DEALINGS IN THE SOFTWARE.  */
 #include <inttypes.h>
 #include <getopt.h>
 
+typedef struct
+{
+    int32_t *gts, mgts;
+    int *arr, marr;
+    uint64_t nchanged;
+    int new_gt;
+}
+state_t;
+
 bcf_hdr_t *in_hdr, *out_hdr;
-int32_t *gts = NULL, mgts = 0;
-int *arr = NULL, marr = 0;
-uint64_t nchanged = 0;
 int new_gt = bcf_gt_unphased(0);
 int use_major = 0;
+static state_t main_state;
 
 const char *about(void)
 {
@@ -83,12 +90,13 @@ int init(int argc, char **argv, bcf_hdr_t *in, bcf_hdr_t *out)
     }
     in_hdr  = in;
     out_hdr = out;
+    main_state.new_gt = new_gt;
     return 0;
 }
 
-bcf1_t *process(bcf1_t *rec)
+static void set_missing(state_t *st, bcf1_t *rec)
 {
-    int ngts = bcf_get_genotypes(in_hdr, rec, &gts, &mgts);
+    int ngts = bcf_get_genotypes(in_hdr, rec, &st->gts, &st->mgts);
     int i, changed = 0;
     
     // Calculating allele frequency for each allele and determining major allele
@@ -96,12 +104,12 @@ bcf1_t *process(bcf1_t *rec)
     int majorAllele = -1;
     int maxAC = -1;
     if(use_major == 1){
-        hts_expand(int,rec->n_allele,marr,arr);
-        int ret = bcf_calc_ac(in_hdr,rec,arr,BCF_UN_FMT);
+        hts_expand(int,rec->n_allele,st->marr,st->arr);
+        int ret = bcf_calc_ac(in_hdr,rec,st->arr,BCF_UN_FMT);
         if(ret > 0){
             for(i=0; i < rec->n_allele; ++i){
-                if(*(arr+i) > maxAC){
-                    maxAC = *(arr+i);
+                if(*(st->arr+i) > maxAC){
+                    maxAC = *(st->arr+i);
                     majorAllele = i;
                 }
             }
@@ -112,31 +120,59 @@ bcf1_t *process(bcf1_t *rec)
         }
 
         // replacing new_gt by major allele
-        if(bcf_gt_is_phased(new_gt))
-            new_gt = bcf_gt_phased(majorAllele);
+        if(bcf_gt_is_phased(st->new_gt))
+            st->new_gt = bcf_gt_phased(majorAllele);
         else
-            new_gt = bcf_gt_unphased(majorAllele);
+            st->new_gt = bcf_gt_unphased(majorAllele);
     }
 
     // replace gts
     for (i=0; i<ngts; i++)
     {
-        if ( gts[i]==bcf_gt_missing )
+        if ( st->gts[i]==bcf_gt_missing )
         {
-            gts[i] = new_gt;
+            st->gts[i] = st->new_gt;
             changed++;
         }
     }
-    nchanged += changed;
-    if ( changed ) bcf_update_genotypes(out_hdr, rec, gts, ngts);
+    st->nchanged += changed;
+    if ( changed ) bcf_update_genotypes(out_hdr, rec, st->gts, ngts);
+}
+
+bcf1_t *process(bcf1_t *rec)
+{
+    set_missing(&main_state, rec);
     return rec;
 }
 
+void *init_thread(void)
+{
+    state_t *st = (state_t*) calloc(1,sizeof(state_t));
+    st->new_gt = new_gt;
+    return st;
+}
+
+int process_batch(void *state, bcf1_t **rec, int nrec)
+{
+    int i;
+    for (i=0; i<nrec; i++) set_missing((state_t*)state, rec[i]);
+    return 0;
+}
+
+void destroy_thread(void *state)
+{
+    state_t *st = (state_t*) state;
+    main_state.nchanged += st->nchanged;
+    free(st->arr);
+    free(st->gts);
+    free(st);
+}
+
 void destroy(void)
 {
-    free(arr);
-    fprintf(stderr,"Filled %"PRId64" REF alleles\n", nchanged);
-    free(gts);
+    free(main_state.arr);
+    fprintf(stderr,"Filled %"PRId64" REF alleles\n", main_state.nchanged);
+    free(main_state.gts);
 }
 
 
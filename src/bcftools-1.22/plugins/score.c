@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <dirent.h>
 #include <getopt.h>
+#include <sys/stat.h>
 #include <htslib/khash_str2int.h>
 #include <htslib/kseq.h>
 #include <htslib/synced_bcf_reader.h>
@@ -35,6 +36,7 @@
 #include "bcftools.h"
 #include "filter.h"
 #include "score.h"
+#include "rbcf_gtstore.h"
 
 #define SCORE_VERSION "2025-08-19"
 
@@ -407,6 +409,7 @@ static const char *usage_text(void) {
            "       --summaries <dir|file>    summary statistics files from directory or list from file\n"
            "       --q-score-thr LIST        comma separated list of p-value thresholds\n"
            "       --counts                  include SNP counts in the output table\n"
+           "       --gt-store <file>         read GT from this RBCFLib genotype store [<in.vcf.gz>.gtc if present]\n"
            "   -o, --output <file.tsv>       write output to a file [standard output]\n"
            "       --sample-header           output header for sample ID column [SAMPLE]\n"
            "   -e, --exclude <expr>          exclude sites for which the expression is true\n"
@@ -444,6 +447,72 @@ static const char *usage_text(void) {
            "\n";
 }
 
+/*
+ * Open the genotype column store of the input (see rbcf_gtstore.h), either
+ * the one given with --gt-store or <input>.gtc when it exists. Returns NULL,
+ * with a warning, if the store was built from another file or the input
+ * changed since (size, modification time or header).
+ */
+static gtstore_t *gt_store_open(const char *fname, const char *input) {
+    char *def = NULL;
+    struct stat st;
+    if (!fname) {
+        def = (char *)malloc(strlen(input) + 5);
+        sprintf(def, "%s.gtc", input);
+        if (stat(def, &st) != 0) {
+            free(def);
+            return NULL;
+        }
+        fname = def;
+    }
+    gtstore_t *gts = gtstore_open(fname);
+    if (!gts) error("Error: could not read the genotype store %s\n", fname);
+    // a streamed input (stdin) cannot be checked
+    const char *stale = stat(input, &st) != 0 ? NULL
+                      : gtstore_source_mismatch(input, gts->hdr.source_size, gts->hdr.source_mtime,
+                                                gts->hdr.source_hash);
+    if (stale) {
+        fprintf(stderr, "Warning: genotype store %s does not match %s (%s), ignoring it\n", fname, input, stale);
+        gtstore_close(gts);
+        gts = NULL;
+    } else {
+        fprintf(stderr, "Reading genotypes from %s\n", fname);
+    }
+    free(def);
+    return gts;
+}
+
+// store column of each sample of hdr, NULL with a warning if one is missing
+static int *gt_store_columns(const gtstore_t *gts, const bcf_hdr_t *hdr) {
+    int k, n_smpls = bcf_hdr_nsamples(hdr);
+    int *cols = (int *)malloc((n_smpls ? n_smpls : 1) * sizeof(int));
+    for (k = 0; k < n_smpls; k++) {
+        if ((cols[k] = gtstore_sample_index(gts, hdr->samples[k])) < 0) {
+            fprintf(stderr, "Warning: sample %s missing from the genotype store, ignoring it\n", hdr->samples[k]);
+            free(cols);
+            return NULL;
+        }
+    }
+    return cols;
+}
+
+static void subset_samples(bcf_hdr_t *hdr, const char *sample_names, int sample_is_file, int force_samples) {
+    int ret = bcf_hdr_set_samples(hdr, sample_names, sample_is_file);
+    if (ret < 0)
+        error("Error parsing the sample list\n");
+    else if (ret > 0) {
+        if (force_samples)
+            fprintf(stderr, "Warn: sample #%d not found in the header... skipping\n", ret);
+        else
+            error(
+                "Error: sample #%d not found in the header. Use "
+                "\"--force-samples\" to "
+                "ignore this error\n",
+                ret);
+    }
+    if (bcf_hdr_nsamples(hdr) == 0) error("Error: subsetting has removed all samples\n");
+}
+
 static double *parse_list(const char *str, int *n) {
     char *endptr;
     char **s = hts_readlist(str, 0, n);
@@ -480,6 +549,7 @@ int run(int argc, char **argv) {
     const char *sample_names = NULL;
     const char *columns_preset = NULL;
     const char *columns_fname = NULL;
+    const char *gt_store_fname = NULL;
 
     filter_t *filter = NULL;
     bcf_srs_t *sr = bcf_sr_init();
@@ -507,6 +577,7 @@ int run(int argc, char **argv) {
                                        {"columns", required_argument, NULL, 'c'},
                                        {"columns-file", required_argument, NULL, 'C'},
                                        {"use-variant-id", no_argument, NULL, 9},
+                                       {"gt-store", required_argument, NULL, 10},
                                        {NULL, 0, NULL, 0}};
     int c;
     while ((c = getopt_long(argc, argv, "h?o:e:f:i:r:R:t:T:s:S:c:C:", loptions, NULL)) >= 0) {
@@ -612,6 +683,9 @@ int run(int argc, char **argv) {
         case 9:
             flags |= VARIANT_ID_MODE;
             break;
+        case 10:
+            gt_store_fname = optarg;
+            break;
         case 'h':
         case '?':
         default:
@@ -648,25 +722,6 @@ int run(int argc, char **argv) {
     if (q_score_thr)
         for (i = 0; i < n_q_score_thr; i++) q_score_thr[i] = -log10(q_score_thr[i]);
 
-    // subset VCF file
-    if (sample_names) {
-        int ret = bcf_hdr_set_samples(hdr, sample_names, sample_is_file);
-        if (ret < 0)
-            error("Error parsing the sample list\n");
-        else if (ret > 0) {
-            if (force_samples)
-                fprintf(stderr, "Warn: sample #%d not found in the header... skipping\n", ret);
-            else
-                error(
-                    "Error: sample #%d not found in the header. Use "
-                    "\"--force-samples\" to "
-                    "ignore this error\n",
-                    ret);
-        }
-        if (bcf_hdr_nsamples(hdr) == 0) error("Error: subsetting has removed all samples\n");
-    }
-    int n_smpls = bcf_hdr_nsamples(hdr);
-
     int n_files, n_prs, *prs2vcf = NULL, m_prs2vcf = 0, *prs2idx = NULL, m_prs2idx = 0;
     char **filenames = NULL;
     if (pathname) {
@@ -803,6 +858,31 @@ int run(int argc, char **argv) {
             : use_tag == SCORE_DS  ? "genotype dosages (DS)"
                                    : "allelic shifts (AS)");
 
+    // subset VCF file; when GT comes from a genotype store and no filter may
+    // need FORMAT fields, the input keeps no sample at all so that FORMAT is
+    // not even parsed and the samples are read from the store
+    gtstore_t *gts = use_tag == SCORE_GT ? gt_store_open(gt_store_fname, argv[optind]) : NULL;
+    int *gts_cols = NULL;
+    bcf_hdr_t *smpl_hdr = gts && !filter ? bcf_hdr_dup(hdr) : hdr;
+    if (sample_names) subset_samples(smpl_hdr, sample_names, sample_is_file, force_samples);
+    if (gts && !(gts_cols = gt_store_columns(gts, smpl_hdr))) {
+        gtstore_close(gts);
+        gts = NULL;
+    }
+    int n_smpls = bcf_hdr_nsamples(smpl_hdr);
+    char **smpl_names = (char **)malloc(n_smpls * sizeof(char *));
+    for (k = 0; k < n_smpls; k++) smpl_names[k] = strdup(smpl_hdr->samples[k]);
+    if (smpl_hdr != hdr) {
+        bcf_hdr_destroy(smpl_hdr);
+        if (gts) {
+            if (bcf_hdr_set_samples(hdr, NULL, 0) < 0) error("Error: could not drop the samples of %s\n", argv[optind]);
+        } else if (sample_names) subset_samples(hdr, sample_names, sample_is_file, force_samples);
+    }
+    // records dropped in gts_only mode: not in the store, allele mismatch, decode failure
+    int gts_only = gts && bcf_hdr_nsamples(hdr) == 0, gts_absent = 0, gts_mismatch = 0, gts_failed = 0;
+    int64_t gts_hint = 0;
+    uint8_t *gts_missing = gts ? (uint8_t *)malloc(n_smpls * sizeof(uint8_t)) : NULL;
+
     FILE *out_fh = strcmp("-", output_fname) ? fopen(output_fname, "w") : stdout;
     if (!out_fh) error("Error: cannot write to %s\n", output_fname);
 
@@ -853,6 +933,27 @@ int run(int argc, char **argv) {
         char *ap_str[] = {"AP1", "AP2"};
         switch (use_tag) {
         case SCORE_GT:
+            if (gts) {
+                int64_t gts_idx = gtstore_find(gts, bcf_seqname(hdr, line), line->pos + 1,
+                                               gtstore_allele_key(line), gts_hint);
+                if (gts_idx >= 0 && gts->vars[gts_idx].n_allele == line->n_allele) {
+                    if (gtstore_allele_counts(gts, gts_idx, gts_cols, n_smpls, aps, gts_missing) >= 0) {
+                        for (k = 0; k < n_smpls; k++) missing[k] = gts_missing[k];
+                        gts_hint = gts_idx + 1;
+                        break;
+                    }
+                }
+                // without samples in the input there is nothing to fall back to
+                if (gts_only) {
+                    if (gts_idx < 0)
+                        gts_absent++;
+                    else if (gts->vars[gts_idx].n_allele != line->n_allele)
+                        gts_mismatch++;
+                    else
+                        gts_failed++;
+                    continue;
+                }
+            }
             number = bcf_get_genotypes(hdr, line, &int32_arr, &m_int32);
             if (number <= 0) continue;
             number /= bcf_hdr_nsamples(hdr);
@@ -1063,6 +1164,13 @@ int run(int argc, char **argv) {
         }
     }
 
+    if (gts_absent)
+        fprintf(stderr, "Warning: skipped %d records missing from the genotype store\n", gts_absent);
+    if (gts_mismatch)
+        fprintf(stderr, "Warning: skipped %d records whose alleles differ in the genotype store\n", gts_mismatch);
+    if (gts_failed)
+        fprintf(stderr, "Warning: skipped %d records whose genotypes could not be decoded from the store\n",
+                gts_failed);
     if (!(flags & TSV_MODE)) {
         for (i = 0; i < n_prs; i++)
             fprintf(stderr, "Matched %d markers for summary statistic %s\n", n_matched[i], prs_names[i]);
@@ -1087,7 +1195,7 @@ int run(int argc, char **argv) {
     }
     fprintf(out_fh, "\n");
     for (k = 0; k < n_smpls; k++) {
-        fprintf(out_fh, "%s", hdr->samples[k]);
+        fprintf(out_fh, "%s", smpl_names[k]);
         for (i = 0; i < n_prs; i++)
             for (j = 0; j < n_q_score_thr; j++) {
                 fprintf(out_fh, "\t%#.6g", scores[(i * n_q_score_thr + j) * n_smpls + k]);
@@ -1116,6 +1224,11 @@ int run(int argc, char **argv) {
     free(q_score_thr);
     free(prs2vcf);
     free(prs2idx);
+    for (k = 0; k < n_smpls; k++) free(smpl_names[k]);
+    free(smpl_names);
+    gtstore_close(gts);
+    free(gts_cols);
+    free(gts_missing);
     if (summaries) {
         for (i = 0; i < n_prs; i++) summary_destroy(summaries[i]);
         free(summaries);
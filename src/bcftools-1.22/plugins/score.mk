@@ -0,0 +1,5 @@
+# score reads GT from an RBCFLib genotype column store (../rbcf_gtstore.c) when one is given
+plugins/score.so: plugins/score.c plugins/score.h version.h version.c ../rbcf_gtstore.h ../rbcf_gtstore.c
+	$(CC) $(PLUGIN_FLAGS) $(CFLAGS) $(ALL_CPPFLAGS) -I.. $(EXTRA_CPPFLAGS) $(LDFLAGS) -o $@ ../rbcf_gtstore.c version.c $< $(PLUGIN_LIBS) $(LIBS) -lz
+plugins/score.dll: plugins/score.c plugins/score.h version.h version.c ../rbcf_gtstore.h ../rbcf_gtstore.c libbcftools.a $(HTSLIB_DLL)
+	$(CC) $(PLUGIN_FLAGS) $(CFLAGS) $(ALL_CPPFLAGS) -I.. $(EXTRA_CPPFLAGS) $(LDFLAGS) -o $@ ../rbcf_gtstore.c version.c $< $(PLUGIN_LIBS)
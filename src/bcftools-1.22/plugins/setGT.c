@@ -427,7 +427,7 @@ static inline int random_draw(args_t *args)
     return hts_drand48() > args->rand_frac ? 1 : 0; // reversed random draw
 }
 
-bcf1_t *process(bcf1_t *rec)
+static bcf1_t *set_gts(args_t *args, bcf1_t *rec)
 {
     if ( !rec->n_sample ) return rec;
 
@@ -657,12 +657,37 @@ bcf1_t *process(bcf1_t *rec)
     return rec;
 }
 
-void destroy(void)
+bcf1_t *process(bcf1_t *rec)
+{
+    return set_gts(args, rec);
+}
+
+// the worker threads share the options and have their own filter and buffers
+void *init_thread(void)
+{
+    if ( args->tgt_mask & GT_RAND ) return NULL;    // the random draws must follow the input order
+
+    args_t *thr = (args_t*) malloc(sizeof(args_t));
+    *thr = *args;
+    thr->gts  = NULL; thr->mgts  = 0;
+    thr->iarr = NULL; thr->miarr = 0;
+    thr->xarr = NULL; thr->mxarr = 0;
+    thr->arr  = NULL; thr->marr  = 0;
+    thr->smpl_pass = NULL;
+    thr->nchanged  = 0;
+    if ( args->filter ) thr->filter = filter_init(args->in_hdr,args->filter_str);
+    return thr;
+}
+
+int process_batch(void *state, bcf1_t **rec, int nrec)
+{
+    int i;
+    for (i=0; i<nrec; i++) set_gts((args_t*)state, rec[i]);
+    return 0;
+}
+
+static void destroy_buffers(args_t *args)
 {
-    fprintf(stderr,"Filled %"PRId64" alleles\n", args->nchanged);
-    free(args->custom.gt);
-    free(args->custom.phased);
-    free(args->binom_tag);
     if ( args->filter ) filter_destroy(args->filter);
     free(args->arr);
     free(args->iarr);
@@ -671,4 +696,20 @@ void destroy(void)
     free(args);
 }
 
+void destroy_thread(void *state)
+{
+    args_t *thr = (args_t*) state;
+    args->nchanged += thr->nchanged;
+    destroy_buffers(thr);
+}
+
+void destroy(void)
+{
+    fprintf(stderr,"Filled %"PRId64" alleles\n", args->nchanged);
+    free(args->custom.gt);
+    free(args->custom.phased);
+    free(args->binom_tag);
+    destroy_buffers(args);
+}
+
 
@@ -354,7 +354,7 @@ int init(int argc, char **argv, bcf_hdr_t *in, bcf_hdr_t *out)
     return 0;
 }
 
-bcf1_t *process_LXX(bcf1_t *rec)
+static bcf1_t *process_LXX(args_t *args, bcf1_t *rec)
 {
     if ( args->skip_nalt && rec->n_allele > args->skip_nalt ) return rec;
 
@@ -437,19 +437,19 @@ bcf1_t *process_LXX(bcf1_t *rec)
     return rec;
 }
 
-bcf1_t *process_XX(bcf1_t *rec)
+static bcf1_t *process_XX(args_t *args, bcf1_t *rec)
 {
     error("todo: --XX-to-LXX\n");
     if ( args->skip_nalt && rec->n_allele < args->skip_nalt ) return rec;
     return rec;
 }
 
-bcf1_t *process(bcf1_t *rec)
+static bcf1_t *convert(args_t *args, bcf1_t *rec)
 {
     int i,j,n;
 
-    if ( args->src==LXX ) return process_LXX(rec);
-    if ( args->src==XX ) return process_XX(rec);
+    if ( args->src==LXX ) return process_LXX(args, rec);
+    if ( args->src==XX ) return process_XX(args, rec);
 
     if ( args->src==QRQA )
     {
@@ -623,7 +623,32 @@ bcf1_t *process(bcf1_t *rec)
     return rec;
 }
 
-void destroy(void)
+bcf1_t *process(bcf1_t *rec)
+{
+    return convert(args, rec);
+}
+
+// the worker threads share the options and have their own buffers
+void *init_thread(void)
+{
+    args_t *thr = (args_t*) malloc(sizeof(args_t));
+    *thr = *args;
+    thr->farr  = NULL; thr->mfarr  = 0;
+    thr->iarr  = NULL; thr->miarr  = 0;
+    thr->iarr2 = NULL; thr->miarr2 = 0;
+    thr->iarr3 = NULL; thr->miarr3 = 0;
+    thr->iarr4 = NULL; thr->miarr4 = 0;
+    return thr;
+}
+
+int process_batch(void *state, bcf1_t **rec, int nrec)
+{
+    int i;
+    for (i=0; i<nrec; i++) convert((args_t*)state, rec[i]);
+    return 0;
+}
+
+static void destroy_buffers(args_t *args)
 {
     free(args->farr);
     free(args->iarr);
@@ -633,4 +658,14 @@ void destroy(void)
     free(args);
 }
 
+void destroy_thread(void *state)
+{
+    destroy_buffers((args_t*)state);
+}
+
+void destroy(void)
+{
+    destroy_buffers(args);
+}
+
 
@@ -38,6 +38,8 @@ THE SOFTWARE.  */
 #include <htslib/synced_bcf_reader.h>
 #include <htslib/kseq.h>
 #include <htslib/khash_str2int.h>
+#include <htslib/thread_pool.h>
+#include <htslib/bgzf.h>
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -75,6 +77,34 @@ typedef struct _plugin_t plugin_t;
  *
  *   void destroy(void)
  *      - called after all lines have been processed to clean up
+ *
+ *   Optional thread-safe API, used with --threads when both init_thread and
+ *   process_batch are implemented:
+ *
+ *   void *init_thread(void)
+ *      - called after init(), once for each worker thread. Returns the state
+ *      passed to process_batch() on that thread, or NULL if the records
+ *      cannot be processed concurrently with the options given, in which case
+ *      process() is called instead.
+ *
+ *   int process_batch(void *state, bcf1_t **rec, int nrec)
+ *      - called from a worker thread for a batch of consecutive records, which
+ *      are modified in place; set rec[i] to NULL for no output. Batches are
+ *      processed concurrently and written in the input order. Return 0 on
+ *      success, -1 on critical errors.
+ *
+ *   void destroy_thread(void *state)
+ *      - called for each state returned by init_thread(), before destroy()
+ *
+ *   Plugins can be chained in one process, "bcftools +a [OPTIONS] <file> --
+ *   [a options] : +b [-- b options] : +c ...": each record is passed in turn
+ *   to the process() of every plugin, until one returns NULL. The out_hdr of
+ *   a plugin is the in_hdr of the next one, and the output is written with
+ *   the out_hdr of the last one. Plugins implementing run() cannot be chained,
+ *   a plugin whose init() returns 1 (no records output) can only be the last
+ *   one, and a plugin can appear only once in a chain as its globals are shared.
+ *   The chain is processed on worker threads only when all of its plugins
+ *   implement the thread-safe API.
  */
 typedef void (*dl_version_f) (const char **, const char **);
 typedef int (*dl_run_f) (int, char **);
@@ -83,6 +113,9 @@ typedef char* (*dl_about_f) (void);
 typedef char* (*dl_usage_f) (void);
 typedef bcf1_t* (*dl_process_f) (bcf1_t *);
 typedef void (*dl_destroy_f) (void);
+typedef void* (*dl_init_thread_f) (void);
+typedef int (*dl_process_batch_f) (void *, bcf1_t **, int);
+typedef void (*dl_destroy_thread_f) (void *);
 
 struct _plugin_t
 {
@@ -95,9 +128,26 @@ struct _plugin_t
     dl_usage_f usage;
     dl_process_f process;
     dl_destroy_f destroy;
+    dl_init_thread_f init_thread;
+    dl_process_batch_f process_batch;
+    dl_destroy_thread_f destroy_thread;
     void *handle;
+    bcf_hdr_t *hdr_out;     // the output header of the plugin, the input header of the next one in the chain
 };
 
+// A batch of consecutive records processed by process_batch() on a worker thread
+#define BATCH_NREC  1024
+#define BATCH_SIZE  (8<<20)
+
+typedef struct
+{
+    struct _args_t *args;
+    bcf1_t **rec, **out;    // records owned by the batch; those passed to the plugins, NULL if dropped
+    int nrec, mrec, nout, ret;
+    size_t size;
+}
+batch_t;
+
 
 struct _args_t;
 
@@ -143,7 +193,13 @@ typedef struct _args_t
     char *filter_str;
     int filter_logic;   // include or exclude sites which match the filters? One of FLT_INCLUDE/FLT_EXCLUDE
 
-    plugin_t plugin;
+    plugin_t *plugin;       // the chain of plugins, each record is processed by all of them in turn
+    int nplugin;
+    void **thread_state;    // nplugin x n_threads states returned by init_thread()
+    htsThreadPool tpool;
+    hts_tpool_process *tqueue;
+    batch_t *batch, **free_batch;
+    int nfree_batch, mfree_batch, nqueued;
     int nplugin_paths;
     char **plugin_paths;
 
@@ -358,6 +414,10 @@ static int load_plugin(args_t *args, const char *fname, int exit_on_error, plugi
         if ( exit_on_error ) error("Could not initialize %s: destroy method not found\n", plugin->name);
         return -1;
     }
+
+    plugin->init_thread = (dl_init_thread_f) GetProcAddress(plugin->handle, "init_thread");
+    plugin->process_batch = (dl_process_batch_f) GetProcAddress(plugin->handle, "process_batch");
+    plugin->destroy_thread = (dl_destroy_thread_f) GetProcAddress(plugin->handle, "destroy_thread");
 #else
     dlerror();
     plugin->init = (dl_init_f) dlsym(plugin->handle, "init");
@@ -420,34 +480,239 @@ static int load_plugin(args_t *args, const char *fname, int exit_on_error, plugi
         if ( exit_on_error ) error("Could not initialize %s: %s\n", plugin->name, ret);
         return -1;
     }
+
+    // the thread-safe API is optional
+    plugin->init_thread = (dl_init_thread_f) dlsym(plugin->handle, "init_thread");
+    plugin->process_batch = (dl_process_batch_f) dlsym(plugin->handle, "process_batch");
+    plugin->destroy_thread = (dl_destroy_thread_f) dlsym(plugin->handle, "destroy_thread");
+    dlerror();
 #endif
+    if ( plugin->init_thread && plugin->process_batch && args->verbose > 1 ) fprintf(stderr,"\tprocess_batch .. ok\n");
 
     return 0;
 }
 
-static void check_version(args_t *args)
+static void check_version(args_t *args, plugin_t *plugin)
 {
     static int warned_bcftools = 0, warned_htslib = 0;
     const char *bver, *hver;
-    args->plugin.version(&bver, &hver);
+    plugin->version(&bver, &hver);
     if ( strcmp(bver,bcftools_version()) && !warned_bcftools )
     {
-        fprintf(stderr,"WARNING: bcftools version mismatch .. bcftools at %s, the plugin \"%s\" at %s\n", bcftools_version(),args->plugin.name,bver);
+        fprintf(stderr,"WARNING: bcftools version mismatch .. bcftools at %s, the plugin \"%s\" at %s\n", bcftools_version(),plugin->name,bver);
         warned_bcftools = 1;
     }
     if ( strcmp(hver,hts_version()) && !warned_htslib )
     {
-        fprintf(stderr,"WARNING: htslib version mismatch .. bcftools at %s, the plugin \"%s\" at %s\n", hts_version(),args->plugin.name,hver);
+        fprintf(stderr,"WARNING: htslib version mismatch .. bcftools at %s, the plugin \"%s\" at %s\n", hts_version(),plugin->name,hver);
         warned_htslib = 1;
     }
 }
 
+/*
+ *  Split the arguments of the first plugin at each ":" followed by "+name"
+ *  and load the chained plugins; their argv[0] is the "+name" token.
+ */
+static void init_plugin_chain(args_t *args)
+{
+    int argc = args->plugin[0].argc, i, j;
+    char **argv = args->plugin[0].argv;
+    for (i=1; i<argc; i++)
+    {
+        if ( strcmp(":",argv[i]) || i+1>=argc || argv[i+1][0]!='+' ) continue;
+        args->plugin[args->nplugin-1].argc = argv + i - args->plugin[args->nplugin-1].argv;
+        args->plugin = (plugin_t*) realloc(args->plugin, sizeof(*args->plugin)*(args->nplugin+1));
+        plugin_t *plugin = &args->plugin[args->nplugin++];
+        memset(plugin, 0, sizeof(*plugin));
+        load_plugin(args, argv[i+1]+1, 1, plugin);
+        if ( plugin->run ) error("The plugin \"%s\" does not process records and cannot be chained\n", plugin->name);
+        for (j=0; j<args->nplugin-1; j++)
+            if ( args->plugin[j].handle==plugin->handle )
+                error("The plugin \"%s\" cannot be chained with itself, its state is shared by all its instances\n", plugin->name);
+        plugin->argv = argv + i + 1;
+        if ( i+2<argc && !strcmp("--",argv[i+2]) )
+        {
+            // drop the separator of the plugin options
+            argv[i+2] = argv[i+1];
+            plugin->argv++;
+        }
+        i++;
+    }
+    args->plugin[args->nplugin-1].argc = argv + argc - args->plugin[args->nplugin-1].argv;
+}
+
 static void init_plugin(args_t *args)
 {
-    int ret = args->plugin.init(args->plugin.argc,args->plugin.argv,args->hdr,args->hdr_out);
-    if ( ret<0 ) error("The plugin exited with an error.\n");
-    check_version(args);
-    args->drop_header += ret;
+    int i;
+    for (i=0; i<args->nplugin; i++)
+    {
+        plugin_t *plugin = &args->plugin[i];
+        bcf_hdr_t *hdr = i ? args->plugin[i-1].hdr_out : args->hdr;
+        plugin->hdr_out = hdr ? bcf_hdr_dup(hdr) : NULL;
+        if ( i ) optind = 0;
+        int ret = plugin->init(plugin->argc,plugin->argv,hdr,plugin->hdr_out);
+        if ( ret<0 ) error("The plugin exited with an error.\n");
+        if ( ret>0 && i<args->nplugin-1 )
+            error("The plugin \"%s\" does not output records and can only be the last of a chain\n", plugin->name);
+        check_version(args, plugin);
+        args->drop_header += ret;
+        if ( plugin->hdr_out && bcf_hdr_sync(plugin->hdr_out)<0 ) error("[%s] Error: failed to update the header of %s\n", __func__,plugin->name);
+    }
+    args->hdr_out = args->plugin[args->nplugin-1].hdr_out;
+}
+
+/*
+ *  Use the thread-safe API if implemented by all plugins of the chain: one
+ *  state per plugin and worker thread, the pool being shared with the output
+ *  compression.
+ */
+static void init_plugin_threads(args_t *args)
+{
+    int i, n = args->nplugin * args->n_threads;
+    if ( n <= 0 ) return;
+    for (i=0; i<args->nplugin; i++)
+        if ( !args->plugin[i].init_thread || !args->plugin[i].process_batch ) return;
+    args->thread_state = (void**) calloc(n, sizeof(*args->thread_state));
+    for (i=0; i<n; i++)
+    {
+        args->thread_state[i] = args->plugin[i / args->n_threads].init_thread();
+        if ( !args->thread_state[i] ) break;
+    }
+    if ( i<n )
+    {
+        // a plugin cannot run concurrently with these options
+        while ( --i >= 0 )
+        {
+            plugin_t *plugin = &args->plugin[i / args->n_threads];
+            if ( plugin->destroy_thread ) plugin->destroy_thread(args->thread_state[i]);
+        }
+        free(args->thread_state);
+        args->thread_state = NULL;
+        return;
+    }
+    args->tpool.pool = hts_tpool_init(args->n_threads);
+    if ( !args->tpool.pool ) error("Error: could not initialize %d threads\n", args->n_threads);
+    args->tqueue = hts_tpool_process_init(args->tpool.pool, 2*args->n_threads, 0);
+    if ( !args->tqueue ) error("Error: could not initialize the thread queue\n");
+}
+
+static void destroy_plugin_threads(args_t *args)
+{
+    if ( !args->thread_state ) return;
+    int i;
+    for (i=0; i<args->nplugin * args->n_threads; i++)
+    {
+        plugin_t *plugin = &args->plugin[i / args->n_threads];
+        if ( plugin->destroy_thread ) plugin->destroy_thread(args->thread_state[i]);
+    }
+    free(args->thread_state);
+    for (i=0; i<args->nfree_batch; i++)
+    {
+        batch_t *batch = args->free_batch[i];
+        int j;
+        for (j=0; j<batch->mrec; j++) bcf_destroy(batch->rec[j]);
+        free(batch->rec);
+        free(batch->out);
+        free(batch);
+    }
+    free(args->free_batch);
+    hts_tpool_process_destroy(args->tqueue);
+}
+
+static void *run_batch(void *arg)
+{
+    batch_t *batch = (batch_t*) arg;
+    args_t *args = batch->args;
+    int id = hts_tpool_worker_id(args->tpool.pool);
+    int i, j;
+    memcpy(batch->out, batch->rec, sizeof(*batch->rec)*batch->nrec);
+    batch->nout = batch->nrec;
+    for (i=0; i<args->nplugin; i++)
+    {
+        if ( i )
+        {
+            // pass on only the records kept by the previous plugin
+            int nout = 0;
+            for (j=0; j<batch->nout; j++)
+                if ( batch->out[j] ) batch->out[nout++] = batch->out[j];
+            batch->nout = nout;
+        }
+        batch->ret = args->plugin[i].process_batch(args->thread_state[i*args->n_threads + id], batch->out, batch->nout);
+        if ( batch->ret<0 ) break;
+    }
+    return batch;
+}
+
+static void write_record(args_t *args, bcf1_t *line)
+{
+    if ( line->errcode ) error("[E::main_plugin] Unchecked error (%d), exiting\n",line->errcode);
+    if ( bcf_write1(args->out_fh, args->hdr_out, line)!=0 ) error("[%s] Error: cannot write to %s\n", __func__,args->output_fname);
+}
+
+static void write_batch(args_t *args, hts_tpool_result *res)
+{
+    if ( !res ) error("Error: failed to retrieve the processed records\n");
+    batch_t *batch = (batch_t*) hts_tpool_result_data(res);
+    hts_tpool_delete_result(res, 0);
+    args->nqueued--;
+    if ( batch->ret<0 ) error("The plugin exited with an error.\n");
+    int i;
+    for (i=0; i<batch->nout; i++)
+        if ( batch->out[i] ) write_record(args, batch->out[i]);
+    batch->nrec = 0;
+    batch->size = 0;
+    hts_expand(batch_t*, args->nfree_batch+1, args->mfree_batch, args->free_batch);
+    args->free_batch[args->nfree_batch++] = batch;
+}
+
+static void dispatch_batch(args_t *args)
+{
+    batch_t *batch = args->batch;
+    args->batch = NULL;
+    while ( hts_tpool_dispatch2(args->tpool.pool, args->tqueue, run_batch, batch, 1)<0 )
+    {
+        // the queue is full, write the oldest batch first
+        if ( errno!=EAGAIN ) error("Error: failed to dispatch the records to the worker threads\n");
+        write_batch(args, hts_tpool_next_result_wait(args->tqueue));
+    }
+    args->nqueued++;
+
+    hts_tpool_result *res;
+    while ( (res = hts_tpool_next_result(args->tqueue)) ) write_batch(args, res);
+}
+
+static void push_record(args_t *args, bcf1_t *line)
+{
+    batch_t *batch = args->batch;
+    if ( !batch )
+    {
+        if ( args->nfree_batch )
+            batch = args->free_batch[--args->nfree_batch];
+        else
+        {
+            batch = (batch_t*) calloc(1, sizeof(batch_t));
+            batch->args = args;
+        }
+        args->batch = batch;
+    }
+    if ( batch->nrec == batch->mrec )
+    {
+        batch->mrec = batch->mrec ? 2*batch->mrec : 64;
+        batch->rec = (bcf1_t**) realloc(batch->rec, sizeof(*batch->rec)*batch->mrec);
+        batch->out = (bcf1_t**) realloc(batch->out, sizeof(*batch->out)*batch->mrec);
+        int i;
+        for (i=batch->nrec; i<batch->mrec; i++) batch->rec[i] = bcf_init();
+    }
+    bcf1_t *rec = batch->rec[batch->nrec++];
+    if ( bcf_copy(rec, line)==NULL ) error("Error: failed to copy the record at %s:%"PRIhts_pos"\n", bcf_seqname(args->hdr,line),line->pos+1);
+    batch->size += rec->shared.l + rec->indiv.l;
+    if ( batch->nrec >= BATCH_NREC || batch->size >= BATCH_SIZE ) dispatch_batch(args);
+}
+
+static void flush_batches(args_t *args)
+{
+    if ( args->batch && args->batch->nrec ) dispatch_batch(args);
+    while ( args->nqueued ) write_batch(args, hts_tpool_next_result_wait(args->tqueue));
 }
 
 static int cmp_plugin_name(const void *p1, const void *p2)
@@ -534,9 +799,9 @@ int count_plugins(void)
 static void init_data(args_t *args)
 {
     args->hdr = args->files->readers[0].header;
-    args->hdr_out = bcf_hdr_dup(args->hdr);
 
     init_plugin(args);
+    init_plugin_threads(args);
 
     if ( args->filter_str )
         args->filter = filter_init(args->hdr, args->filter_str);
@@ -548,7 +813,11 @@ static void init_data(args_t *args)
         set_wmode(wmode,args->output_type,args->output_fname,args->clevel);
         args->out_fh = hts_open(args->output_fname ? args->output_fname : "-", wmode);
         if ( args->out_fh == NULL ) error("Can't write to \"%s\": %s\n", args->output_fname, strerror(errno));
-        if ( args->n_threads ) hts_set_threads(args->out_fh, args->n_threads);
+        if ( args->tpool.pool )
+        {
+            if ( hts_get_format(args->out_fh)->compression==bgzf ) bgzf_thread_pool(hts_get_bgzfp(args->out_fh), args->tpool.pool, 0);
+        }
+        else if ( args->n_threads ) hts_set_threads(args->out_fh, args->n_threads);
         if ( bcf_hdr_write(args->out_fh, args->hdr_out)!=0 ) error("[%s] Error: cannot write to %s\n", __func__,args->output_fname);
         if ( init_index2(args->out_fh,args->hdr_out,args->output_fname,
                          &args->index_fn, args->write_index)<0 )
@@ -558,17 +827,24 @@ static void init_data(args_t *args)
 
 static void destroy_data(args_t *args)
 {
-    free(args->plugin.name);
-    if ( args->plugin.destroy ) args->plugin.destroy();
+    int i;
+    destroy_plugin_threads(args);
+    for (i=0; i<args->nplugin; i++)
+    {
+        plugin_t *plugin = &args->plugin[i];
+        free(plugin->name);
+        if ( plugin->destroy ) plugin->destroy();
 #ifdef _WIN32
-    FreeLibrary(args->plugin.handle);
+        FreeLibrary(plugin->handle);
 #else
-    dlclose(args->plugin.handle);
+        dlclose(plugin->handle);
 #endif
-    if ( args->hdr_out ) bcf_hdr_destroy(args->hdr_out);
+    }
+    for (i=0; i<args->nplugin; i++)
+        if ( args->plugin[i].hdr_out ) bcf_hdr_destroy(args->plugin[i].hdr_out);
+    free(args->plugin);
     if ( args->nplugin_paths>0 )
     {
-        int i;
         for (i=0; i<args->nplugin_paths; i++) free(args->plugin_paths[i]);
         free(args->plugin_paths);
     }
@@ -587,6 +863,7 @@ static void destroy_data(args_t *args)
         }
         if ( hts_close(args->out_fh)!=0 ) error("[%s] Error: close failed .. %s\n", __func__,args->output_fname);
     }
+    if ( args->tpool.pool ) hts_tpool_destroy(args->tpool.pool);
 }
 
 static void usage(args_t *args)
@@ -595,6 +872,7 @@ static void usage(args_t *args)
     fprintf(stderr, "About:   Run user defined plugin\n");
     fprintf(stderr, "Usage:   bcftools plugin <name> [OPTIONS] <file> [-- PLUGIN_OPTIONS]\n");
     fprintf(stderr, "         bcftools +name [OPTIONS] <file>  [-- PLUGIN_OPTIONS]\n");
+    fprintf(stderr, "         bcftools +name [OPTIONS] <file>  -- [PLUGIN_OPTIONS] : +name2 [-- PLUGIN2_OPTIONS] [: ...]\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "VCF input options:\n");
     fprintf(stderr, "   -e, --exclude EXPR             Exclude sites for which the expression is true\n");
@@ -652,6 +930,8 @@ int main_plugin(int argc, char *argv[])
     args->record_cmd_line = 1;
     args->nplugin_paths = -1;
     args->clevel = -1;
+    args->plugin  = (plugin_t*) calloc(1,sizeof(plugin_t));
+    args->nplugin = 1;
     int regions_is_file = 0, targets_is_file = 0, usage_only = 0, version_only = 0;
     int regions_overlap = 1;
     int targets_overlap = 0;
@@ -664,11 +944,11 @@ int main_plugin(int argc, char *argv[])
         plugin_name = argv[1];
         argc--;
         argv++;
-        load_plugin(args, plugin_name, 1, &args->plugin);
-        if ( args->plugin.run )
+        load_plugin(args, plugin_name, 1, args->plugin);
+        if ( args->plugin->run )
         {
-            check_version(args);
-            int ret = args->plugin.run(argc, argv);
+            check_version(args, args->plugin);
+            int ret = args->plugin->run(argc, argv);
             destroy_data(args);
             free(args);
             return ret;
@@ -765,7 +1045,7 @@ int main_plugin(int argc, char *argv[])
     if ( version_only )
     {
         const char *bver, *hver;
-        args->plugin.version(&bver, &hver);
+        args->plugin->version(&bver, &hver);
         printf("bcftools  %s using htslib %s\n", bcftools_version(), hts_version());
         printf("plugin at %s using htslib %s\n\n", bver, hver);
         return 0;
@@ -773,18 +1053,19 @@ int main_plugin(int argc, char *argv[])
 
     if ( usage_only )
     {
-        if ( args->plugin.usage )
-            fprintf(stderr,"%s",args->plugin.usage());
+        if ( args->plugin->usage )
+            fprintf(stderr,"%s",args->plugin->usage());
         else
             fprintf(stderr,"Usage: bcftools +%s [General Options] -- [Plugin Options]\n",plugin_name);
         return 0;
     }
 
     char *fname = NULL;
-    if ( optind>=argc || (argv[optind][0]=='-' && argv[optind][1]) )
+    if ( optind>=argc || (argv[optind][0]=='-' && argv[optind][1]) || !strcmp(":",argv[optind]) )
     {
-        args->plugin.argc = argc - optind + 1;
-        args->plugin.argv = argv + optind - 1;
+        args->plugin->argc = argc - optind + 1;
+        args->plugin->argv = argv + optind - 1;
+        init_plugin_chain(args);
 
         if ( !isatty(fileno((FILE *)stdin)) ) fname = "-";  // reading from stdin
         else if ( optind>=argc ) usage(args);
@@ -797,8 +1078,9 @@ int main_plugin(int argc, char *argv[])
     else
     {
         fname = argv[optind];
-        args->plugin.argc = argc - optind;
-        args->plugin.argv = argv + optind;
+        args->plugin->argc = argc - optind;
+        args->plugin->argv = argv + optind;
+        init_plugin_chain(args);
     }
     optind = 0;
 
@@ -828,13 +1110,16 @@ int main_plugin(int argc, char *argv[])
             if ( args->filter_logic & FLT_EXCLUDE ) pass = pass ? 0 : 1;
             if ( !pass ) continue;
         }
-        line = args->plugin.process(line);
-        if ( line )
+        if ( args->tqueue )
         {
-            if ( line->errcode ) error("[E::main_plugin] Unchecked error (%d), exiting\n",line->errcode);
-            if ( bcf_write1(args->out_fh, args->hdr_out, line)!=0 ) error("[%s] Error: cannot write to %s\n", __func__,args->output_fname);
+            push_record(args, line);
+            continue;
         }
+        int i;
+        for (i=0; i<args->nplugin && line; i++) line = args->plugin[i].process(line);
+        if ( line ) write_record(args, line);
     }
+    if ( args->tqueue ) flush_batches(args);
     destroy_data(args);
     bcf_sr_destroy(args->files);
     free(args);
@@ -118,6 +118,7 @@ void cr_destroy(cgranges_t *cr)
 	for (i = 0; i < cr->n_ctg; ++i)
 		free(cr->ctg[i].name);
 	free(cr->ctg);
+	free(cr->r);
 	kh_destroy(str, (strhash_t*)cr->hc);
 	free(cr);
 }
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rbcf_arena.h"
+
+#define BLOCK_HDR ((sizeof(rbcf_arena_block_t) + 15) & ~(size_t)15)
+#define BLOCK_DATA(b) ((char *)(b) + BLOCK_HDR)
+
+static rbcf_arena_block_t *block_new(size_t size) {
+    rbcf_arena_block_t *b = malloc(BLOCK_HDR + size);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void rbcf_arena_init(rbcf_arena_t *a) {
+    memset(a, 0, sizeof(rbcf_arena_t));
+}
+
+static void free_fmt_str(rbcf_arena_t *a) {
+    if (a->fmt_str) {
+        free(a->fmt_str[0]);
+        free(a->fmt_str);
+    }
+    a->fmt_str = NULL;
+    a->m_fmt_str = 0;
+    a->fmt_str_nsmpl = 0;
+}
+
+/* buffers with data but no capacity are borrowed (see vbi_map.h), not freed */
+static void rec_destroy(bcf1_t *rec) {
+    if (!rec->shared.m) rec->shared.s = NULL;
+    if (!rec->indiv.m) rec->indiv.s = NULL;
+    bcf_destroy(rec);
+}
+
+void rbcf_arena_destroy(rbcf_arena_t *a) {
+    rbcf_arena_block_t *b = a->head;
+    while (b) {
+        rbcf_arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    for (int k = 0; k < RBCF_ARENA_NBUF; k++) free(a->buf[k]);
+    free_fmt_str(a);
+    for (int i = 0; i < a->n_recs; i++) rec_destroy(a->recs[i]);
+    free(a->recs);
+    free(a->str.s);
+    memset(a, 0, sizeof(rbcf_arena_t));
+}
+
+void rbcf_arena_reset(rbcf_arena_t *a) {
+    rbcf_arena_block_t *b = a->head;
+    if (b && b->next) {
+        // the last query spilled over several blocks: replace them with a
+        // single one large enough for the next query of the same size
+        size_t total = 0;
+        while (b) {
+            rbcf_arena_block_t *next = b->next;
+            total += b->size;
+            free(b);
+            b = next;
+        }
+        a->head = block_new(total < RBCF_ARENA_KEEP ? total : RBCF_ARENA_KEEP);
+    } else if (b) {
+        b->used = 0;
+        if (b->size > RBCF_ARENA_KEEP) {
+            free(b);
+            a->head = NULL;
+        }
+    }
+    for (int k = 0; k < RBCF_ARENA_NBUF; k++) {
+        // elements are at most 4 bytes wide
+        if ((size_t)a->m_buf[k] * 4 > RBCF_ARENA_KEEP) {
+            free(a->buf[k]);
+            a->buf[k] = NULL;
+            a->m_buf[k] = 0;
+        }
+    }
+    if ((size_t)a->m_fmt_str > RBCF_ARENA_KEEP) free_fmt_str(a);
+    // pooled records keep their packed buffers: keep the first ones up to
+    // the cap, the others are created again when a query needs them
+    size_t kept = 0;
+    for (int i = 0; i < a->n_recs; i++) {
+        kept += sizeof(bcf1_t) + a->recs[i]->shared.m + a->recs[i]->indiv.m;
+        if (kept > RBCF_ARENA_KEEP) {
+            for (int j = i; j < a->n_recs; j++) rec_destroy(a->recs[j]);
+            a->n_recs = i;
+            break;
+        }
+    }
+    if (a->str.m > RBCF_ARENA_KEEP) {
+        free(a->str.s);
+        a->str.s = NULL;
+        a->str.m = 0;
+    }
+    a->str.l = 0;
+}
+
+void *rbcf_arena_alloc(rbcf_arena_t *a, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    if (n == 0) n = 16;
+    rbcf_arena_block_t *b = a->head;
+    if (!b || b->size - b->used < n) {
+        size_t size = RBCF_ARENA_BLOCK;
+        if (b && b->size * 2 > size) size = b->size * 2;
+        if (size < n) size = n;
+        rbcf_arena_block_t *nb = block_new(size);
+        if (!nb) return NULL;
+        nb->next = b;
+        a->head = b = nb;
+    }
+    void *p = BLOCK_DATA(b) + b->used;
+    b->used += n;
+    return p;
+}
+
+void *rbcf_arena_calloc(rbcf_arena_t *a, size_t n, size_t size) {
+    if (size && n > (size_t)-1 / size) return NULL;
+    void *p = rbcf_arena_alloc(a, n * size);
+    if (p) memset(p, 0, n * size);
+    return p;
+}
+
+bcf1_t *rbcf_arena_rec(rbcf_arena_t *a, int i) {
+    if (i < a->n_recs) return a->recs[i];
+    bcf1_t **recs = realloc(a->recs, (size_t)(i + 1) * sizeof(bcf1_t *));
+    if (!recs) return NULL;
+    a->recs = recs;
+    while (a->n_recs <= i) {
+        bcf1_t *rec = bcf_init();
+        if (!rec) return NULL;
+        a->recs[a->n_recs++] = rec;
+    }
+    return a->recs[i];
+}
+
+char ***rbcf_arena_fmt_str(rbcf_arena_t *a, int nsmpl) {
+    if (a->fmt_str && a->fmt_str_nsmpl != nsmpl) free_fmt_str(a);
+    a->fmt_str_nsmpl = nsmpl;
+    return &a->fmt_str;
+}
@@ -0,0 +1,76 @@
+#ifndef RBCF_ARENA_H
+#define RBCF_ARENA_H
+
+#include <stddef.h>
+#include "htslib/vcf.h"
+#include "htslib/kstring.h"
+
+/*
+ * Scratch memory for the query and accessor paths.
+ *
+ * An arena bundles everything a query needs only until it returns:
+ *  - a bump allocator for temporary arrays (hit lists, row maps, ...),
+ *    rewound by rbcf_arena_reset() instead of freed piece by piece;
+ *  - realloc-style buffers handed to bcf_get_info_*()/bcf_get_format_*(),
+ *    which htslib grows in place, so a buffer sized by one record is
+ *    reused by the next one;
+ *  - a pool of bcf1_t records and a kstring for rendering.
+ *
+ * The arena is owned by a long-lived object (a VBI context, or the file
+ * scope of RC_RBCF.c) and reset at the start of every query. Memory held
+ * across a reset is capped at RBCF_ARENA_KEEP bytes, so one huge query
+ * does not pin its peak footprint for the rest of the session. Because
+ * nothing is freed on the error path, an R error raised mid-query leaks
+ * nothing: the next reset reclaims it.
+ *
+ * Pointers obtained from the bump allocator are valid until the next
+ * reset. Not thread-safe; use one arena per thread.
+ */
+
+#define RBCF_ARENA_BLOCK (64 * 1024)
+#define RBCF_ARENA_KEEP  (16 * 1024 * 1024)
+
+typedef struct rbcf_arena_block_t {
+    struct rbcf_arena_block_t *next;
+    size_t size, used;
+} rbcf_arena_block_t;
+
+/* htslib decode buffers: pass &a->buf[k], &a->m_buf[k] to bcf_get_*() */
+enum {
+    RBCF_BUF_GT,
+    RBCF_BUF_INFO,
+    RBCF_BUF_FMT,
+    RBCF_ARENA_NBUF
+};
+
+typedef struct {
+    rbcf_arena_block_t *head;   /* current block first */
+    void *buf[RBCF_ARENA_NBUF];
+    int m_buf[RBCF_ARENA_NBUF]; /* capacity in elements, as htslib counts it */
+    char **fmt_str;             /* bcf_get_format_string() buffer */
+    int m_fmt_str, fmt_str_nsmpl;
+    bcf1_t **recs;
+    int n_recs;
+    kstring_t str;
+} rbcf_arena_t;
+
+void rbcf_arena_init(rbcf_arena_t *a);
+void rbcf_arena_destroy(rbcf_arena_t *a);
+/* rewind the bump allocator and trim what is kept to RBCF_ARENA_KEEP */
+void rbcf_arena_reset(rbcf_arena_t *a);
+
+/* 16-byte aligned, uninitialised; NULL on failure */
+void *rbcf_arena_alloc(rbcf_arena_t *a, size_t n);
+void *rbcf_arena_calloc(rbcf_arena_t *a, size_t n, size_t size);
+
+/* i-th pooled record, created on first use; NULL on failure */
+bcf1_t *rbcf_arena_rec(rbcf_arena_t *a, int i);
+
+/*
+ * Buffer for bcf_get_format_string(): its row array is sized for the
+ * sample count it was first used with, so it is dropped when nsmpl
+ * changes.
+ */
+char ***rbcf_arena_fmt_str(rbcf_arena_t *a, int nsmpl);
+
+#endif // RBCF_ARENA_H
@@ -0,0 +1,115 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rbcf_dosage.h"
+
+/* standardizes the raw dosages out[0..ns-1] (-1 for missing) */
+static int std_finish(const rbcf_std_t *s, int ns, double sum, int64_t n_alleles, int n_called,
+                      float *out, double *af) {
+    if (!n_called) return 0;
+    double p = sum / n_alleles, mean = sum / n_called;
+    *af = p;
+    if (p <= 0 || p >= 1 || (p < 0.5 ? p : 1 - p) < s->min_maf) return 0;
+    double ss = 0;
+    for (int k = 0; k < ns; k++) {
+        double x = out[k] < 0 ? 0 : out[k] - mean;
+        ss += x * x;
+    }
+    if (ss <= 0) return 0;
+    double scale = s->scale == RBCF_STD_BINOM ? 1 / sqrt(2 * p * (1 - p)) : 1 / sqrt(ss);
+    for (int k = 0; k < ns; k++) {
+        out[k] = out[k] < 0 ? 0 : (float)((out[k] - mean) * scale);
+    }
+    return 1;
+}
+
+int rbcf_std_dosages(rbcf_std_t *s, const bcf_hdr_t *hdr, bcf1_t *rec, float *out, double *af) {
+    *af = NAN;
+    int nsmpl = bcf_hdr_nsamples(hdr);
+    int n = bcf_get_genotypes(hdr, rec, &s->gt, &s->m_gt);
+    if (n <= 0 || !nsmpl) return 0;
+    int ploidy = n / nsmpl, ns = s->smp ? s->n : nsmpl;
+    // raw dosages first, -1 for missing
+    double sum = 0;
+    int64_t n_alleles = 0;
+    int n_called = 0;
+    for (int k = 0; k < ns; k++) {
+        const int32_t *g = s->gt + (size_t)(s->smp ? s->smp[k] : k) * ploidy;
+        int d = 0, a = 0, missing = 0;
+        for (int p = 0; p < ploidy && g[p] != bcf_int32_vector_end; p++) {
+            if (bcf_gt_is_missing(g[p])) {
+                missing = 1;
+                break;
+            }
+            d += bcf_gt_allele(g[p]) > 0;
+            a++;
+        }
+        if (missing || !a) {
+            out[k] = -1;
+            continue;
+        }
+        out[k] = (float)d;
+        sum += d;
+        n_alleles += a;
+        n_called++;
+    }
+    return std_finish(s, ns, sum, n_alleles, n_called, out, af);
+}
+
+int rbcf_std_counts(const rbcf_std_t *s, const float *counts, int n_allele, const uint8_t *missing,
+                    int n, float *out, double *af) {
+    *af = NAN;
+    double sum = 0;
+    int64_t n_alleles = 0;
+    int n_called = 0;
+    for (int k = 0; k < n; k++) {
+        float d = 0, a = counts[k];
+        for (int i = 1; i < n_allele; i++) d += counts[(size_t)i * n + k];
+        a += d;
+        if (missing[k] || a <= 0) {
+            out[k] = -1;
+            continue;
+        }
+        out[k] = d;
+        sum += d;
+        n_alleles += (int64_t)a;
+        n_called++;
+    }
+    return std_finish(s, n, sum, n_alleles, n_called, out, af);
+}
+
+void rbcf_std_destroy(rbcf_std_t *s) {
+    free(s->gt);
+    s->gt = NULL;
+    s->m_gt = 0;
+}
+
+const char *rbcf_stream_open(rbcf_stream_t *st, const char *fn, const char *regions, int n_threads) {
+    memset(st, 0, sizeof(rbcf_stream_t));
+    st->sr = bcf_sr_init();
+    if (!st->sr) return "Out of memory";
+    if (regions) {
+        bcf_sr_set_opt(st->sr, BCF_SR_REQUIRE_IDX);
+        if (bcf_sr_set_regions(st->sr, regions, 0) < 0) {
+            rbcf_stream_close(st);
+            return "Cannot parse the regions";
+        }
+    }
+    if (n_threads > 1) bcf_sr_set_threads(st->sr, n_threads);
+    if (!bcf_sr_add_reader(st->sr, fn)) {
+        const char *err = bcf_sr_strerror(st->sr->errnum);
+        rbcf_stream_close(st);
+        return err;
+    }
+    st->hdr = bcf_sr_get_header(st->sr, 0);
+    return NULL;
+}
+
+bcf1_t *rbcf_stream_next(rbcf_stream_t *st) {
+    return bcf_sr_next_line(st->sr) ? bcf_sr_get_line(st->sr, 0) : NULL;
+}
+
+void rbcf_stream_close(rbcf_stream_t *st) {
+    if (st->sr) bcf_sr_destroy(st->sr);
+    memset(st, 0, sizeof(rbcf_stream_t));
+}
@@ -0,0 +1,70 @@
+#ifndef RBCF_DOSAGE_H
+#define RBCF_DOSAGE_H
+
+#include <stdint.h>
+#include "htslib/vcf.h"
+#include "htslib/synced_bcf_reader.h"
+
+/*
+ * Standardized genotype dosages, the rows fed to the compute kernels
+ * (rbcf_linalg.h).
+ *
+ * The dosage of a sample is its number of non-REF alleles in GT, so a
+ * multi-allelic record counts all its ALT alleles together. Missing
+ * genotypes (any allele '.') are imputed to the mean, i.e. are 0 once
+ * centered. Rows are then scaled either
+ *   - RBCF_STD_UNIT: to unit norm, so that the dot product of two rows is
+ *     the correlation of the (imputed) dosages, or
+ *   - RBCF_STD_BINOM: by sqrt(2p(1-p)), p the ALT frequency among the
+ *     called alleles, the usual GRM standardization (assumes diploidy).
+ *
+ * Records without GT, with no called sample, monomorphic among the called
+ * samples or with a minor allele frequency below min_maf are filtered.
+ */
+
+#define RBCF_STD_UNIT 0
+#define RBCF_STD_BINOM 1
+
+typedef struct {
+    const int *smp;     /* sample columns in the header, NULL for all */
+    int n;              /* number of samples (bcf_hdr_nsamples if smp is NULL) */
+    double min_maf;
+    int scale;          /* RBCF_STD_* */
+    int32_t *gt;        /* bcf_get_genotypes() buffer */
+    int m_gt;
+} rbcf_std_t;
+
+/*
+ * Standardized dosages of rec into out[0..n-1]. Returns 1 if the record is
+ * kept, 0 if it is filtered (out is then undefined). *af is set to the ALT
+ * frequency among the called alleles (NaN without any).
+ */
+int rbcf_std_dosages(rbcf_std_t *s, const bcf_hdr_t *hdr, bcf1_t *rec, float *out, double *af);
+
+/*
+ * Same from allele counts, e.g. gtstore_allele_counts(): counts[a * n + k]
+ * copies of allele a in sample k, missing[k] set for missing genotypes.
+ * The n samples are taken as they are, s->smp and s->n are not used.
+ */
+int rbcf_std_counts(const rbcf_std_t *s, const float *counts, int n_allele, const uint8_t *missing,
+                    int n, float *out, double *af);
+
+/* frees the buffers of s */
+void rbcf_std_destroy(rbcf_std_t *s);
+
+/*
+ * Sequential reader over a VCF/BCF, restricted to regions ("chr",
+ * "chr:beg-end", comma separated) if not NULL, which needs an index.
+ * Several passes are made by closing and reopening.
+ */
+typedef struct {
+    bcf_srs_t *sr;
+    bcf_hdr_t *hdr;
+} rbcf_stream_t;
+
+/* Returns NULL on success, otherwise a static error message */
+const char *rbcf_stream_open(rbcf_stream_t *st, const char *fn, const char *regions, int n_threads);
+bcf1_t *rbcf_stream_next(rbcf_stream_t *st);
+void rbcf_stream_close(rbcf_stream_t *st);
+
+#endif // RBCF_DOSAGE_H
@@ -0,0 +1,366 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "rbcf_gtstore.h"
+#include "rbcf_gtsample.h"
+
+typedef struct {
+    FILE *fp;
+    int compress;
+    int64_t nsmpl;
+    int block_variants;
+    uint8_t *codes;         /* [sample][variant in block][2] */
+    int n_codes;            /* variants in the current block */
+    uint64_t *words;
+    uint8_t *z;
+    uint32_t *table;
+    size_t m_z;
+    gtsample_block_t *blocks;
+    int64_t n_blocks, m_blocks;
+    gtsample_var_t *vars;
+    int64_t n_vars, m_vars;
+} gtsample_writer_t;
+
+static int code_bits(int max_code) {
+    int nb = 1;
+    while ((1 << nb) <= max_code) nb++;
+    return 2 * nb + 1;
+}
+
+static int writer_flush(gtsample_writer_t *w) {
+    int nv = w->n_codes;
+    if (!nv) return 0;
+    if (w->n_blocks == w->m_blocks) {
+        int64_t m = w->m_blocks ? w->m_blocks * 2 : 64;
+        gtsample_block_t *b = realloc(w->blocks, m * sizeof(gtsample_block_t));
+        if (!b) return -1;
+        w->blocks = b;
+        w->m_blocks = m;
+    }
+    int max_code = 1;
+    int bv = w->block_variants;
+    for (int64_t s = 0; s < w->nsmpl; s++) {
+        const uint8_t *c = w->codes + (size_t)s * bv * 2;
+        for (int k = 0; k < 2 * nv; k++) {
+            if ((c[k] & 0x7f) > max_code) max_code = c[k] & 0x7f;
+        }
+    }
+    gtsample_block_t *b = &w->blocks[w->n_blocks++];
+    b->offset = (int64_t)ftello(w->fp);
+    b->first_variant = w->n_vars - nv;
+    b->n_variants = nv;
+    b->bits = code_bits(max_code);
+    int nb = (b->bits - 1) / 2, per_word = 64 / b->bits;
+    size_t nw = (size_t)(nv + per_word - 1) / per_word, rsize = nw * sizeof(uint64_t);
+
+    // the offsets are filled in once the runs are written
+    size_t table_size = (size_t)(w->nsmpl + 1) * sizeof(uint32_t);
+    memset(w->table, 0, table_size);
+    if (fwrite(w->table, 1, table_size, w->fp) != table_size) return -1;
+    for (int64_t s = 0; s < w->nsmpl; s++) {
+        const uint8_t *c = w->codes + (size_t)s * bv * 2;
+        memset(w->words, 0, rsize);
+        for (int k = 0; k < nv; k++) {
+            uint64_t code = c[2 * k] | (uint64_t)(c[2 * k + 1] & 0x7f) << nb |
+                            (uint64_t)(c[2 * k + 1] >> 7) << (2 * nb);
+            w->words[k / per_word] |= code << (k % per_word) * b->bits;
+        }
+        const uint8_t *data = (const uint8_t *)w->words;
+        size_t len = rsize;
+        if (w->compress) {
+            uLongf zlen = w->m_z;
+            if (compress2(w->z, &zlen, data, rsize, 1) != Z_OK) return -1;
+            if (zlen < rsize) {
+                data = w->z;
+                len = zlen;
+            }
+        }
+        if (fwrite(data, 1, len, w->fp) != len) return -1;
+        w->table[s + 1] = w->table[s] + (uint32_t)len;
+    }
+    if (fseeko(w->fp, (off_t)b->offset, SEEK_SET) != 0 ||
+        fwrite(w->table, 1, table_size, w->fp) != table_size ||
+        fseeko(w->fp, 0, SEEK_END) != 0) return -1;
+    w->n_codes = 0;
+    return 0;
+}
+
+static gtsample_var_t *writer_var(gtsample_writer_t *w) {
+    if (w->n_vars == w->m_vars) {
+        int64_t m = w->m_vars ? w->m_vars * 2 : 4096;
+        gtsample_var_t *v = realloc(w->vars, m * sizeof(gtsample_var_t));
+        if (!v) return NULL;
+        w->vars = v;
+        w->m_vars = m;
+    }
+    memset(&w->vars[w->n_vars], 0, sizeof(gtsample_var_t));
+    return &w->vars[w->n_vars++];
+}
+
+static uint8_t allele_code(int32_t g, int n_allele) {
+    if (g == bcf_int32_vector_end) return 1;
+    if (bcf_gt_is_missing(g)) return 0;
+    int a = bcf_gt_allele(g);
+    return a < n_allele ? (uint8_t)(a + 2) : 0;
+}
+
+/* codes of one record into the block, missing if gt is NULL */
+static void writer_add_gt(gtsample_writer_t *w, const int32_t *gt, int ploidy, int n_allele) {
+    size_t stride = (size_t)w->block_variants * 2;
+    uint8_t *c = w->codes + (size_t)w->n_codes * 2;
+    for (int64_t s = 0; s < w->nsmpl; s++, c += stride) {
+        if (!gt) {
+            c[0] = c[1] = 0;
+            continue;
+        }
+        const int32_t *g = gt + (size_t)s * ploidy;
+        int32_t g1 = ploidy > 1 ? g[1] : bcf_int32_vector_end;
+        if (g[0] == bcf_int32_vector_end) {
+            c[0] = 0;
+            c[1] = 1;
+            continue;
+        }
+        c[0] = allele_code(g[0], n_allele);
+        c[1] = allele_code(g1, n_allele);
+        if (g1 != bcf_int32_vector_end && bcf_gt_is_phased(g1)) c[1] |= 0x80;
+    }
+    w->n_codes++;
+}
+
+const char *gtsample_build(const char *in, const char *out, int n_threads, int compress) {
+    gtstore_source_t src;
+    const char *err = gtstore_source_open(&src, in, n_threads);
+    if (err) return err;
+    bcf_hdr_t *hdr = src.hdr;
+    bcf1_t *rec = src.rec;
+    gtsample_writer_t w;
+    memset(&w, 0, sizeof(gtsample_writer_t));
+    w.compress = compress;
+    int32_t *gt = NULL;
+    int m_gt = 0;
+    int nsmpl = bcf_hdr_nsamples(hdr);
+    w.nsmpl = nsmpl;
+    // as many variants per block as the build buffer holds, in whole words
+    int64_t bv = GTSAMPLE_BLOCK_BYTES / 2 / (nsmpl ? nsmpl : 1);
+    bv = bv < 64 ? 64 : bv > 65536 ? 65536 : bv & ~(int64_t)63;
+    w.block_variants = (int)bv;
+    // the widest codes take 15 bits, 4 genotypes per word
+    size_t max_words = (size_t)(bv + 3) / 4;
+    w.m_z = compressBound(max_words * sizeof(uint64_t));
+    w.codes = malloc((size_t)(nsmpl ? nsmpl : 1) * bv * 2);
+    w.words = malloc(max_words * sizeof(uint64_t));
+    w.z = malloc(w.m_z);
+    w.table = malloc((size_t)(nsmpl + 1) * sizeof(uint32_t));
+    if (!w.codes || !w.words || !w.z || !w.table) {
+        err = "Out of memory";
+        goto done;
+    }
+
+    w.fp = fopen(out, "wb");
+    if (!w.fp) {
+        err = "Cannot open output";
+        goto done;
+    }
+    if (gtstore_write_head(w.fp, GTSAMPLE_MAGIC, hdr) < 0) {
+        err = "Write error";
+        goto done;
+    }
+    int ret;
+    while ((ret = gtstore_source_next(&src, &err)) == 0) {
+        gtsample_var_t *v = writer_var(&w);
+        if (!v) {
+            err = "Out of memory";
+            goto done;
+        }
+        v->pos = rec->pos + 1;
+        v->chrom = src.chrom;
+        v->n_allele = rec->n_allele;
+        v->key = gtstore_allele_key(rec);
+        int n = nsmpl ? bcf_get_genotypes(hdr, rec, &gt, &m_gt) : 0;
+        int ploidy = n > 0 ? n / nsmpl : 0;
+        if (ploidy < 1 || ploidy > 2 || rec->n_allele > GTSAMPLE_MAX_ALLELES) {
+            v->flags = GTSAMPLE_F_SKIPPED;
+            writer_add_gt(&w, NULL, 0, 0);
+        } else {
+            writer_add_gt(&w, gt, ploidy, rec->n_allele);
+        }
+        if (w.n_codes == w.block_variants && writer_flush(&w) < 0) {
+            err = "Write error";
+            goto done;
+        }
+    }
+    if (ret < -1) goto done;
+    if (writer_flush(&w) < 0) {
+        err = "Write error";
+        goto done;
+    }
+
+    gtsample_header_t h;
+    memset(&h, 0, sizeof(gtsample_header_t));
+    h.n_variants = w.n_vars;
+    h.n_blocks = w.n_blocks;
+    h.compressed = compress ? 1 : 0;
+    if (gtstore_write_tail(w.fp, &h, &src, w.blocks, sizeof(gtsample_block_t), w.vars, sizeof(gtsample_var_t)) < 0) {
+        err = "Write error";
+    }
+
+done:
+    if (w.fp && fclose(w.fp) != 0 && !err) err = "Write error";
+    if (err && w.fp) remove(out);
+    free(w.codes);
+    free(w.words);
+    free(w.z);
+    free(w.table);
+    free(w.blocks);
+    free(w.vars);
+    free(gt);
+    gtstore_source_close(&src);
+    return err;
+}
+
+gtsample_t *gtsample_open(const char *fn) {
+    FILE *fp = fopen(fn, "rb");
+    if (!fp) return NULL;
+    gtsample_t *g = calloc(1, sizeof(gtsample_t));
+    gtstore_layout_t l;
+    if (!g || gtstore_read_layout(fp, GTSAMPLE_MAGIC, sizeof(gtsample_block_t), sizeof(gtsample_var_t), &l) < 0) {
+        free(g);
+        fclose(fp);
+        return NULL;
+    }
+    g->fp = fp;
+    g->hdr = l.hdr;
+    g->samples = l.samples;
+    g->chroms = l.chroms;
+    g->blocks = l.blocks;
+    g->vars = l.vars;
+    g->chrom_beg = l.chrom_beg;
+    g->chrom_end = l.chrom_end;
+    g->sorted = l.sorted;
+    int64_t next = 0;
+    for (int64_t b = 0; b < g->hdr.n_blocks; b++) {
+        gtsample_block_t *blk = &g->blocks[b];
+        if (blk->first_variant != next || blk->n_variants <= 0 ||
+            blk->bits < 3 || blk->bits > 63 || !(blk->bits & 1)) goto fail;
+        next += blk->n_variants;
+    }
+    if (next != g->hdr.n_variants) goto fail;
+    return g;
+
+fail:
+    gtsample_close(g);
+    return NULL;
+}
+
+void gtsample_close(gtsample_t *g) {
+    if (!g) return;
+    gtstore_free_strs(g->samples, g->hdr.n_samples);
+    gtstore_free_strs(g->chroms, g->hdr.n_chroms);
+    free(g->blocks);
+    free(g->vars);
+    free(g->chrom_beg);
+    free(g->chrom_end);
+    free(g->buf);
+    free(g->zbuf);
+    if (g->fp) fclose(g->fp);
+    free(g);
+}
+
+int gtsample_sample_index(const gtsample_t *g, const char *name) {
+    for (int64_t s = 0; s < g->hdr.n_samples; s++) {
+        if (strcmp(g->samples[s], name) == 0) return (int)s;
+    }
+    return -1;
+}
+
+int gtsample_region(const gtsample_t *g, const char *chrom, int64_t from, int64_t to,
+                    int64_t *beg, int64_t *end) {
+    if (!g->sorted) return -1;
+    *beg = *end = 0;
+    int c;
+    for (c = 0; c < g->hdr.n_chroms; c++) {
+        if (strcmp(g->chroms[c], chrom) == 0) break;
+    }
+    if (c == g->hdr.n_chroms) return 0;
+    int64_t lo = g->chrom_beg[c], hi = g->chrom_end[c];
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (g->vars[mid].pos < from) lo = mid + 1;
+        else hi = mid;
+    }
+    *beg = lo;
+    hi = g->chrom_end[c];
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (g->vars[mid].pos <= to) lo = mid + 1;
+        else hi = mid;
+    }
+    *end = lo;
+    return 0;
+}
+
+/* inflated run of sample s in block b, into g->buf */
+static int load_run(gtsample_t *g, int64_t b, int s) {
+    const gtsample_block_t *blk = &g->blocks[b];
+    int per_word = 64 / blk->bits;
+    size_t rsize = (size_t)(blk->n_variants + per_word - 1) / per_word * sizeof(uint64_t);
+    uint32_t off[2];
+    off_t data = (off_t)(blk->offset + (g->hdr.n_samples + 1) * sizeof(uint32_t));
+    if (fseeko(g->fp, (off_t)(blk->offset + (int64_t)s * sizeof(uint32_t)), SEEK_SET) != 0 ||
+        fread(off, sizeof(uint32_t), 2, g->fp) != 2 || off[1] < off[0]) return -1;
+    size_t csize = off[1] - off[0];
+    if (csize > rsize) return -1;
+    if (rsize > g->m_buf) {
+        uint64_t *buf = realloc(g->buf, rsize);
+        if (!buf) return -1;
+        g->buf = buf;
+        g->m_buf = rsize;
+    }
+    int raw = csize == rsize;
+    if (!raw && csize > g->m_zbuf) {
+        uint8_t *z = realloc(g->zbuf, csize);
+        if (!z) return -1;
+        g->zbuf = z;
+        g->m_zbuf = csize;
+    }
+    uint8_t *dst = raw ? (uint8_t *)g->buf : g->zbuf;
+    if (fseeko(g->fp, data + off[0], SEEK_SET) != 0 ||
+        (csize && fread(dst, 1, csize, g->fp) != csize)) return -1;
+    if (!raw) {
+        uLongf len = rsize;
+        if (uncompress((uint8_t *)g->buf, &len, g->zbuf, csize) != Z_OK || len != rsize) return -1;
+    }
+    return 0;
+}
+
+int gtsample_codes(gtsample_t *g, int s, int64_t beg, int64_t end, uint8_t *codes) {
+    if (s < 0 || s >= g->hdr.n_samples || beg < 0 || end > g->hdr.n_variants) return -1;
+    if (beg >= end) return 0;
+    // the block holding beg: the last one starting at or before it
+    int64_t lo = 0, hi = g->hdr.n_blocks;
+    while (hi - lo > 1) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (g->blocks[mid].first_variant <= beg) lo = mid;
+        else hi = mid;
+    }
+    for (int64_t b = lo; b < g->hdr.n_blocks && g->blocks[b].first_variant < end; b++) {
+        const gtsample_block_t *blk = &g->blocks[b];
+        if (load_run(g, b, s) < 0) return -1;
+        int bits = blk->bits, nb = (bits - 1) / 2, per_word = 64 / bits;
+        uint64_t mask = (1ULL << nb) - 1;
+        int64_t i0 = beg > blk->first_variant ? beg : blk->first_variant;
+        int64_t i1 = blk->first_variant + blk->n_variants;
+        if (i1 > end) i1 = end;
+        for (int64_t i = i0; i < i1; i++) {
+            int k = (int)(i - blk->first_variant);
+            uint64_t code = g->buf[k / per_word] >> (k % per_word) * bits;
+            uint8_t *c = codes + 2 * (i - beg);
+            c[0] = (uint8_t)(code & mask);
+            c[1] = (uint8_t)((code >> nb) & mask) | (uint8_t)(((code >> (2 * nb)) & 1) << 7);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef RBCF_GTSAMPLE_H
+#define RBCF_GTSAMPLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "htslib/vcf.h"
+#include "rbcf_gtstore.h"
+
+/*
+ * Sample-major genotype store: a sidecar file (by convention <file>.gts)
+ * holding the GT field of a VCF/BCF transposed, so that the genotypes of
+ * one sample over a region are read without touching the other samples.
+ *
+ * Variants are grouped in blocks of consecutive records. Within a block,
+ * each sample has its own run of 64-bit words packing its genotypes in
+ * record order, `bits` bits each, never straddling a word:
+ *   - the low nb = (bits - 1) / 2 bits: code of the first allele
+ *   - the next nb bits: code of the second allele
+ *   - the top bit: phased
+ * where the code is 0 for a missing allele, 1 for the end of a haploid
+ * genotype and a + 2 for allele a. nb is the smallest width holding the
+ * codes of the block. Samples without GT data are missing. Records without
+ * GT, with a ploidy above 2 or more than GTSAMPLE_MAX_ALLELES alleles
+ * are kept in the variant table with the GTSAMPLE_F_SKIPPED flag and have
+ * missing codes.
+ *
+ * A block starts with a table of n_samples + 1 uint32 offsets (relative to
+ * the end of the table) of the sample runs, each deflated on its own
+ * unless that does not help (then stored as is: its size is the raw size).
+ * Reading a sample over a block is thus one seek in the table and one in
+ * the data.
+ *
+ * The variant table holds the contig, position and allele key
+ * (gtstore_allele_key) of every record in file order, so that variant i
+ * is marker i + 1 of a VBI index of the same file. All integers are
+ * native-endian.
+ *
+ * File layout:
+ *   magic "RBCFGTS\2", header (gtsample_header_t),
+ *   sample names (int32 length + bytes each), blocks, contig names,
+ *   block table (gtsample_block_t) at table_offset, variant table
+ *   (gtsample_var_t), int64 offset of the contig names
+ */
+
+#define GTSAMPLE_MAGIC "RBCFGTS\2"
+#define GTSAMPLE_BLOCK_BYTES (32 * 1024 * 1024)  /* build buffer */
+#define GTSAMPLE_MAX_ALLELES 126
+
+#define GTSAMPLE_F_SKIPPED 1
+
+/* the header of a genotype column store: same fields, same meaning */
+typedef gtstore_header_t gtsample_header_t;
+
+typedef struct {
+    int64_t offset;         /* of the sample offset table */
+    int64_t first_variant;
+    int32_t n_variants;
+    int32_t bits;           /* per genotype */
+} gtsample_block_t;
+
+typedef struct {
+    int64_t pos;            /* 1-based */
+    int32_t chrom;
+    int32_t n_allele;
+    uint32_t key;           /* gtstore_allele_key() */
+    uint32_t flags;
+} gtsample_var_t;
+
+typedef struct {
+    FILE *fp;
+    gtsample_header_t hdr;
+    char **samples;
+    char **chroms;
+    gtsample_block_t *blocks;
+    gtsample_var_t *vars;
+    int64_t *chrom_beg, *chrom_end;   /* variant range of each contig */
+    int sorted;             /* contigs contiguous, positions ascending */
+    uint64_t *buf;
+    uint8_t *zbuf;
+    size_t m_buf, m_zbuf;
+} gtsample_t;
+
+/*
+ * Build a store from a VCF/BCF. Returns NULL on success, otherwise a
+ * static error message.
+ */
+const char *gtsample_build(const char *in, const char *out, int n_threads, int compress);
+
+gtsample_t *gtsample_open(const char *fn);
+void gtsample_close(gtsample_t *g);
+
+/* index of a sample, -1 if absent */
+int gtsample_sample_index(const gtsample_t *g, const char *name);
+
+/*
+ * Variant range [*beg, *end) of chrom:from-to (1-based, inclusive) in a
+ * sorted store. Returns -1 if the store is not sorted, 0 otherwise (an
+ * empty range for an absent contig).
+ */
+int gtsample_region(const gtsample_t *g, const char *chrom, int64_t from, int64_t to,
+                    int64_t *beg, int64_t *end);
+
+/*
+ * Genotype codes of sample s for the variants [beg, end): codes[2 * k]
+ * and codes[2 * k + 1] are the allele codes of variant beg + k (see
+ * above), with 0x80 set on the second one if the genotype is phased.
+ * Only the runs of s in the blocks overlapping the range are read.
+ * Returns 0, or -1 on I/O error.
+ */
+int gtsample_codes(gtsample_t *g, int s, int64_t beg, int64_t end, uint8_t *codes);
+
+#endif // RBCF_GTSAMPLE_H
@@ -0,0 +1,554 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+#include "rbcf_gtstore.h"
+
+typedef struct {
+    FILE *fp;
+    int compress;
+    uint8_t *raw, *z;
+    size_t n_raw, m_raw, m_z;
+    int64_t first_variant;
+    gtstore_block_t *blocks;
+    int64_t n_blocks, m_blocks;
+    gtstore_var_t *vars;
+    int64_t n_vars, m_vars;
+} gtstore_writer_t;
+
+int gtstore_write_str(FILE *fp, const char *s) {
+    int32_t len = (int32_t)strlen(s);
+    if (fwrite(&len, sizeof(int32_t), 1, fp) != 1) return -1;
+    return fwrite(s, 1, len, fp) == (size_t)len ? 0 : -1;
+}
+
+char *gtstore_read_str(FILE *fp) {
+    int32_t len;
+    if (fread(&len, sizeof(int32_t), 1, fp) != 1 || len < 0) return NULL;
+    char *s = malloc((size_t)len + 1);
+    if (!s) return NULL;
+    if (fread(s, 1, len, fp) != (size_t)len) {
+        free(s);
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+void gtstore_free_strs(char **s, int64_t n) {
+    if (!s) return;
+    for (int64_t i = 0; i < n; i++) free(s[i]);
+    free(s);
+}
+
+static int writer_flush(gtstore_writer_t *w) {
+    if (w->n_vars == w->first_variant) return 0;
+    if (w->n_blocks == w->m_blocks) {
+        int64_t m = w->m_blocks ? w->m_blocks * 2 : 64;
+        gtstore_block_t *b = realloc(w->blocks, m * sizeof(gtstore_block_t));
+        if (!b) return -1;
+        w->blocks = b;
+        w->m_blocks = m;
+    }
+    gtstore_block_t *b = &w->blocks[w->n_blocks++];
+    b->offset = (int64_t)ftello(w->fp);
+    b->first_variant = w->first_variant;
+    b->rsize = (uint32_t)w->n_raw;
+    b->csize = b->rsize;
+    const uint8_t *data = w->raw;
+    if (w->compress && w->n_raw) {
+        uLongf zlen = compressBound(w->n_raw);
+        if (zlen > w->m_z) {
+            uint8_t *z = realloc(w->z, zlen);
+            if (!z) return -1;
+            w->z = z;
+            w->m_z = zlen;
+        }
+        if (compress2(w->z, &zlen, w->raw, w->n_raw, 1) != Z_OK) return -1;
+        if (zlen < w->n_raw) {
+            b->csize = (uint32_t)zlen;
+            data = w->z;
+        }
+    }
+    if (b->csize && fwrite(data, 1, b->csize, w->fp) != b->csize) return -1;
+    w->n_raw = 0;
+    w->first_variant = w->n_vars;
+    return 0;
+}
+
+static uint64_t *writer_planes(gtstore_writer_t *w, size_t n_words) {
+    size_t need = w->n_raw + n_words * sizeof(uint64_t);
+    if (need > w->m_raw) {
+        size_t m = w->m_raw ? w->m_raw : GTSTORE_BLOCK_BYTES;
+        while (m < need) m *= 2;
+        uint8_t *raw = realloc(w->raw, m);
+        if (!raw) return NULL;
+        w->raw = raw;
+        w->m_raw = m;
+    }
+    uint64_t *p = (uint64_t *)(w->raw + w->n_raw);
+    memset(p, 0, n_words * sizeof(uint64_t));
+    w->n_raw = need;
+    return p;
+}
+
+static gtstore_var_t *writer_var(gtstore_writer_t *w) {
+    if (w->n_vars == w->m_vars) {
+        int64_t m = w->m_vars ? w->m_vars * 2 : 4096;
+        gtstore_var_t *v = realloc(w->vars, m * sizeof(gtstore_var_t));
+        if (!v) return NULL;
+        w->vars = v;
+        w->m_vars = m;
+    }
+    // zeroed so that the struct padding is written deterministically
+    memset(&w->vars[w->n_vars], 0, sizeof(gtstore_var_t));
+    return &w->vars[w->n_vars++];
+}
+
+/* append the planes of one record, sets v->flags */
+static int writer_add_gt(gtstore_writer_t *w, gtstore_var_t *v, const int32_t *gt, int ploidy, int nsmpl, int nw) {
+    int n_alt = v->n_allele - 1;
+    size_t start = w->n_raw;
+    uint64_t *planes = writer_planes(w, (size_t)(2 + 2 * n_alt) * nw);
+    if (!planes) return -1;
+    uint64_t *miss = planes, *hap = planes + nw, *alt = planes + 2 * nw;
+    for (int s = 0; s < nsmpl; s++) {
+        const int32_t *g = gt + (size_t)s * ploidy;
+        int32_t g0 = g[0], g1 = ploidy > 1 ? g[1] : bcf_int32_vector_end;
+        uint64_t bit = 1ULL << (s & 63);
+        int word = s >> 6;
+        if (g0 == bcf_int32_vector_end || bcf_gt_is_missing(g0) ||
+            (g1 != bcf_int32_vector_end && bcf_gt_is_missing(g1))) {
+            miss[word] |= bit;
+            v->flags |= GTSTORE_F_MISSING;
+            continue;
+        }
+        if (g1 == bcf_int32_vector_end) {
+            hap[word] |= bit;
+            v->flags |= GTSTORE_F_HAPLOID;
+        }
+        int a0 = bcf_gt_allele(g0);
+        int a1 = g1 == bcf_int32_vector_end ? -1 : bcf_gt_allele(g1);
+        if (a0 == a1 && a0 >= 1 && a0 <= n_alt) {
+            alt[(size_t)(2 * (a0 - 1) + 1) * nw + word] |= bit;
+            continue;
+        }
+        if (a0 >= 1 && a0 <= n_alt) alt[(size_t)(2 * (a0 - 1)) * nw + word] |= bit;
+        if (a1 >= 1 && a1 <= n_alt) alt[(size_t)(2 * (a1 - 1)) * nw + word] |= bit;
+    }
+    // drop the planes the flags say are absent
+    size_t plane = (size_t)nw * sizeof(uint64_t);
+    uint8_t *base = w->raw + start;
+    size_t keep = 0;
+    if (v->flags & GTSTORE_F_MISSING) keep += plane;
+    if (v->flags & GTSTORE_F_HAPLOID) {
+        if (keep != plane) memmove(base + keep, base + plane, plane);
+        keep += plane;
+    }
+    memmove(base + keep, base + 2 * plane, (size_t)2 * n_alt * plane);
+    w->n_raw = start + keep + (size_t)2 * n_alt * plane;
+    return 0;
+}
+
+uint32_t gtstore_header_hash(const bcf_hdr_t *hdr) {
+    kstring_t ks = {0, 0, NULL};
+    uint32_t h = 2166136261u;
+    if (bcf_hdr_format(hdr, 0, &ks) == 0) {
+        for (size_t i = 0; i < ks.l; i++) h = (h ^ (uint8_t)ks.s[i]) * 16777619u;
+    }
+    free(ks.s);
+    return h;
+}
+
+const char *gtstore_source_mismatch(const char *fn, int64_t size, int64_t mtime, uint32_t hash) {
+    struct stat st;
+    if (stat(fn, &st) != 0) return "cannot stat the source";
+    if ((int64_t)st.st_size != size) return "the source has another size";
+    if ((int64_t)st.st_mtime != mtime) return "the source was modified after the store was built";
+    htsFile *fp = hts_open(fn, "r");
+    if (!fp) return "cannot open the source";
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    uint32_t h = hdr ? gtstore_header_hash(hdr) : hash + 1;
+    if (hdr) bcf_hdr_destroy(hdr);
+    hts_close(fp);
+    return h == hash ? NULL : "the header of the source differs";
+}
+
+const char *gtstore_source_open(gtstore_source_t *src, const char *fn, int n_threads) {
+    struct stat st;
+    memset(src, 0, sizeof(gtstore_source_t));
+    if (stat(fn, &st) != 0) return "Cannot stat input";
+    src->size = (int64_t)st.st_size;
+    src->mtime = (int64_t)st.st_mtime;
+    if (!(src->fp = hts_open(fn, "r"))) return "Cannot open input";
+    if (n_threads > 1) hts_set_threads(src->fp, n_threads);
+    src->hdr = bcf_hdr_read(src->fp);
+    src->rec = bcf_init();
+    if (!src->hdr || !src->rec) {
+        gtstore_source_close(src);
+        return "Cannot read header";
+    }
+    // hashed as read: VCF parsing adds the undeclared contigs and tags to hdr
+    src->hash = gtstore_header_hash(src->hdr);
+    return NULL;
+}
+
+int gtstore_source_next(gtstore_source_t *src, const char **err) {
+    int ret = bcf_read(src->fp, src->hdr, src->rec);
+    if (ret < -1) {
+        *err = "Error reading a record";
+        return -2;
+    }
+    if (ret < 0) return -1;
+    int rid = src->rec->rid;
+    if (rid >= src->n_rid) {
+        // VCF parsing declares unknown contigs on the fly
+        int n = src->hdr->n[BCF_DT_CTG];
+        int *c = realloc(src->chrom_of_rid, n * sizeof(int));
+        if (c) src->chrom_of_rid = c;
+        const char **names = c ? realloc(src->chroms, n * sizeof(char *)) : NULL;
+        if (!names) {
+            *err = "Out of memory";
+            return -2;
+        }
+        src->chroms = names;
+        while (src->n_rid < n) src->chrom_of_rid[src->n_rid++] = -1;
+    }
+    if (src->chrom_of_rid[rid] < 0) {
+        src->chroms[src->n_chroms] = bcf_hdr_id2name(src->hdr, rid);
+        src->chrom_of_rid[rid] = src->n_chroms++;
+    }
+    src->chrom = src->chrom_of_rid[rid];
+    return 0;
+}
+
+void gtstore_source_close(gtstore_source_t *src) {
+    free(src->chroms);
+    free(src->chrom_of_rid);
+    if (src->rec) bcf_destroy(src->rec);
+    if (src->hdr) bcf_hdr_destroy(src->hdr);
+    if (src->fp) hts_close(src->fp);
+    memset(src, 0, sizeof(gtstore_source_t));
+}
+
+int gtstore_write_head(FILE *fp, const char *magic, const bcf_hdr_t *hdr) {
+    gtstore_header_t h;
+    memset(&h, 0, sizeof(gtstore_header_t));
+    if (fwrite(magic, 1, 8, fp) != 8 || fwrite(&h, sizeof(h), 1, fp) != 1) return -1;
+    for (int s = 0; s < bcf_hdr_nsamples(hdr); s++) {
+        if (gtstore_write_str(fp, hdr->samples[s]) < 0) return -1;
+    }
+    return 0;
+}
+
+int gtstore_write_tail(FILE *fp, gtstore_header_t *h, const gtstore_source_t *src, const void *blocks,
+                       size_t block_size, const void *vars, size_t var_size) {
+    h->n_samples = bcf_hdr_nsamples(src->hdr);
+    h->n_chroms = src->n_chroms;
+    h->source_size = src->size;
+    h->source_mtime = src->mtime;
+    h->source_hash = src->hash;
+    int64_t names_offset = (int64_t)ftello(fp);
+    for (int i = 0; i < src->n_chroms; i++) {
+        if (gtstore_write_str(fp, src->chroms[i]) < 0) return -1;
+    }
+    h->table_offset = (int64_t)ftello(fp);
+    if ((h->n_blocks && fwrite(blocks, block_size, h->n_blocks, fp) != (size_t)h->n_blocks) ||
+        (h->n_variants && fwrite(vars, var_size, h->n_variants, fp) != (size_t)h->n_variants) ||
+        fwrite(&names_offset, sizeof(int64_t), 1, fp) != 1 ||
+        fseeko(fp, 8, SEEK_SET) != 0 || fwrite(h, sizeof(gtstore_header_t), 1, fp) != 1) return -1;
+    return 0;
+}
+
+int gtstore_read_layout(FILE *fp, const char *magic, size_t block_size, size_t var_size, gtstore_layout_t *l) {
+    memset(l, 0, sizeof(gtstore_layout_t));
+    gtstore_header_t *h = &l->hdr;
+    char m[8];
+    if (fread(m, 1, 8, fp) != 8 || memcmp(m, magic, 8) != 0 ||
+        fread(h, sizeof(gtstore_header_t), 1, fp) != 1) return -1;
+    if (h->n_samples < 0 || h->n_variants < 0 || h->n_blocks < 0 || h->n_chroms < 0) return -1;
+
+    l->samples = calloc(h->n_samples ? h->n_samples : 1, sizeof(char *));
+    l->chroms = calloc(h->n_chroms ? h->n_chroms : 1, sizeof(char *));
+    l->blocks = malloc((h->n_blocks ? h->n_blocks : 1) * block_size);
+    l->vars = malloc((h->n_variants ? h->n_variants : 1) * var_size);
+    l->chrom_beg = malloc((h->n_chroms ? h->n_chroms : 1) * sizeof(int64_t));
+    l->chrom_end = malloc((h->n_chroms ? h->n_chroms : 1) * sizeof(int64_t));
+    if (!l->samples || !l->chroms || !l->blocks || !l->vars || !l->chrom_beg || !l->chrom_end) goto fail;
+    for (int64_t s = 0; s < h->n_samples; s++) {
+        if (!(l->samples[s] = gtstore_read_str(fp))) goto fail;
+    }
+
+    int64_t names_offset;
+    if (fseeko(fp, (off_t)(h->table_offset + h->n_blocks * block_size + h->n_variants * var_size), SEEK_SET) != 0 ||
+        fread(&names_offset, sizeof(int64_t), 1, fp) != 1 ||
+        fseeko(fp, (off_t)names_offset, SEEK_SET) != 0) goto fail;
+    for (int i = 0; i < h->n_chroms; i++) {
+        if (!(l->chroms[i] = gtstore_read_str(fp))) goto fail;
+    }
+    if (fseeko(fp, (off_t)h->table_offset, SEEK_SET) != 0) goto fail;
+    if (h->n_blocks && fread(l->blocks, block_size, h->n_blocks, fp) != (size_t)h->n_blocks) goto fail;
+    if (h->n_variants && fread(l->vars, var_size, h->n_variants, fp) != (size_t)h->n_variants) goto fail;
+
+    // contig ranges; a contig seen twice or a position going back leaves
+    // the store unsorted and lookups to a scan
+    l->sorted = 1;
+    for (int i = 0; i < h->n_chroms; i++) l->chrom_beg[i] = l->chrom_end[i] = -1;
+    int64_t prev = 0;
+    for (int64_t i = 0; i < h->n_variants; i++) {
+        const gtstore_loc_t *v = (const gtstore_loc_t *)((const char *)l->vars + i * var_size);
+        if (v->chrom < 0 || v->chrom >= h->n_chroms) goto fail;
+        if (l->chrom_beg[v->chrom] < 0) {
+            l->chrom_beg[v->chrom] = i;
+        } else if (l->chrom_end[v->chrom] != i || v->pos < prev) {
+            l->sorted = 0;
+        }
+        l->chrom_end[v->chrom] = i + 1;
+        prev = v->pos;
+    }
+    return 0;
+
+fail:
+    gtstore_free_strs(l->samples, h->n_samples);
+    gtstore_free_strs(l->chroms, h->n_chroms);
+    free(l->blocks);
+    free(l->vars);
+    free(l->chrom_beg);
+    free(l->chrom_end);
+    memset(l, 0, sizeof(gtstore_layout_t));
+    return -1;
+}
+
+const char *gtstore_build(const char *in, const char *out, int n_threads, int compress) {
+    gtstore_source_t src;
+    const char *err = gtstore_source_open(&src, in, n_threads);
+    if (err) return err;
+    bcf_hdr_t *hdr = src.hdr;
+    bcf1_t *rec = src.rec;
+    gtstore_writer_t w;
+    memset(&w, 0, sizeof(gtstore_writer_t));
+    w.compress = compress;
+    int32_t *gt = NULL;
+    int m_gt = 0;
+    int nsmpl = bcf_hdr_nsamples(hdr);
+    int nw = (nsmpl + 63) / 64;
+
+    w.fp = fopen(out, "wb");
+    if (!w.fp) {
+        err = "Cannot open output";
+        goto done;
+    }
+    if (gtstore_write_head(w.fp, GTSTORE_MAGIC, hdr) < 0) {
+        err = "Write error";
+        goto done;
+    }
+    int ret;
+    while ((ret = gtstore_source_next(&src, &err)) == 0) {
+        gtstore_var_t *v = writer_var(&w);
+        if (!v) {
+            err = "Out of memory";
+            goto done;
+        }
+        v->pos = rec->pos + 1;
+        v->chrom = src.chrom;
+        v->n_allele = rec->n_allele;
+        v->offset = (uint32_t)w.n_raw;
+        v->key = gtstore_allele_key(rec);
+        int n = nsmpl ? bcf_get_genotypes(hdr, rec, &gt, &m_gt) : 0;
+        int ploidy = n > 0 ? n / nsmpl : 0;
+        if (ploidy < 1 || ploidy > 2) {
+            v->flags = GTSTORE_F_SKIPPED;
+        } else if (writer_add_gt(&w, v, gt, ploidy, nsmpl, nw) < 0) {
+            err = "Out of memory";
+            goto done;
+        }
+        if (w.n_vars - w.first_variant >= GTSTORE_BLOCK_VARIANTS || w.n_raw >= GTSTORE_BLOCK_BYTES) {
+            if (writer_flush(&w) < 0) {
+                err = "Write error";
+                goto done;
+            }
+        }
+    }
+    if (ret < -1) goto done;
+    if (writer_flush(&w) < 0) {
+        err = "Write error";
+        goto done;
+    }
+
+    gtstore_header_t h;
+    memset(&h, 0, sizeof(gtstore_header_t));
+    h.n_variants = w.n_vars;
+    h.n_blocks = w.n_blocks;
+    h.compressed = compress ? 1 : 0;
+    if (gtstore_write_tail(w.fp, &h, &src, w.blocks, sizeof(gtstore_block_t), w.vars, sizeof(gtstore_var_t)) < 0) {
+        err = "Write error";
+    }
+
+done:
+    if (w.fp && fclose(w.fp) != 0 && !err) err = "Write error";
+    if (err && w.fp) remove(out);
+    free(w.raw);
+    free(w.z);
+    free(w.blocks);
+    free(w.vars);
+    free(gt);
+    gtstore_source_close(&src);
+    return err;
+}
+
+gtstore_t *gtstore_open(const char *fn) {
+    FILE *fp = fopen(fn, "rb");
+    if (!fp) return NULL;
+    gtstore_t *g = calloc(1, sizeof(gtstore_t));
+    gtstore_layout_t l;
+    if (!g || gtstore_read_layout(fp, GTSTORE_MAGIC, sizeof(gtstore_block_t), sizeof(gtstore_var_t), &l) < 0) {
+        free(g);
+        fclose(fp);
+        return NULL;
+    }
+    g->fp = fp;
+    g->cur_block = -1;
+    g->hdr = l.hdr;
+    g->n_words = (int)((g->hdr.n_samples + 63) / 64);
+    g->samples = l.samples;
+    g->chroms = l.chroms;
+    g->blocks = l.blocks;
+    g->vars = l.vars;
+    g->chrom_beg = l.chrom_beg;
+    g->chrom_end = l.chrom_end;
+    g->sorted = l.sorted;
+    return g;
+}
+
+void gtstore_close(gtstore_t *g) {
+    if (!g) return;
+    gtstore_free_strs(g->samples, g->hdr.n_samples);
+    gtstore_free_strs(g->chroms, g->hdr.n_chroms);
+    free(g->blocks);
+    free(g->vars);
+    free(g->chrom_beg);
+    free(g->chrom_end);
+    free(g->buf);
+    free(g->zbuf);
+    if (g->fp) fclose(g->fp);
+    free(g);
+}
+
+int gtstore_sample_index(const gtstore_t *g, const char *name) {
+    for (int64_t s = 0; s < g->hdr.n_samples; s++) {
+        if (strcmp(g->samples[s], name) == 0) return (int)s;
+    }
+    return -1;
+}
+
+uint32_t gtstore_allele_key(bcf1_t *rec) {
+    bcf_unpack(rec, BCF_UN_STR);
+    // FNV-1a over the alleles, separated by a byte no allele contains
+    uint32_t h = 2166136261u;
+    for (int a = 0; a < rec->n_allele; a++) {
+        for (const unsigned char *c = (const unsigned char *)rec->d.allele[a]; *c; c++) {
+            h = (h ^ *c) * 16777619u;
+        }
+        h = (h ^ 0xffu) * 16777619u;
+    }
+    return h;
+}
+
+int64_t gtstore_find(const gtstore_t *g, const char *chrom, int64_t pos, uint32_t key, int64_t hint) {
+    int64_t n = g->hdr.n_variants;
+    if (hint >= 0 && hint < n && g->vars[hint].pos == pos && g->vars[hint].key == key &&
+        strcmp(g->chroms[g->vars[hint].chrom], chrom) == 0) {
+        return hint;
+    }
+    if (!g->sorted) return -1;
+    int c;
+    for (c = 0; c < g->hdr.n_chroms; c++) {
+        if (strcmp(g->chroms[c], chrom) == 0) break;
+    }
+    if (c == g->hdr.n_chroms) return -1;
+    int64_t lo = g->chrom_beg[c], hi = g->chrom_end[c];
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (g->vars[mid].pos < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    for (; lo < g->chrom_end[c] && g->vars[lo].pos == pos; lo++) {
+        if (g->vars[lo].key == key) return lo;
+    }
+    return -1;
+}
+
+static int load_block(gtstore_t *g, int64_t b) {
+    if (g->cur_block == b) return 0;
+    gtstore_block_t *blk = &g->blocks[b];
+    if (blk->rsize > g->m_buf) {
+        uint8_t *buf = realloc(g->buf, blk->rsize);
+        if (!buf) return -1;
+        g->buf = buf;
+        g->m_buf = blk->rsize;
+    }
+    int raw = blk->csize == blk->rsize;
+    if (!raw && blk->csize > g->m_zbuf) {
+        uint8_t *z = realloc(g->zbuf, blk->csize);
+        if (!z) return -1;
+        g->zbuf = z;
+        g->m_zbuf = blk->csize;
+    }
+    g->cur_block = -1;
+    uint8_t *dst = raw ? g->buf : g->zbuf;
+    if (fseeko(g->fp, (off_t)blk->offset, SEEK_SET) != 0) return -1;
+    if (blk->csize && fread(dst, 1, blk->csize, g->fp) != blk->csize) return -1;
+    if (!raw) {
+        uLongf len = blk->rsize;
+        if (uncompress(g->buf, &len, g->zbuf, blk->csize) != Z_OK || len != blk->rsize) return -1;
+    }
+    g->cur_block = b;
+    return 0;
+}
+
+const uint64_t *gtstore_planes(gtstore_t *g, int64_t i) {
+    if (i < 0 || i >= g->hdr.n_variants || (g->vars[i].flags & GTSTORE_F_SKIPPED)) return NULL;
+    // the block holding i: the last one starting at or before it
+    int64_t lo = 0, hi = g->hdr.n_blocks;
+    if (g->cur_block >= 0 && g->blocks[g->cur_block].first_variant <= i &&
+        (g->cur_block + 1 == hi || g->blocks[g->cur_block + 1].first_variant > i)) {
+        lo = g->cur_block;
+    } else {
+        while (hi - lo > 1) {
+            int64_t mid = lo + (hi - lo) / 2;
+            if (g->blocks[mid].first_variant <= i) lo = mid;
+            else hi = mid;
+        }
+    }
+    if (load_block(g, lo) < 0) return NULL;
+    return (const uint64_t *)(g->buf + g->vars[i].offset);
+}
+
+int gtstore_allele_counts(gtstore_t *g, int64_t i, const int *cols, int n, float *counts, uint8_t *missing) {
+    const uint64_t *p = gtstore_planes(g, i);
+    if (!p) return -1;
+    const gtstore_var_t *v = &g->vars[i];
+    int nw = g->n_words, n_alt = v->n_allele - 1;
+    const uint64_t *miss = NULL, *hap = NULL;
+    if (v->flags & GTSTORE_F_MISSING) miss = p, p += nw;
+    if (v->flags & GTSTORE_F_HAPLOID) hap = p, p += nw;
+    for (int k = 0; k < n; k++) {
+        int s = cols ? cols[k] : k;
+        int word = s >> 6, b = s & 63;
+        int m = miss ? (int)((miss[word] >> b) & 1) : 0;
+        int ref = m ? 0 : hap ? 2 - (int)((hap[word] >> b) & 1) : 2;
+        missing[k] = (uint8_t)m;
+        // lo + 2 * hi, the bits are clear for missing genotypes
+        const uint64_t *lo = p + word;
+        for (int a = 1; a <= n_alt; a++, lo += 2 * nw) {
+            int c = (int)((lo[0] >> b) & 1) + 2 * (int)((lo[nw] >> b) & 1);
+            counts[(size_t)a * n + k] = (float)c;
+            ref -= c;
+        }
+        counts[k] = (float)ref;
+    }
+    return v->n_allele;
+}
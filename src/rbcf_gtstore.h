@@ -0,0 +1,198 @@
+#ifndef RBCF_GTSTORE_H
+#define RBCF_GTSTORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "htslib/vcf.h"
+
+/*
+ * Genotype column store: a sidecar file (by convention <file>.gtc) holding
+ * the GT field of a VCF/BCF as bit planes, so that genotype-only passes
+ * (scores, GRM, LD, ...) read a few bits per sample instead of inflating
+ * and decoding the whole FORMAT block of every record.
+ *
+ * Each variant is a run of planes of ceil(nsmpl / 64) 64-bit words, bit s
+ * of a plane being sample s:
+ *   - missing   (if GTSTORE_F_MISSING) any allele of the genotype is '.'
+ *   - haploid   (if GTSTORE_F_HAPLOID) the sample has a single allele
+ *   - lo, hi    for every ALT allele a = 1..n_allele-1: the number of
+ *               copies of a is lo + 2 * hi
+ * The REF count is ploidy minus the ALT counts. Phase is not kept. Records
+ * without GT or with a ploidy above 2 are kept in the variant table but
+ * have no planes (GTSTORE_F_SKIPPED); readers fall back to the source.
+ *
+ * Variants are grouped in blocks of up to GTSTORE_BLOCK_VARIANTS, each
+ * deflated on its own. Like a VBI index, the variant table records the
+ * contig, position, allele key and location (block, offset) of every
+ * record, in file order. All integers are native-endian.
+ *
+ * File layout (the contigs are only known once the records are read):
+ *   magic "RBCFGTC\2", header (gtstore_header_t),
+ *   sample names (int32 length + bytes each), blocks, contig names,
+ *   block table (gtstore_block_t) at table_offset, variant table
+ *   (gtstore_var_t), int64 offset of the contig names
+ */
+
+#define GTSTORE_MAGIC "RBCFGTC\2"
+#define GTSTORE_BLOCK_VARIANTS 1024
+#define GTSTORE_BLOCK_BYTES (4 * 1024 * 1024)
+
+#define GTSTORE_F_MISSING 1
+#define GTSTORE_F_HAPLOID 2
+#define GTSTORE_F_SKIPPED 4
+
+typedef struct {
+    int64_t n_samples;
+    int64_t n_variants;
+    int64_t n_blocks;
+    int64_t table_offset;   /* start of the block table */
+    int64_t source_size;    /* size of the file the store was built from */
+    int64_t source_mtime;   /* and its modification time, in seconds */
+    int32_t n_chroms;
+    int32_t compressed;
+    uint32_t source_hash;   /* gtstore_header_hash() of its header */
+} gtstore_header_t;
+
+typedef struct {
+    int64_t offset;         /* in the store file */
+    int64_t first_variant;
+    uint32_t csize, rsize;  /* stored and inflated sizes; equal if stored raw */
+} gtstore_block_t;
+
+typedef struct {
+    int64_t pos;            /* 1-based */
+    int32_t chrom;
+    int32_t n_allele;
+    uint32_t offset;        /* in the inflated block, in bytes */
+    uint32_t flags;
+    uint32_t key;           /* gtstore_allele_key() */
+} gtstore_var_t;
+
+typedef struct {
+    FILE *fp;
+    gtstore_header_t hdr;
+    int n_words;            /* 64-bit words per plane */
+    char **samples;
+    char **chroms;
+    gtstore_block_t *blocks;
+    gtstore_var_t *vars;
+    int64_t *chrom_beg, *chrom_end;   /* variant range of each contig */
+    int sorted;             /* contigs contiguous, positions ascending */
+    int64_t cur_block;      /* block held in buf, -1 if none */
+    uint8_t *buf, *zbuf;
+    size_t m_buf, m_zbuf;
+} gtstore_t;
+
+/*
+ * Build a store from a VCF/BCF. Returns NULL on success, otherwise a
+ * static error message.
+ */
+const char *gtstore_build(const char *in, const char *out, int n_threads, int compress);
+
+gtstore_t *gtstore_open(const char *fn);
+void gtstore_close(gtstore_t *g);
+
+/* FNV-1a hash of the text of a VCF/BCF header, sample names included */
+uint32_t gtstore_header_hash(const bcf_hdr_t *hdr);
+
+/*
+ * Checks that the file `fn` is still the one a store was built from (size,
+ * modification time and header hash, as recorded at build time). Returns
+ * NULL if so, otherwise a static message saying what differs. Shared by
+ * the genotype stores (this file and rbcf_gtsample.h).
+ */
+const char *gtstore_source_mismatch(const char *fn, int64_t size, int64_t mtime, uint32_t hash);
+
+/*
+ * Also shared by the genotype stores, which have the layout above around
+ * blocks and variant entries of their own. Those entries start with the
+ * fields of gtstore_loc_t.
+ */
+typedef struct {
+    int64_t pos;            /* 1-based */
+    int32_t chrom;
+    int32_t n_allele;
+} gtstore_loc_t;
+
+/* int32 length + bytes; 0 or -1 */
+int gtstore_write_str(FILE *fp, const char *s);
+/* malloc'd, NULL on error */
+char *gtstore_read_str(FILE *fp);
+void gtstore_free_strs(char **s, int64_t n);
+
+/*
+ * A VCF/BCF being read to build a store. The contigs are numbered in
+ * order of first use: chroms[chrom_of_rid[rid]] is the name of rid.
+ */
+typedef struct {
+    htsFile *fp;
+    bcf_hdr_t *hdr;
+    bcf1_t *rec;
+    int64_t size, mtime;    /* source stamps, see gtstore_header_t */
+    uint32_t hash;
+    int *chrom_of_rid;      /* -1 for contigs not seen yet */
+    int n_rid;
+    const char **chroms;
+    int n_chroms;
+    int chrom;              /* of rec */
+} gtstore_source_t;
+
+/* Returns NULL on success, otherwise a static error message */
+const char *gtstore_source_open(gtstore_source_t *src, const char *fn, int n_threads);
+/* Reads the next record into src->rec: 0, -1 at the end, -2 on error (*err set) */
+int gtstore_source_next(gtstore_source_t *src, const char **err);
+void gtstore_source_close(gtstore_source_t *src);
+
+/* magic, a blank header and the sample names; 0 or -1 */
+int gtstore_write_head(FILE *fp, const char *magic, const bcf_hdr_t *hdr);
+
+/*
+ * The contig names, the block and variant tables (h->n_blocks entries of
+ * block_size bytes, h->n_variants of var_size), the offset of the names,
+ * then h again at the start, completed from src. 0 or -1
+ */
+int gtstore_write_tail(FILE *fp, gtstore_header_t *h, const gtstore_source_t *src, const void *blocks,
+                       size_t block_size, const void *vars, size_t var_size);
+
+/* What gtstore_read_layout() reads of a store, all of it malloc'd */
+typedef struct {
+    gtstore_header_t hdr;
+    char **samples;
+    char **chroms;
+    void *blocks;
+    void *vars;
+    int64_t *chrom_beg, *chrom_end;
+    int sorted;
+} gtstore_layout_t;
+
+/* Reads the store opened as fp, checking its magic and contig numbers; 0 or -1 */
+int gtstore_read_layout(FILE *fp, const char *magic, size_t block_size, size_t var_size, gtstore_layout_t *l);
+
+/* index of a sample, -1 if absent */
+int gtstore_sample_index(const gtstore_t *g, const char *name);
+
+/* hash of the REF and ALT alleles of a record, unpacking them if needed */
+uint32_t gtstore_allele_key(bcf1_t *rec);
+
+/*
+ * Index of the variant at chrom:pos (1-based) with the given allele key,
+ * trying `hint` first so that a reader walking the source in order pays
+ * O(1) per record. -1 if not found.
+ */
+int64_t gtstore_find(const gtstore_t *g, const char *chrom, int64_t pos, uint32_t key, int64_t hint);
+
+/*
+ * Planes of variant i (layout above), valid until the next call on g.
+ * NULL on I/O error or for a GTSTORE_F_SKIPPED variant.
+ */
+const uint64_t *gtstore_planes(gtstore_t *g, int64_t i);
+
+/*
+ * Allele counts of variant i for the samples cols[0..n-1] (all samples if
+ * cols is NULL): counts[a * n + k] is the number of copies of allele a in
+ * sample k, missing[k] is set for missing genotypes (their counts are 0).
+ * Returns the number of alleles, or -1 (see gtstore_planes).
+ */
+int gtstore_allele_counts(gtstore_t *g, int64_t i, const int *cols, int n, float *counts, uint8_t *missing);
+
+#endif // RBCF_GTSTORE_H
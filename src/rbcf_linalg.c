@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include "rbcf_linalg.h"
+#include "rbcf_parallel.h"
+
+#define TB RBCF_LINALG_TB
+#define KB RBCF_LINALG_KB
+
+/* the four dot products of rows a0, a1 with rows b0, b1 over kb columns */
+static void dot2x2(const float *a0, const float *a1, const float *b0, const float *b1,
+                   int kb, double out[4]) {
+    float s00[8] = {0}, s01[8] = {0}, s10[8] = {0}, s11[8] = {0};
+    int t = 0;
+    for (; t + 8 <= kb; t += 8) {
+        for (int l = 0; l < 8; l++) {
+            s00[l] += a0[t + l] * b0[t + l];
+            s01[l] += a0[t + l] * b1[t + l];
+            s10[l] += a1[t + l] * b0[t + l];
+            s11[l] += a1[t + l] * b1[t + l];
+        }
+    }
+    double r00 = 0, r01 = 0, r10 = 0, r11 = 0;
+    for (int l = 0; l < 8; l++) {
+        r00 += s00[l];
+        r01 += s01[l];
+        r10 += s10[l];
+        r11 += s11[l];
+    }
+    for (; t < kb; t++) {
+        r00 += a0[t] * b0[t];
+        r01 += a0[t] * b1[t];
+        r10 += a1[t] * b0[t];
+        r11 += a1[t] * b1[t];
+    }
+    out[0] = r00;
+    out[1] = r01;
+    out[2] = r10;
+    out[3] = r11;
+}
+
+typedef struct {
+    int n, k;
+    const float *A;
+    size_t lda;
+    double *C;
+    rbcf_emit_fn emit;
+    void *arg;
+    int *tiles;         /* pairs (I, J), J <= I */
+    rbcf_tasks_t tasks;
+} syrk_job_t;
+
+static void syrk_tile(syrk_job_t *job, int ti, int tj) {
+    int n = job->n;
+    int i0 = ti * TB, i1 = i0 + TB < n ? i0 + TB : n;
+    int j0 = tj * TB, j1 = j0 + TB < n ? j0 + TB : n;
+    double acc[TB * TB] = {0};
+    double d[4];
+    for (int k0 = 0; k0 < job->k; k0 += KB) {
+        int kb = job->k - k0 < KB ? job->k - k0 : KB;
+        for (int i = i0; i < i1; i += 2) {
+            // an odd last row is paired with itself, its copy discarded
+            int i2 = i + 1 < i1 ? i + 1 : i;
+            const float *a0 = job->A + job->lda * i + k0, *a1 = job->A + job->lda * i2 + k0;
+            int jend = ti == tj ? i2 + 1 : j1;
+            for (int j = j0; j < jend; j += 2) {
+                int j2 = j + 1 < jend ? j + 1 : j;
+                const float *b0 = job->A + job->lda * j + k0, *b1 = job->A + job->lda * j2 + k0;
+                dot2x2(a0, a1, b0, b1, kb, d);
+                double *r = acc + (size_t)(i - i0) * TB + (j - j0);
+                r[0] += d[0];
+                if (j2 != j) r[1] += d[1];
+                if (i2 != i) {
+                    r[TB] += d[2];
+                    if (j2 != j) r[TB + 1] += d[3];
+                }
+            }
+        }
+    }
+    if (!job->C) {
+        job->emit(i0, i1, j0, j1, acc, TB, job->arg);
+        return;
+    }
+    for (int i = i0; i < i1; i++) {
+        int jend = ti == tj ? i + 1 : j1;
+        for (int j = j0; j < jend; j++) {
+            double v = acc[(size_t)(i - i0) * TB + (j - j0)];
+            job->C[i + (size_t)n * j] = v;
+            job->C[j + (size_t)n * i] = v;
+        }
+    }
+}
+
+static void syrk_worker(void *arg, int t) {
+    (void)t;
+    syrk_job_t *job = (syrk_job_t *)arg;
+    int64_t task;
+    while ((task = rbcf_parallel_next(&job->tasks)) >= 0) {
+        syrk_tile(job, job->tiles[2 * task], job->tiles[2 * task + 1]);
+    }
+}
+
+void rbcf_syrk(int n, int k, const float *A, size_t lda, double *C, int n_threads,
+               rbcf_tile_fn keep, rbcf_emit_fn emit, void *arg) {
+    int nt = (n + TB - 1) / TB;
+    syrk_job_t job = {.n = n, .k = k, .A = A, .lda = lda, .C = C, .emit = emit, .arg = arg};
+    job.tiles = malloc((size_t)nt * (nt + 1) * sizeof(int) + 1);
+    int64_t n_tasks = 0;
+    for (int ti = 0; ti < nt; ti++) {
+        for (int tj = 0; tj <= ti; tj++) {
+            int i1 = (ti + 1) * TB < n ? (ti + 1) * TB : n;
+            int j1 = (tj + 1) * TB < n ? (tj + 1) * TB : n;
+            if (keep && !keep(ti * TB, i1, tj * TB, j1, arg)) continue;
+            if (job.tiles) {
+                job.tiles[2 * n_tasks] = ti;
+                job.tiles[2 * n_tasks + 1] = tj;
+                n_tasks++;
+            } else {
+                syrk_tile(&job, ti, tj);
+            }
+        }
+    }
+    if (!job.tiles) return;
+    rbcf_tasks_init(&job.tasks, n_tasks);
+    rbcf_parallel_run(n_threads < n_tasks ? n_threads : (int)(n_tasks ? n_tasks : 1), syrk_worker, &job);
+    rbcf_tasks_destroy(&job.tasks);
+    free(job.tiles);
+}
+
+/* dot product of x and y over kb floats, 8 lanes as in dot2x2() */
+static double dot1(const float *x, const float *y, int kb) {
+    float s[8] = {0};
+    int t = 0;
+    for (; t + 8 <= kb; t += 8) {
+        for (int l = 0; l < 8; l++) s[l] += x[t + l] * y[t + l];
+    }
+    double r = 0;
+    for (int l = 0; l < 8; l++) r += s[l];
+    for (; t < kb; t++) r += x[t] * y[t];
+    return r;
+}
+
+#define GEMM_ROWS 16        /* rows of A per rbcf_gemm_aq task */
+#define GEMM_COLS 1024      /* columns of A per rbcf_gemm_atw task */
+
+typedef struct {
+    int b, k, l;
+    const float *A;
+    size_t lda;
+    const float *Q;
+    const double *W;
+    double *out;
+    rbcf_tasks_t tasks;
+} gemm_job_t;
+
+static void aq_worker(void *arg, int t) {
+    (void)t;
+    gemm_job_t *job = (gemm_job_t *)arg;
+    int b = job->b;
+    int64_t task;
+    while ((task = rbcf_parallel_next(&job->tasks)) >= 0) {
+        int i0 = (int)task * GEMM_ROWS, i1 = i0 + GEMM_ROWS < b ? i0 + GEMM_ROWS : b;
+        for (int c = 0; c < job->l; c++) {
+            for (int i = i0; i < i1; i++) job->out[i + (size_t)b * c] = 0;
+        }
+        // a k block of the rows and of Q stays in cache across the l columns
+        for (int k0 = 0; k0 < job->k; k0 += KB) {
+            int kb = job->k - k0 < KB ? job->k - k0 : KB;
+            for (int i = i0; i < i1; i++) {
+                const float *a = job->A + job->lda * i + k0;
+                for (int c = 0; c < job->l; c++) {
+                    job->out[i + (size_t)b * c] += dot1(a, job->Q + (size_t)job->k * c + k0, kb);
+                }
+            }
+        }
+    }
+}
+
+static void atw_worker(void *arg, int t) {
+    (void)t;
+    gemm_job_t *job = (gemm_job_t *)arg;
+    int b = job->b;
+    int64_t task;
+    while ((task = rbcf_parallel_next(&job->tasks)) >= 0) {
+        int s0 = (int)task * GEMM_COLS, s1 = s0 + GEMM_COLS < job->k ? s0 + GEMM_COLS : job->k;
+        for (int c = 0; c < job->l; c++) {
+            double *y = job->out + (size_t)job->k * c;
+            const double *w = job->W + (size_t)b * c;
+            // four rows at a time to load and store y once for them
+            int i = 0;
+            for (; i + 4 <= b; i += 4) {
+                const float *a0 = job->A + job->lda * i, *a1 = a0 + job->lda;
+                const float *a2 = a1 + job->lda, *a3 = a2 + job->lda;
+                double w0 = w[i], w1 = w[i + 1], w2 = w[i + 2], w3 = w[i + 3];
+                for (int s = s0; s < s1; s++) y[s] += w0 * a0[s] + w1 * a1[s] + w2 * a2[s] + w3 * a3[s];
+            }
+            for (; i < b; i++) {
+                const float *a = job->A + job->lda * i;
+                for (int s = s0; s < s1; s++) y[s] += w[i] * a[s];
+            }
+        }
+    }
+}
+
+static void gemm_run(gemm_job_t *job, int64_t n_tasks, int n_threads, void (*worker)(void *, int)) {
+    rbcf_tasks_init(&job->tasks, n_tasks);
+    rbcf_parallel_run(n_threads < n_tasks ? n_threads : (int)(n_tasks ? n_tasks : 1), worker, job);
+    rbcf_tasks_destroy(&job->tasks);
+}
+
+void rbcf_gemm_aq(int b, int k, const float *A, size_t lda, const float *Q, int l, double *W,
+                  int n_threads) {
+    gemm_job_t job = {.b = b, .k = k, .l = l, .A = A, .lda = lda, .Q = Q, .out = W};
+    gemm_run(&job, (b + GEMM_ROWS - 1) / GEMM_ROWS, n_threads, aq_worker);
+}
+
+void rbcf_gemm_atw(int b, int k, const float *A, size_t lda, const double *W, int l, double *Y,
+                   int n_threads) {
+    gemm_job_t job = {.b = b, .k = k, .l = l, .A = A, .lda = lda, .W = W, .out = Y};
+    gemm_run(&job, (k + GEMM_COLS - 1) / GEMM_COLS, n_threads, atw_worker);
+}
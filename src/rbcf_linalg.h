@@ -0,0 +1,55 @@
+#ifndef RBCF_LINALG_H
+#define RBCF_LINALG_H
+
+#include <stddef.h>
+
+/*
+ * Dense kernels over genotype matrices.
+ *
+ * Genotypes are kept as float rows (one variant per row, one sample per
+ * column, row stride ld), which halves the memory traffic of double
+ * matrices; products are accumulated in float over k blocks of
+ * RBCF_LINALG_KB columns and summed in double across blocks, so the
+ * rounding error does not grow with the number of samples.
+ *
+ * The work is split in RBCF_LINALG_TB x RBCF_LINALG_TB output tiles whose
+ * two row panels fit in cache, shared among threads with
+ * rbcf_parallel_run(). The inner loops work on 8 independent lanes, which
+ * the compiler turns into SIMD code without reassociating float sums.
+ */
+
+#define RBCF_LINALG_TB 64
+#define RBCF_LINALG_KB 512
+
+/* tile filter: 1 to compute rows [i0, i1) x [j0, j1) of the output */
+typedef int (*rbcf_tile_fn)(int i0, int i1, int j0, int j1, void *arg);
+
+/*
+ * tile sink: element (i, j) of the output is tile[(i - i0) * ld + j - j0].
+ * Tiles on the diagonal (i0 == j0) only hold j <= i. Called from the worker
+ * threads, so it must lock whatever it shares.
+ */
+typedef void (*rbcf_emit_fn)(int i0, int i1, int j0, int j1, const double *tile, int ld, void *arg);
+
+/*
+ * C = A A^T for the n x k matrix A, with j <= i tiles computed. They go
+ * into the n x n column-major (R layout) matrix C, both triangles, or to
+ * emit if C is NULL. Tiles rejected by keep (if not NULL) are skipped: C
+ * is left untouched there, as are the mirror images.
+ */
+void rbcf_syrk(int n, int k, const float *A, size_t lda, double *C, int n_threads,
+               rbcf_tile_fn keep, rbcf_emit_fn emit, void *arg);
+
+/*
+ * Products of a b x k block A with thin matrices (l columns, a sketch or
+ * basis), for the out-of-core randomized SVD:
+ *   rbcf_gemm_aq:  W = A Q, Q k x l and W b x l, both column-major
+ *   rbcf_gemm_atw: Y += A^T W, Y k x l column-major
+ * Rows of A are split among threads for the first, columns for the second.
+ */
+void rbcf_gemm_aq(int b, int k, const float *A, size_t lda, const float *Q, int l, double *W,
+                  int n_threads);
+void rbcf_gemm_atw(int b, int k, const float *A, size_t lda, const double *W, int l, double *Y,
+                   int n_threads);
+
+#endif // RBCF_LINALG_H
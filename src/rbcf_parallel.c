@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include "rbcf_parallel.h"
+
+void rbcf_tasks_init(rbcf_tasks_t *q, int64_t n) {
+    pthread_mutex_init(&q->lock, NULL);
+    q->next = 0;
+    q->n = n;
+}
+
+void rbcf_tasks_destroy(rbcf_tasks_t *q) {
+    pthread_mutex_destroy(&q->lock);
+}
+
+int64_t rbcf_parallel_next(rbcf_tasks_t *q) {
+    pthread_mutex_lock(&q->lock);
+    int64_t i = q->next < q->n ? q->next++ : -1;
+    pthread_mutex_unlock(&q->lock);
+    return i;
+}
+
+typedef struct {
+    void (*fn)(void *arg, int t);
+    void *arg;
+    int t;
+} worker_t;
+
+static void *worker_main(void *p) {
+    worker_t *w = (worker_t *)p;
+    w->fn(w->arg, w->t);
+    return NULL;
+}
+
+void rbcf_parallel_run(int n_threads, void (*fn)(void *arg, int t), void *arg) {
+    if (n_threads <= 1) {
+        fn(arg, 0);
+        return;
+    }
+    pthread_t *tid = malloc((size_t)n_threads * sizeof(pthread_t));
+    worker_t *w = malloc((size_t)n_threads * sizeof(worker_t));
+    int started = 0;
+    if (tid && w) {
+        for (int t = 1; t < n_threads; t++) {
+            w[t].fn = fn;
+            w[t].arg = arg;
+            w[t].t = t;
+            if (pthread_create(&tid[t], NULL, worker_main, &w[t]) != 0) break;
+            started = t;
+        }
+    }
+    fn(arg, 0);
+    // threads that could not be created run here
+    for (int t = started + 1; t < n_threads; t++) fn(arg, t);
+    for (int t = 1; t <= started; t++) pthread_join(tid[t], NULL);
+    free(tid);
+    free(w);
+}
@@ -0,0 +1,38 @@
+#ifndef RBCF_PARALLEL_H
+#define RBCF_PARALLEL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Fork-join helper for the compute kernels (LD, GRM, PCA, ...).
+ *
+ * rbcf_parallel_run() calls fn(arg, t) on n_threads threads, t = 0 being
+ * the calling thread, and returns once all calls have returned. Work is
+ * usually shared through a task counter: each thread loops on
+ * rbcf_parallel_next() until it returns -1.
+ *
+ * The calls must not touch the R API (no allocation, no Rf_error, no
+ * R_CheckUserInterrupt): only the calling thread may, and only once
+ * rbcf_parallel_run() has returned.
+ */
+
+typedef struct {
+    pthread_mutex_t lock;
+    int64_t next, n;
+} rbcf_tasks_t;
+
+void rbcf_tasks_init(rbcf_tasks_t *q, int64_t n);
+void rbcf_tasks_destroy(rbcf_tasks_t *q);
+
+/* next task index in 0..n-1, -1 once all are taken */
+int64_t rbcf_parallel_next(rbcf_tasks_t *q);
+
+/*
+ * Runs fn on n_threads threads (at least 1). If threads cannot be
+ * created, the remaining calls run on the calling thread, one after the
+ * other: fn must not wait for the others.
+ */
+void rbcf_parallel_run(int n_threads, void (*fn)(void *arg, int t), void *arg);
+
+#endif // RBCF_PARALLEL_H
@@ -0,0 +1,31 @@
+#ifndef VBI_CONTEXT_H
+#define VBI_CONTEXT_H
+
+#include <Rinternals.h>
+#include "htslib/vcf.h"
+#include "vbi_index_capi.h"
+
+/*
+ * Records of a VBI context (VCFLoad()) for code outside RC_VBI_IOP.c,
+ * such as the compute kernels. The context must stay protected while
+ * these are used; invalid contexts raise an R error.
+ */
+
+bcf_hdr_t *vbi_context_header(SEXP vbi_vcf_ctx);
+
+/* The VBI index of a context */
+vbi_index_t *vbi_context_index(SEXP vbi_vcf_ctx);
+
+/* 0-based markers of a region, to free(); NULL (and *n = 0) if none */
+int *vbi_context_region(SEXP vbi_vcf_ctx, const char *region, int *n);
+
+/*
+ * Reads a marker into rec, through the mapping if the file is mapped: call
+ * vbi_map_release() on rec before destroying it. Returns 0 or -1.
+ */
+int vbi_context_read(SEXP vbi_vcf_ctx, int marker, bcf1_t *rec);
+
+/* The intervals of a cgranges object (RC_cgranges_create()) */
+cgranges_t *cgranges_context(SEXP cr_ptr);
+
+#endif // VBI_CONTEXT_H
@@ -0,0 +1,564 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // struct ucred
+#endif
+#include "vbi_daemon.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "htslib/kstring.h"
+#endif
+
+#define VBID_MAX_PATH  4096
+#define VBID_MAX_BYTES (1u << 30)
+#define VBID_POLL_MS   200
+
+static int hits_grow(vbid_hits_t *h, int64_t n) {
+    if (h->n + n <= h->m) return 0;
+    int64_t m = h->m ? h->m : 256;
+    while (m < h->n + n) m *= 2;
+    int32_t *q = realloc(h->query, m * sizeof(int32_t));
+    if (q) h->query = q;
+    int32_t *k = realloc(h->marker, m * sizeof(int32_t));
+    if (k) h->marker = k;
+    int32_t *c = realloc(h->chrom, m * sizeof(int32_t));
+    if (c) h->chrom = c;
+    int64_t *p = realloc(h->pos, m * sizeof(int64_t));
+    if (p) h->pos = p;
+    if (!q || !k || !c || !p) return -1;
+    h->m = m;
+    return 0;
+}
+
+void vbid_hits_free(vbid_hits_t *h) {
+    free(h->query);
+    free(h->marker);
+    free(h->chrom);
+    free(h->pos);
+    memset(h, 0, sizeof(*h));
+}
+
+static int cmp_int32(const void *a, const void *b) {
+    int32_t x = *(const int32_t *) a, y = *(const int32_t *) b;
+    return (x > y) - (x < y);
+}
+
+// markers [beg, h->n) of query q: sort, drop repeats (overlapping regions)
+// and fill their contig and position
+static void hits_finish(const vbi_index_t *idx, vbid_hits_t *h, int64_t beg, int32_t q) {
+    qsort(h->marker + beg, h->n - beg, sizeof(int32_t), cmp_int32);
+    int64_t n = beg;
+    int32_t prev = -1;
+    for (int64_t i = beg; i < h->n; i++) {
+        int32_t m = h->marker[i];
+        if (m == prev) continue;
+        prev = m;
+        h->query[n] = q;
+        h->marker[n] = m + 1;
+        h->chrom[n] = idx->chrom_ids[m];
+        h->pos[n] = idx->positions[m];
+        n++;
+    }
+    h->n = n;
+}
+
+int vbid_query(const vbi_index_t *idx, int op, const char *queries, uint32_t nquery,
+               vbid_hits_t *h, char *err, size_t nerr) {
+    if (op == VBID_OP_ID && !idx->id_keys) {
+        snprintf(err, nerr, "Index has no ID table, rebuild it with VBIIndex(Keys = TRUE)");
+        return -1;
+    }
+    if (op == VBID_OP_REGION && !idx->cr) {
+        snprintf(err, nerr, "Index has no interval tree");
+        return -1;
+    }
+    cgranges_t *cr = (cgranges_t *) idx->cr;
+    int64_t *b = NULL, mb = 0;
+    const char *s = queries;
+    for (uint32_t q = 0; q < nquery; q++, s += strlen(s) + 1) {
+        int64_t beg = h->n;
+        if (op == VBID_OP_ID) {
+            int64_t i = vbi_key_find(idx->id_keys, idx->n_id_keys, vbi_id_key(s, strlen(s)));
+            int64_t e = i;
+            if (i >= 0) while (e < idx->n_id_keys && idx->id_keys[e].key == idx->id_keys[i].key) e++;
+            if (hits_grow(h, e - i) < 0) goto oom;
+            for (; i < e; i++) h->marker[h->n++] = (int32_t) idx->id_keys[i].marker;
+        } else {
+            region_t *regions = NULL;
+            int nregions = 0;
+            parse_regions(s, &regions, &nregions);
+            for (int r = 0; r < nregions; r++) {
+                // markers are points [pos,pos): overlap [start-1, end+1)
+                int64_t st = regions[r].start < 1 ? 1 : regions[r].start;
+                int64_t en = regions[r].end >= INT32_MAX ? INT32_MAX - 1 : regions[r].end;
+                if (st > en) continue;
+                int64_t n = cr_overlap(cr, regions[r].chrom, (int32_t)(st - 1), (int32_t)(en + 1), &b, &mb);
+                if (hits_grow(h, n) < 0) {
+                    free(regions);
+                    goto oom;
+                }
+                for (int64_t i = 0; i < n; i++) h->marker[h->n++] = cr_label(cr, b[i]);
+            }
+            free(regions);
+        }
+        hits_finish(idx, h, beg, (int32_t)(q + 1));
+    }
+    free(b);
+    return 0;
+oom:
+    free(b);
+    snprintf(err, nerr, "Out of memory");
+    return -1;
+}
+
+#ifndef _WIN32
+
+static int send_all(int fd, const void *buf, size_t n) {
+    const char *p = buf;
+    while (n) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+// 0, 1 on EOF before the first byte, -1 on error or truncation
+static int recv_all(int fd, void *buf, size_t n) {
+    char *p = buf;
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = recv(fd, p + got, n - got, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r == 0 && got == 0) return 1;
+        if (r <= 0) return -1;
+        got += r;
+    }
+    return 0;
+}
+
+/*
+ * Server
+ */
+
+typedef struct {
+    char *path;                 // realpath of the index
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    vbi_index_t *idx;
+    int refs;
+    int64_t nquery;
+} vbid_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    vbid_entry_t **entry;       // loaded indexes; replaced ones live until released
+    int nentry, mentry;
+    int *conn;                  // open connections
+    int nconn, mconn;
+    int stop;
+    time_t last;
+} vbid_server_t;
+
+typedef struct {
+    vbid_server_t *srv;
+    int fd;
+} vbid_conn_t;
+
+static void entry_free(vbid_entry_t *e) {
+    vbi_index_free(e->idx);
+    free(e->path);
+    free(e);
+}
+
+static void entry_release(vbid_server_t *srv, vbid_entry_t *e) {
+    pthread_mutex_lock(&srv->lock);
+    int live = 0;
+    for (int i = 0; i < srv->nentry; i++) live |= srv->entry[i] == e;
+    if (--e->refs == 0 && !live) entry_free(e);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+static int entry_current(const vbid_entry_t *e, const struct stat *st) {
+    return e->dev == st->st_dev && e->ino == st->st_ino && e->size == st->st_size && e->mtime == st->st_mtime;
+}
+
+// index of path, loaded (outside the lock) on first use or when the file changed
+static vbid_entry_t *entry_acquire(vbid_server_t *srv, const char *path, char *err, size_t nerr) {
+    char real[PATH_MAX];
+    struct stat st;
+    if (!realpath(path, real) || stat(real, &st) != 0) {
+        snprintf(err, nerr, "Cannot open index %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    pthread_mutex_lock(&srv->lock);
+    for (int i = 0; i < srv->nentry; i++) {
+        vbid_entry_t *e = srv->entry[i];
+        if (strcmp(e->path, real) != 0) continue;
+        if (entry_current(e, &st)) {
+            e->refs++;
+            pthread_mutex_unlock(&srv->lock);
+            return e;
+        }
+        // stale: forget it, its last user frees it
+        srv->entry[i] = srv->entry[--srv->nentry];
+        if (e->refs == 0) entry_free(e);
+        break;
+    }
+    pthread_mutex_unlock(&srv->lock);
+
+    vbid_entry_t *e = calloc(1, sizeof(vbid_entry_t));
+    if (!e || !(e->path = strdup(real)) || !(e->idx = vbi_index_load(real))) {
+        snprintf(err, nerr, "Failed to load index from %s", real);
+        if (e) free(e->path);
+        free(e);
+        return NULL;
+    }
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+    e->refs = 1;
+
+    pthread_mutex_lock(&srv->lock);
+    for (int i = 0; i < srv->nentry; i++) {
+        // loaded meanwhile by another connection
+        vbid_entry_t *o = srv->entry[i];
+        if (strcmp(o->path, real) == 0 && entry_current(o, &st)) {
+            o->refs++;
+            pthread_mutex_unlock(&srv->lock);
+            entry_free(e);
+            return o;
+        }
+    }
+    if (srv->nentry == srv->mentry) {
+        int m = srv->mentry ? 2 * srv->mentry : 8;
+        vbid_entry_t **a = realloc(srv->entry, m * sizeof(*a));
+        if (!a) {
+            pthread_mutex_unlock(&srv->lock);
+            entry_free(e);
+            snprintf(err, nerr, "Out of memory");
+            return NULL;
+        }
+        srv->entry = a;
+        srv->mentry = m;
+    }
+    srv->entry[srv->nentry++] = e;
+    pthread_mutex_unlock(&srv->lock);
+    return e;
+}
+
+static int send_resp(int fd, int32_t status, const vbid_hits_t *h, uint32_t nchrom, const char *text, uint64_t ntext) {
+    vbid_resp_t r = { VBID_MAGIC, status, nchrom, 0, h ? (uint64_t) h->n : 0, ntext };
+    if (send_all(fd, &r, sizeof(r)) < 0) return -1;
+    if (r.nhit && (send_all(fd, h->query, r.nhit * sizeof(int32_t)) < 0 ||
+                   send_all(fd, h->marker, r.nhit * sizeof(int32_t)) < 0 ||
+                   send_all(fd, h->chrom, r.nhit * sizeof(int32_t)) < 0 ||
+                   send_all(fd, h->pos, r.nhit * sizeof(int64_t)) < 0)) return -1;
+    return ntext ? send_all(fd, text, ntext) : 0;
+}
+
+static int send_error(int fd, const char *msg) {
+    return send_resp(fd, -1, NULL, 0, msg, strlen(msg) + 1);
+}
+
+static int serve_status(vbid_server_t *srv, int fd) {
+    kstring_t s = {0, 0, NULL};
+    pthread_mutex_lock(&srv->lock);
+    for (int i = 0; i < srv->nentry; i++) {
+        vbid_entry_t *e = srv->entry[i];
+        ksprintf(&s, "%s\t%" PRId64 "\t%" PRId64 "\n", e->path, e->idx->num_marker, e->nquery);
+    }
+    pthread_mutex_unlock(&srv->lock);
+    int ret = send_resp(fd, 0, NULL, 0, s.s, s.l);
+    free(s.s);
+    return ret;
+}
+
+static int serve_query(vbid_server_t *srv, int fd, const vbid_req_t *req, const char *path, const char *queries) {
+    char err[PATH_MAX + 64];
+    vbid_entry_t *e = entry_acquire(srv, path, err, sizeof(err));
+    if (!e) return send_error(fd, err);
+    vbid_hits_t h = {0};
+    int ret;
+    if (vbid_query(e->idx, req->op, queries, req->nquery, &h, err, sizeof(err)) < 0) {
+        ret = send_error(fd, err);
+    } else {
+        kstring_t names = {0, 0, NULL};
+        for (int i = 0; i < e->idx->n_chroms; i++) kputsn(e->idx->chrom_names[i], strlen(e->idx->chrom_names[i]) + 1, &names);
+        ret = send_resp(fd, 0, &h, e->idx->n_chroms, names.s, names.l);
+        free(names.s);
+    }
+    pthread_mutex_lock(&srv->lock);
+    e->nquery += req->nquery;
+    pthread_mutex_unlock(&srv->lock);
+    vbid_hits_free(&h);
+    entry_release(srv, e);
+    return ret;
+}
+
+// 0 if the process at the other end of fd runs as the same user as this one
+static int peer_same_user(int fd) {
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t n = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &n) != 0) return -1;
+    return cred.uid == geteuid() ? 0 : -1;
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) != 0) return -1;
+    return uid == geteuid() ? 0 : -1;
+#endif
+}
+
+static void *serve_conn(void *arg) {
+    vbid_conn_t *c = arg;
+    vbid_server_t *srv = c->srv;
+    char *path = NULL, *queries = NULL;
+    vbid_req_t req;
+    // only the processes of the user of the daemon may query or stop it
+    if (peer_same_user(c->fd) != 0) send_error(c->fd, "Permission denied");
+    else while (recv_all(c->fd, &req, sizeof(req)) == 0) {
+        if (req.magic != VBID_MAGIC || req.npath > VBID_MAX_PATH || req.nbytes > VBID_MAX_BYTES) {
+            send_error(c->fd, "Malformed request");
+            break;
+        }
+        free(path);
+        free(queries);
+        path = calloc(req.npath + 1, 1);
+        queries = malloc(req.nbytes + 1);
+        if (!path || !queries ||
+            (req.npath && recv_all(c->fd, path, req.npath) != 0) ||
+            (req.nbytes && recv_all(c->fd, queries, req.nbytes) != 0)) break;
+        // exactly nquery NUL-terminated queries
+        uint64_t nul = 0;
+        for (uint64_t i = 0; i < req.nbytes; i++) nul += queries[i] == 0;
+        queries[req.nbytes] = 0;
+        pthread_mutex_lock(&srv->lock);
+        srv->last = time(NULL);
+        pthread_mutex_unlock(&srv->lock);
+        int ret;
+        if (nul != req.nquery || (req.nbytes && queries[req.nbytes - 1])) {
+            ret = send_error(c->fd, "Malformed request");
+        } else if (req.op == VBID_OP_REGION || req.op == VBID_OP_ID) {
+            ret = serve_query(srv, c->fd, &req, path, queries);
+        } else if (req.op == VBID_OP_STATUS) {
+            ret = serve_status(srv, c->fd);
+        } else if (req.op == VBID_OP_STOP) {
+            pthread_mutex_lock(&srv->lock);
+            srv->stop = 1;
+            pthread_mutex_unlock(&srv->lock);
+            ret = send_resp(c->fd, 0, NULL, 0, NULL, 0);
+        } else {
+            ret = send_error(c->fd, "Unknown request");
+        }
+        if (ret < 0) break;
+    }
+    free(path);
+    free(queries);
+    pthread_mutex_lock(&srv->lock);
+    close(c->fd);
+    for (int i = 0; i < srv->nconn; i++) {
+        if (srv->conn[i] == c->fd) {
+            srv->conn[i] = srv->conn[--srv->nconn];
+            break;
+        }
+    }
+    srv->last = time(NULL);
+    pthread_cond_signal(&srv->done);
+    pthread_mutex_unlock(&srv->lock);
+    free(c);
+    return NULL;
+}
+
+static int sockaddr_set(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int vbid_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (sockaddr_set(&addr, path) < 0) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // a daemon of another user could answer anything: ignore it
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || peer_same_user(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int vbid_listen(const char *path, char *err, size_t nerr) {
+    struct sockaddr_un addr;
+    if (sockaddr_set(&addr, path) < 0) {
+        snprintf(err, nerr, "Socket path too long (%zu bytes at most): %s", sizeof(addr.sun_path) - 1, path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        snprintf(err, nerr, "Cannot create socket: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // the socket file is only accessible to the user, from its creation on
+    mode_t mask = umask(077);
+    int ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    if (ret != 0 && errno == EADDRINUSE) {
+        // a socket file left by a daemon that died, unless one still answers
+        struct stat st;
+        int c = vbid_connect(path);
+        if (c >= 0) {
+            close(c);
+            close(fd);
+            umask(mask);
+            snprintf(err, nerr, "A daemon already listens on %s", path);
+            return -1;
+        }
+        if (lstat(path, &st) == 0 && (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid())) {
+            close(fd);
+            umask(mask);
+            snprintf(err, nerr, "%s exists and is not a socket of this user", path);
+            return -1;
+        }
+        unlink(path);
+        ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    }
+    umask(mask);
+    if (ret == 0) ret = chmod(path, 0600);
+    if (ret != 0 || listen(fd, 64) != 0) {
+        snprintf(err, nerr, "Cannot listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void vbid_serve(int fd, const char *path, int idle, int (*interrupted)(void)) {
+    vbid_server_t srv;
+    memset(&srv, 0, sizeof(srv));
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.done, NULL);
+    srv.last = time(NULL);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    for (;;) {
+        pthread_mutex_lock(&srv.lock);
+        int stop = srv.stop || (idle > 0 && srv.nconn == 0 && time(NULL) - srv.last >= idle);
+        pthread_mutex_unlock(&srv.lock);
+        if (stop || (interrupted && interrupted())) break;
+        int r = poll(&pfd, 1, VBID_POLL_MS);
+        if (r < 0 && errno != EINTR) break;
+        if (r <= 0) continue;
+        int cfd = accept(fd, NULL, NULL);
+        if (cfd < 0) continue;
+        fcntl(cfd, F_SETFD, FD_CLOEXEC);
+        vbid_conn_t *c = malloc(sizeof(vbid_conn_t));
+        pthread_mutex_lock(&srv.lock);
+        int *a = srv.nconn < srv.mconn ? srv.conn : realloc(srv.conn, (srv.mconn = 2 * srv.mconn + 8) * sizeof(int));
+        if (!c || !a) {
+            pthread_mutex_unlock(&srv.lock);
+            free(c);
+            close(cfd);
+            continue;
+        }
+        srv.conn = a;
+        srv.conn[srv.nconn++] = cfd;
+        srv.last = time(NULL);
+        pthread_mutex_unlock(&srv.lock);
+        c->srv = &srv;
+        c->fd = cfd;
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, serve_conn, c) != 0) serve_conn(c);
+    }
+    pthread_attr_destroy(&attr);
+    close(fd);
+    unlink(path);
+    // wake up the connections waiting for a request, then wait for them
+    pthread_mutex_lock(&srv.lock);
+    for (int i = 0; i < srv.nconn; i++) shutdown(srv.conn[i], SHUT_RDWR);
+    while (srv.nconn) pthread_cond_wait(&srv.done, &srv.lock);
+    pthread_mutex_unlock(&srv.lock);
+    for (int i = 0; i < srv.nentry; i++) entry_free(srv.entry[i]);
+    free(srv.entry);
+    free(srv.conn);
+    pthread_cond_destroy(&srv.done);
+    pthread_mutex_destroy(&srv.lock);
+}
+
+/*
+ * Client
+ */
+
+int vbid_request(int fd, uint32_t op, const char *path, const char *queries, uint32_t nquery,
+                 uint64_t nbytes, vbid_hits_t *h, uint32_t *nchrom, char **text, uint64_t *ntext) {
+    vbid_req_t req = { VBID_MAGIC, op, path ? (uint32_t) strlen(path) : 0, nquery, nbytes };
+    vbid_resp_t r;
+    *text = NULL;
+    *ntext = 0;
+    *nchrom = 0;
+    if (send_all(fd, &req, sizeof(req)) < 0 ||
+        (req.npath && send_all(fd, path, req.npath) < 0) ||
+        (nbytes && send_all(fd, queries, nbytes) < 0) ||
+        recv_all(fd, &r, sizeof(r)) != 0 || r.magic != VBID_MAGIC) return -2;
+    if (r.nhit) {
+        if (hits_grow(h, r.nhit) < 0) return -2;
+        int64_t n = h->n;
+        if (recv_all(fd, h->query + n, r.nhit * sizeof(int32_t)) != 0 ||
+            recv_all(fd, h->marker + n, r.nhit * sizeof(int32_t)) != 0 ||
+            recv_all(fd, h->chrom + n, r.nhit * sizeof(int32_t)) != 0 ||
+            recv_all(fd, h->pos + n, r.nhit * sizeof(int64_t)) != 0) return -2;
+        h->n += r.nhit;
+    }
+    if (r.nbytes) {
+        if (!(*text = malloc(r.nbytes + 1)) || recv_all(fd, *text, r.nbytes) != 0) return -2;
+        (*text)[r.nbytes] = 0;
+        *ntext = r.nbytes;
+    }
+    *nchrom = r.nchrom;
+    return r.status;
+}
+
+#else // _WIN32: no daemon, queries run in process
+
+int vbid_listen(const char *path, char *err, size_t nerr) {
+    snprintf(err, nerr, "The VBI daemon is not supported on Windows");
+    return -1;
+}
+
+void vbid_serve(int fd, const char *path, int idle, int (*interrupted)(void)) {}
+
+int vbid_connect(const char *path) {
+    return -1;
+}
+
+int vbid_request(int fd, uint32_t op, const char *path, const char *queries, uint32_t nquery,
+                 uint64_t nbytes, vbid_hits_t *h, uint32_t *nchrom, char **text, uint64_t *ntext) {
+    return -2;
+}
+
+#endif
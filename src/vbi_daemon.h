@@ -0,0 +1,96 @@
+#ifndef VBI_DAEMON_H
+#define VBI_DAEMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vbi_index_capi.h"
+
+/*
+ * Local VBI query daemon.
+ *
+ * One process per node keeps VBI indexes loaded, keyed by path, and
+ * answers batched region and ID queries from other processes over a Unix
+ * domain socket. Indexes are loaded on their first query and reloaded when
+ * the file changes, so workers share one copy of each index and skip its
+ * load.
+ *
+ * Each connection carries any number of request/response pairs, in the
+ * host byte order (the socket is local):
+ *
+ *   request:  vbid_req_t, the index path (npath bytes), then nquery
+ *             NUL-terminated queries (nbytes bytes)
+ *   response: vbid_resp_t, then the columns int32 query[nhit],
+ *             int32 marker[nhit], int32 chrom[nhit], int64 pos[nhit], then
+ *             nbytes of text: the nchrom contig names, NUL-terminated, or
+ *             the error message when status < 0
+ *
+ * query and marker are 1-based, chrom indexes the contig names. Hits are
+ * ordered by query, then marker. The status request returns no hits and
+ * one "path\tmarkers\tqueries\n" line per loaded index as text.
+ *
+ * The same query code serves in-process lookups (vbid_query), so a client
+ * without a daemon gets identical results.
+ */
+
+#define VBID_MAGIC 0x44494256u  /* "VBID" */
+
+#define VBID_OP_REGION 1        /* region strings, as VBIQueryRegion() */
+#define VBID_OP_ID     2        /* IDs, needs VBIIndex(Keys = TRUE) */
+#define VBID_OP_STATUS 3
+#define VBID_OP_STOP   4
+
+typedef struct {
+    uint32_t magic, op;
+    uint32_t npath, nquery;
+    uint64_t nbytes;
+} vbid_req_t;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status;             /* 0, or -1 with a message */
+    uint32_t nchrom, pad;
+    uint64_t nhit, nbytes;
+} vbid_resp_t;
+
+/* Hits of a batch, as the columns of a response */
+typedef struct {
+    int32_t *query, *marker, *chrom;
+    int64_t *pos;
+    int64_t n, m;
+} vbid_hits_t;
+
+/*
+ * Appends the hits of the nquery NUL-terminated queries (regions or IDs, by
+ * op) to h. Returns 0, or -1 with a message in err.
+ */
+int vbid_query(const vbi_index_t *idx, int op, const char *queries, uint32_t nquery,
+               vbid_hits_t *h, char *err, size_t nerr);
+void vbid_hits_free(vbid_hits_t *h);
+
+/*
+ * Binds and listens on path, replacing a stale socket file. Returns the
+ * socket, or -1 with a message in err (e.g. when a daemon already listens).
+ */
+int vbid_listen(const char *path, char *err, size_t nerr);
+
+/*
+ * Serves the listening socket until a stop request, idle seconds without
+ * any connection (0: never) or interrupted() returns nonzero (checked
+ * every few hundred milliseconds, may be NULL). Connections are served on
+ * their own threads. Closes the socket, unlinks path and frees the loaded
+ * indexes on return.
+ */
+void vbid_serve(int fd, const char *path, int idle, int (*interrupted)(void));
+
+/* Connects to a daemon; -1 when none listens on path */
+int vbid_connect(const char *path);
+
+/*
+ * Sends one request and reads its response: the hits into h (appended),
+ * the text into *text (malloc'd, *ntext bytes). Returns the status of the
+ * response, or -2 if the connection failed.
+ */
+int vbid_request(int fd, uint32_t op, const char *path, const char *queries, uint32_t nquery,
+                 uint64_t nbytes, vbid_hits_t *h, uint32_t *nchrom, char **text, uint64_t *ntext);
+
+#endif // VBI_DAEMON_H
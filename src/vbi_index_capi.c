@@ -8,6 +8,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <math.h>
 #include "vbi_index_capi.h"
 
 #ifdef _WIN32
@@ -40,6 +42,7 @@ int parse_region(const char *str, region_t *reg) {
         return 0;
     }
     size_t clen = colon-str;
+    if (clen >= sizeof(reg->chrom)) clen = sizeof(reg->chrom)-1;
     strncpy(reg->chrom, str, clen);
     reg->chrom[clen] = 0;
     const char *dash = strchr(colon+1, '-');
@@ -82,6 +85,9 @@ void vbi_index_free(vbi_index_t *idx) {
         free(idx->chrom_names);
     }
     if (idx->cr) cr_destroy(idx->cr);
+    free(idx->id_keys);
+    free(idx->allele_keys);
+    free(idx->payload);
     free(idx);
 }
 
@@ -157,10 +163,161 @@ static void check_interrupt_internal(void *dummy) {
 bool check_interrupt(void) {
   return (R_ToplevelExec(check_interrupt_internal, NULL) == FALSE);
 }
+// FNV-1a, 64-bit
+static uint64_t fnv1a(uint64_t h, const char *s, size_t len) {
+    for (size_t i = 0; i < len; ++i) h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+    return h;
+}
+#define FNV1A_INIT 14695981039346656037ULL
+
+uint64_t vbi_id_key(const char *id, size_t len) {
+    return fnv1a(FNV1A_INIT, id, len);
+}
+
+uint64_t vbi_allele_key(const char *chrom, int64_t pos, const char *ref, const char *alt) {
+    size_t lr = strlen(ref), la = strlen(alt);
+    while (lr > 1 && la > 1 && toupper((unsigned char)ref[lr-1]) == toupper((unsigned char)alt[la-1])) { lr--; la--; }
+    while (lr > 1 && la > 1 && toupper((unsigned char)ref[0]) == toupper((unsigned char)alt[0])) { ref++; alt++; lr--; la--; pos++; }
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "\t%" PRId64 "\t", pos);
+    uint64_t h = fnv1a(FNV1A_INIT, chrom, strlen(chrom));
+    h = fnv1a(h, buf, n);
+    for (size_t i = 0; i < lr; ++i) { char c = toupper((unsigned char)ref[i]); h = fnv1a(h, &c, 1); }
+    h = fnv1a(h, "\t", 1);
+    for (size_t i = 0; i < la; ++i) { char c = toupper((unsigned char)alt[i]); h = fnv1a(h, &c, 1); }
+    return h;
+}
+
+int64_t vbi_key_find(const vbi_key_t *keys, int64_t n, uint64_t key) {
+    int64_t lo = 0, hi = n;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (keys[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < n && keys[lo].key == key ? lo : -1;
+}
+
+static int key_cmp(const void *a, const void *b) {
+    const vbi_key_t *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->marker > y->marker) - (x->marker < y->marker);
+}
+
+typedef struct {
+    vbi_key_t *a;
+    int64_t n, m;
+} key_vec_t;
+
+static void key_push(key_vec_t *v, uint64_t key, int64_t marker) {
+    if (v->n == v->m) {
+        v->m = v->m ? v->m * 2 : 1024;
+        v->a = realloc(v->a, v->m * sizeof(vbi_key_t));
+    }
+    v->a[v->n].key = key;
+    v->a[v->n].marker = marker;
+    v->n++;
+}
+
+// IDs ('.' excepted, ';'-separated lists split) and ALT alleles of a record
+static void add_record_keys(key_vec_t *ids, key_vec_t *alleles, const char *chr, bcf1_t *rec, int64_t marker) {
+    bcf_unpack(rec, BCF_UN_STR);
+    const char *id = rec->d.id;
+    if (id && strcmp(id, ".") != 0) {
+        while (*id) {
+            const char *end = strchr(id, ';');
+            size_t len = end ? (size_t)(end - id) : strlen(id);
+            if (len) key_push(ids, vbi_id_key(id, len), marker);
+            if (!end) break;
+            id = end + 1;
+        }
+    }
+    for (int a = 1; a < rec->n_allele; ++a) {
+        key_push(alleles, vbi_allele_key(chr, rec->pos + 1, rec->d.allele[0], rec->d.allele[a]), marker);
+    }
+}
+
+static int write_keys(FILE *f, key_vec_t *v) {
+    if (v->n) qsort(v->a, v->n, sizeof(vbi_key_t), key_cmp);
+    if (fwrite(&v->n, sizeof(int64_t), 1, f) != 1) return -1;
+    return v->n && fwrite(v->a, sizeof(vbi_key_t), v->n, f) != (size_t)v->n ? -1 : 0;
+}
+
+static vbi_key_t *read_keys(FILE *f, int64_t *n) {
+    if (fread(n, sizeof(int64_t), 1, f) != 1 || *n < 0) return NULL;
+    vbi_key_t *keys = malloc((*n ? *n : 1) * sizeof(vbi_key_t));
+    if (keys && *n && fread(keys, sizeof(vbi_key_t), *n, f) != (size_t)*n) {
+        free(keys);
+        return NULL;
+    }
+    return keys;
+}
+
+static void record_payload(const bcf_hdr_t *hdr, bcf1_t *rec, vbi_payload_t *p, int32_t **buf, int *mbuf) {
+    p->n_allele = rec->n_allele; // n_allele is a 16-bit field of bcf1_t
+    // bcf_get_variant_types() masks out VCF_INS and VCF_DEL, keep them
+    bcf_get_variant_types(rec);
+    p->type = rec->d.var_type & VCF_ANY;
+    p->ac = p->an = -1;
+    p->af = NAN;
+    int n = bcf_get_info_int32(hdr, rec, "AN", buf, mbuf);
+    if (n == 1 && (*buf)[0] != bcf_int32_missing) {
+        int32_t an = (*buf)[0];
+        n = bcf_get_info_int32(hdr, rec, "AC", buf, mbuf);
+        if (n > 0) {
+            p->an = an;
+            p->ac = 0;
+            for (int i = 0; i < n && (*buf)[i] != bcf_int32_vector_end; i++) {
+                if ((*buf)[i] != bcf_int32_missing) p->ac += (*buf)[i];
+            }
+        }
+    }
+    if (p->an < 0 && bcf_hdr_nsamples(hdr) > 0 && (n = bcf_get_genotypes(hdr, rec, buf, mbuf)) > 0) {
+        p->ac = p->an = 0;
+        for (int i = 0; i < n; i++) {
+            int32_t g = (*buf)[i];
+            if (g == bcf_int32_vector_end || bcf_gt_is_missing(g)) continue;
+            p->an++;
+            if (bcf_gt_allele(g) > 0) p->ac++;
+        }
+    }
+    if (p->an > 0) {
+        p->af = (float)p->ac / p->an;
+    } else if (p->an < 0) {
+        float *af = NULL;
+        int maf = 0;
+        n = bcf_get_info_float(hdr, rec, "AF", &af, &maf);
+        for (int i = 0; i < n; i++) {
+            if (bcf_float_is_vector_end(af[i])) break;
+            if (bcf_float_is_missing(af[i])) continue;
+            p->af = (isnan(p->af) ? 0 : p->af) + af[i];
+        }
+        free(af);
+    }
+}
+
+int vbi_payload_pass(const vbi_payload_t *p, const vbi_payload_filter_t *f) {
+    if (f->types != -1 && !(p->type ? (p->type & f->types) : f->ref)) return 0;
+    if (f->min_an > 0 && p->an < f->min_an) return 0;
+    if (f->use_af) {
+        double af = p->af, maf = af > 0.5 ? 1 - af : af;
+        if (isnan(af) || af < f->min_af || af > f->max_af || maf < f->min_maf || maf > f->max_maf) return 0;
+    }
+    return 1;
+}
+
+int vbi_payload_filter_hits(const vbi_index_t *idx, int *hits, int n, const vbi_payload_filter_t *f) {
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        if (vbi_payload_pass(&idx->payload[hits[i]], f)) hits[k++] = hits[i];
+    }
+    return k;
+}
+
 // indexing workhorse
 // TODO : interrupt checking
 
-int do_index(const char *infile, const char *outfile, int n_threads) {
+int do_index(const char *infile, const char *outfile, int n_threads, int flags) {
     htsFile *fp = NULL;
     if (n_threads > 1) {
         fp = hts_open(infile, "r");
@@ -191,6 +348,10 @@ int do_index(const char *infile, const char *outfile, int n_threads) {
     chrom_ids = malloc(alloc * sizeof(int32_t));
     positions = malloc(alloc * sizeof(int64_t));
     offsets = malloc(alloc * sizeof(int64_t));
+    key_vec_t id_keys = {0}, allele_keys = {0};
+    vbi_payload_t *payload = flags & VBI_INDEX_PAYLOAD ? malloc(alloc * sizeof(vbi_payload_t)) : NULL;
+    int32_t *pbuf = NULL;
+    int mpbuf = 0;
     bcf1_t *rec = bcf_init();
     while (1) {
         BGZF *bg = (BGZF *)fp->fp.bgzf;
@@ -216,10 +377,13 @@ int do_index(const char *infile, const char *outfile, int n_threads) {
             chrom_ids = realloc(chrom_ids, alloc * sizeof(int32_t));
             positions = realloc(positions, alloc * sizeof(int64_t));
             offsets = realloc(offsets, alloc * sizeof(int64_t));
+            if (payload) payload = realloc(payload, alloc * sizeof(vbi_payload_t));
         }
         chrom_ids[n] = chrom_id;
         positions[n] = rec->pos + 1;
         offsets[n] = this_offset;
+        if (flags & VBI_INDEX_KEYS) add_record_keys(&id_keys, &allele_keys, chr, rec, n);
+        if (payload) record_payload(hdr, rec, &payload[n], &pbuf, &mpbuf);
         n++;
         // check interupt every 1M records
         if (n % 1000000 == 0) {
@@ -230,6 +394,7 @@ int do_index(const char *infile, const char *outfile, int n_threads) {
                 hts_close(fp);
             for (int i = 0; i < chrom_count; ++i) free(chrom_names[i]);
             free(chrom_names); free(chrom_ids); free(positions); free(offsets);
+            free(id_keys.a); free(allele_keys.a); free(payload); free(pbuf);
             return 1;
         }
          // print number of records processed
@@ -244,7 +409,7 @@ int do_index(const char *infile, const char *outfile, int n_threads) {
 
     // Write index
     FILE *fidx = fopen(outfile, "wb");
-    if (!fidx) { for (int i = 0; i < chrom_count; ++i) free(chrom_names[i]); free(chrom_names); free(chrom_ids); free(positions); free(offsets); return 1; }
+    if (!fidx) { for (int i = 0; i < chrom_count; ++i) free(chrom_names[i]); free(chrom_names); free(chrom_ids); free(positions); free(offsets); free(id_keys.a); free(allele_keys.a); free(payload); free(pbuf); return 1; }
     fwrite(&num_sample, sizeof(int64_t), 1, fidx);
     fwrite(&num_marker, sizeof(int64_t), 1, fidx);
     int32_t n_chroms32 = chrom_count;
@@ -265,15 +430,28 @@ int do_index(const char *infile, const char *outfile, int n_threads) {
                 fclose(fidx);
             for (int j = 0; j < chrom_count; ++j) free(chrom_names[j]);
             free(chrom_names); free(chrom_ids); free(positions); free(offsets);
+            free(id_keys.a); free(allele_keys.a); free(payload); free(pbuf);
             return 1;
         }
          // print number of records processed
         Rprintf("Wrote %zu index records into %s\n", n, outfile);
     }
     }
-    fclose(fidx);
+    int ret = 0;
+    if (flags & VBI_INDEX_KEYS) {
+        // readers of the plain layout stop before this section
+        if (fwrite(VBI_KEYS_MAGIC, 1, 8, fidx) != 8 || write_keys(fidx, &id_keys) < 0 ||
+            write_keys(fidx, &allele_keys) < 0) ret = 1;
+        else Rprintf("Indexed %" PRId64 " IDs and %" PRId64 " alleles\n", id_keys.n, allele_keys.n);
+    }
+    if (payload && !ret) {
+        if (fwrite(VBI_PAYLOAD_MAGIC, 1, 8, fidx) != 8 || fwrite(payload, sizeof(vbi_payload_t), n, fidx) != n) ret = 1;
+    }
+    if (fclose(fidx) != 0) ret = 1;
     for (int i = 0; i < chrom_count; ++i) free(chrom_names[i]);
     free(chrom_names); free(chrom_ids); free(positions); free(offsets);
+    free(id_keys.a); free(allele_keys.a); free(payload); free(pbuf);
+    if (ret) return ret;
     Rprintf("Indexing  finished: %" PRId64 " samples, %" PRId64 " markers, %d chromosomes\n", num_sample, num_marker, chrom_count);
     return 0;
 }
@@ -308,6 +486,16 @@ vbi_index_t *vbi_index_load(const char *filename) {
         if (fread(&idx->positions[i], sizeof(int64_t), 1, f) != 1) goto fail;
         if (fread(&idx->offsets[i], sizeof(int64_t), 1, f) != 1) goto fail;
     }
+    char magic[8];
+    while (fread(magic, 1, 8, f) == 8) {
+        if (memcmp(magic, VBI_KEYS_MAGIC, 8) == 0) {
+            if (!(idx->id_keys = read_keys(f, &idx->n_id_keys))) goto fail;
+            if (!(idx->allele_keys = read_keys(f, &idx->n_allele_keys))) goto fail;
+        } else if (memcmp(magic, VBI_PAYLOAD_MAGIC, 8) == 0) {
+            idx->payload = malloc((n ? n : 1) * sizeof(vbi_payload_t));
+            if (!idx->payload || fread(idx->payload, sizeof(vbi_payload_t), n, f) != n) goto fail;
+        } else break;
+    }
     fclose(f);
     // Build cgranges for fast overlap
     idx->cr = cr_init();
@@ -317,6 +505,9 @@ vbi_index_t *vbi_index_load(const char *filename) {
     cr_index(idx->cr);
     return idx;
 fail:
+    free(idx->id_keys);
+    free(idx->allele_keys);
+    free(idx->payload);
     if (idx->chrom_ids) free(idx->chrom_ids);
     if (idx->positions) free(idx->positions);
     if (idx->offsets) free(idx->offsets);
@@ -16,8 +16,47 @@
 #include "cgranges.h"
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <Rinternals.h>
 
+// do_index() flags
+#define VBI_INDEX_KEYS    1
+#define VBI_INDEX_PAYLOAD 2
+
+// Optional sections, written after the marker records in this order, each
+// starting with its magic:
+//  - VBI_INDEX_KEYS: 64-bit hashes of the IDs and of the normalized
+//    alleles (vbi_allele_key), sorted by key, then by marker.
+//  - VBI_INDEX_PAYLOAD: one vbi_payload_t per marker.
+#define VBI_KEYS_MAGIC "VBIKEYS\1"
+#define VBI_PAYLOAD_MAGIC "VBIPAYL\1"
+
+typedef struct {
+    uint64_t key;
+    int64_t marker; // 0-based ordinal
+} vbi_key_t;
+
+// Per-marker summary, enough to filter before seeking to the record. AC
+// and AN count the ALT and called alleles, from INFO/AC and INFO/AN or
+// else from GT; -1 when neither is available. af is AC/AN, or the sum of
+// INFO/AF without them, NaN when unknown.
+typedef struct {
+    int32_t ac, an;
+    float af;
+    uint16_t n_allele;
+    uint16_t type; // bcf_get_variant_types(), VCF_REF (0) for monomorphic
+} vbi_payload_t;
+
+// Bounds on the payload; af bounds only apply when use_af is set, and then
+// reject markers without a frequency
+typedef struct {
+    int use_af;
+    double min_af, max_af, min_maf, max_maf;
+    int32_t min_an;
+    int types;      // mask of accepted types, -1 for all
+    int ref;        // accept VCF_REF markers when types != -1
+} vbi_payload_filter_t;
+
 typedef struct {
     int64_t num_sample;
     int64_t num_marker;
@@ -27,6 +66,10 @@ typedef struct {
     char **chrom_names;
     int n_chroms;
     void *cr; // cgranges_t *cr; (opaque)
+    int64_t n_id_keys, n_allele_keys; // 0 and NULL when not indexed
+    vbi_key_t *id_keys;
+    vbi_key_t *allele_keys;
+    vbi_payload_t *payload; // NULL when not indexed
 } vbi_index_t;
 
 typedef struct {
@@ -40,6 +83,9 @@ vbi_index_t *vbi_index_load(const char *filename);
 void vbi_index_free(vbi_index_t *idx);
 int parse_regions(const char *str, region_t **regions, int *nregions);
 
+// Build a VBI index; flags add the optional sections (VBI_INDEX_*)
+int do_index(const char *infile, const char *outfile, int n_threads, int flags);
+
 
 // Load VBI index from file
 vbi_index_t *vbi_index_load(const char *filename);
@@ -59,10 +105,26 @@ const char *vbi_index_chrom_name(vbi_index_t *idx, int idx_var);
 // Get position for a given variant index
 int64_t vbi_index_position(vbi_index_t *idx, int idx_var);
 
+// TRUE if the user interrupted, checked without longjmp-ing out of C
+bool check_interrupt(void);
+
 // Print the first n lines of the VBI index for debugging
 void vbi_index_print(const vbi_index_t *idx, int n);
 
 int *vbi_index_query_region_cgranges(vbi_index_t *idx, const char *region_str, int *nfound);
 
 void vbi_index_finalizer(SEXP extPtr);
+
+// Key of an ID (a single one, not a ';'-separated list)
+uint64_t vbi_id_key(const char *id, size_t len);
+// Key of one ALT allele: REF/ALT uppercased and trimmed of their common
+// suffix, then of their common prefix (advancing pos), so that e.g.
+// 1:100:CAG:CTG and 1:101:A:T give the same key
+uint64_t vbi_allele_key(const char *chrom, int64_t pos, const char *ref, const char *alt);
+// Position of the first entry with the given key, -1 if none
+int64_t vbi_key_find(const vbi_key_t *keys, int64_t n, uint64_t key);
+
+int vbi_payload_pass(const vbi_payload_t *p, const vbi_payload_filter_t *f);
+// Keep the hits whose payload passes f, in order; returns their number
+int vbi_payload_filter_hits(const vbi_index_t *idx, int *hits, int n, const vbi_payload_filter_t *f);
 #endif // VBI_INDEX_CAPI_H
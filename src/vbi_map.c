@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+#include "htslib/hts_endian.h"
+#include "htslib/kstring.h"
+#include "vbi_map.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define BGZF_HDR 18     /* gzip header with the BC extra field */
+#define STORED_HDR 5    /* deflate stored block: BFINAL/BTYPE, LEN, NLEN */
+#define BGZF_FTR 8      /* CRC32, ISIZE */
+
+/* a run of record bytes in the mapping: the data of one block */
+typedef struct {
+    const vbi_map_t *m;
+    uint64_t coff;      /* block offset in the file (0 for raw BCF) */
+    size_t bsize;       /* block size in the file */
+    const uint8_t *data;
+    size_t dlen, uoff;
+} map_cur_t;
+
+/* 0: stored block, 1: valid but compressed block, -1: not a BGZF block */
+static int map_block(map_cur_t *c, uint64_t coff) {
+    const vbi_map_t *m = c->m;
+    const uint8_t *b = m->base + coff;
+    if (coff + BGZF_HDR + STORED_HDR > m->len) return -1;
+    if (b[0] != 31 || b[1] != 139 || b[2] != 8 || !(b[3] & 4) ||
+        le_to_u16(b + 10) != 6 || b[12] != 'B' || b[13] != 'C') return -1;
+    size_t bsize = (size_t) le_to_u16(b + 16) + 1;
+    if (coff + bsize > m->len) return -1;
+    // htslib writes level 0 (and incompressible) blocks as a single final
+    // stored block
+    size_t dlen = le_to_u16(b + BGZF_HDR + 1);
+    if (b[BGZF_HDR] != 1 || (uint16_t) ~le_to_u16(b + BGZF_HDR + 3) != dlen ||
+        BGZF_HDR + STORED_HDR + dlen + BGZF_FTR != bsize) return 1;
+    c->coff = coff;
+    c->bsize = bsize;
+    c->data = b + BGZF_HDR + STORED_HDR;
+    c->dlen = dlen;
+    c->uoff = 0;
+    return 0;
+}
+
+static int map_seek(map_cur_t *c, const vbi_map_t *m, int64_t voff) {
+    c->m = m;
+    if (!m->bgzf) {
+        // raw BCF goes through an uncompressed BGZF whose "blocks" are file
+        // chunks: the virtual offset still splits as block << 16 | offset
+        uint64_t off = ((uint64_t) voff >> 16) + ((uint64_t) voff & 0xffff);
+        if (off > m->len) return -1;
+        c->coff = 0;
+        c->bsize = c->dlen = m->len;
+        c->data = m->base;
+        c->uoff = off;
+        return 0;
+    }
+    int ret = map_block(c, (uint64_t) voff >> 16);
+    if (ret != 0) return ret;
+    c->uoff = (size_t) voff & 0xffff;
+    return c->uoff <= c->dlen ? 0 : -1;
+}
+
+/* copies n bytes, crossing into the next blocks as needed */
+static int map_copy(map_cur_t *c, uint8_t *dst, size_t n) {
+    while (n) {
+        if (c->uoff == c->dlen) {
+            if (!c->m->bgzf) return -1;
+            int ret = map_block(c, c->coff + c->bsize);
+            if (ret != 0) return ret;
+            continue;
+        }
+        size_t k = c->dlen - c->uoff < n ? c->dlen - c->uoff : n;
+        memcpy(dst, c->data + c->uoff, k);
+        c->uoff += k;
+        dst += k;
+        n -= k;
+    }
+    return 0;
+}
+
+int vbi_map_open(vbi_map_t *m, const char *fn) {
+    memset(m, 0, sizeof(*m));
+#ifdef _WIN32
+    (void) fn;
+    return -1;
+#else
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BGZF_HDR + STORED_HDR + 5) {
+        close(fd);
+        return -1;
+    }
+    // read-only: a stray in-place write by a decoder faults instead of
+    // silently changing the bytes every other reader sees
+    void *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+    m->base = base;
+    m->len = (size_t) st.st_size;
+    // BCF magic, behind a stored first block for BGZF
+    map_cur_t c = { .m = m };
+    m->bgzf = m->base[0] == 31 && m->base[1] == 139;
+    const uint8_t *magic = m->base;
+    if (m->bgzf) magic = map_block(&c, 0) == 0 && c.dlen >= 5 ? c.data : NULL;
+    if (!magic || memcmp(magic, "BCF\2", 4) != 0) {
+        vbi_map_close(m);
+        return -1;
+    }
+    posix_madvise(m->base, m->len, POSIX_MADV_RANDOM);
+    return 0;
+#endif
+}
+
+void vbi_map_close(vbi_map_t *m) {
+#ifndef _WIN32
+    if (m->base) munmap(m->base, m->len);
+#endif
+    memset(m, 0, sizeof(*m));
+}
+
+/* mapped records are the only ones with data but no capacity */
+void vbi_map_release(bcf1_t *rec) {
+    if (rec->shared.s && !rec->shared.m) {
+        rec->shared.s = NULL;
+        rec->shared.l = 0;
+    }
+    if (rec->indiv.s && !rec->indiv.m) {
+        rec->indiv.s = NULL;
+        rec->indiv.l = 0;
+    }
+}
+
+static void map_attach(kstring_t *ks, const uint8_t *p, size_t l) {
+    if (ks->m) free(ks->s);
+    ks->s = (char *) p;
+    ks->l = l;
+    ks->m = 0;
+}
+
+int vbi_map_record(const vbi_map_t *m, int64_t voff, bcf1_t *rec) {
+    map_cur_t c;
+    int ret = map_seek(&c, m, voff);
+    if (ret != 0) return ret;
+    // see bcf_read1_core()
+    uint8_t hdr[32];
+    const uint8_t *x = hdr;
+    uint32_t shared_len, indiv_len;
+    if (c.dlen - c.uoff >= 32) {
+        x = c.data + c.uoff;
+    } else if ((ret = map_copy(&c, hdr, 32)) != 0) {
+        return ret;
+    }
+    shared_len = le_to_u32(x);
+    indiv_len = le_to_u32(x + 4);
+    if (shared_len < 24) return -1;
+    shared_len -= 24;
+
+    bcf_clear(rec);
+    rec->rid = le_to_i32(x + 8);
+    rec->pos = le_to_u32(x + 12);
+    if (rec->pos == UINT32_MAX) rec->pos = -1;
+    rec->rlen = le_to_i32(x + 16);
+    rec->qual = le_to_float(x + 20);
+    rec->n_info = le_to_u16(x + 24);
+    rec->n_allele = le_to_u16(x + 26);
+    rec->n_sample = le_to_u32(x + 28) & 0xffffff;
+    rec->n_fmt = x[31];
+    if (!indiv_len || !rec->n_sample) rec->n_fmt = 0;
+
+    if (x != hdr && c.dlen - c.uoff >= 32 + (size_t) shared_len + indiv_len) {
+        // the whole record is in this block: point into the mapping
+        map_attach(&rec->shared, x + 32, shared_len);
+        map_attach(&rec->indiv, x + 32 + shared_len, indiv_len);
+        return 0;
+    }
+    // straddles blocks: copy it, still without inflating anything
+    if (x != hdr) c.uoff += 32;
+    vbi_map_release(rec);
+    if (ks_resize(&rec->shared, shared_len ? shared_len : 1) != 0 ||
+        ks_resize(&rec->indiv, indiv_len ? indiv_len : 1) != 0) return -1;
+    if ((ret = map_copy(&c, (uint8_t *) rec->shared.s, shared_len)) != 0 ||
+        (ret = map_copy(&c, (uint8_t *) rec->indiv.s, indiv_len)) != 0) {
+        rec->shared.l = rec->indiv.l = 0;
+        return ret;
+    }
+    rec->shared.l = shared_len;
+    rec->indiv.l = indiv_len;
+    return 0;
+}
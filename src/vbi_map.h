@@ -0,0 +1,60 @@
+#ifndef VBI_MAP_H
+#define VBI_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "htslib/vcf.h"
+
+/*
+ * Memory-mapped record access for uncompressed BCF.
+ *
+ * htslib writes "uncompressed" BCF (bcftools -Ou, or -l 0) as BGZF with
+ * level-0 blocks: each block is a deflate "stored" block, i.e. the raw
+ * bytes behind an 18+5 byte header. Compressed files also fall back to
+ * stored blocks where deflate does not help. Raw BCF without BGZF framing
+ * can be read as well.
+ *
+ * Given the virtual offset of a record (as kept in a VBI index), its bytes
+ * are found directly in the mapping, with no hFILE buffering and no
+ * inflate. When the record lies within one block, the bcf1_t points into
+ * the mapping (zero copy); when it straddles stored blocks it is copied
+ * into the record. Records in compressed blocks are left to the caller's
+ * regular bcf_read() path.
+ *
+ * The mapping is PROT_READ: decoders only read the bytes of a record, and
+ * one writing into them in place faults rather than changing what every
+ * other reader of the mapping sees. Any number of threads may decode from
+ * the mapping at once, each into its own bcf1_t. A record that points into
+ * the mapping is read-only (no bcf_update_*() on it) and must be released
+ * with vbi_map_release() before htslib frees or refills it (bcf_destroy,
+ * bcf_read, ...).
+ *
+ * Records are checked against the mapping bounds, not validated like
+ * bcf_read() does (bcf_record_check is internal to htslib): map trusted
+ * files only.
+ */
+
+typedef struct {
+    uint8_t *base;  /* NULL when not mapped */
+    size_t len;
+    int bgzf;       /* BGZF framing; otherwise raw BCF */
+} vbi_map_t;
+
+/*
+ * Maps fn if it is a BCF file. Returns 0 on success, -1 if the file is not
+ * BCF or cannot be mapped (m->base is then NULL).
+ */
+int vbi_map_open(vbi_map_t *m, const char *fn);
+void vbi_map_close(vbi_map_t *m);
+
+/*
+ * Decodes the record at virtual offset voff into rec. Returns 0 on
+ * success, 1 if the record is in a compressed block (read it with htslib
+ * instead), -1 if the offset or record is out of bounds.
+ */
+int vbi_map_record(const vbi_map_t *m, int64_t voff, bcf1_t *rec);
+
+/* Detaches rec from the mapping; a no-op for records owning their data */
+void vbi_map_release(bcf1_t *rec);
+
+#endif // VBI_MAP_H